@@ -149,6 +149,7 @@ testScripts = [
     # 'invalidtxrequest.py',
     # 'p2p-versionbits-warning.py',
     'preciousblock.py',
+    'blockwindow.py',
     'importprunedfunds.py',
     'signmessages.py',
     # 'nulldummy.py',
@@ -159,6 +160,7 @@ testScripts = [
     'rpcnamedargs.py',
     'listsinceblock.py',
     'p2p-leaktests.py',
+    'p2p-msghandlers.py',
 ]
 if ENABLE_ZMQ:
     testScripts.append('zmq_test.py')
@@ -0,0 +1,46 @@
+#!/usr/bin/env python3
+# Copyright (c) 2017 The Prux Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+# Test the block download measurements getpeerinfo reports: a node that
+# downloads a chain from a peer reports the peer's request window and its
+# measured round trip, block rate and bandwidth.
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import *
+
+MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16
+MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER = 1024
+
+class BlockWindowTest(BitcoinTestFramework):
+    def __init__(self):
+        super().__init__()
+        self.num_nodes = 2
+        self.setup_clean_chain = True
+
+    def setup_network(self):
+        self.nodes = start_nodes(self.num_nodes, self.options.tmpdir, [["-debug=net"]] * self.num_nodes)
+        self.is_network_split = False
+
+    def run_test(self):
+        self.nodes[0].generate(300)
+
+        connect_nodes(self.nodes[1], 0)
+        sync_blocks(self.nodes)
+
+        # Node 1 requested the chain from node 0 and measured it
+        peer = self.nodes[1].getpeerinfo()[0]
+        assert(MAX_BLOCKS_IN_TRANSIT_PER_PEER <= peer['blockwindow'] <= MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER)
+        assert(peer['blockroundtrip'] > 0)
+        assert(peer['blockrate'] > 0)
+        assert(peer['blockbytespersec'] > 0)
+
+        # Node 0 downloaded nothing from node 1: only the initial window is reported
+        peer = self.nodes[0].getpeerinfo()[0]
+        assert_equal(peer['blockwindow'], MAX_BLOCKS_IN_TRANSIT_PER_PEER)
+        for field in ['blockroundtrip', 'blockrate', 'blockbytespersec']:
+            assert(field not in peer)
+
+if __name__ == '__main__':
+    BlockWindowTest().main()
@@ -117,9 +117,37 @@ class ImportPrunedFundsTest(BitcoinTestFramework):
         balance2 = self.nodes[1].getbalance("*", 0, True)
         assert_equal(balance2, Decimal('2.5'))
 
+        #Histories no longer list the removed transaction
+        received = self.nodes[1].listreceivedbyaddress(0, True, True)
+        assert_equal([r['txids'] for r in received if r['address'] == address2], [[]])
+        history = self.nodes[1].listtransactionhistory(100, None, {"include_watchonly": True})
+        assert(txnid2 not in [t['txid'] for t in history['transactions']])
+        assert(txnid2 not in [t['txid'] for t in self.nodes[1].listtransactionhistory(100, None, {"address": address2, "include_watchonly": True})['transactions']])
+
         self.nodes[1].removeprunedfunds(txnid3)
         balance3 = self.nodes[1].getbalance("*", 0, True)
         assert_equal(balance3, Decimal('0.0'))
 
+        #A removed spend is still in the spends index; the transaction it
+        #spends arriving later must not trip over it
+        txnid4 = self.nodes[0].sendtoaddress(address3, 1)
+        self.nodes[0].generate(1)
+        rawtxn4 = self.nodes[0].gettransaction(txnid4)['hex']
+        proof4 = self.nodes[0].gettxoutproof([txnid4])
+        vout4 = [o['n'] for o in self.nodes[0].decoderawtransaction(rawtxn4)['vout'] if o['scriptPubKey']['addresses'] == [address3]][0]
+        rawspend = self.nodes[0].createrawtransaction([{"txid": txnid4, "vout": vout4}], {address3: Decimal('0.99')})
+        txnid5 = self.nodes[0].sendrawtransaction(self.nodes[0].signrawtransaction(rawspend)['hex'])
+        self.nodes[0].generate(1)
+        rawtxn5 = self.nodes[0].gettransaction(txnid5)['hex']
+        proof5 = self.nodes[0].gettxoutproof([txnid5])
+        self.sync_all()
+
+        self.nodes[1].importprunedfunds(rawtxn5, proof5)
+        self.nodes[1].removeprunedfunds(txnid5)
+        self.nodes[1].listaddressgroupings()
+        self.nodes[1].importprunedfunds(rawtxn4, proof4)
+        assert_equal(self.nodes[1].getbalance("*", 0, True), Decimal('1'))
+        assert(address3 in [a[0] for g in self.nodes[1].listaddressgroupings() for a in g])
+
 if __name__ == '__main__':
     ImportPrunedFundsTest().main()
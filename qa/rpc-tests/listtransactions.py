@@ -99,6 +99,7 @@ class ListTransactionsTest(BitcoinTestFramework):
                            {"txid":txid, "account" : "watchonly"} )
 
         self.run_rbf_opt_in_test()
+        self.run_history_test()
 
     # Check that the opt-in-rbf flag works properly, for sent and received
     # transactions.
@@ -199,5 +200,25 @@ class ListTransactionsTest(BitcoinTestFramework):
         assert_equal(self.nodes[0].gettransaction(txid_4)["bip125-replaceable"], "unknown")
 
 
+    # Paging through listtransactionhistory must give listtransactions in
+    # reverse, and filters must only return matching entries.
+    def run_history_test(self):
+        node = self.nodes[0]
+        expected = node.listtransactions("*", 1000, 0, True)[::-1]
+        entries = []
+        cursor = None
+        while True:
+            page = node.listtransactionhistory(3, cursor, {"include_watchonly": True})
+            assert(len(page["transactions"]) <= 3)
+            entries += page["transactions"]
+            if "next" not in page:
+                break
+            cursor = page["next"]
+        assert_equal(entries, expected)
+
+        watchonly = node.listtransactionhistory(100, None, {"label": "watchonly", "include_watchonly": True})["transactions"]
+        assert_equal(watchonly, [e for e in expected if e.get("label") == "watchonly"])
+        assert_raises_jsonrpc(-8, "Invalid cursor", node.listtransactionhistory, 1, "00")
+
 if __name__ == '__main__':
     ListTransactionsTest().main()
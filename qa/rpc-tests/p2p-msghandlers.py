@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+# Copyright (c) 2017 The Prux Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+from test_framework.mininode import *
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import *
+
+'''
+Test message processing on several message handler threads.
+
+Two peers interleave getdata and ping requests as fast as they can, so the
+node's message handler threads serve both at once. Each peer must still get
+its replies in the order it asked for them.
+'''
+
+class TestNode(NodeConnCB):
+    def __init__(self):
+        NodeConnCB.__init__(self)
+        self.connection = None
+        self.replies = []
+
+    def add_connection(self, conn):
+        self.connection = conn
+
+    def on_inv(self, conn, message):
+        pass
+
+    def on_block(self, conn, message):
+        message.block.calc_sha256()
+        self.replies.append(("block", message.block.sha256))
+
+    def on_pong(self, conn, message):
+        self.replies.append(("pong", message.nonce))
+
+    def wait_for_verack(self):
+        def veracked():
+            return self.verack_received
+        return wait_until(veracked, timeout=10)
+
+    def wait_for_replies(self, count):
+        def received():
+            return len(self.replies) >= count
+        return wait_until(received, timeout=60)
+
+class P2PMsgHandlersTest(BitcoinTestFramework):
+
+    def __init__(self):
+        super().__init__()
+        self.setup_clean_chain = True
+        self.num_nodes = 1
+
+    def setup_network(self):
+        self.nodes = [start_node(0, self.options.tmpdir, ["-debug", "-msghandlerthreads=4"])]
+
+    def run_test(self):
+        blocks = [int(h, 16) for h in self.nodes[0].generate(50)]
+
+        peers = []
+        for i in range(2):
+            peer = TestNode()
+            peer.add_connection(NodeConn('127.0.0.1', p2p_port(0), self.nodes[0], peer))
+            peers.append(peer)
+        NetworkThread().start()
+        for peer in peers:
+            assert(peer.wait_for_verack())
+
+        # Each peer asks for every block, following each with a ping, and
+        # the two peers walk the chain in opposite directions
+        expected = []
+        for i, peer in enumerate(peers):
+            order = blocks if i == 0 else list(reversed(blocks))
+            replies = []
+            for n, block in enumerate(order):
+                replies.append(("block", block))
+                replies.append(("pong", i * 1000 + n))
+            expected.append(replies)
+
+        for n in range(len(blocks)):
+            for i, peer in enumerate(peers):
+                getdata = msg_getdata()
+                getdata.inv.append(CInv(2, expected[i][2 * n][1]))
+                peer.connection.send_message(getdata)
+                peer.connection.send_message(msg_ping(nonce=i * 1000 + n))
+
+        for i, peer in enumerate(peers):
+            assert(peer.wait_for_replies(len(expected[i])))
+            with mininode_lock:
+                assert_equal(peer.replies, expected[i])
+
+if __name__ == '__main__':
+    P2PMsgHandlersTest().main()
@@ -293,6 +293,20 @@ class WalletTest (BitcoinTestFramework):
                            {"address": address_to_import},
                            {"spendable": True})
 
+        # 7. Adding a redeem script turns an output already in the wallet into ours
+        multisig_keys = [self.nodes[1].validateaddress(self.nodes[1].getnewaddress())["pubkey"] for i in range(2)]
+        multisig_address = self.nodes[1].createmultisig(1, multisig_keys)["address"]
+        txid = self.nodes[1].sendtoaddress(multisig_address, 1)
+        self.nodes[0].generate(1)
+        self.sync_all()
+        assert(multisig_address not in [utxo.get("address") for utxo in self.nodes[1].listunspent()])
+        balance = self.nodes[1].getbalance()
+        assert_equal(self.nodes[1].addmultisigaddress(1, multisig_keys), multisig_address)
+        assert_equal(self.nodes[1].getbalance(), balance + Decimal('1'))
+        assert_array_result(self.nodes[1].listunspent(),
+                           {"txid": txid, "address": multisig_address},
+                           {"spendable": True, "amount": Decimal('1')})
+
         # Mine a block from node0 to an address from node1
         cbAddr = self.nodes[1].getnewaddress()
         blkHash = self.nodes[0].generatetoaddress(1, cbAddr)[0]
@@ -26,13 +26,33 @@ class ZMQTest (BitcoinTestFramework):
         self.zmqSubSocket.setsockopt(zmq.SUBSCRIBE, b"hashblock")
         self.zmqSubSocket.setsockopt(zmq.SUBSCRIBE, b"hashtx")
         self.zmqSubSocket.connect("tcp://127.0.0.1:%i" % self.port)
+        self.zmqSeqSocket = self.zmqContext.socket(zmq.SUB)
+        self.zmqSeqSocket.setsockopt(zmq.SUBSCRIBE, b"sequence")
+        self.zmqSeqSocket.setsockopt(zmq.RCVTIMEO, 60000)
+        self.zmqSeqSocket.connect("tcp://127.0.0.1:%i" % (self.port + 1))
         return start_nodes(self.num_nodes, self.options.tmpdir, extra_args=[
-            ['-zmqpubhashtx=tcp://127.0.0.1:'+str(self.port), '-zmqpubhashblock=tcp://127.0.0.1:'+str(self.port)],
+            ['-zmqpubhashtx=tcp://127.0.0.1:'+str(self.port), '-zmqpubhashblock=tcp://127.0.0.1:'+str(self.port),
+             '-zmqpubsequence=tcp://127.0.0.1:'+str(self.port + 1)],
             [],
             [],
             []
             ])
 
+    def recv_sequence(self):
+        msg = self.zmqSeqSocket.recv_multipart()
+        assert_equal(msg[0], b"sequence")
+        body = msg[1]
+        return bytes_to_hex_str(body[:32]), body[32:33], struct.unpack('<Q', body[33:41])[0], body[41:]
+
+    def expect_sequence(self, seq, events):
+        for (hash, label, extra) in events:
+            seq += 1
+            received = self.recv_sequence()
+            assert_equal(received[:3], (hash, label, seq))
+            if extra is not None:
+                assert_equal(received[3], extra)
+        return seq
+
     def run_test(self):
         self.sync_all()
 
@@ -92,6 +112,31 @@ class ZMQTest (BitcoinTestFramework):
 
         assert_equal(hashRPC, hashZMQ) #blockhash from generate must be equal to the hash received over zmq
 
+        # pubsequence: events come in the order they were applied, also across a reorg
+        self.nodes[0].generate(1)
+        self.sync_all()
+        seq = None
+        while self.zmqSeqSocket.poll(1000):
+            seq = self.recv_sequence()[2]
+
+        txid = self.nodes[0].sendtoaddress(self.nodes[0].getnewaddress(), 1.0)
+        (h, label, n, raw) = self.recv_sequence()
+        assert_equal((h, label), (txid, b"A"))
+        assert_equal(bytes_to_hex_str(raw), self.nodes[0].getrawtransaction(txid))
+        if seq is not None:
+            assert_equal(n, seq + 1)
+
+        # The block's transactions leave the mempool before it is connected
+        blockhash = self.nodes[0].generate(1)[0]
+        n = self.expect_sequence(n, [(txid, b"R", b"\x04"), (blockhash, b"C", b"")])
+
+        # The disconnected block comes before the transactions it returns to the mempool
+        self.nodes[0].invalidateblock(blockhash)
+        n = self.expect_sequence(n, [(blockhash, b"D", b""), (txid, b"A", None)])
+
+        self.nodes[0].reconsiderblock(blockhash)
+        n = self.expect_sequence(n, [(txid, b"R", b"\x04"), (blockhash, b"C", b"")])
+
 
 if __name__ == '__main__':
     ZMQTest ().main ()
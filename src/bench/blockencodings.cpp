@@ -0,0 +1,71 @@
+// Copyright (c) 2017 The Prux Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "blockencodings.h"
+#include "policy/policy.h"
+#include "txmempool.h"
+
+#include <vector>
+
+static const size_t RECONSTRUCT_BLOCK_TXS = 1000;
+
+// Fill a mempool with nPoolSize unrelated transactions and build a compact
+// block whose transactions are spread evenly over the mempool contents.
+static void CompactBlockReconstruction(benchmark::State& state, size_t nPoolSize)
+{
+    CTxMemPool pool(CFeeRate(1000));
+    CBlock block;
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].scriptSig = CScript() << OP_1 << OP_0;
+    coinbase.vout.resize(1);
+    coinbase.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    coinbase.vout[0].nValue = 50 * COIN;
+    block.vtx.push_back(MakeTransactionRef(coinbase));
+
+    const size_t nStride = std::max<size_t>(1, nPoolSize / RECONSTRUCT_BLOCK_TXS);
+    for (size_t i = 0; i < nPoolSize; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(uint256(), i);
+        tx.vin[0].scriptSig = CScript() << OP_1;
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+        tx.vout[0].nValue = COIN;
+        CTransactionRef ptx = MakeTransactionRef(tx);
+        LockPoints lp;
+        pool.addUnchecked(ptx->GetHash(), CTxMemPoolEntry(ptx, 1000, 0, 10.0, 1, ptx->GetValueOut(), false, 4, lp));
+        if (i % nStride == 0 && block.vtx.size() <= RECONSTRUCT_BLOCK_TXS)
+            block.vtx.push_back(ptx);
+    }
+
+    const CBlockHeaderAndShortTxIDs cmpctblock(block, true);
+    const std::vector<std::pair<uint256, CTransactionRef>> extra_txn;
+
+    while (state.KeepRunning()) {
+        PartiallyDownloadedBlock partialBlock(&pool);
+        ReadStatus status = partialBlock.InitData(cmpctblock, extra_txn);
+        assert(status == READ_STATUS_OK);
+    }
+}
+
+static void CompactBlockReconstruction1k(benchmark::State& state)
+{
+    CompactBlockReconstruction(state, 1000);
+}
+
+static void CompactBlockReconstruction10k(benchmark::State& state)
+{
+    CompactBlockReconstruction(state, 10000);
+}
+
+static void CompactBlockReconstruction100k(benchmark::State& state)
+{
+    CompactBlockReconstruction(state, 100000);
+}
+
+BENCHMARK(CompactBlockReconstruction1k);
+BENCHMARK(CompactBlockReconstruction10k);
+BENCHMARK(CompactBlockReconstruction100k);
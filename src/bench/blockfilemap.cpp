@@ -0,0 +1,103 @@
+// Copyright (c) 2017 The Prux Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "blockfilemap.h"
+#include "chain.h"
+#include "chainparams.h"
+#include "clientversion.h"
+#include "streams.h"
+#include "util.h"
+#include "validation.h"
+
+#include <boost/filesystem.hpp>
+
+namespace block_bench {
+#include "bench/data/block413567.raw.h"
+}
+
+// Copies of the block stored in the bench block file, read in turn.
+static const int BLOCK_FILE_BENCH_BLOCKS = 64;
+
+// A blk00000.dat in a temporary datadir holding BLOCK_FILE_BENCH_BLOCKS
+// copies of the bench block, framed as WriteBlockToDisk does.
+class BenchBlockFile
+{
+public:
+    boost::filesystem::path path;
+    std::vector<CDiskBlockPos> vPos;
+
+    BenchBlockFile()
+    {
+        path = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("bench_prux_blockfile_%%%%%%%%");
+        boost::filesystem::create_directories(path / "blocks");
+        ForceSetArg("-datadir", path.string());
+        ClearDatadirCache();
+
+        CDataStream stream((const char*)block_bench::block413567,
+                (const char*)&block_bench::block413567[sizeof(block_bench::block413567)],
+                SER_NETWORK, PROTOCOL_VERSION);
+        CBlock block;
+        stream >> block;
+
+        CAutoFile fileout(fopen(GetBlockPosFilename(CDiskBlockPos(0, 0), "blk").string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        unsigned int nPos = 0;
+        const unsigned int nSize = GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+        for (int i = 0; i < BLOCK_FILE_BENCH_BLOCKS; i++) {
+            fileout << FLATDATA(Params().MessageStart()) << nSize << block;
+            nPos += 8;
+            vPos.push_back(CDiskBlockPos(0, nPos));
+            nPos += nSize;
+        }
+    }
+
+    ~BenchBlockFile()
+    {
+        boost::filesystem::remove_all(path);
+        ClearDatadirCache();
+    }
+};
+
+// Open, seek and read through stdio, like ReadBlockFromDisk without -blockmmap
+template<typename T>
+static void BlockFileRead(benchmark::State& state)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    BenchBlockFile blockFile;
+    size_t nBlock = 0;
+    while (state.KeepRunning()) {
+        T block;
+        CAutoFile filein(OpenBlockFile(blockFile.vPos[nBlock++ % blockFile.vPos.size()], true), SER_DISK, CLIENT_VERSION);
+        filein >> block;
+    }
+}
+
+// Deserialize straight from the mapped file, like ReadBlockFromDisk with -blockmmap
+template<typename T>
+static void BlockFileReadMapped(benchmark::State& state)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    BenchBlockFile blockFile;
+    CBlockFileMappings mappings;
+    mappings.SetFirstOpenFile(1);
+    size_t nBlock = 0;
+    while (state.KeepRunning()) {
+        T block;
+        const CDiskBlockPos& pos = blockFile.vPos[nBlock++ % blockFile.vPos.size()];
+        std::shared_ptr<const CMappedFile> mapping = mappings.Get(pos.nFile, false);
+        CSpanReader reader(SER_DISK, CLIENT_VERSION, mapping->data + pos.nPos, mapping->data + mapping->size);
+        reader >> block;
+    }
+}
+
+static void BlockFileReadBlock(benchmark::State& state) { BlockFileRead<CBlock>(state); }
+static void BlockFileReadBlockMapped(benchmark::State& state) { BlockFileReadMapped<CBlock>(state); }
+static void BlockFileReadHeader(benchmark::State& state) { BlockFileRead<CBlockHeader>(state); }
+static void BlockFileReadHeaderMapped(benchmark::State& state) { BlockFileReadMapped<CBlockHeader>(state); }
+
+BENCHMARK(BlockFileReadBlock);
+BENCHMARK(BlockFileReadBlockMapped);
+BENCHMARK(BlockFileReadHeader);
+BENCHMARK(BlockFileReadHeaderMapped);
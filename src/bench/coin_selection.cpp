@@ -57,4 +57,46 @@ static void CoinSelection(benchmark::State& state)
     }
 }
 
+static const int COIN_SELECTION_BENCH_COINS = 100000;
+
+// A wallet with many small outputs of assorted values (as left behind by
+// mining payouts or faucets), spending an amount that needs a large number
+// of them. With fExact the target can be met exactly, so the exact-match
+// search finishes; otherwise it runs out of tries and the stochastic
+// approximation is used.
+static void CoinSelectionDust(benchmark::State& state, bool fExact)
+{
+    const CWallet wallet;
+    std::vector<COutput> vCoins;
+    LOCK(wallet.cs_wallet);
+
+    for (int i = 0; i < COIN_SELECTION_BENCH_COINS; i++)
+        addCoin(1000 * (1 + (i * 7919) % 100), wallet, vCoins);
+    addCoin(100000 * COIN, wallet, vCoins);
+
+    const CAmount nTarget = 10 * COIN + (fExact ? 0 : 1);
+    while (state.KeepRunning()) {
+        std::set<std::pair<const CWalletTx*, unsigned int> > setCoinsRet;
+        CAmount nValueRet;
+        bool success = wallet.SelectCoinsMinConf(nTarget, 1, 6, 0, vCoins, setCoinsRet, nValueRet);
+        assert(success);
+        assert(nValueRet >= nTarget);
+    }
+
+    BOOST_FOREACH (COutput output, vCoins)
+        delete output.tx;
+}
+
+static void CoinSelection100kDustExact(benchmark::State& state)
+{
+    CoinSelectionDust(state, true);
+}
+
+static void CoinSelection100kDustInexact(benchmark::State& state)
+{
+    CoinSelectionDust(state, false);
+}
+
 BENCHMARK(CoinSelection);
+BENCHMARK(CoinSelection100kDustExact);
+BENCHMARK(CoinSelection100kDustInexact);
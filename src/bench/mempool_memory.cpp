@@ -0,0 +1,84 @@
+// Copyright (c) 2017 The Prux Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "policy/policy.h"
+#include "txmempool.h"
+
+#include <iostream>
+#include <vector>
+
+static const size_t MEMPOOL_BENCH_TXS = 100000;
+
+static void AddTx(const CTransactionRef& tx, const CAmount& nFee, CTxMemPool& pool)
+{
+    LockPoints lp;
+    pool.addUnchecked(tx->GetHash(), CTxMemPoolEntry(tx, nFee, 0, 10.0, 1, tx->GetValueOut(), false, 4, lp));
+}
+
+// Build a mempool-like population: most transactions spend a confirmed
+// output, every fourth one spends an output of an earlier in-mempool
+// transaction so that parent/child links are exercised as well.
+static std::vector<CTransactionRef> CreateTransactions(size_t nCount)
+{
+    std::vector<CTransactionRef> vtx;
+    vtx.reserve(nCount);
+    for (size_t i = 0; i < nCount; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        if (i % 4 == 3) {
+            tx.vin[0].prevout = COutPoint(vtx[i - 1]->GetHash(), 0);
+        } else {
+            tx.vin[0].prevout = COutPoint(uint256(), i);
+        }
+        tx.vin[0].scriptSig = CScript() << OP_1;
+        tx.vout.resize(2);
+        tx.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+        tx.vout[0].nValue = COIN;
+        tx.vout[1].scriptPubKey = CScript() << OP_2 << OP_EQUAL;
+        tx.vout[1].nValue = COIN;
+        vtx.push_back(MakeTransactionRef(tx));
+    }
+    return vtx;
+}
+
+static void MempoolBuild100k(benchmark::State& state)
+{
+    const std::vector<CTransactionRef> vtx = CreateTransactions(MEMPOOL_BENCH_TXS);
+    bool fReported = false;
+
+    while (state.KeepRunning()) {
+        CTxMemPool pool(CFeeRate(1000));
+        for (size_t i = 0; i < vtx.size(); i++) {
+            AddTx(vtx[i], 1000 + (i % 97), pool);
+        }
+        if (!fReported) {
+            // Lines starting with '#' are ignored by consumers of the CSV output.
+            std::cout << "#MempoolBuild100k,bytes_per_entry," << pool.DynamicMemoryUsage() / pool.size() << "\n";
+            fReported = true;
+        }
+    }
+}
+
+static void MempoolInsertRemove100k(benchmark::State& state)
+{
+    const std::vector<CTransactionRef> vtx = CreateTransactions(MEMPOOL_BENCH_TXS);
+    CTxMemPool pool(CFeeRate(1000));
+    for (size_t i = 0; i < vtx.size(); i++) {
+        AddTx(vtx[i], 1000 + (i % 97), pool);
+    }
+
+    // Cycle through the child transactions, removing and re-adding each one.
+    size_t n = 3;
+    while (state.KeepRunning()) {
+        pool.removeRecursive(*vtx[n]);
+        AddTx(vtx[n], 1000, pool);
+        n += 4;
+        if (n >= vtx.size())
+            n = 3;
+    }
+}
+
+BENCHMARK(MempoolBuild100k);
+BENCHMARK(MempoolInsertRemove100k);
@@ -0,0 +1,64 @@
+// Copyright (c) 2017 The Prux Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "bloom.h"
+#include "merkleblock.h"
+#include "streams.h"
+#include "version.h"
+
+namespace block_bench {
+#include "bench/data/block413567.raw.h"
+}
+
+// Serve a filtered block to an SPV peer whose filter matches a handful of
+// the block's transactions.
+
+static CBlock LoadBenchBlock()
+{
+    CDataStream stream((const char*)block_bench::block413567,
+            (const char*)&block_bench::block413567[sizeof(block_bench::block413567)],
+            SER_NETWORK, PROTOCOL_VERSION);
+    CBlock block;
+    stream >> block;
+    return block;
+}
+
+static CBloomFilter MakeBenchFilter(const CBlock& block)
+{
+    CBloomFilter filter(10, 0.000001, 0, BLOOM_UPDATE_ALL);
+    for (unsigned int i = 0; i < block.vtx.size(); i += 200)
+        filter.insert(block.vtx[i]->GetHash());
+    return filter;
+}
+
+static void MerkleBlockFromBlock(benchmark::State& state)
+{
+    const CBlock block = LoadBenchBlock();
+    const CBloomFilter filterLoaded = MakeBenchFilter(block);
+
+    while (state.KeepRunning()) {
+        CBloomFilter filter(filterLoaded);
+        CMerkleBlock merkleBlock(block, filter);
+        assert(!merkleBlock.vMatchedTxn.empty());
+    }
+}
+
+// Filter elements already extracted by an earlier peer's request
+static void MerkleBlockFromElements(benchmark::State& state)
+{
+    const CBlock block = LoadBenchBlock();
+    const CBloomFilter filterLoaded = MakeBenchFilter(block);
+    const std::vector<CTxFilterElements> vElements = CMerkleBlock::GetBlockFilterElements(block);
+
+    while (state.KeepRunning()) {
+        CBloomFilter filter(filterLoaded);
+        CMerkleBlock merkleBlock(block, filter, vElements);
+        assert(!merkleBlock.vMatchedTxn.empty());
+    }
+}
+
+BENCHMARK(MerkleBlockFromBlock);
+BENCHMARK(MerkleBlockFromElements);
@@ -0,0 +1,118 @@
+// Copyright (c) 2017 The Prux Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "chainparams.h"
+#include "hash.h"
+#include "net.h"
+#include "streams.h"
+
+#include <atomic>
+#include <iostream>
+#include <new>
+#include <stdlib.h>
+
+// Heap allocations made while fCountAllocs is set. Replacing the global
+// operator new is the only way to see every allocation, including those in
+// the standard containers, so this benchmark is built as bench_net_receive,
+// apart from the others.
+static std::atomic<bool> fCountAllocs(false);
+static std::atomic<uint64_t> nAllocs(0);
+
+void* operator new(size_t nSize)
+{
+    if (fCountAllocs.load(std::memory_order_relaxed))
+        nAllocs.fetch_add(1, std::memory_order_relaxed);
+    void* p = malloc(nSize ? nSize : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+// Size of the socket handler's receive buffer, the chunks data arrives in
+static const size_t NET_BENCH_RECV_CHUNK = 0x10000;
+
+static void AppendMessage(std::vector<char>& vWire, const char* pszCommand, size_t nPayloadSize)
+{
+    std::vector<unsigned char> payload(nPayloadSize);
+    for (size_t i = 0; i < nPayloadSize; i++)
+        payload[i] = i * 7;
+    CMessageHeader hdr(Params().MessageStart(), pszCommand, payload.size());
+    uint256 hash = Hash(payload.begin(), payload.end());
+    memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
+    CDataStream ssHeader(SER_NETWORK, INIT_PROTO_VERSION);
+    ssHeader << hdr;
+    vWire.insert(vWire.end(), ssHeader.begin(), ssHeader.end());
+    vWire.insert(vWire.end(), payload.begin(), payload.end());
+}
+
+// What a relaying peer sends over a few seconds: mostly transaction
+// announcements, requests and transactions, with a ping and a new block
+// announced by its header and relayed compactly.
+static std::vector<char> MessageMix(size_t& nMessages)
+{
+    std::vector<char> vWire;
+    nMessages = 0;
+    for (int i = 0; i < 50; i++) {
+        AppendMessage(vWire, "inv", 1 + 36 * (1 + i % 7));
+        AppendMessage(vWire, "getdata", 1 + 36 * (1 + i % 3));
+        AppendMessage(vWire, "tx", 190 + 37 * (i % 23));
+        nMessages += 3;
+        if (i % 5 == 0) {
+            AppendMessage(vWire, "tx", 800 + 151 * (i % 11));
+            nMessages++;
+        }
+    }
+    AppendMessage(vWire, "ping", 8);
+    AppendMessage(vWire, "pong", 8);
+    AppendMessage(vWire, "headers", 1 + 81);
+    AppendMessage(vWire, "cmpctblock", 18000);
+    AppendMessage(vWire, "blocktxn", 3500);
+    AppendMessage(vWire, "feefilter", 8);
+    nMessages += 6;
+    return vWire;
+}
+
+// Receive the mix as the socket handler does, in NET_BENCH_RECV_CHUNK reads
+// queued after each, and take each message off the process queue as the
+// message handler does. Reports the heap allocations per message.
+static void NetReceiveMessageMix(benchmark::State& state)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    size_t nMessages;
+    const std::vector<char> vWire = MessageMix(nMessages);
+    in_addr ipv4Addr;
+    ipv4Addr.s_addr = 0xa0b0c001;
+    CNode node(0, NODE_NETWORK, 0, INVALID_SOCKET, CAddress(CService(ipv4Addr, 7777), NODE_NETWORK), 0, 0, "", true);
+
+    uint64_t nIterations = 0;
+    nAllocs = 0;
+    while (state.KeepRunning()) {
+        fCountAllocs = true;
+        for (size_t nPos = 0; nPos < vWire.size(); nPos += NET_BENCH_RECV_CHUNK) {
+            bool fComplete;
+            node.ReceiveMsgBytes(&vWire[nPos], std::min(NET_BENCH_RECV_CHUNK, vWire.size() - nPos), fComplete);
+            if (fComplete)
+                node.QueueReceivedMsgs(DEFAULT_MAXRECEIVEBUFFER * 1000);
+        }
+        while (true) {
+            CNetMessageBatch batch(node.recvPool);
+            if (node.vProcessMsg.empty())
+                break;
+            batch.msgs.splice(batch.msgs.begin(), node.vProcessMsg, node.vProcessMsg.begin());
+            node.nProcessQueueSize -= batch.msgs.front().vRecv.size() + CMessageHeader::HEADER_SIZE;
+        }
+        fCountAllocs = false;
+        nIterations++;
+    }
+    // Lines starting with '#' are ignored by consumers of the CSV output.
+    std::cout << "#NetReceiveMessageMix,allocs_per_message," << (double)nAllocs / (nIterations * nMessages) << "\n";
+}
+
+BENCHMARK(NetReceiveMessageMix);
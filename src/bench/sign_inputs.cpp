@@ -0,0 +1,61 @@
+// Copyright (c) 2017 The Prux Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "key.h"
+#include "keystore.h"
+#include "primitives/transaction.h"
+#include "script/sign.h"
+#include "script/standard.h"
+
+// Inputs of the consolidation transaction signed per iteration; the time per
+// input is the reported time divided by this.
+static const unsigned int SIGN_BENCH_INPUTS = 1000;
+
+// Sign a transaction spending SIGN_BENCH_INPUTS P2PKH outputs, one input
+// after another re-serializing the transaction for every signature hash, or
+// spread over threads resuming from the precomputed hash states.
+static void SignInputs(benchmark::State& state, bool fParallel)
+{
+    CBasicKeyStore keystore;
+    CKey key;
+    key.MakeNewKey(true);
+    keystore.AddKey(key);
+    const CScript scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+
+    CMutableTransaction mtx;
+    mtx.vin.resize(SIGN_BENCH_INPUTS);
+    for (unsigned int i = 0; i < SIGN_BENCH_INPUTS; i++)
+        mtx.vin[i].prevout = COutPoint(uint256S("ee"), i);
+    mtx.vout.resize(1);
+    mtx.vout[0].nValue = SIGN_BENCH_INPUTS;
+    mtx.vout[0].scriptPubKey = scriptPubKey;
+    const CTransaction tx(mtx);
+
+    std::vector<SignatureData> vSigData(SIGN_BENCH_INPUTS);
+    while (state.KeepRunning()) {
+        if (fParallel) {
+            const PrecomputedTransactionData txdata(tx, true);
+            ForEachInputParallel(SIGN_BENCH_INPUTS, [&](unsigned int nIn) {
+                ProduceSignature(TransactionSignatureCreator(&keystore, &tx, nIn, 1, SIGHASH_ALL, txdata), scriptPubKey, vSigData[nIn]);
+            });
+        } else {
+            for (unsigned int nIn = 0; nIn < SIGN_BENCH_INPUTS; nIn++)
+                ProduceSignature(TransactionSignatureCreator(&keystore, &tx, nIn, 1, SIGHASH_ALL), scriptPubKey, vSigData[nIn]);
+        }
+    }
+}
+
+static void SignInputsSerial(benchmark::State& state)
+{
+    SignInputs(state, false);
+}
+
+static void SignInputsParallel(benchmark::State& state)
+{
+    SignInputs(state, true);
+}
+
+BENCHMARK(SignInputsSerial);
+BENCHMARK(SignInputsParallel);
@@ -0,0 +1,131 @@
+// Copyright (c) 2017 The Prux Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "compat.h"
+#include "netbase.h"
+
+#ifndef WIN32
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+#endif
+
+// Loopback peers kept connected; below FD_SETSIZE so select() can take them.
+static const int SOCKET_BENCH_PEERS = 400;
+// Size of the message sent to one peer per iteration, a bare message header.
+static const int SOCKET_BENCH_MESSAGE = 24;
+
+// SOCKET_BENCH_PEERS connected loopback TCP pairs; the accepted ends play
+// the node's peer sockets, the connecting ends the remote peers.
+class LoopbackPeers
+{
+public:
+    std::vector<SOCKET> vLocal;
+    std::vector<SOCKET> vRemote;
+
+    LoopbackPeers()
+    {
+        SOCKET hListen = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(addr);
+        if (bind(hListen, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(hListen, SOCKET_BENCH_PEERS) != 0 ||
+            getsockname(hListen, (struct sockaddr*)&addr, &len) != 0) {
+            CloseSocket(hListen);
+            return;
+        }
+        for (int i = 0; i < SOCKET_BENCH_PEERS; i++) {
+            SOCKET hRemote = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+            if (connect(hRemote, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+                CloseSocket(hRemote);
+                break;
+            }
+            SOCKET hLocal = accept(hListen, NULL, NULL);
+            int set = 1;
+            setsockopt(hRemote, IPPROTO_TCP, TCP_NODELAY, (void*)&set, sizeof(int));
+            vRemote.push_back(hRemote);
+            vLocal.push_back(hLocal);
+        }
+        CloseSocket(hListen);
+    }
+
+    ~LoopbackPeers()
+    {
+        for (SOCKET& hSocket : vLocal)
+            CloseSocket(hSocket);
+        for (SOCKET& hSocket : vRemote)
+            CloseSocket(hSocket);
+    }
+};
+
+// One remote peer sends a message and the local end waits for it and reads
+// it: the time per iteration is the latency one message sees in the socket
+// handler with the other peers idle, and the cycles the CPU it costs.
+static void SocketEventsSelect(benchmark::State& state)
+{
+    LoopbackPeers peers;
+    const size_t nPeers = peers.vLocal.size();
+    char pchMsg[SOCKET_BENCH_MESSAGE] = {};
+    size_t nPeer = 0;
+    while (state.KeepRunning()) {
+        send(peers.vRemote[nPeer++ % nPeers], pchMsg, sizeof(pchMsg), MSG_NOSIGNAL);
+
+        // Like the select() socket handler, rebuild the set over every peer
+        fd_set fdsetRecv;
+        FD_ZERO(&fdsetRecv);
+        SOCKET hSocketMax = 0;
+        for (SOCKET hSocket : peers.vLocal) {
+            FD_SET(hSocket, &fdsetRecv);
+            hSocketMax = std::max(hSocketMax, hSocket);
+        }
+        struct timeval timeout = {1, 0};
+        select(hSocketMax + 1, &fdsetRecv, NULL, NULL, &timeout);
+        for (SOCKET hSocket : peers.vLocal) {
+            if (FD_ISSET(hSocket, &fdsetRecv))
+                recv(hSocket, pchMsg, sizeof(pchMsg), MSG_DONTWAIT);
+        }
+    }
+}
+
+BENCHMARK(SocketEventsSelect);
+
+#ifdef USE_EPOLL
+static void SocketEventsEpoll(benchmark::State& state)
+{
+    LoopbackPeers peers;
+    const size_t nPeers = peers.vLocal.size();
+    int epollfd = epoll_create1(EPOLL_CLOEXEC);
+    for (size_t i = 0; i < nPeers; i++) {
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLET;
+        event.data.u64 = i;
+        epoll_ctl(epollfd, EPOLL_CTL_ADD, peers.vLocal[i], &event);
+    }
+
+    std::vector<struct epoll_event> vEvents(64);
+    char pchMsg[SOCKET_BENCH_MESSAGE] = {};
+    size_t nPeer = 0;
+    while (state.KeepRunning()) {
+        send(peers.vRemote[nPeer++ % nPeers], pchMsg, sizeof(pchMsg), MSG_NOSIGNAL);
+
+        int nEvents = epoll_wait(epollfd, vEvents.data(), vEvents.size(), 1000);
+        for (int i = 0; i < nEvents; i++)
+            recv(peers.vLocal[vEvents[i].data.u64], pchMsg, sizeof(pchMsg), MSG_DONTWAIT);
+    }
+    close(epollfd);
+}
+
+BENCHMARK(SocketEventsEpoll);
+#endif
+
+#endif // WIN32
@@ -0,0 +1,93 @@
+// Copyright (c) 2017 The Prux Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "bloom.h"
+#include "policy/policy.h"
+#include "txmempool.h"
+#include "txrelay.h"
+
+#include <vector>
+
+// Peers trickling transaction announcements.
+static const int TX_RELAY_BENCH_PEERS = 500;
+// Transactions accepted per iteration, which plays one broadcast interval.
+static const int TX_RELAY_BENCH_TXS_PER_INTERVAL = 100;
+// Distinct transactions in the mempool, relayed in turn.
+static const int TX_RELAY_BENCH_POOL_TXS = 20000;
+// Announced per peer per interval at most, like INVENTORY_BROADCAST_MAX.
+static const unsigned int TX_RELAY_BENCH_BROADCAST_MAX = 35;
+
+// A peer's relay state. The known inventory filter is a tenth of the one in
+// CNode, to keep 500 of them at a reasonable size.
+struct BenchRelayPeer
+{
+    CRollingBloomFilter filterInventoryKnown;
+    uint64_t nTxRelayCursor;
+    CAmount minFeeFilter;
+
+    BenchRelayPeer() : filterInventoryKnown(5000, 0.000001), nTxRelayCursor(0), minFeeFilter(0) {}
+};
+
+// Each iteration, TX_RELAY_BENCH_TXS_PER_INTERVAL transactions are relayed,
+// each received from one of the peers, and then every peer has its trickle:
+// announcements are picked from the shared queue past the peer's cursor,
+// skipping what the peer knows and what its fee filter rejects.
+static void TxRelay500Peers(benchmark::State& state)
+{
+    CTxMemPool pool(CFeeRate(0));
+    std::vector<uint256> vHashes;
+    for (int i = 0; i < TX_RELAY_BENCH_POOL_TXS; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].scriptSig = CScript() << i;
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+        tx.vout[0].nValue = 10 * COIN;
+        LockPoints lp;
+        pool.addUnchecked(tx.GetHash(), CTxMemPoolEntry(MakeTransactionRef(tx), 1000 + (i * 7919) % 50000, 0, 10.0, 1, 10 * COIN, false, 4, lp));
+        vHashes.push_back(tx.GetHash());
+    }
+
+    CTxRelayQueue queue;
+    std::vector<BenchRelayPeer> vPeers(TX_RELAY_BENCH_PEERS);
+    for (int i = 0; i < TX_RELAY_BENCH_PEERS; i++) {
+        // A quarter of the peers have a fee filter set
+        if (i % 4 == 0)
+            vPeers[i].minFeeFilter = 20000;
+    }
+
+    size_t nNextTx = 0;
+    int64_t nTime = 0;
+    std::vector<uint256> vInv;
+    while (state.KeepRunning()) {
+        for (int i = 0; i < TX_RELAY_BENCH_TXS_PER_INTERVAL; i++) {
+            const uint256& hash = vHashes[nNextTx++ % vHashes.size()];
+            vPeers[nNextTx % vPeers.size()].filterInventoryKnown.insert(hash);
+            queue.Push(hash);
+        }
+        nTime += 5;
+
+        for (BenchRelayPeer& peer : vPeers) {
+            queue.MakeBatch(pool, nTime);
+            unsigned int nRelayed = 0;
+            queue.ForEachFrom(peer.nTxRelayCursor, [&](const CTxRelayQueue::Entry& entry) {
+                if (nRelayed >= TX_RELAY_BENCH_BROADCAST_MAX)
+                    return false;
+                const uint256& hash = entry.tx->GetHash();
+                if (peer.filterInventoryKnown.contains(hash))
+                    return true;
+                if (peer.minFeeFilter && entry.nFeePerK < peer.minFeeFilter)
+                    return true;
+                vInv.push_back(hash);
+                nRelayed++;
+                peer.filterInventoryKnown.insert(hash);
+                return true;
+            });
+            vInv.clear();
+        }
+    }
+}
+
+BENCHMARK(TxRelay500Peers);
@@ -0,0 +1,70 @@
+// Copyright (c) 2017 The Prux Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "key.h"
+#include "util.h"
+#include "utiltime.h"
+#include "wallet/db.h"
+#include "wallet/wallet.h"
+
+#include <iostream>
+
+#include <boost/filesystem.hpp>
+
+// Records written per iteration
+static const int WALLET_BENCH_RECORDS = 1000;
+
+// Write WALLET_BENCH_RECORDS keypool records to an on-disk wallet, each
+// through its own CWalletDB like keypool refill and rescan did, either
+// committed one by one or grouped by a CDBWriteBatch. Reports the records
+// written per second, including the commit and log checkpoint at the end.
+static void WalletWriteRecords(benchmark::State& state, bool fBatch, const char* pszName)
+{
+    const boost::filesystem::path path = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("bench_prux_walletdb_%%%%%%%%");
+    boost::filesystem::create_directories(path);
+    ForceSetArg("-datadir", path.string());
+    ClearDatadirCache();
+    bitdb.Open(path);
+
+    CKey key;
+    key.MakeNewKey(true);
+    const CKeyPool keypool(key.GetPubKey());
+    CWalletDB("bench_wallet.dat", "cr+").WriteVersion(CLIENT_VERSION);
+
+    int64_t nIndex = 0;
+    int64_t nElapsed = 0;
+    while (state.KeepRunning()) {
+        const int64_t nStart = GetTimeMicros();
+        {
+            CDBWriteBatch dbBatch(fBatch ? "bench_wallet.dat" : "");
+            for (int i = 0; i < WALLET_BENCH_RECORDS; i++) {
+                CWalletDB("bench_wallet.dat").WritePool(++nIndex, keypool);
+                dbBatch.Checkpoint();
+            }
+            dbBatch.Commit();
+        }
+        nElapsed += GetTimeMicros() - nStart;
+    }
+    // Lines starting with '#' are ignored by consumers of the CSV output.
+    std::cout << "#" << pszName << ",records_per_second," << nIndex * 1000000.0 / std::max<int64_t>(nElapsed, 1) << "\n";
+
+    bitdb.Flush(true);
+    bitdb.Reset();
+    boost::filesystem::remove_all(path);
+    ClearDatadirCache();
+}
+
+static void WalletWriteRecordsSingle(benchmark::State& state)
+{
+    WalletWriteRecords(state, false, "WalletWriteRecordsSingle");
+}
+
+static void WalletWriteRecordsBatched(benchmark::State& state)
+{
+    WalletWriteRecords(state, true, "WalletWriteRecordsBatched");
+}
+
+BENCHMARK(WalletWriteRecordsSingle);
+BENCHMARK(WalletWriteRecordsBatched);
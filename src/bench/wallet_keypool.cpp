@@ -0,0 +1,62 @@
+// Copyright (c) 2017 The Prux Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "util.h"
+#include "wallet/db.h"
+#include "wallet/wallet.h"
+
+#include <boost/filesystem.hpp>
+
+// Keys generated per iteration; keys/sec is this divided by the reported
+// time per iteration.
+static const int WALLET_BENCH_KEYS = 1000;
+
+// Generate WALLET_BENCH_KEYS HD keys in an on-disk wallet, either one at a
+// time or in bulk, and commit them.
+static void WalletGenerateKeys(benchmark::State& state, bool fBulk)
+{
+    const boost::filesystem::path path = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("bench_prux_keypool_%%%%%%%%");
+    boost::filesystem::create_directories(path);
+    ForceSetArg("-datadir", path.string());
+    ClearDatadirCache();
+    bitdb.Open(path);
+
+    {
+        CWallet wallet("bench_keypool.dat");
+        bool fFirstRun;
+        wallet.LoadWallet(fFirstRun);
+        LOCK(wallet.cs_wallet);
+        wallet.SetHDMasterKey(wallet.GenerateNewHDMasterKey());
+
+        std::vector<CPubKey> vPubKeys;
+        while (state.KeepRunning()) {
+            CDBWriteBatch dbBatch(wallet.strWalletFile);
+            if (fBulk) {
+                wallet.GenerateNewKeys(WALLET_BENCH_KEYS, vPubKeys);
+            } else {
+                for (int i = 0; i < WALLET_BENCH_KEYS; i++)
+                    wallet.GenerateNewKey();
+            }
+        }
+    }
+
+    bitdb.Flush(true);
+    bitdb.Reset();
+    boost::filesystem::remove_all(path);
+    ClearDatadirCache();
+}
+
+static void WalletGenerateKeysSingle(benchmark::State& state)
+{
+    WalletGenerateKeys(state, false);
+}
+
+static void WalletGenerateKeysBulk(benchmark::State& state)
+{
+    WalletGenerateKeys(state, true);
+}
+
+BENCHMARK(WalletGenerateKeysSingle);
+BENCHMARK(WalletGenerateKeysBulk);
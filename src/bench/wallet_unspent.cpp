@@ -0,0 +1,76 @@
+// Copyright (c) 2017 The Prux Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "chain.h"
+#include "random.h"
+#include "validation.h"
+#include "wallet/wallet.h"
+
+static const int WALLET_BENCH_UNSPENT = 100000;
+
+// Build a wallet holding nUnspent confirmed outputs to its own key, plus as
+// many outputs that have already been spent by other confirmed wallet
+// transactions, then list its available coins.
+static void WalletAvailableCoins(benchmark::State& state, int nUnspent)
+{
+    LOCK(cs_main);
+    CBlockIndex index;
+    const uint256 hashBlock = GetRandHash();
+    index.phashBlock = &hashBlock;
+    index.nHeight = 0;
+    mapBlockIndex[hashBlock] = &index;
+    chainActive.SetTip(&index);
+
+    {
+        CWallet wallet;
+        LOCK(wallet.cs_wallet);
+        CKey key;
+        key.MakeNewKey(true);
+        wallet.AddKeyPubKey(key, key.GetPubKey());
+        const CScript scriptMine = GetScriptForDestination(key.GetPubKey().GetID());
+
+        for (int i = 0; i < 2 * nUnspent; i++) {
+            CMutableTransaction tx;
+            tx.nLockTime = i; // so all transactions get different hashes
+            tx.vout.resize(1);
+            tx.vout[0].nValue = COIN + i;
+            tx.vout[0].scriptPubKey = scriptMine;
+            CWalletTx wtx(&wallet, MakeTransactionRef(std::move(tx)));
+            wtx.hashBlock = hashBlock;
+            wtx.nIndex = 0;
+            wallet.LoadToWallet(wtx);
+
+            if (i % 2 == 1) {
+                // Spend it to someone else
+                CMutableTransaction spend;
+                spend.vin.resize(1);
+                spend.vin[0].prevout = COutPoint(wtx.GetHash(), 0);
+                spend.vout.resize(1);
+                spend.vout[0].nValue = COIN;
+                spend.vout[0].scriptPubKey = CScript() << OP_TRUE;
+                CWalletTx wtxSpend(&wallet, MakeTransactionRef(std::move(spend)));
+                wtxSpend.hashBlock = hashBlock;
+                wtxSpend.nIndex = 0;
+                wallet.LoadToWallet(wtxSpend);
+            }
+        }
+
+        std::vector<COutput> vCoins;
+        while (state.KeepRunning()) {
+            wallet.AvailableCoins(vCoins);
+            assert(vCoins.size() == (size_t)nUnspent);
+        }
+    }
+
+    chainActive.SetTip(NULL);
+    mapBlockIndex.erase(hashBlock);
+}
+
+static void WalletAvailableCoins100k(benchmark::State& state)
+{
+    WalletAvailableCoins(state, WALLET_BENCH_UNSPENT);
+}
+
+BENCHMARK(WalletAvailableCoins100k);
@@ -0,0 +1,63 @@
+// Copyright (c) 2017 The Prux Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockcache.h"
+
+#include "primitives/block.h"
+#include "streams.h"
+#include "version.h"
+
+CSerializedBlockCache::CSerializedBlockCache(size_t nMaxBytesIn) : nMaxBytes(nMaxBytesIn), nBytes(0)
+{
+}
+
+std::shared_ptr<const CSharedNetPayload> CSerializedBlockCache::Get(const uint256& hash, bool fWitness)
+{
+    LOCK(cs);
+    std::map<Key, EntryList::iterator>::iterator it = mapEntries.find(Key(hash, fWitness));
+    if (it == mapEntries.end())
+        return nullptr;
+    listEntries.splice(listEntries.begin(), listEntries, it->second);
+    return it->second->second;
+}
+
+std::shared_ptr<const CSharedNetPayload> CSerializedBlockCache::Add(const uint256& hash, const CBlock& block, bool fWitness)
+{
+    std::vector<unsigned char> vchBlock;
+    CVectorWriter{SER_NETWORK, PROTOCOL_VERSION | (fWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS), vchBlock, 0, block};
+    std::shared_ptr<const CSharedNetPayload> payload = std::make_shared<const CSharedNetPayload>(std::move(vchBlock));
+    if (payload->data.size() > nMaxBytes)
+        return payload;
+
+    LOCK(cs);
+    const Key key(hash, fWitness);
+    std::map<Key, EntryList::iterator>::iterator it = mapEntries.find(key);
+    if (it != mapEntries.end()) {
+        // Another thread added it meanwhile; keep the copy other peers may
+        // already be sending
+        listEntries.splice(listEntries.begin(), listEntries, it->second);
+        return it->second->second;
+    }
+    listEntries.emplace_front(key, payload);
+    mapEntries.emplace(key, listEntries.begin());
+    nBytes += payload->data.size();
+    while (nBytes > nMaxBytes) {
+        nBytes -= listEntries.back().second->data.size();
+        mapEntries.erase(listEntries.back().first);
+        listEntries.pop_back();
+    }
+    return payload;
+}
+
+size_t CSerializedBlockCache::Count() const
+{
+    LOCK(cs);
+    return mapEntries.size();
+}
+
+size_t CSerializedBlockCache::Bytes() const
+{
+    LOCK(cs);
+    return nBytes;
+}
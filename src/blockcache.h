@@ -0,0 +1,55 @@
+// Copyright (c) 2017 The Prux Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKCACHE_H
+#define BITCOIN_BLOCKCACHE_H
+
+#include "net.h"
+#include "sync.h"
+#include "uint256.h"
+
+#include <list>
+#include <map>
+#include <memory>
+
+class CBlock;
+
+/** Bytes of serialized blocks kept in memory for answering getdata requests */
+static const size_t DEFAULT_BLOCK_SERVE_CACHE_SIZE = 64 * 1024 * 1024;
+
+/**
+ * Least recently used cache of blocks serialized for the network, in the
+ * witness and the non-witness form, with their message checksums. Peers
+ * fetching the same block are all sent the one cached payload, which costs
+ * neither a disk read, a reserialization nor a copy per peer.
+ */
+class CSerializedBlockCache
+{
+private:
+    //! Block hash, and whether witness data is included
+    typedef std::pair<uint256, bool> Key;
+    typedef std::list<std::pair<Key, std::shared_ptr<const CSharedNetPayload> > > EntryList;
+
+    mutable CCriticalSection cs;
+    //! Most recently used first
+    EntryList listEntries;
+    std::map<Key, EntryList::iterator> mapEntries;
+    size_t nMaxBytes;
+    size_t nBytes;
+
+public:
+    explicit CSerializedBlockCache(size_t nMaxBytesIn = DEFAULT_BLOCK_SERVE_CACHE_SIZE);
+
+    //! Cached payload of a block, or null
+    std::shared_ptr<const CSharedNetPayload> Get(const uint256& hash, bool fWitness);
+    //! Serialize a block, cache it and return the payload. Blocks larger than
+    //! the whole cache are serialized but not kept.
+    std::shared_ptr<const CSharedNetPayload> Add(const uint256& hash, const CBlock& block, bool fWitness);
+
+    //! Number of payloads and their total size in bytes
+    size_t Count() const;
+    size_t Bytes() const;
+};
+
+#endif // BITCOIN_BLOCKCACHE_H
@@ -13,8 +13,6 @@
 #include "validation.h"
 #include "util.h"
 
-#include <unordered_map>
-
 #define MIN_TRANSACTION_BASE_SIZE (::GetSerializeSize(CTransaction(), SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS))
 
 CBlockHeaderAndShortTxIDs::CBlockHeaderAndShortTxIDs(const CBlock& block, bool fUseWTXID) :
@@ -45,6 +43,93 @@ uint64_t CBlockHeaderAndShortTxIDs::GetShortID(const uint256& txhash) const {
     return SipHashUint256(shorttxidk0, shorttxidk1, txhash) & 0xffffffffffffL;
 }
 
+void CBlockHeaderAndShortTxIDs::GetShortIDBatch(const uint256* const txhashes[SIPHASH_BATCH_LANES], uint64_t shortids[SIPHASH_BATCH_LANES]) const {
+    static_assert(SHORTTXIDS_LENGTH == 6, "shorttxids calculation assumes 6-byte shorttxids");
+    SipHashUint256Batch(shorttxidk0, shorttxidk1, txhashes, shortids);
+    for (size_t i = 0; i < SIPHASH_BATCH_LANES; i++)
+        shortids[i] &= 0xffffffffffffL;
+}
+
+namespace {
+
+/**
+ * Open-addressing (linear probing) map from 48-bit short IDs to transaction
+ * positions in the block. Each slot packs the position into the top 16 bits
+ * above the short ID, so a probe reads a single 8-byte word. The start slot is
+ * derived from the short ID with a random multiplier, so a peer can't line up
+ * short IDs into one long probe sequence.
+ */
+class ShortIdTable
+{
+private:
+    //! All ones across the packed value. Insert() only stores positions below
+    //! 0xffff, so the top 16 bits of a used slot are never all ones.
+    static const uint64_t EMPTY = ~(uint64_t)0;
+    //! Positions that fit in a slot are below this.
+    static const size_t MAX_POS = 0xffff;
+    static const uint64_t SHORTID_MASK = 0xffffffffffffULL;
+
+    std::vector<uint64_t> slots;
+    uint64_t salt;
+    int shift;
+
+    size_t Slot(uint64_t shortid) const { return (shortid * salt) >> shift; }
+
+public:
+    //! Give up on a block whose short IDs cluster this badly (see InitData).
+    static const size_t MAX_PROBE = 32;
+
+    explicit ShortIdTable(size_t count) : salt(GetRand(std::numeric_limits<uint64_t>::max()) | 1)
+    {
+        // Keep the load factor at or below 1/4 so honest probe sequences stay short.
+        int bits = 4;
+        while (((size_t)1 << bits) < count * 4)
+            bits++;
+        slots.assign((size_t)1 << bits, EMPTY);
+        shift = 64 - bits;
+    }
+
+    enum InsertResult { INSERTED, DUPLICATE, OVERFULL, POS_TOO_LARGE };
+
+    InsertResult Insert(uint64_t shortid, size_t pos)
+    {
+        if (pos >= MAX_POS)
+            return POS_TOO_LARGE;
+        const size_t mask = slots.size() - 1;
+        size_t slot = Slot(shortid);
+        for (size_t probe = 0; probe < MAX_PROBE; probe++, slot = (slot + 1) & mask) {
+            if (slots[slot] == EMPTY) {
+                slots[slot] = ((uint64_t)pos << 48) | shortid;
+                return INSERTED;
+            }
+            if ((slots[slot] & SHORTID_MASK) == shortid)
+                return DUPLICATE;
+        }
+        return OVERFULL;
+    }
+
+    //! Returns the position stored for shortid, or -1 if it is not present.
+    int Find(uint64_t shortid) const
+    {
+        const size_t mask = slots.size() - 1;
+        size_t slot = Slot(shortid);
+        for (size_t probe = 0; probe < MAX_PROBE; probe++, slot = (slot + 1) & mask) {
+            const uint64_t value = slots[slot];
+            if (value == EMPTY)
+                return -1;
+            if ((value & SHORTID_MASK) == shortid)
+                return value >> 48;
+        }
+        return -1;
+    }
+};
+
+const uint64_t ShortIdTable::EMPTY;
+const uint64_t ShortIdTable::SHORTID_MASK;
+const size_t ShortIdTable::MAX_POS;
+const size_t ShortIdTable::MAX_PROBE;
+
+} // anon namespace
 
 
 ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& cmpctblock, const std::vector<std::pair<uint256, CTransactionRef>>& extra_txn) {
@@ -79,69 +164,34 @@ ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& c
     // Because well-formed cmpctblock messages will have a (relatively) uniform distribution
     // of short IDs, any highly-uneven distribution of elements can be safely treated as a
     // READ_STATUS_FAILED.
-    std::unordered_map<uint64_t, uint16_t> shorttxids(cmpctblock.shorttxids.size());
+    ShortIdTable shorttxids(cmpctblock.shorttxids.size());
     uint16_t index_offset = 0;
     for (size_t i = 0; i < cmpctblock.shorttxids.size(); i++) {
         while (txn_available[i + index_offset])
             index_offset++;
-        shorttxids[cmpctblock.shorttxids[i]] = i + index_offset;
-        // To determine the chance that the number of entries in a bucket exceeds N,
-        // we use the fact that the number of elements in a single bucket is
-        // binomially distributed (with n = the number of shorttxids S, and p =
-        // 1 / the number of buckets), that in the worst case the number of buckets is
-        // equal to S (due to std::unordered_map having a default load factor of 1.0),
-        // and that the chance for any bucket to exceed N elements is at most
-        // buckets * (the chance that any given bucket is above N elements).
-        // Thus: P(max_elements_per_bucket > N) <= S * (1 - cdf(binomial(n=S,p=1/S), N)).
-        // If we assume blocks of up to 16000, allowing 12 elements per bucket should
-        // only fail once per ~1 million block transfers (per peer and connection).
-        if (shorttxids.bucket_size(shorttxids.bucket(cmpctblock.shorttxids[i])) > 12)
-            return READ_STATUS_FAILED;
+        // With the load factor capped at 1/4 and randomized slot selection, an
+        // honest block essentially never needs MAX_PROBE probes for one insert.
+        ShortIdTable::InsertResult result = shorttxids.Insert(cmpctblock.shorttxids[i], i + index_offset);
+        // TODO: in the shortid-collision case, we should instead request both transactions
+        // which collided. Falling back to full-block-request here is overkill.
+        if (result != ShortIdTable::INSERTED)
+            return READ_STATUS_FAILED; // Short ID collision, overloaded table or too many transactions
     }
-    // TODO: in the shortid-collision case, we should instead request both transactions
-    // which collided. Falling back to full-block-request here is overkill.
-    if (shorttxids.size() != cmpctblock.shorttxids.size())
-        return READ_STATUS_FAILED; // Short ID collision
 
+    const size_t nShortIds = cmpctblock.shorttxids.size();
     std::vector<bool> have_txn(txn_available.size());
-    {
-    LOCK(pool->cs);
-    const std::vector<std::pair<uint256, CTxMemPool::txiter> >& vTxHashes = pool->vTxHashes;
-    for (size_t i = 0; i < vTxHashes.size(); i++) {
-        uint64_t shortid = cmpctblock.GetShortID(vTxHashes[i].first);
-        std::unordered_map<uint64_t, uint16_t>::iterator idit = shorttxids.find(shortid);
-        if (idit != shorttxids.end()) {
-            if (!have_txn[idit->second]) {
-                txn_available[idit->second] = vTxHashes[i].second->GetSharedTx();
-                have_txn[idit->second]  = true;
-                mempool_count++;
-            } else {
-                // If we find two mempool txn that match the short id, just request it.
-                // This should be rare enough that the extra bandwidth doesn't matter,
-                // but eating a round-trip due to FillBlock failure would be annoying
-                if (txn_available[idit->second]) {
-                    txn_available[idit->second].reset();
-                    mempool_count--;
-                }
-            }
-        }
-        // Though ideally we'd continue scanning for the two-txn-match-shortid case,
-        // the performance win of an early exit here is too good to pass up and worth
-        // the extra risk.
-        if (mempool_count == shorttxids.size())
-            break;
-    }
-    }
 
-    for (size_t i = 0; i < extra_txn.size(); i++) {
-        uint64_t shortid = cmpctblock.GetShortID(extra_txn[i].first);
-        std::unordered_map<uint64_t, uint16_t>::iterator idit = shorttxids.find(shortid);
-        if (idit != shorttxids.end()) {
-            if (!have_txn[idit->second]) {
-                txn_available[idit->second] = extra_txn[i].second;
-                have_txn[idit->second]  = true;
+    // Match one candidate transaction against the short ID table. Returns true
+    // once every short ID has been found.
+    auto match = [&](uint64_t shortid, const CTransactionRef& tx, bool fExtra) {
+        int idx = shorttxids.Find(shortid);
+        if (idx >= 0) {
+            if (!have_txn[idx]) {
+                txn_available[idx] = tx;
+                have_txn[idx]  = true;
                 mempool_count++;
-                extra_count++;
+                if (fExtra)
+                    extra_count++;
             } else {
                 // If we find two mempool/extra txn that match the short id, just
                 // request it.
@@ -149,20 +199,51 @@ ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& c
                 // but eating a round-trip due to FillBlock failure would be annoying
                 // Note that we dont want duplication between extra_txn and mempool to
                 // trigger this case, so we compare witness hashes first
-                if (txn_available[idit->second] &&
-                        txn_available[idit->second]->GetWitnessHash() != extra_txn[i].second->GetWitnessHash()) {
-                    txn_available[idit->second].reset();
+                if (txn_available[idx] &&
+                        (!fExtra || txn_available[idx]->GetWitnessHash() != tx->GetWitnessHash())) {
+                    txn_available[idx].reset();
                     mempool_count--;
-                    extra_count--;
+                    if (fExtra)
+                        extra_count--;
                 }
             }
         }
         // Though ideally we'd continue scanning for the two-txn-match-shortid case,
         // the performance win of an early exit here is too good to pass up and worth
         // the extra risk.
-        if (mempool_count == shorttxids.size())
-            break;
+        return mempool_count == nShortIds;
+    };
+
+    // Short IDs are computed SIPHASH_BATCH_LANES at a time; the tail that does
+    // not fill a batch falls back to GetShortID.
+    const uint256* hashes[SIPHASH_BATCH_LANES];
+    uint64_t shortids[SIPHASH_BATCH_LANES];
+    bool fDone = false;
+    {
+    LOCK(pool->cs);
+    const std::vector<std::pair<uint256, CTxMemPool::txiter> >& vTxHashes = pool->vTxHashes;
+    size_t i = 0;
+    for (; !fDone && i + SIPHASH_BATCH_LANES <= vTxHashes.size(); i += SIPHASH_BATCH_LANES) {
+        for (size_t l = 0; l < SIPHASH_BATCH_LANES; l++)
+            hashes[l] = &vTxHashes[i + l].first;
+        cmpctblock.GetShortIDBatch(hashes, shortids);
+        for (size_t l = 0; l < SIPHASH_BATCH_LANES && !fDone; l++)
+            fDone = match(shortids[l], vTxHashes[i + l].second->GetSharedTx(), false);
+    }
+    for (; !fDone && i < vTxHashes.size(); i++)
+        fDone = match(cmpctblock.GetShortID(vTxHashes[i].first), vTxHashes[i].second->GetSharedTx(), false);
+    }
+
+    size_t i = 0;
+    for (; !fDone && i + SIPHASH_BATCH_LANES <= extra_txn.size(); i += SIPHASH_BATCH_LANES) {
+        for (size_t l = 0; l < SIPHASH_BATCH_LANES; l++)
+            hashes[l] = &extra_txn[i + l].first;
+        cmpctblock.GetShortIDBatch(hashes, shortids);
+        for (size_t l = 0; l < SIPHASH_BATCH_LANES && !fDone; l++)
+            fDone = match(shortids[l], extra_txn[i + l].second, true);
     }
+    for (; !fDone && i < extra_txn.size(); i++)
+        fDone = match(cmpctblock.GetShortID(extra_txn[i].first), extra_txn[i].second, true);
 
     LogPrint("cmpctblock", "Initialized PartiallyDownloadedBlock for block %s using a cmpctblock of size %lu\n", cmpctblock.header.GetHash().ToString(), GetSerializeSize(cmpctblock, SER_NETWORK, PROTOCOL_VERSION));
 
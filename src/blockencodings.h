@@ -5,6 +5,7 @@
 #ifndef BITCOIN_BLOCK_ENCODINGS_H
 #define BITCOIN_BLOCK_ENCODINGS_H
 
+#include "hash.h"
 #include "primitives/block.h"
 
 #include <memory>
@@ -151,6 +152,8 @@ public:
     CBlockHeaderAndShortTxIDs(const CBlock& block, bool fUseWTXID);
 
     uint64_t GetShortID(const uint256& txhash) const;
+    /** GetShortID for SIPHASH_BATCH_LANES hashes at once */
+    void GetShortIDBatch(const uint256* const txhashes[SIPHASH_BATCH_LANES], uint64_t shortids[SIPHASH_BATCH_LANES]) const;
 
     size_t BlockTxCount() const { return shorttxids.size() + prefilledtxn.size(); }
 
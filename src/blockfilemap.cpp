@@ -0,0 +1,105 @@
+// Copyright (c) 2017 The Prux Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilemap.h"
+
+#include "chain.h"
+#include "util.h"
+#include "validation.h"
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+std::shared_ptr<const CMappedFile> CMappedFile::Map(const boost::filesystem::path& path)
+{
+#ifndef WIN32
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+    struct stat st;
+    void* addr = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    // The mapping stays valid after the descriptor is closed
+    close(fd);
+    if (addr == MAP_FAILED) {
+        LogPrintf("Unable to map file %s\n", path.string());
+        return nullptr;
+    }
+    return std::shared_ptr<const CMappedFile>(new CMappedFile(static_cast<const unsigned char*>(addr), st.st_size));
+#else
+    return nullptr;
+#endif
+}
+
+CMappedFile::~CMappedFile()
+{
+#ifndef WIN32
+    munmap(const_cast<unsigned char*>(data), size);
+#endif
+}
+
+CBlockFileMappings::CBlockFileMappings(size_t nMaxFilesIn) : nFirstOpenFile(0), nMaxFiles(nMaxFilesIn)
+{
+}
+
+std::shared_ptr<const CMappedFile> CBlockFileMappings::Get(int nFile, bool fUndo)
+{
+    LOCK(cs);
+    if (nFile >= nFirstOpenFile)
+        return nullptr;
+    const Key key(nFile, fUndo);
+    std::map<Key, EntryList::iterator>::iterator it = mapEntries.find(key);
+    if (it != mapEntries.end()) {
+        listEntries.splice(listEntries.begin(), listEntries, it->second);
+        return it->second->second;
+    }
+
+    std::shared_ptr<const CMappedFile> mapping = CMappedFile::Map(GetBlockPosFilename(CDiskBlockPos(nFile, 0), fUndo ? "rev" : "blk"));
+    if (!mapping)
+        return nullptr;
+    listEntries.emplace_front(key, mapping);
+    mapEntries.emplace(key, listEntries.begin());
+    while (listEntries.size() > nMaxFiles) {
+        mapEntries.erase(listEntries.back().first);
+        listEntries.pop_back();
+    }
+    return mapping;
+}
+
+void CBlockFileMappings::SetFirstOpenFile(int nFile)
+{
+    LOCK(cs);
+    nFirstOpenFile = nFile;
+    for (EntryList::iterator it = listEntries.begin(); it != listEntries.end();) {
+        if (it->first.first >= nFirstOpenFile) {
+            mapEntries.erase(it->first);
+            it = listEntries.erase(it);
+        } else {
+            it++;
+        }
+    }
+}
+
+void CBlockFileMappings::Invalidate(int nFile)
+{
+    LOCK(cs);
+    for (bool fUndo : {false, true}) {
+        std::map<Key, EntryList::iterator>::iterator it = mapEntries.find(Key(nFile, fUndo));
+        if (it != mapEntries.end()) {
+            listEntries.erase(it->second);
+            mapEntries.erase(it);
+        }
+    }
+}
+
+size_t CBlockFileMappings::Count() const
+{
+    LOCK(cs);
+    return mapEntries.size();
+}
@@ -0,0 +1,79 @@
+// Copyright (c) 2017 The Prux Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILEMAP_H
+#define BITCOIN_BLOCKFILEMAP_H
+
+#include "sync.h"
+
+#include <list>
+#include <map>
+#include <memory>
+
+#include <boost/filesystem/path.hpp>
+
+/** Default for -blockmmap, reading blocks and undo data from memory mapped files */
+static const bool DEFAULT_BLOCK_MMAP = false;
+/** Block and undo files kept mapped at most; blk files are up to 128 MiB */
+static const size_t MAX_BLOCK_FILE_MAPPINGS = 64;
+
+/** A whole file mapped read-only into memory, unmapped when the last reference goes */
+class CMappedFile
+{
+public:
+    const unsigned char* const data;
+    const size_t size;
+
+    /** Map the file at path, or return nullptr if it is empty or cannot be mapped */
+    static std::shared_ptr<const CMappedFile> Map(const boost::filesystem::path& path);
+
+    ~CMappedFile();
+
+private:
+    CMappedFile(const unsigned char* dataIn, size_t sizeIn) : data(dataIn), size(sizeIn) {}
+    CMappedFile(const CMappedFile&) = delete;
+    CMappedFile& operator=(const CMappedFile&) = delete;
+};
+
+/**
+ * Least recently used mappings of the blk and rev files no more blocks are
+ * appended to, so historical blocks and undo data are deserialized straight
+ * from the page cache instead of with an open, seek and buffered read for
+ * every access. Readers hold a reference to the mapping they read from, so
+ * evicting it does not unmap it under them.
+ *
+ * Undo data for blocks stored in an older file is still appended to its rev
+ * file; a read past the end of an older mapping has to Invalidate() it.
+ */
+class CBlockFileMappings
+{
+private:
+    //! File number, and whether it is the rev file
+    typedef std::pair<int, bool> Key;
+    typedef std::list<std::pair<Key, std::shared_ptr<const CMappedFile> > > EntryList;
+
+    mutable CCriticalSection cs;
+    //! Most recently used first
+    EntryList listEntries;
+    std::map<Key, EntryList::iterator> mapEntries;
+    //! Files from this one on may still have blocks appended, and are not mapped
+    int nFirstOpenFile;
+    const size_t nMaxFiles;
+
+public:
+    explicit CBlockFileMappings(size_t nMaxFilesIn = MAX_BLOCK_FILE_MAPPINGS);
+
+    /** Mapping of blk or rev file nFile, or nullptr if it is not to be mapped */
+    std::shared_ptr<const CMappedFile> Get(int nFile, bool fUndo);
+
+    /** Blocks are appended to nFile from now on; files before it are finished */
+    void SetFirstOpenFile(int nFile);
+
+    /** Drop the mappings of file nFile, because it grew or was removed */
+    void Invalidate(int nFile);
+
+    size_t Count() const;
+};
+
+#endif // BITCOIN_BLOCKFILEMAP_H
@@ -4,6 +4,7 @@
 
 #include "bloom.h"
 
+#include "crypto/common.h"
 #include "primitives/transaction.h"
 #include "hash.h"
 #include "script/script.h"
@@ -11,6 +12,7 @@
 #include "random.h"
 #include "streams.h"
 
+#include <algorithm>
 #include <math.h>
 #include <stdlib.h>
 
@@ -50,25 +52,38 @@ CBloomFilter::CBloomFilter(unsigned int nElements, double nFPRate, unsigned int
 {
 }
 
-inline unsigned int CBloomFilter::Hash(unsigned int nHashNum, const std::vector<unsigned char>& vDataToHash) const
-{
-    // 0xFBA4C795 chosen as it guarantees a reasonable bit difference between nHashNum values.
-    return MurmurHash3(nHashNum * 0xFBA4C795 + nTweak, vDataToHash) % (vData.size() * 8);
-}
+// Bloom filter hash functions computed per MurmurHash3Multi call. Four fill
+// one SSE2 register, and checking the bits after each batch lets contains()
+// give up early on the common miss.
+static const unsigned int BLOOM_HASH_BATCH = 4;
 
-void CBloomFilter::insert(const std::vector<unsigned char>& vKey)
+void CBloomFilter::insert(const unsigned char* pData, size_t nLen)
 {
     if (isFull)
         return;
-    for (unsigned int i = 0; i < nHashFuncs; i++)
+    uint32_t vSeeds[BLOOM_HASH_BATCH], vHashes[BLOOM_HASH_BATCH];
+    for (unsigned int i = 0; i < nHashFuncs; i += BLOOM_HASH_BATCH)
     {
-        unsigned int nIndex = Hash(i, vKey);
-        // Sets bit nIndex of vData
-        vData[nIndex >> 3] |= (1 << (7 & nIndex));
+        const unsigned int nBatch = std::min(nHashFuncs - i, BLOOM_HASH_BATCH);
+        // 0xFBA4C795 chosen as it guarantees a reasonable bit difference between nHashNum values.
+        for (unsigned int j = 0; j < nBatch; j++)
+            vSeeds[j] = (i + j) * 0xFBA4C795 + nTweak;
+        MurmurHash3Multi(vSeeds, nBatch, pData, nLen, vHashes);
+        for (unsigned int j = 0; j < nBatch; j++)
+        {
+            unsigned int nIndex = vHashes[j] % (vData.size() * 8);
+            // Sets bit nIndex of vData
+            vData[nIndex >> 3] |= (1 << (7 & nIndex));
+        }
     }
     isEmpty = false;
 }
 
+void CBloomFilter::insert(const std::vector<unsigned char>& vKey)
+{
+    insert(vKey.data(), vKey.size());
+}
+
 void CBloomFilter::insert(const COutPoint& outpoint)
 {
     CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
@@ -79,26 +94,38 @@ void CBloomFilter::insert(const COutPoint& outpoint)
 
 void CBloomFilter::insert(const uint256& hash)
 {
-    std::vector<unsigned char> data(hash.begin(), hash.end());
-    insert(data);
+    insert(hash.begin(), hash.size());
 }
 
-bool CBloomFilter::contains(const std::vector<unsigned char>& vKey) const
+bool CBloomFilter::contains(const unsigned char* pData, size_t nLen) const
 {
     if (isFull)
         return true;
     if (isEmpty)
         return false;
-    for (unsigned int i = 0; i < nHashFuncs; i++)
+    uint32_t vSeeds[BLOOM_HASH_BATCH], vHashes[BLOOM_HASH_BATCH];
+    for (unsigned int i = 0; i < nHashFuncs; i += BLOOM_HASH_BATCH)
     {
-        unsigned int nIndex = Hash(i, vKey);
-        // Checks bit nIndex of vData
-        if (!(vData[nIndex >> 3] & (1 << (7 & nIndex))))
-            return false;
+        const unsigned int nBatch = std::min(nHashFuncs - i, BLOOM_HASH_BATCH);
+        for (unsigned int j = 0; j < nBatch; j++)
+            vSeeds[j] = (i + j) * 0xFBA4C795 + nTweak;
+        MurmurHash3Multi(vSeeds, nBatch, pData, nLen, vHashes);
+        for (unsigned int j = 0; j < nBatch; j++)
+        {
+            unsigned int nIndex = vHashes[j] % (vData.size() * 8);
+            // Checks bit nIndex of vData
+            if (!(vData[nIndex >> 3] & (1 << (7 & nIndex))))
+                return false;
+        }
     }
     return true;
 }
 
+bool CBloomFilter::contains(const std::vector<unsigned char>& vKey) const
+{
+    return contains(vKey.data(), vKey.size());
+}
+
 bool CBloomFilter::contains(const COutPoint& outpoint) const
 {
     CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
@@ -109,8 +136,7 @@ bool CBloomFilter::contains(const COutPoint& outpoint) const
 
 bool CBloomFilter::contains(const uint256& hash) const
 {
-    std::vector<unsigned char> data(hash.begin(), hash.end());
-    return contains(data);
+    return contains(hash.begin(), hash.size());
 }
 
 void CBloomFilter::clear()
@@ -131,7 +157,62 @@ bool CBloomFilter::IsWithinSizeConstraints() const
     return vData.size() <= MAX_BLOOM_FILTER_SIZE && nHashFuncs <= MAX_HASH_FUNCS;
 }
 
+void CTxFilterElements::AddElement(const unsigned char* pbegin, const unsigned char* pend)
+{
+    vData.insert(vData.end(), pbegin, pend);
+    vElementEnd.push_back(vData.size());
+}
+
+void CTxFilterElements::AddScriptPushes(const CScript& script)
+{
+    CScript::const_iterator pc = script.begin();
+    std::vector<unsigned char> data;
+    while (pc < script.end())
+    {
+        opcodetype opcode;
+        if (!script.GetOp(pc, opcode, data))
+            break;
+        if (data.size() != 0)
+            AddElement(data.data(), data.data() + data.size());
+    }
+    vGroupEnd.push_back(vElementEnd.size());
+}
+
+CTxFilterElements::CTxFilterElements(const CTransaction& tx) : ptx(&tx), hash(tx.GetHash())
+{
+    // Scripts hold their pushes plus a little opcode overhead
+    size_t nBytes = 0;
+    for (const CTxOut& txout : tx.vout)
+        nBytes += txout.scriptPubKey.size();
+    for (const CTxIn& txin : tx.vin)
+        nBytes += 36 + txin.scriptSig.size();
+    vData.reserve(nBytes);
+    vGroupEnd.reserve(tx.vout.size() + tx.vin.size());
+
+    for (const CTxOut& txout : tx.vout)
+        AddScriptPushes(txout.scriptPubKey);
+
+    for (const CTxIn& txin : tx.vin)
+    {
+        // The prevout as CBloomFilter::insert(const COutPoint&) serializes it
+        unsigned char pchIndex[4];
+        WriteLE32(pchIndex, txin.prevout.n);
+        vData.insert(vData.end(), txin.prevout.hash.begin(), txin.prevout.hash.end());
+        AddElement(pchIndex, pchIndex + sizeof(pchIndex));
+        AddScriptPushes(txin.scriptSig);
+    }
+}
+
 bool CBloomFilter::IsRelevantAndUpdate(const CTransaction& tx)
+{
+    if (isFull)
+        return true;
+    if (isEmpty)
+        return false;
+    return IsRelevantAndUpdate(CTxFilterElements(tx));
+}
+
+bool CBloomFilter::IsRelevantAndUpdate(const CTxFilterElements& elements)
 {
     bool fFound = false;
     // Match if the filter contains the hash of tx
@@ -140,25 +221,23 @@ bool CBloomFilter::IsRelevantAndUpdate(const CTransaction& tx)
         return true;
     if (isEmpty)
         return false;
-    const uint256& hash = tx.GetHash();
+    const uint256& hash = elements.hash;
     if (contains(hash))
         fFound = true;
 
-    for (unsigned int i = 0; i < tx.vout.size(); i++)
+    const unsigned char* pData = elements.vData.data();
+    const unsigned int nOutputs = elements.ptx->vout.size();
+    unsigned int nElement = 0;
+    for (unsigned int i = 0; i < nOutputs; i++)
     {
-        const CTxOut& txout = tx.vout[i];
         // Match if the filter contains any arbitrary script data element in any scriptPubKey in tx
         // If this matches, also add the specific output that was matched.
         // This means clients don't have to update the filter themselves when a new relevant tx 
         // is discovered in order to find spending transactions, which avoids round-tripping and race conditions.
-        CScript::const_iterator pc = txout.scriptPubKey.begin();
-        std::vector<unsigned char> data;
-        while (pc < txout.scriptPubKey.end())
+        for (; nElement < elements.vGroupEnd[i]; nElement++)
         {
-            opcodetype opcode;
-            if (!txout.scriptPubKey.GetOp(pc, opcode, data))
-                break;
-            if (data.size() != 0 && contains(data))
+            const uint32_t nBegin = nElement ? elements.vElementEnd[nElement - 1] : 0;
+            if (contains(pData + nBegin, elements.vElementEnd[nElement] - nBegin))
             {
                 fFound = true;
                 if ((nFlags & BLOOM_UPDATE_MASK) == BLOOM_UPDATE_ALL)
@@ -167,35 +246,26 @@ bool CBloomFilter::IsRelevantAndUpdate(const CTransaction& tx)
                 {
                     txnouttype type;
                     std::vector<std::vector<unsigned char> > vSolutions;
-                    if (Solver(txout.scriptPubKey, type, vSolutions) &&
+                    if (Solver(elements.ptx->vout[i].scriptPubKey, type, vSolutions) &&
                             (type == TX_PUBKEY || type == TX_MULTISIG))
                         insert(COutPoint(hash, i));
                 }
                 break;
             }
         }
+        nElement = elements.vGroupEnd[i];
     }
 
     if (fFound)
         return true;
 
-    BOOST_FOREACH(const CTxIn& txin, tx.vin)
+    // Match if the filter contains an outpoint tx spends (the first element
+    // of each input), or any arbitrary script data element in any scriptSig in tx
+    for (; nElement < elements.vElementEnd.size(); nElement++)
     {
-        // Match if the filter contains an outpoint tx spends
-        if (contains(txin.prevout))
+        const uint32_t nBegin = nElement ? elements.vElementEnd[nElement - 1] : 0;
+        if (contains(pData + nBegin, elements.vElementEnd[nElement] - nBegin))
             return true;
-
-        // Match if the filter contains any arbitrary script data element in any scriptSig in tx
-        CScript::const_iterator pc = txin.scriptSig.begin();
-        std::vector<unsigned char> data;
-        while (pc < txin.scriptSig.end())
-        {
-            opcodetype opcode;
-            if (!txin.scriptSig.GetOp(pc, opcode, data))
-                break;
-            if (data.size() != 0 && contains(data))
-                return true;
-        }
     }
 
     return false;
@@ -7,11 +7,13 @@
 
 #include "serialize.h"
 
+#include "uint256.h"
+
 #include <vector>
 
 class COutPoint;
+class CScript;
 class CTransaction;
-class uint256;
 
 //! 20,000 items with fp rate < 0.1% or 10,000 items and <0.0001%
 static const unsigned int MAX_BLOOM_FILTER_SIZE = 36000; // bytes
@@ -30,6 +32,34 @@ enum bloomflags
     BLOOM_UPDATE_MASK = 3,
 };
 
+/**
+ * The data elements of a transaction which CBloomFilter::IsRelevantAndUpdate
+ * tests, extracted once so that many filters can be checked against them
+ * without re-parsing the scripts. Refers to tx, which must outlive it.
+ *
+ * The elements are stored back to back in one buffer, grouped per output
+ * (the nonempty data pushes of its scriptPubKey) and then per input (the
+ * serialized prevout followed by the nonempty data pushes of its scriptSig).
+ * Script parsing stops at the first opcode GetOp fails on.
+ */
+class CTxFilterElements
+{
+public:
+    const CTransaction* ptx;
+    uint256 hash;
+    std::vector<unsigned char> vData;
+    //! End offset in vData of each element
+    std::vector<uint32_t> vElementEnd;
+    //! Index in vElementEnd of the end of each output's, then each input's, elements
+    std::vector<uint32_t> vGroupEnd;
+
+    explicit CTxFilterElements(const CTransaction& tx);
+
+private:
+    void AddElement(const unsigned char* pbegin, const unsigned char* pend);
+    void AddScriptPushes(const CScript& script);
+};
+
 /**
  * BloomFilter is a probabilistic filter which SPV clients provide
  * so that we can filter the transactions we send them.
@@ -51,7 +81,8 @@ private:
     unsigned int nTweak;
     unsigned char nFlags;
 
-    unsigned int Hash(unsigned int nHashNum, const std::vector<unsigned char>& vDataToHash) const;
+    void insert(const unsigned char* pData, size_t nLen);
+    bool contains(const unsigned char* pData, size_t nLen) const;
 
     // Private constructor for CRollingBloomFilter, no restrictions on size
     CBloomFilter(unsigned int nElements, double nFPRate, unsigned int nTweak);
@@ -97,6 +128,8 @@ public:
 
     //! Also adds any outputs which match the filter to the filter (to match their spending txes)
     bool IsRelevantAndUpdate(const CTransaction& tx);
+    //! Same as above, on elements already extracted from the transaction
+    bool IsRelevantAndUpdate(const CTxFilterElements& elements);
 
     //! Checks for empty and full filters to avoid wasting cpu
     void UpdateEmptyFull();
@@ -12,6 +12,102 @@ extern "C" {
 #include "crypto/ctaes/ctaes.c"
 }
 
+#if defined(__x86_64__) && (defined(__clang__) || (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+#define USE_AESNI
+#include <cpuid.h>
+#include <wmmintrin.h>
+#endif
+
+#if defined(USE_AESNI)
+// AES-256 using the AES-NI instructions, selected at runtime. AES-NI runs in
+// constant time like ctaes, and is much faster at both the key schedule and
+// the block operations.
+namespace aesni {
+
+static bool Available()
+{
+    static const bool fAvailable = [] {
+        unsigned int eax, ebx, ecx, edx;
+        return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_AES);
+    }();
+    return fAvailable;
+}
+
+__attribute__((target("aes"))) static inline __m128i ExpandLow(__m128i a, __m128i b)
+{
+    b = _mm_shuffle_epi32(b, 0xff);
+    a = _mm_xor_si128(a, _mm_slli_si128(a, 4));
+    a = _mm_xor_si128(a, _mm_slli_si128(a, 4));
+    a = _mm_xor_si128(a, _mm_slli_si128(a, 4));
+    return _mm_xor_si128(a, b);
+}
+
+__attribute__((target("aes"))) static inline __m128i ExpandHigh(__m128i a, __m128i b)
+{
+    __m128i t = _mm_shuffle_epi32(_mm_aeskeygenassist_si128(a, 0x00), 0xaa);
+    b = _mm_xor_si128(b, _mm_slli_si128(b, 4));
+    b = _mm_xor_si128(b, _mm_slli_si128(b, 4));
+    b = _mm_xor_si128(b, _mm_slli_si128(b, 4));
+    return _mm_xor_si128(b, t);
+}
+
+#define AESNI_EXPAND_256(n, rcon)                                            \
+    a = ExpandLow(a, _mm_aeskeygenassist_si128(b, rcon));                    \
+    _mm_storeu_si128((__m128i*)(rk + 16 * (n)), a);                          \
+    if ((n) < 14) {                                                          \
+        b = ExpandHigh(a, b);                                                \
+        _mm_storeu_si128((__m128i*)(rk + 16 * ((n) + 1)), b);                \
+    }
+
+__attribute__((target("aes"))) static void ExpandKey256(unsigned char rk[240], const unsigned char key[32])
+{
+    __m128i a = _mm_loadu_si128((const __m128i*)key);
+    __m128i b = _mm_loadu_si128((const __m128i*)(key + 16));
+    _mm_storeu_si128((__m128i*)rk, a);
+    _mm_storeu_si128((__m128i*)(rk + 16), b);
+    AESNI_EXPAND_256(2, 0x01);
+    AESNI_EXPAND_256(4, 0x02);
+    AESNI_EXPAND_256(6, 0x04);
+    AESNI_EXPAND_256(8, 0x08);
+    AESNI_EXPAND_256(10, 0x10);
+    AESNI_EXPAND_256(12, 0x20);
+    AESNI_EXPAND_256(14, 0x40);
+}
+
+#undef AESNI_EXPAND_256
+
+/** Turn an encryption key schedule into one for the equivalent inverse cipher. */
+__attribute__((target("aes"))) static void InvertKey256(unsigned char rk[240])
+{
+    __m128i k[15];
+    for (int i = 0; i < 15; i++)
+        k[i] = _mm_loadu_si128((const __m128i*)(rk + 16 * i));
+    _mm_storeu_si128((__m128i*)rk, k[14]);
+    for (int i = 1; i < 14; i++)
+        _mm_storeu_si128((__m128i*)(rk + 16 * i), _mm_aesimc_si128(k[14 - i]));
+    _mm_storeu_si128((__m128i*)(rk + 16 * 14), k[0]);
+    memset(k, 0, sizeof(k));
+}
+
+__attribute__((target("aes"))) static void Encrypt256(const unsigned char rk[240], unsigned char out[16], const unsigned char in[16])
+{
+    __m128i x = _mm_xor_si128(_mm_loadu_si128((const __m128i*)in), _mm_loadu_si128((const __m128i*)rk));
+    for (int i = 1; i < 14; i++)
+        x = _mm_aesenc_si128(x, _mm_loadu_si128((const __m128i*)(rk + 16 * i)));
+    _mm_storeu_si128((__m128i*)out, _mm_aesenclast_si128(x, _mm_loadu_si128((const __m128i*)(rk + 16 * 14))));
+}
+
+__attribute__((target("aes"))) static void Decrypt256(const unsigned char rk[240], unsigned char out[16], const unsigned char in[16])
+{
+    __m128i x = _mm_xor_si128(_mm_loadu_si128((const __m128i*)in), _mm_loadu_si128((const __m128i*)rk));
+    for (int i = 1; i < 14; i++)
+        x = _mm_aesdec_si128(x, _mm_loadu_si128((const __m128i*)(rk + 16 * i)));
+    _mm_storeu_si128((__m128i*)out, _mm_aesdeclast_si128(x, _mm_loadu_si128((const __m128i*)(rk + 16 * 14))));
+}
+
+} // namespace aesni
+#endif
+
 AES128Encrypt::AES128Encrypt(const unsigned char key[16])
 {
     AES128_init(&ctx, key);
@@ -42,33 +138,62 @@ void AES128Decrypt::Decrypt(unsigned char plaintext[16], const unsigned char cip
     AES128_decrypt(&ctx, 1, plaintext, ciphertext);
 }
 
-AES256Encrypt::AES256Encrypt(const unsigned char key[32])
+AES256Encrypt::AES256Encrypt(const unsigned char key[32]) : fAESNI(false)
 {
+#if defined(USE_AESNI)
+    if (aesni::Available()) {
+        aesni::ExpandKey256(rk, key);
+        fAESNI = true;
+        return;
+    }
+#endif
     AES256_init(&ctx, key);
 }
 
 AES256Encrypt::~AES256Encrypt()
 {
     memset(&ctx, 0, sizeof(ctx));
+    memset(rk, 0, sizeof(rk));
 }
 
 void AES256Encrypt::Encrypt(unsigned char ciphertext[16], const unsigned char plaintext[16]) const
 {
+#if defined(USE_AESNI)
+    if (fAESNI) {
+        aesni::Encrypt256(rk, ciphertext, plaintext);
+        return;
+    }
+#endif
     AES256_encrypt(&ctx, 1, ciphertext, plaintext);
 }
 
-AES256Decrypt::AES256Decrypt(const unsigned char key[32])
+AES256Decrypt::AES256Decrypt(const unsigned char key[32]) : fAESNI(false)
 {
+#if defined(USE_AESNI)
+    if (aesni::Available()) {
+        aesni::ExpandKey256(rk, key);
+        aesni::InvertKey256(rk);
+        fAESNI = true;
+        return;
+    }
+#endif
     AES256_init(&ctx, key);
 }
 
 AES256Decrypt::~AES256Decrypt()
 {
     memset(&ctx, 0, sizeof(ctx));
+    memset(rk, 0, sizeof(rk));
 }
 
 void AES256Decrypt::Decrypt(unsigned char plaintext[16], const unsigned char ciphertext[16]) const
 {
+#if defined(USE_AESNI)
+    if (fAESNI) {
+        aesni::Decrypt256(rk, plaintext, ciphertext);
+        return;
+    }
+#endif
     AES256_decrypt(&ctx, 1, plaintext, ciphertext);
 }
 
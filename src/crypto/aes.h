@@ -44,6 +44,9 @@ class AES256Encrypt
 {
 private:
     AES256_ctx ctx;
+    //! Expanded round keys, used instead of ctx when the CPU has AES-NI
+    unsigned char rk[15 * AES_BLOCKSIZE];
+    bool fAESNI;
 
 public:
     AES256Encrypt(const unsigned char key[32]);
@@ -56,6 +59,9 @@ class AES256Decrypt
 {
 private:
     AES256_ctx ctx;
+    //! Expanded round keys, used instead of ctx when the CPU has AES-NI
+    unsigned char rk[15 * AES_BLOCKSIZE];
+    bool fAESNI;
 
 public:
     AES256Decrypt(const unsigned char key[32]);
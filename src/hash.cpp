@@ -7,62 +7,62 @@
 #include "crypto/hmac_sha512.h"
 #include "pubkey.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 
 inline uint32_t ROTL32(uint32_t x, int8_t r)
 {
     return (x << r) | (x >> (32 - r));
 }
 
-unsigned int MurmurHash3(unsigned int nHashSeed, const std::vector<unsigned char>& vDataToHash)
-{
-    // The following is MurmurHash3 (x86_32), see http://code.google.com/p/smhasher/source/browse/trunk/MurmurHash3.cpp
-    uint32_t h1 = nHashSeed;
-    if (vDataToHash.size() > 0)
-    {
-        const uint32_t c1 = 0xcc9e2d51;
-        const uint32_t c2 = 0x1b873593;
-
-        const int nblocks = vDataToHash.size() / 4;
-
-        //----------
-        // body
-        const uint8_t* blocks = &vDataToHash[0] + nblocks * 4;
+// The following is MurmurHash3 (x86_32), see http://code.google.com/p/smhasher/source/browse/trunk/MurmurHash3.cpp
+// The input words are mixed the same way whatever the seed, only the hash
+// state depends on it; MurmurHash3Multi shares the former between seeds.
 
-        for (int i = -nblocks; i; i++) {
-            uint32_t k1 = ReadLE32(blocks + i*4);
-
-            k1 *= c1;
-            k1 = ROTL32(k1, 15);
-            k1 *= c2;
+static inline uint32_t MurmurMixK(uint32_t k1)
+{
+    k1 *= 0xcc9e2d51;
+    k1 = ROTL32(k1, 15);
+    k1 *= 0x1b873593;
+    return k1;
+}
 
-            h1 ^= k1;
-            h1 = ROTL32(h1, 13);
-            h1 = h1 * 5 + 0xe6546b64;
-        }
+static inline uint32_t MurmurTailK(const unsigned char* pData, size_t nLen)
+{
+    const uint8_t* tail = pData + (nLen & ~(size_t)3);
+    uint32_t k1 = 0;
+    switch (nLen & 3) {
+    case 3:
+        k1 ^= tail[2] << 16;
+    case 2:
+        k1 ^= tail[1] << 8;
+    case 1:
+        k1 ^= tail[0];
+        return MurmurMixK(k1);
+    }
+    return 0;
+}
 
-        //----------
-        // tail
-        const uint8_t* tail = (const uint8_t*)(&vDataToHash[0] + nblocks * 4);
-
-        uint32_t k1 = 0;
-
-        switch (vDataToHash.size() & 3) {
-        case 3:
-            k1 ^= tail[2] << 16;
-        case 2:
-            k1 ^= tail[1] << 8;
-        case 1:
-            k1 ^= tail[0];
-            k1 *= c1;
-            k1 = ROTL32(k1, 15);
-            k1 *= c2;
-            h1 ^= k1;
-        }
+static uint32_t MurmurHash3(uint32_t h1, const unsigned char* pData, size_t nLen)
+{
+    //----------
+    // body
+    const size_t nblocks = nLen / 4;
+    for (size_t i = 0; i < nblocks; i++) {
+        h1 ^= MurmurMixK(ReadLE32(pData + i*4));
+        h1 = ROTL32(h1, 13);
+        h1 = h1 * 5 + 0xe6546b64;
     }
 
+    //----------
+    // tail
+    h1 ^= MurmurTailK(pData, nLen);
+
     //----------
     // finalization
-    h1 ^= vDataToHash.size();
+    h1 ^= nLen;
     h1 ^= h1 >> 16;
     h1 *= 0x85ebca6b;
     h1 ^= h1 >> 13;
@@ -72,6 +72,51 @@ unsigned int MurmurHash3(unsigned int nHashSeed, const std::vector<unsigned char
     return h1;
 }
 
+unsigned int MurmurHash3(unsigned int nHashSeed, const std::vector<unsigned char>& vDataToHash)
+{
+    return MurmurHash3(nHashSeed, vDataToHash.data(), vDataToHash.size());
+}
+
+#if defined(__SSE2__)
+// Low 32 bits of the products of each lane and n (SSE2 lacks pmulld)
+static inline __m128i MulLo32(__m128i a, uint32_t n)
+{
+    const __m128i b = _mm_set1_epi32(n);
+    const __m128i even = _mm_mul_epu32(a, b);
+    const __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), b);
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+#endif
+
+void MurmurHash3Multi(const uint32_t* pSeeds, unsigned int nSeeds, const unsigned char* pData, size_t nLen, uint32_t* pHashesOut)
+{
+    unsigned int i = 0;
+#if defined(__SSE2__)
+    const size_t nblocks = nLen / 4;
+    const __m128i kTail = _mm_set1_epi32(MurmurTailK(pData, nLen));
+    const __m128i kLen = _mm_set1_epi32(nLen);
+    for (; i + 4 <= nSeeds; i += 4) {
+        // Four seeds, one per lane
+        __m128i h = _mm_loadu_si128((const __m128i*)(pSeeds + i));
+        for (size_t j = 0; j < nblocks; j++) {
+            h = _mm_xor_si128(h, _mm_set1_epi32(MurmurMixK(ReadLE32(pData + j*4))));
+            h = _mm_or_si128(_mm_slli_epi32(h, 13), _mm_srli_epi32(h, 19));
+            h = _mm_add_epi32(_mm_add_epi32(_mm_slli_epi32(h, 2), h), _mm_set1_epi32(0xe6546b64));
+        }
+        h = _mm_xor_si128(h, kTail);
+        h = _mm_xor_si128(h, kLen);
+        h = _mm_xor_si128(h, _mm_srli_epi32(h, 16));
+        h = MulLo32(h, 0x85ebca6b);
+        h = _mm_xor_si128(h, _mm_srli_epi32(h, 13));
+        h = MulLo32(h, 0xc2b2ae35);
+        h = _mm_xor_si128(h, _mm_srli_epi32(h, 16));
+        _mm_storeu_si128((__m128i*)(pHashesOut + i), h);
+    }
+#endif
+    for (; i < nSeeds; i++)
+        pHashesOut[i] = MurmurHash3(pSeeds[i], pData, nLen);
+}
+
 void BIP32Hash(const ChainCode &chainCode, unsigned int nChild, unsigned char header, const unsigned char data[32], unsigned char output[64])
 {
     unsigned char num[4];
@@ -208,3 +253,56 @@ uint64_t SipHashUint256(uint64_t k0, uint64_t k1, const uint256& val)
     SIPROUND;
     return v0 ^ v1 ^ v2 ^ v3;
 }
+
+#define SIPROUND_LANES do { \
+    for (size_t l = 0; l < SIPHASH_BATCH_LANES; l++) { \
+        v0[l] += v1[l]; v1[l] = ROTL(v1[l], 13); v1[l] ^= v0[l]; \
+        v0[l] = ROTL(v0[l], 32); \
+        v2[l] += v3[l]; v3[l] = ROTL(v3[l], 16); v3[l] ^= v2[l]; \
+        v0[l] += v3[l]; v3[l] = ROTL(v3[l], 21); v3[l] ^= v0[l]; \
+        v2[l] += v1[l]; v1[l] = ROTL(v1[l], 17); v1[l] ^= v2[l]; \
+        v2[l] = ROTL(v2[l], 32); \
+    } \
+} while (0)
+
+void SipHashUint256Batch(uint64_t k0, uint64_t k1, const uint256* const vals[SIPHASH_BATCH_LANES], uint64_t out[SIPHASH_BATCH_LANES])
+{
+    /* Same steps as SipHashUint256, with every step applied to all lanes */
+    uint64_t v0[SIPHASH_BATCH_LANES], v1[SIPHASH_BATCH_LANES], v2[SIPHASH_BATCH_LANES], v3[SIPHASH_BATCH_LANES], d[SIPHASH_BATCH_LANES];
+
+    for (size_t l = 0; l < SIPHASH_BATCH_LANES; l++) {
+        d[l] = vals[l]->GetUint64(0);
+        v0[l] = 0x736f6d6570736575ULL ^ k0;
+        v1[l] = 0x646f72616e646f6dULL ^ k1;
+        v2[l] = 0x6c7967656e657261ULL ^ k0;
+        v3[l] = 0x7465646279746573ULL ^ k1 ^ d[l];
+    }
+    SIPROUND_LANES;
+    SIPROUND_LANES;
+    for (int i = 1; i < 4; i++) {
+        for (size_t l = 0; l < SIPHASH_BATCH_LANES; l++) {
+            v0[l] ^= d[l];
+            d[l] = vals[l]->GetUint64(i);
+            v3[l] ^= d[l];
+        }
+        SIPROUND_LANES;
+        SIPROUND_LANES;
+    }
+    for (size_t l = 0; l < SIPHASH_BATCH_LANES; l++) {
+        v0[l] ^= d[l];
+        v3[l] ^= ((uint64_t)4) << 59;
+    }
+    SIPROUND_LANES;
+    SIPROUND_LANES;
+    for (size_t l = 0; l < SIPHASH_BATCH_LANES; l++) {
+        v0[l] ^= ((uint64_t)4) << 59;
+        v2[l] ^= 0xFF;
+    }
+    SIPROUND_LANES;
+    SIPROUND_LANES;
+    SIPROUND_LANES;
+    SIPROUND_LANES;
+    for (size_t l = 0; l < SIPHASH_BATCH_LANES; l++) {
+        out[l] = v0[l] ^ v1[l] ^ v2[l] ^ v3[l];
+    }
+}
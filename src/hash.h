@@ -170,6 +170,10 @@ uint256 SerializeHash(const T& obj, int nType=SER_GETHASH, int nVersion=PROTOCOL
 }
 
 unsigned int MurmurHash3(unsigned int nHashSeed, const std::vector<unsigned char>& vDataToHash);
+/** MurmurHash3 of one data element under each of nSeeds seeds, as MurmurHash3(pSeeds[i], data)
+ *  would compute them. The input is mixed once for all seeds, which are hashed four at a
+ *  time in SSE2 lanes where available. */
+void MurmurHash3Multi(const uint32_t* pSeeds, unsigned int nSeeds, const unsigned char* pData, size_t nLen, uint32_t* pHashesOut);
 
 void BIP32Hash(const ChainCode &chainCode, unsigned int nChild, unsigned char header, const unsigned char data[32], unsigned char output[64]);
 
@@ -207,4 +211,15 @@ public:
  */
 uint64_t SipHashUint256(uint64_t k0, uint64_t k1, const uint256& val);
 
+/** Number of inputs SipHashUint256Batch hashes per call. */
+static const size_t SIPHASH_BATCH_LANES = 4;
+
+/** Compute SipHashUint256(k0, k1, *vals[i]) for SIPHASH_BATCH_LANES values.
+ *
+ *  The lanes are computed interleaved, one round at a time, so that the
+ *  independent dependency chains can execute in parallel (and be vectorized
+ *  by the compiler where the target supports it).
+ */
+void SipHashUint256Batch(uint64_t k0, uint64_t k1, const uint256* const vals[SIPHASH_BATCH_LANES], uint64_t out[SIPHASH_BATCH_LANES]);
+
 #endif // BITCOIN_HASH_H
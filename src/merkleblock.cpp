@@ -35,6 +35,42 @@ CMerkleBlock::CMerkleBlock(const CBlock& block, CBloomFilter& filter)
     txn = CPartialMerkleTree(vHashes, vMatch);
 }
 
+CMerkleBlock::CMerkleBlock(const CBlock& block, CBloomFilter& filter, const std::vector<CTxFilterElements>& vElements)
+{
+    assert(vElements.size() == block.vtx.size());
+    header = block.GetBlockHeader();
+
+    std::vector<bool> vMatch;
+    std::vector<uint256> vHashes;
+
+    vMatch.reserve(vElements.size());
+    vHashes.reserve(vElements.size());
+
+    for (unsigned int i = 0; i < vElements.size(); i++)
+    {
+        const uint256& hash = vElements[i].hash;
+        if (filter.IsRelevantAndUpdate(vElements[i]))
+        {
+            vMatch.push_back(true);
+            vMatchedTxn.push_back(std::make_pair(i, hash));
+        }
+        else
+            vMatch.push_back(false);
+        vHashes.push_back(hash);
+    }
+
+    txn = CPartialMerkleTree(vHashes, vMatch);
+}
+
+std::vector<CTxFilterElements> CMerkleBlock::GetBlockFilterElements(const CBlock& block)
+{
+    std::vector<CTxFilterElements> vElements;
+    vElements.reserve(block.vtx.size());
+    for (const CTransactionRef& tx : block.vtx)
+        vElements.emplace_back(*tx);
+    return vElements;
+}
+
 CMerkleBlock::CMerkleBlock(const CBlock& block, const std::set<uint256>& txids)
 {
     header = block.GetBlockHeader();
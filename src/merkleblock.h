@@ -140,11 +140,21 @@ public:
      */
     CMerkleBlock(const CBlock& block, CBloomFilter& filter);
 
+    /**
+     * Same as above, with the filter elements of each of block's transactions
+     * already extracted (see GetBlockFilterElements), so they can be shared
+     * between all the peers the block is filtered for.
+     */
+    CMerkleBlock(const CBlock& block, CBloomFilter& filter, const std::vector<CTxFilterElements>& vElements);
+
     // Create from a CBlock, matching the txids in the set
     CMerkleBlock(const CBlock& block, const std::set<uint256>& txids);
 
     CMerkleBlock() {}
 
+    //! The filter elements of each of block's transactions, in block order
+    static std::vector<CTxFilterElements> GetBlockFilterElements(const CBlock& block);
+
     ADD_SERIALIZE_METHODS;
 
     template <typename Stream, typename Operation>
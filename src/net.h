@@ -19,6 +19,7 @@
 #include "random.h"
 #include "streams.h"
 #include "sync.h"
+#include "txrelay.h"
 #include "uint256.h"
 #include "threadinterrupt.h"
 
@@ -27,6 +28,7 @@
 #include <stdint.h>
 #include <thread>
 #include <memory>
+#include <unordered_map>
 #include <condition_variable>
 
 #ifndef WIN32
@@ -90,6 +92,35 @@ static const size_t DEFAULT_MAXSENDBUFFER    = 1 * 1000;
 
 static const ServiceFlags REQUIRED_SERVICES = NODE_NETWORK;
 
+/** How the socket handler waits for sockets to become ready */
+enum SocketEventsMode
+{
+    //! select() over every socket, rebuilt each iteration; limited to FD_SETSIZE descriptors
+    SOCKETEVENTS_SELECT,
+    //! Edge-triggered epoll with sockets registered once, on Linux
+    SOCKETEVENTS_EPOLL,
+};
+#ifdef USE_EPOLL
+static const char* const DEFAULT_SOCKETEVENTS = "epoll";
+#else
+static const char* const DEFAULT_SOCKETEVENTS = "select";
+#endif
+/** Maximum time the socket handler waits for socket events, and interval of the inactivity checks (in milliseconds) */
+static const int SOCKET_HANDLER_INTERVAL = 50;
+/** Maximum number of socket events taken from epoll per wakeup */
+static const int MAX_EPOLL_EVENTS = 1024;
+/** -msghandlerthreads default, 0 = one per core */
+static const int DEFAULT_MSGHANDLER_THREADS = 0;
+/** Maximum number of message handler threads */
+static const int MAX_MSGHANDLER_THREADS = 16;
+/** Smallest and largest receive buffer kept for reuse by a connection; larger messages grow their buffer as they arrive */
+static const size_t MIN_POOLED_RECV_BUFFER = 256;
+static const size_t MAX_POOLED_RECV_BUFFER = 256 * 1024;
+/** Maximum total capacity of the receive buffers a connection keeps for reuse */
+static const size_t MAX_POOLED_RECV_BYTES = 512 * 1024;
+/** Maximum number of spent messages a connection keeps for reuse */
+static const size_t MAX_POOLED_RECV_MESSAGES = 256;
+
 // NOTE: When adjusting this, update rpcnet:setban's help ("24h")
 static const unsigned int DEFAULT_MISBEHAVING_BANTIME = 60 * 60 * 24;  // Default 24-hour ban
 
@@ -107,6 +138,16 @@ class CTransaction;
 class CNodeStats;
 class CClientUIInterface;
 
+/** A serialized message payload and its double-SHA256, built once and then
+ *  queued unmodified to any number of peers (e.g. a cached block) */
+struct CSharedNetPayload
+{
+    std::vector<unsigned char> data;
+    uint256 hash;
+
+    explicit CSharedNetPayload(std::vector<unsigned char>&& dataIn);
+};
+
 struct CSerializedNetMsg
 {
     CSerializedNetMsg() = default;
@@ -118,6 +159,24 @@ struct CSerializedNetMsg
 
     std::vector<unsigned char> data;
     std::string command;
+    //! If set, sent as the payload instead of data
+    std::shared_ptr<const CSharedNetPayload> payload;
+};
+
+/** A buffer queued in CNode::vSendMsg: bytes of its own, or a payload shared
+ *  with the send queues of other peers */
+class CNetSendBuffer
+{
+private:
+    std::vector<unsigned char> vchOwned;
+    std::shared_ptr<const CSharedNetPayload> payload;
+
+public:
+    explicit CNetSendBuffer(std::vector<unsigned char>&& vchIn) : vchOwned(std::move(vchIn)) {}
+    explicit CNetSendBuffer(std::shared_ptr<const CSharedNetPayload> payloadIn) : payload(std::move(payloadIn)) {}
+
+    const unsigned char* data() const { return payload ? payload->data.data() : vchOwned.data(); }
+    size_t size() const { return payload ? payload->data.size() : vchOwned.size(); }
 };
 
 
@@ -146,6 +205,8 @@ public:
         unsigned int nReceiveFloodSize = 0;
         uint64_t nMaxOutboundTimeframe = 0;
         uint64_t nMaxOutboundLimit = 0;
+        SocketEventsMode socketEventsMode = SOCKETEVENTS_SELECT;
+        int nMsgHandlerThreads = 1;
     };
     CConnman(uint64_t seed0, uint64_t seed1);
     ~CConnman();
@@ -287,6 +348,17 @@ public:
     unsigned int GetReceiveFloodSize() const;
 
     void WakeMessageHandler();
+
+    /** Announce a transaction to every peer, at their next trickle */
+    void RelayTransaction(const uint256& txid);
+    CTxRelayQueue& GetTxRelayQueue() { return txRelayQueue; }
+    /**
+     * Whether the next relay queue batch is due at nNow (microseconds), and if
+     * so schedule the one after it. Batches follow one Poisson timer shared by
+     * all peers, so peers drawing short trickle delays cannot cut them short;
+     * exactly one caller sees each one.
+     */
+    bool TxRelayBatchDue(int64_t nNow, int average_interval_seconds);
 private:
     struct ListenSocket {
         SOCKET socket;
@@ -298,8 +370,17 @@ private:
     void ThreadOpenAddedConnections();
     void ProcessOneShot();
     void ThreadOpenConnections();
-    void ThreadMessageHandler();
+    void ThreadMessageHandler(int nThread);
     void AcceptConnection(const ListenSocket& hListenSocket);
+    void AddNode(CNode* pnode);
+    void DisconnectNodes();
+    void NotifyNumConnectionsChanged(unsigned int& nPrevNodeCount);
+    bool SocketRecvData(CNode* pnode);
+    void InactivityCheck(CNode* pnode);
+    void SocketHandlerSelect();
+#ifdef USE_EPOLL
+    void SocketHandlerEpoll();
+#endif
     void ThreadSocketHandler();
     void ThreadDNSAddressSeed();
 
@@ -357,6 +438,17 @@ private:
     unsigned int nReceiveFloodSize;
 
     std::vector<ListenSocket> vhListenSocket;
+
+    SocketEventsMode socketEventsMode;
+#ifdef USE_EPOLL
+    int epollfd;
+    //! Nodes by id, for the socket events from epoll. Guarded by cs_vNodes.
+    std::unordered_map<NodeId, CNode*> mapEpollNodes;
+    //! Nodes whose socket may have more to read than the socket handler
+    //! took. Edge-triggered epoll will not report them again until new data
+    //! arrives. Only used by the socket handler thread.
+    std::set<CNode*> setNodesRecvReady;
+#endif
     std::atomic<bool> fNetworkActive;
     banmap_t setBanned;
     CCriticalSection cs_setBanned;
@@ -372,6 +464,11 @@ private:
     mutable CCriticalSection cs_vNodes;
     std::atomic<NodeId> nLastNodeId;
 
+    /** Transactions to announce, with each peer's position in CNode::nTxRelayCursor */
+    CTxRelayQueue txRelayQueue;
+    /** When the next relay queue batch is due, in microseconds */
+    std::atomic<int64_t> nNextTxRelayBatch;
+
     /** Services this instance offers */
     ServiceFlags nLocalServices;
 
@@ -390,8 +487,9 @@ private:
     /** SipHasher seeds for deterministic randomness */
     const uint64_t nSeed0, nSeed1;
 
-    /** flag for waking the message processor. */
-    bool fMsgProcWake;
+    /** Bumped to wake the message handler threads, which each sleep until it changes. */
+    uint64_t nMsgProcWake;
+    int nMsgHandlerThreads;
 
     std::condition_variable condMsgProc;
     std::mutex mutexMsgProc;
@@ -403,7 +501,7 @@ private:
     std::thread threadSocketHandler;
     std::thread threadOpenAddedConnections;
     std::thread threadOpenConnections;
-    std::thread threadMessageHandler;
+    std::vector<std::thread> threadMessageHandlers;
 };
 extern std::unique_ptr<CConnman> g_connman;
 void Discover(boost::thread_group& threadGroup);
@@ -522,7 +620,7 @@ private:
 public:
     bool in_data;                   // parsing header (false) or data (true)
 
-    CDataStream hdrbuf;             // partially received header
+    char hdrbuf[CMessageHeader::HEADER_SIZE]; // partially received header
     CMessageHeader hdr;             // complete header
     unsigned int nHdrPos;
 
@@ -531,14 +629,27 @@ public:
 
     int64_t nTime;                  // time (in microseconds) of message receipt.
 
-    CNetMessage(const CMessageHeader::MessageStartChars& pchMessageStartIn, int nTypeIn, int nVersionIn) : hdrbuf(nTypeIn, nVersionIn), hdr(pchMessageStartIn), vRecv(nTypeIn, nVersionIn) {
-        hdrbuf.resize(24);
+    CNetMessage(const CMessageHeader::MessageStartChars& pchMessageStartIn, int nTypeIn, int nVersionIn) : hdr(pchMessageStartIn), vRecv(nTypeIn, nVersionIn) {
         in_data = false;
         nHdrPos = 0;
         nDataPos = 0;
         nTime = 0;
     }
 
+    //! Start receiving a new message, keeping vRecv's buffer
+    void Reset(const CMessageHeader::MessageStartChars& pchMessageStartIn, int nTypeIn, int nVersionIn)
+    {
+        hasher.Reset();
+        data_hash.SetNull();
+        in_data = false;
+        hdr = CMessageHeader(pchMessageStartIn);
+        nHdrPos = 0;
+        vRecv.clear();
+        vRecv.Init(nTypeIn, nVersionIn);
+        nDataPos = 0;
+        nTime = 0;
+    }
+
     bool complete() const
     {
         if (!in_data)
@@ -550,7 +661,6 @@ public:
 
     void SetVersion(int nVersionIn)
     {
-        hdrbuf.SetVersion(nVersionIn);
         vRecv.SetVersion(nVersionIn);
     }
 
@@ -558,6 +668,46 @@ public:
     int readData(const char *pch, unsigned int nBytes);
 };
 
+/**
+ * Spent messages and receive buffers of a connection, kept so that receiving
+ * a message reuses them rather than allocating. Buffers are kept in
+ * power-of-two size classes from MIN_POOLED_RECV_BUFFER to
+ * MAX_POOLED_RECV_BUFFER.
+ */
+class CNetMessagePool
+{
+public:
+    CNetMessagePool() : nPooledBytes(0) {}
+
+    //! Append a message to msgs to receive into, reusing a spent one if any
+    void NewMessage(std::list<CNetMessage>& msgs, const CMessageHeader::MessageStartChars& pchMessageStart, int nType, int nVersion);
+    //! Size vRecv for a message of nSize bytes, from a pooled buffer if one fits
+    void PrepareBuffer(CDataStream& vRecv, size_t nSize);
+    //! Take back spent messages and their buffers, leaving msgs empty
+    void Recycle(std::list<CNetMessage>& msgs);
+
+private:
+    static const int NUM_BUFFER_CLASSES = 11;
+
+    CCriticalSection cs;
+    std::list<CNetMessage> spareMessages;
+    std::vector<CSerializeData> vBuffers[NUM_BUFFER_CLASSES];
+    size_t nPooledBytes;
+};
+
+/** Messages taken off a node's process queue, returned to its message pool when done with */
+class CNetMessageBatch
+{
+public:
+    std::list<CNetMessage> msgs;
+
+    explicit CNetMessageBatch(CNetMessagePool& poolIn) : pool(poolIn) {}
+    ~CNetMessageBatch() { pool.Recycle(msgs); }
+
+private:
+    CNetMessagePool& pool;
+};
+
 
 /** Information about a peer */
 class CNode
@@ -571,7 +721,7 @@ public:
     size_t nSendSize; // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes;
-    std::deque<std::vector<unsigned char>> vSendMsg;
+    std::deque<CNetSendBuffer> vSendMsg;
     CCriticalSection cs_vSend;
     CCriticalSection cs_hSocket;
     CCriticalSection cs_vRecv;
@@ -579,8 +729,12 @@ public:
     CCriticalSection cs_vProcessMsg;
     std::list<CNetMessage> vProcessMsg;
     size_t nProcessQueueSize;
+    CNetMessagePool recvPool;
 
     CCriticalSection cs_sendProcessing;
+    // Set while a message handler thread processes this peer, so that no
+    // other one does and its messages are handled in order.
+    std::atomic_bool fProcessingMsgs;
 
     std::deque<CInv> vRecvGetData;
     uint64_t nRecvBytes;
@@ -640,9 +794,9 @@ public:
 
     // inventory based relay
     CRollingBloomFilter filterInventoryKnown;
-    // Set of transaction ids we still have to announce.
-    // They are sorted by the mempool before relay, so the order is not important.
-    std::set<uint256> setInventoryTxToSend;
+    // Sequence number in the connman's transaction relay queue of the next
+    // transaction to consider announcing. Protected by cs_inventory.
+    uint64_t nTxRelayCursor;
     // List of block ids we still have announce.
     // There is no final sorting before sending, as they are always sent immediately
     // and in the order requested.
@@ -728,6 +882,9 @@ public:
     }
 
     bool ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete);
+    //! Move the complete messages received to the process queue, pausing
+    //! receiving once it holds more than nReceiveFloodSize bytes
+    void QueueReceivedMsgs(size_t nReceiveFloodSize);
 
     void SetRecvVersion(int nVersionIn)
     {
@@ -795,12 +952,9 @@ public:
 
     void PushInventory(const CInv& inv)
     {
+        // Transactions are announced through CConnman::RelayTransaction
         LOCK(cs_inventory);
-        if (inv.type == MSG_TX) {
-            if (!filterInventoryKnown.contains(inv.hash)) {
-                setInventoryTxToSend.insert(inv.hash);
-            }
-        } else if (inv.type == MSG_BLOCK) {
+        if (inv.type == MSG_BLOCK) {
             vInventoryBlockToSend.push_back(inv.hash);
         }
     }
@@ -8,6 +8,7 @@
 #include "addrman.h"
 #include "alert.h"
 #include "arith_uint256.h"
+#include "blockcache.h"
 #include "blockencodings.h"
 #include "chainparams.h"
 #include "consensus/validation.h"
@@ -106,6 +107,7 @@ namespace {
         const CBlockIndex* pindex;                               //!< Optional.
         bool fValidatedHeaders;                                  //!< Whether this block has validated headers at the time of request.
         std::unique_ptr<PartiallyDownloadedBlock> partialBlock;  //!< Optional, used for CMPCTBLOCK downloads
+        int64_t nTimeRequested;                                  //!< When the block was requested (in microseconds).
     };
     std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> > mapBlocksInFlight;
 
@@ -118,6 +120,9 @@ namespace {
     /** Number of peers from which we're downloading blocks. */
     int nPeersWithValidatedDownloads = 0;
 
+    /** Smoothed size of the blocks requested peers delivered, sizing the block download window. Protected by cs_main. */
+    int64_t nBlockDownloadBytesAvg = 0;
+
     /** Relay map, protected by cs_main. */
     typedef std::map<uint256, CTransactionRef> MapRelay;
     MapRelay mapRelay;
@@ -125,6 +130,33 @@ namespace {
     std::deque<std::pair<int64_t, MapRelay::iterator>> vRelayExpiration;
 } // anon namespace
 
+// Keep twice the blocks a peer delivers in a round trip in flight. While the
+// window is what limits the rate this doubles it every round trip, until the
+// peer's bandwidth does. Times in microseconds.
+int GetBlockRequestWindow(int64_t nRoundTripUsec, int64_t nIntervalUsec)
+{
+    int64_t nWindow = 2 * nRoundTripUsec / std::max<int64_t>(nIntervalUsec, 1) + 1;
+    return std::max<int64_t>(MAX_BLOCKS_IN_TRANSIT_PER_PEER, std::min<int64_t>(nWindow, MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER));
+}
+
+// How far ahead of the last common block to fetch: BLOCK_DOWNLOAD_WINDOW_BYTES
+// worth of blocks the size of those downloaded recently (0 if none yet).
+int GetBlockDownloadWindow(int64_t nBlockBytesAvg)
+{
+    if (nBlockBytesAvg <= 0)
+        return BLOCK_DOWNLOAD_WINDOW;
+    return std::max<int64_t>(BLOCK_DOWNLOAD_WINDOW, std::min<int64_t>(MAX_BLOCK_DOWNLOAD_WINDOW, BLOCK_DOWNLOAD_WINDOW_BYTES / nBlockBytesAvg));
+}
+
+// Time (in microseconds) a peer may hold back the download window before it
+// is disconnected: twice what its measured round trip and delivery rate need
+// to deliver the blocks it has in flight, within the stalling timeout bounds.
+int64_t GetBlockStallingTimeout(int64_t nRoundTripUsec, int64_t nIntervalUsec, int nBlocksInFlight)
+{
+    int64_t nTimeout = 2 * (nRoundTripUsec + nBlocksInFlight * nIntervalUsec);
+    return std::max<int64_t>(1000000 * BLOCK_STALLING_TIMEOUT, std::min<int64_t>(nTimeout, 1000000 * MAX_BLOCK_STALLING_TIMEOUT));
+}
+
 //////////////////////////////////////////////////////////////////////////////
 //
 // Registration of network node signals.
@@ -192,6 +224,17 @@ struct CNodeState {
     bool fHaveWitness;
     //! Whether this peer wants witnesses in cmpctblocks/blocktxns
     bool fWantsCmpctWitness;
+    //! Blocks that may be in flight from this peer at once, adapted to its delivery rate.
+    int nBlockWindow;
+    //! Shortest time from requesting a block to receiving it (in microseconds), or 0 before the first
+    //! block. Taken as the round trip time, as it excludes queueing behind other blocks.
+    int64_t nBlockRoundTripUsec;
+    //! Smoothed time between blocks delivered while requests were outstanding (in microseconds).
+    int64_t nBlockIntervalUsec;
+    //! Smoothed size of the blocks delivered, in bytes.
+    int64_t nBlockBytesAvg;
+    //! When the last requested block arrived (in microseconds).
+    int64_t nLastBlockReceived;
     /**
      * If we've announced NODE_WITNESS to this peer: whether the peer sends witnesses in cmpctblocks/blocktxns,
      * otherwise: whether this peer sends non-witnesses in cmpctblocks/blocktxns.
@@ -219,6 +262,11 @@ struct CNodeState {
         fHaveWitness = false;
         fWantsCmpctWitness = false;
         fSupportsDesiredCmpctVersion = false;
+        nBlockWindow = MAX_BLOCKS_IN_TRANSIT_PER_PEER;
+        nBlockRoundTripUsec = 0;
+        nBlockIntervalUsec = 0;
+        nBlockBytesAvg = 0;
+        nLastBlockReceived = 0;
     }
 };
 
@@ -271,6 +319,11 @@ void InitializeNode(CNode *pnode, CConnman& connman) {
         LOCK(cs_main);
         mapNodeState.emplace_hint(mapNodeState.end(), std::piecewise_construct, std::forward_as_tuple(nodeid), std::forward_as_tuple(addr, std::move(addrName)));
     }
+    {
+        // Only announce transactions relayed from now on
+        LOCK(pnode->cs_inventory);
+        pnode->nTxRelayCursor = connman.GetTxRelayQueue().GetEndSequence();
+    }
     if(!pnode->fInbound)
         PushNodeVersion(pnode, connman, GetTime());
 }
@@ -348,7 +401,7 @@ bool MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const Consensus::Pa
     MarkBlockAsReceived(hash);
 
     std::list<QueuedBlock>::iterator it = state->vBlocksInFlight.insert(state->vBlocksInFlight.end(),
-            {hash, pindex, pindex != NULL, std::unique_ptr<PartiallyDownloadedBlock>(pit ? new PartiallyDownloadedBlock(&mempool) : NULL)});
+            {hash, pindex, pindex != NULL, std::unique_ptr<PartiallyDownloadedBlock>(pit ? new PartiallyDownloadedBlock(&mempool) : NULL), GetTimeMicros()});
     state->nBlocksInFlight++;
     state->nBlocksInFlightValidHeaders += it->fValidatedHeaders;
     if (state->nBlocksInFlight == 1) {
@@ -364,6 +417,37 @@ bool MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const Consensus::Pa
     return true;
 }
 
+/** Exponentially smoothed average with a weight of 1/8 for the new sample. */
+int64_t SmoothedAverage(int64_t nAverage, int64_t nSample)
+{
+    return nAverage == 0 ? nSample : nAverage + (nSample - nAverage) / 8;
+}
+
+// Requires cs_main.
+// Measure how fast a peer delivers a block we requested from it, before it is
+// marked as received, and size the peer's block request window from that.
+void MarkBlockAsDelivered(NodeId nodeid, const uint256& hash, int64_t nBytes)
+{
+    std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
+    if (itInFlight == mapBlocksInFlight.end() || itInFlight->second.first != nodeid)
+        return;
+    CNodeState *state = State(nodeid);
+    const int64_t nNow = GetTimeMicros();
+    const int64_t nRequested = itInFlight->second.second->nTimeRequested;
+
+    const int64_t nRoundTrip = std::max<int64_t>(nNow - nRequested, 1);
+    if (state->nBlockRoundTripUsec == 0 || nRoundTrip < state->nBlockRoundTripUsec)
+        state->nBlockRoundTripUsec = nRoundTrip;
+    // The peer could only start sending this block once it was requested
+    // and the one before it was sent.
+    state->nBlockIntervalUsec = SmoothedAverage(state->nBlockIntervalUsec, std::max<int64_t>(nNow - std::max(nRequested, state->nLastBlockReceived), 1));
+    state->nBlockBytesAvg = SmoothedAverage(state->nBlockBytesAvg, nBytes);
+    state->nLastBlockReceived = nNow;
+    nBlockDownloadBytesAvg = SmoothedAverage(nBlockDownloadBytesAvg, nBytes);
+
+    state->nBlockWindow = GetBlockRequestWindow(state->nBlockRoundTripUsec, state->nBlockIntervalUsec);
+}
+
 /** Check whether the last unknown block a peer advertised is not yet known. */
 void ProcessBlockAvailability(NodeId nodeid) {
     CNodeState *state = State(nodeid);
@@ -499,10 +583,10 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<con
 
     std::vector<const CBlockIndex*> vToFetch;
     const CBlockIndex *pindexWalk = state->pindexLastCommonBlock;
-    // Never fetch further than the best block we know the peer has, or more than BLOCK_DOWNLOAD_WINDOW + 1 beyond the last
+    // Never fetch further than the best block we know the peer has, or more than the download window + 1 beyond the last
     // linked block we have in common with this peer. The +1 is so we can detect stalling, namely if we would be able to
     // download that next block if the window were 1 larger.
-    int nWindowEnd = state->pindexLastCommonBlock->nHeight + BLOCK_DOWNLOAD_WINDOW;
+    int nWindowEnd = state->pindexLastCommonBlock->nHeight + GetBlockDownloadWindow(nBlockDownloadBytesAvg);
     int nMaxHeight = std::min<int>(state->pindexBestKnownBlock->nHeight, nWindowEnd + 1);
     NodeId waitingfor = -1;
     while (pindexWalk->nHeight < nMaxHeight) {
@@ -569,6 +653,10 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
         if (queue.pindex)
             stats.vHeightInFlight.push_back(queue.pindex->nHeight);
     }
+    stats.nBlockWindow = state->nBlockWindow;
+    stats.nBlockRoundTripUsec = state->nBlockRoundTripUsec;
+    stats.nBlockIntervalUsec = state->nBlockIntervalUsec;
+    stats.nBlockBytesPerSec = state->nBlockIntervalUsec ? state->nBlockBytesAvg * 1000000 / state->nBlockIntervalUsec : 0;
     return true;
 }
 
@@ -795,6 +883,48 @@ static std::shared_ptr<const CBlock> most_recent_block;
 static std::shared_ptr<const CBlockHeaderAndShortTxIDs> most_recent_compact_block;
 static uint256 most_recent_block_hash;
 
+static CSerializedBlockCache blockServeCache;
+
+/** Number of recently filtered blocks whose filter elements are kept */
+static const size_t MAX_FILTERED_BLOCK_ELEMENTS = 16;
+
+/** A block with the filter elements of its transactions, which point into it */
+struct CBlockFilterElements
+{
+    std::shared_ptr<const CBlock> pblock;
+    std::vector<CTxFilterElements> vElements;
+};
+
+static CCriticalSection cs_filtered_block_elements;
+//! Most recently used last
+static std::deque<std::shared_ptr<const CBlockFilterElements>> filtered_block_elements;
+
+static std::shared_ptr<const CBlockFilterElements> FindBlockFilterElements(const uint256& hash)
+{
+    LOCK(cs_filtered_block_elements);
+    for (auto it = filtered_block_elements.begin(); it != filtered_block_elements.end(); ++it) {
+        if ((*it)->pblock->GetHash() == hash) {
+            std::shared_ptr<const CBlockFilterElements> elements = *it;
+            filtered_block_elements.erase(it);
+            filtered_block_elements.push_back(elements);
+            return elements;
+        }
+    }
+    return nullptr;
+}
+
+static std::shared_ptr<const CBlockFilterElements> AddBlockFilterElements(const std::shared_ptr<const CBlock>& pblock)
+{
+    std::shared_ptr<CBlockFilterElements> elements = std::make_shared<CBlockFilterElements>();
+    elements->pblock = pblock;
+    elements->vElements = CMerkleBlock::GetBlockFilterElements(*pblock);
+    LOCK(cs_filtered_block_elements);
+    filtered_block_elements.push_back(elements);
+    if (filtered_block_elements.size() > MAX_FILTERED_BLOCK_ELEMENTS)
+        filtered_block_elements.pop_front();
+    return elements;
+}
+
 void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std::shared_ptr<const CBlock>& pblock) {
     std::shared_ptr<const CBlockHeaderAndShortTxIDs> pcmpctblock = std::make_shared<const CBlockHeaderAndShortTxIDs> (*pblock, true);
     const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
@@ -940,11 +1070,7 @@ bool static AlreadyHave(const CInv& inv) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 
 static void RelayTransaction(const CTransaction& tx, CConnman& connman)
 {
-    CInv inv(MSG_TX, tx.GetHash());
-    connman.ForEachNode([&inv](CNode* pnode)
-    {
-        pnode->PushInventory(inv);
-    });
+    connman.RelayTransaction(tx.GetHash());
 }
 
 static void RelayAddress(const CAddress& addr, bool fReachable, CConnman& connman)
@@ -983,11 +1109,40 @@ static void RelayAddress(const CAddress& addr, bool fReachable, CConnman& connma
     connman.ForEachNodeThen(std::move(sortfunc), std::move(pushfunc));
 }
 
+/**
+ * Taken by the message handler threads around each message they process.
+ * SendMessages and the commands accepted by IsConcurrentCommand only change
+ * the state of the peer being served (which no other thread touches while it
+ * is being served) or state behind its own lock, so they hold it shared and
+ * run for different peers at once. Every other message may update other
+ * peers without a lock of theirs (addr relay, for one) and holds it
+ * exclusively. Always acquired before cs_main.
+ */
+static boost::shared_mutex cs_msgproc;
+
+static bool IsConcurrentCommand(const std::string& strCommand)
+{
+    return strCommand == NetMsgType::GETDATA || strCommand == NetMsgType::GETBLOCKS ||
+           strCommand == NetMsgType::GETHEADERS || strCommand == NetMsgType::GETADDR ||
+           strCommand == NetMsgType::PING || strCommand == NetMsgType::PONG;
+}
+
 void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParams, CConnman& connman, const std::atomic<bool>& interruptMsgProc)
 {
     std::deque<CInv>::iterator it = pfrom->vRecvGetData.begin();
     std::vector<CInv> vNotFound;
     const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
+
+    // The block to serve is chosen under cs_main, but read from disk and
+    // sent after releasing it, so other peers' requests are not held up
+    // behind the disk read and serialization.
+    CInv invBlock;
+    CDiskBlockPos posBlock;
+    bool fBlockWantsWitness = false;
+    bool fBlockSendCmpct = false;
+    uint256 hashBlockContinue;
+
+    {
     LOCK(cs_main);
 
     while (it != pfrom->vRecvGetData.end()) {
@@ -1054,66 +1209,20 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                 // it's available before trying to send.
                 if (send && (mi->second->nStatus & BLOCK_HAVE_DATA))
                 {
-                    // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second, consensusParams, false))
-                        assert(!"cannot load block from disk");
-                    if (inv.type == MSG_BLOCK)
-                        connman.PushMessage(pfrom, msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCK, block));
-                    else if (inv.type == MSG_WITNESS_BLOCK)
-                        connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCK, block));
-                    else if (inv.type == MSG_FILTERED_BLOCK)
-                    {
-                        bool sendMerkleBlock = false;
-                        CMerkleBlock merkleBlock;
-                        {
-                            LOCK(pfrom->cs_filter);
-                            if (pfrom->pfilter) {
-                                sendMerkleBlock = true;
-                                merkleBlock = CMerkleBlock(block, *pfrom->pfilter);
-                            }
-                        }
-                        if (sendMerkleBlock) {
-                            connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::MERKLEBLOCK, merkleBlock));
-                            // CMerkleBlock just contains hashes, so also push any transactions in the block the client did not see
-                            // This avoids hurting performance by pointlessly requiring a round-trip
-                            // Note that there is currently no way for a node to request any single transactions we didn't send here -
-                            // they must either disconnect and retry or request the full block.
-                            // Thus, the protocol spec specified allows for us to provide duplicate txn here,
-                            // however we MUST always provide at least what the remote peer needs
-                            typedef std::pair<unsigned int, uint256> PairType;
-                            BOOST_FOREACH(PairType& pair, merkleBlock.vMatchedTxn)
-                                connman.PushMessage(pfrom, msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::TX, *block.vtx[pair.first]));
-                        }
-                        // else
-                            // no response
-                    }
-                    else if (inv.type == MSG_CMPCT_BLOCK)
-                    {
+                    invBlock = inv;
+                    posBlock = mi->second->GetBlockPos();
+                    if (inv.type == MSG_CMPCT_BLOCK) {
                         // If a peer is asking for old blocks, we're almost guaranteed
                         // they won't have a useful mempool to match against a compact block,
                         // and we don't feel like constructing the object for them, so
                         // instead we respond with the full, non-compact block.
-                        bool fPeerWantsWitness = State(pfrom->GetId())->fWantsCmpctWitness;
-                        int nSendFlags = fPeerWantsWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS;
-                        if (CanDirectFetch(consensusParams) && mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH) {
-                            CBlockHeaderAndShortTxIDs cmpctblock(block, fPeerWantsWitness);
-                            connman.PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock));
-                        } else
-                            connman.PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::BLOCK, block));
+                        fBlockWantsWitness = State(pfrom->GetId())->fWantsCmpctWitness;
+                        fBlockSendCmpct = CanDirectFetch(consensusParams) && mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH;
                     }
 
                     // Trigger the peer node to send a getblocks request for the next batch of inventory
                     if (inv.hash == pfrom->hashContinue)
-                    {
-                        // Bypass PushInventory, this must send even if redundant,
-                        // and we want it right after the last block so they don't
-                        // wait for other stuff first.
-                        std::vector<CInv> vInv;
-                        vInv.push_back(CInv(MSG_BLOCK, chainActive.Tip()->GetBlockHash()));
-                        connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::INV, vInv));
-                        pfrom->hashContinue.SetNull();
-                    }
+                        hashBlockContinue = chainActive.Tip()->GetBlockHash();
                 }
             }
             else if (inv.type == MSG_TX || inv.type == MSG_WITNESS_TX)
@@ -1146,9 +1255,102 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                 break;
         }
     }
+    }
 
     pfrom->vRecvGetData.erase(pfrom->vRecvGetData.begin(), it);
 
+    if (!posBlock.IsNull())
+    {
+        // Full blocks are sent from the serialized block cache, shared with
+        // every other peer fetching them; only a miss loads the block
+        const bool fFullBlock = invBlock.type == MSG_BLOCK || invBlock.type == MSG_WITNESS_BLOCK || (invBlock.type == MSG_CMPCT_BLOCK && !fBlockSendCmpct);
+        const bool fWitness = invBlock.type == MSG_WITNESS_BLOCK || (invBlock.type == MSG_CMPCT_BLOCK && fBlockWantsWitness);
+        std::shared_ptr<const CSharedNetPayload> payload;
+        if (fFullBlock)
+            payload = blockServeCache.Get(invBlock.hash, fWitness);
+
+        std::shared_ptr<const CBlock> pblock;
+        // Filtered blocks are matched against the elements extracted from
+        // the block once for all the SPV peers asking for it
+        std::shared_ptr<const CBlockFilterElements> filterElements;
+        if (invBlock.type == MSG_FILTERED_BLOCK) {
+            filterElements = FindBlockFilterElements(invBlock.hash);
+            if (filterElements)
+                pblock = filterElements->pblock;
+        }
+        if (!payload && !pblock) {
+            LOCK(cs_most_recent_block);
+            if (most_recent_block_hash == invBlock.hash)
+                pblock = most_recent_block;
+        }
+        if (!payload && !pblock) {
+            // Send block from disk
+            std::shared_ptr<CBlock> pblockRead = std::make_shared<CBlock>();
+            if (ReadBlockFromDisk(*pblockRead, posBlock, consensusParams, false) && pblockRead->GetHash() == invBlock.hash) {
+                pblock = pblockRead;
+            } else {
+                // The block may have been pruned since cs_main was released;
+                // anything else is as fatal as it always was.
+                LOCK(cs_main);
+                BlockMap::iterator mi = mapBlockIndex.find(invBlock.hash);
+                if (mi == mapBlockIndex.end() || (mi->second->nStatus & BLOCK_HAVE_DATA))
+                    assert(!"cannot load block from disk");
+                LogPrint("net", "%s: block %s was pruned before it could be sent to peer=%d\n", __func__, invBlock.hash.ToString(), pfrom->GetId());
+            }
+        }
+
+        if (payload)
+            connman.PushMessage(pfrom, msgMaker.MakeShared(NetMsgType::BLOCK, payload));
+        else if (pblock && fFullBlock)
+            connman.PushMessage(pfrom, msgMaker.MakeShared(NetMsgType::BLOCK, blockServeCache.Add(invBlock.hash, *pblock, fWitness)));
+        else if (pblock && invBlock.type == MSG_FILTERED_BLOCK)
+        {
+            const CBlock& block = *pblock;
+            bool sendMerkleBlock = false;
+            CMerkleBlock merkleBlock;
+            {
+                LOCK(pfrom->cs_filter);
+                if (pfrom->pfilter) {
+                    sendMerkleBlock = true;
+                    if (!filterElements)
+                        filterElements = AddBlockFilterElements(pblock);
+                    merkleBlock = CMerkleBlock(block, *pfrom->pfilter, filterElements->vElements);
+                }
+            }
+            if (sendMerkleBlock) {
+                connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::MERKLEBLOCK, merkleBlock));
+                // CMerkleBlock just contains hashes, so also push any transactions in the block the client did not see
+                // This avoids hurting performance by pointlessly requiring a round-trip
+                // Note that there is currently no way for a node to request any single transactions we didn't send here -
+                // they must either disconnect and retry or request the full block.
+                // Thus, the protocol spec specified allows for us to provide duplicate txn here,
+                // however we MUST always provide at least what the remote peer needs
+                typedef std::pair<unsigned int, uint256> PairType;
+                BOOST_FOREACH(PairType& pair, merkleBlock.vMatchedTxn)
+                    connman.PushMessage(pfrom, msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::TX, *block.vtx[pair.first]));
+            }
+            // else
+                // no response
+        }
+        else if (pblock && invBlock.type == MSG_CMPCT_BLOCK)
+        {
+            int nSendFlags = fBlockWantsWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS;
+            CBlockHeaderAndShortTxIDs cmpctblock(*pblock, fBlockWantsWitness);
+            connman.PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock));
+        }
+
+        if (!hashBlockContinue.IsNull() && (payload || pblock))
+        {
+            // Bypass PushInventory, this must send even if redundant,
+            // and we want it right after the last block so they don't
+            // wait for other stuff first.
+            std::vector<CInv> vInv;
+            vInv.push_back(CInv(MSG_BLOCK, hashBlockContinue));
+            connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::INV, vInv));
+            pfrom->hashContinue.SetNull();
+        }
+    }
+
     if (!vNotFound.empty()) {
         // Let the peer know that we didn't find what it asked for, so it doesn't
         // have to wait around forever. Currently only SPV clients actually care
@@ -1645,6 +1847,8 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
             ActivateBestChain(dummy, Params(), a_recent_block);
         }
 
+        // Unlike getheaders this replies with block hashes queued for the next
+        // inv, so there is nothing worth moving out from under cs_main.
         LOCK(cs_main);
 
         // Find the last block the caller has in the main chain
@@ -1739,53 +1943,57 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         uint256 hashStop;
         vRecv >> locator >> hashStop;
 
-        LOCK(cs_main);
-        if (IsInitialBlockDownload() && !pfrom->fWhitelisted) {
-            LogPrint("net", "Ignoring getheaders from peer=%d because node is in initial block download\n", pfrom->id);
-            return true;
-        }
-
-        CNodeState *nodestate = State(pfrom->GetId());
-        const CBlockIndex* pindex = NULL;
-        if (locator.IsNull())
-        {
-            // If locator is null, return the hashStop block
-            BlockMap::iterator mi = mapBlockIndex.find(hashStop);
-            if (mi == mapBlockIndex.end())
-                return true;
-            pindex = (*mi).second;
-        }
-        else
-        {
-            // Find the last block the caller has in the main chain
-            pindex = FindForkInGlobalIndex(chainActive, locator);
-            if (pindex)
-                pindex = chainActive.Next(pindex);
-        }
-
         // we must use CBlocks, as CBlockHeaders won't include the 0x00 nTx count at the end
         std::vector<CBlock> vHeaders;
-        int nLimit = MAX_HEADERS_RESULTS;
-        LogPrint("net", "getheaders %d to %s from peer=%d\n", (pindex ? pindex->nHeight : -1), hashStop.IsNull() ? "end" : hashStop.ToString(), pfrom->id);
-        for (; pindex; pindex = chainActive.Next(pindex))
+        // The headers are collected under cs_main, but serialized and sent
+        // after releasing it.
         {
-            vHeaders.push_back(pindex->GetBlockHeader(chainparams.GetConsensus(pindex->nHeight), false));
-            if (--nLimit <= 0 || pindex->GetBlockHash() == hashStop)
-                break;
+            LOCK(cs_main);
+            if (IsInitialBlockDownload() && !pfrom->fWhitelisted) {
+                LogPrint("net", "Ignoring getheaders from peer=%d because node is in initial block download\n", pfrom->id);
+                return true;
+            }
+
+            CNodeState *nodestate = State(pfrom->GetId());
+            const CBlockIndex* pindex = NULL;
+            if (locator.IsNull())
+            {
+                // If locator is null, return the hashStop block
+                BlockMap::iterator mi = mapBlockIndex.find(hashStop);
+                if (mi == mapBlockIndex.end())
+                    return true;
+                pindex = (*mi).second;
+            }
+            else
+            {
+                // Find the last block the caller has in the main chain
+                pindex = FindForkInGlobalIndex(chainActive, locator);
+                if (pindex)
+                    pindex = chainActive.Next(pindex);
+            }
+
+            int nLimit = MAX_HEADERS_RESULTS;
+            LogPrint("net", "getheaders %d to %s from peer=%d\n", (pindex ? pindex->nHeight : -1), hashStop.IsNull() ? "end" : hashStop.ToString(), pfrom->id);
+            for (; pindex; pindex = chainActive.Next(pindex))
+            {
+                vHeaders.push_back(pindex->GetBlockHeader(chainparams.GetConsensus(pindex->nHeight), false));
+                if (--nLimit <= 0 || pindex->GetBlockHash() == hashStop)
+                    break;
+            }
+            // pindex can be NULL either if we sent chainActive.Tip() OR
+            // if our peer has chainActive.Tip() (and thus we are sending an empty
+            // headers message). In both cases it's safe to update
+            // pindexBestHeaderSent to be our tip.
+            //
+            // It is important that we simply reset the BestHeaderSent value here,
+            // and not max(BestHeaderSent, newHeaderSent). We might have announced
+            // the currently-being-connected tip using a compact block, which
+            // resulted in the peer sending a headers request, which we respond to
+            // without the new block. By resetting the BestHeaderSent, we ensure we
+            // will re-announce the new block via headers (or compact blocks again)
+            // in the SendMessages logic.
+            nodestate->pindexBestHeaderSent = pindex ? pindex : chainActive.Tip();
         }
-        // pindex can be NULL either if we sent chainActive.Tip() OR
-        // if our peer has chainActive.Tip() (and thus we are sending an empty
-        // headers message). In both cases it's safe to update
-        // pindexBestHeaderSent to be our tip.
-        //
-        // It is important that we simply reset the BestHeaderSent value here,
-        // and not max(BestHeaderSent, newHeaderSent). We might have announced
-        // the currently-being-connected tip using a compact block, which
-        // resulted in the peer sending a headers request, which we respond to
-        // without the new block. By resetting the BestHeaderSent, we ensure we
-        // will re-announce the new block via headers (or compact blocks again)
-        // in the SendMessages logic.
-        nodestate->pindexBestHeaderSent = pindex ? pindex : chainActive.Tip();
         connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::HEADERS, vHeaders));
     }
 
@@ -2060,9 +2268,11 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         }
 
         // We want to be a bit conservative just to be extra careful about DoS
-        // possibilities in compact block processing...
+        // possibilities in compact block processing... The height check bounds
+        // that; the peer's own window bounds what it may have in flight, so a
+        // peer we are downloading a lot from is not turned away here.
         if (pindex->nHeight <= chainActive.Height() + 2) {
-            if ((!fAlreadyInFlight && nodestate->nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) ||
+            if ((!fAlreadyInFlight && nodestate->nBlocksInFlight < nodestate->nBlockWindow) ||
                  (fAlreadyInFlight && blockInFlightIt->second.first == pfrom->GetId())) {
                 std::list<QueuedBlock>::iterator* queuedBlockIt = NULL;
                 if (!MarkBlockAsInFlight(pfrom->GetId(), pindex->GetBlockHash(), chainparams.GetConsensus(pindex->nHeight), pindex, &queuedBlockIt)) {
@@ -2373,7 +2583,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
                 std::vector<CInv> vGetData;
                 // Download as much as possible, from earliest to latest.
                 BOOST_REVERSE_FOREACH(const CBlockIndex *pindex, vToFetch) {
-                    if (nodestate->nBlocksInFlight >= MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+                    if (nodestate->nBlocksInFlight >= nodestate->nBlockWindow) {
                         // Can't download any more from this peer
                         break;
                     }
@@ -2401,6 +2611,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
 
     else if (strCommand == NetMsgType::BLOCK && !fImporting && !fReindex) // Ignore blocks received while importing
     {
+        const int64_t nBlockBytes = vRecv.size();
         std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
         vRecv >> *pblock;
 
@@ -2416,6 +2627,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
             LOCK(cs_main);
             // Also always process if we requested the block explicitly, as we may
             // need it even though it is not a candidate for a new best tip.
+            MarkBlockAsDelivered(pfrom->GetId(), hash, nBlockBytes);
             forceProcessing |= MarkBlockAsReceived(hash);
             // mapBlockSource is only used for sending reject messages and DoS scores,
             // so the race between here and cs_main in ProcessNewBlock is fine.
@@ -2715,8 +2927,10 @@ bool ProcessMessages(CNode* pfrom, CConnman& connman, const std::atomic<bool>& i
     //
     bool fMoreWork = false;
 
-    if (!pfrom->vRecvGetData.empty())
+    if (!pfrom->vRecvGetData.empty()) {
+        boost::shared_lock<boost::shared_mutex> lock(cs_msgproc);
         ProcessGetData(pfrom, chainparams.GetConsensus(chainActive.Height()), connman, interruptMsgProc);
+    }
 
     if (pfrom->fDisconnect)
         return false;
@@ -2728,18 +2942,19 @@ bool ProcessMessages(CNode* pfrom, CConnman& connman, const std::atomic<bool>& i
         if (pfrom->fPauseSend)
             return false;
 
-        std::list<CNetMessage> msgs;
+        // The message and its buffer go back to the peer's pool once processed
+        CNetMessageBatch batch(pfrom->recvPool);
         {
             LOCK(pfrom->cs_vProcessMsg);
             if (pfrom->vProcessMsg.empty())
                 return false;
             // Just take one message
-            msgs.splice(msgs.begin(), pfrom->vProcessMsg, pfrom->vProcessMsg.begin());
-            pfrom->nProcessQueueSize -= msgs.front().vRecv.size() + CMessageHeader::HEADER_SIZE;
+            batch.msgs.splice(batch.msgs.begin(), pfrom->vProcessMsg, pfrom->vProcessMsg.begin());
+            pfrom->nProcessQueueSize -= batch.msgs.front().vRecv.size() + CMessageHeader::HEADER_SIZE;
             pfrom->fPauseRecv = pfrom->nProcessQueueSize > connman.GetReceiveFloodSize();
             fMoreWork = !pfrom->vProcessMsg.empty();
         }
-        CNetMessage& msg(msgs.front());
+        CNetMessage& msg(batch.msgs.front());
 
         msg.SetVersion(pfrom->GetRecvVersion());
         // Scan for message start
@@ -2777,7 +2992,13 @@ bool ProcessMessages(CNode* pfrom, CConnman& connman, const std::atomic<bool>& i
         bool fRet = false;
         try
         {
-            fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime, chainparams, connman, interruptMsgProc);
+            if (IsConcurrentCommand(strCommand)) {
+                boost::shared_lock<boost::shared_mutex> lock(cs_msgproc);
+                fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime, chainparams, connman, interruptMsgProc);
+            } else {
+                boost::unique_lock<boost::shared_mutex> lock(cs_msgproc);
+                fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime, chainparams, connman, interruptMsgProc);
+            }
             if (interruptMsgProc)
                 return false;
             if (!pfrom->vRecvGetData.empty())
@@ -2822,25 +3043,9 @@ bool ProcessMessages(CNode* pfrom, CConnman& connman, const std::atomic<bool>& i
     return fMoreWork;
 }
 
-class CompareInvMempoolOrder
-{
-    CTxMemPool *mp;
-public:
-    CompareInvMempoolOrder(CTxMemPool *_mempool)
-    {
-        mp = _mempool;
-    }
-
-    bool operator()(std::set<uint256>::iterator a, std::set<uint256>::iterator b)
-    {
-        /* As std::make_heap produces a max-heap, we want the entries with the
-         * fewest ancestors/highest fee to sort later. */
-        return mp->CompareDepthAndScore(*b, *a);
-    }
-};
-
 bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interruptMsgProc)
 {
+    boost::shared_lock<boost::shared_mutex> lockMsgProc(cs_msgproc);
     const Consensus::Params& consensusParams = Params().GetConsensus(chainActive.Height());
     {
         // Don't send anything until the version handshake is complete
@@ -3118,6 +3323,13 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
             }
             pto->vInventoryBlockToSend.clear();
 
+            // Topologically and fee-rate sort the transactions relayed since
+            // the last batch, once for all peers, for privacy and priority
+            // reasons. Whoever finds the shared timer expired does it.
+            CTxRelayQueue& txRelayQueue = connman.GetTxRelayQueue();
+            if (connman.TxRelayBatchDue(nNow, INVENTORY_BROADCAST_INTERVAL))
+                txRelayQueue.MakeBatch(mempool, nNow / 1000000);
+
             // Check whether periodic sends should happen
             bool fSendTrickle = pto->fWhitelisted;
             if (pto->nNextInvSend < nNow) {
@@ -3129,7 +3341,7 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
             // Time to send but the peer has requested we not relay transactions.
             if (fSendTrickle) {
                 LOCK(pto->cs_filter);
-                if (!pto->fRelayTxes) pto->setInventoryTxToSend.clear();
+                if (!pto->fRelayTxes) pto->nTxRelayCursor = txRelayQueue.GetEndSequence();
             }
 
             // Respond to BIP35 mempool requests
@@ -3147,7 +3359,6 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
                 for (const auto& txinfo : vtxinfo) {
                     const uint256& hash = txinfo.tx->GetHash();
                     CInv inv(MSG_TX, hash);
-                    pto->setInventoryTxToSend.erase(hash);
                     if (filterrate) {
                         if (txinfo.feeRate.GetFeePerK() < filterrate)
                             continue;
@@ -3167,46 +3378,31 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
 
             // Determine transactions to relay
             if (fSendTrickle) {
-                // Produce a vector with all candidates for sending
-                std::vector<std::set<uint256>::iterator> vInvTx;
-                vInvTx.reserve(pto->setInventoryTxToSend.size());
-                for (std::set<uint256>::iterator it = pto->setInventoryTxToSend.begin(); it != pto->setInventoryTxToSend.end(); it++) {
-                    vInvTx.push_back(it);
-                }
                 CAmount filterrate = 0;
                 {
                     LOCK(pto->cs_feeFilter);
                     filterrate = pto->minFeeFilter;
                 }
-                // Topologically and fee-rate sort the inventory we send for privacy and priority reasons.
-                // A heap is used so that not all items need sorting if only a few are being sent.
-                CompareInvMempoolOrder compareInvMempoolOrder(&mempool);
-                std::make_heap(vInvTx.begin(), vInvTx.end(), compareInvMempoolOrder);
                 // No reason to drain out at many times the network's capacity,
                 // especially since we have many peers and some will draw much shorter delays.
                 unsigned int nRelayedTransactions = 0;
                 LOCK(pto->cs_filter);
-                while (!vInvTx.empty() && nRelayedTransactions < INVENTORY_BROADCAST_MAX) {
-                    // Fetch the top element from the heap
-                    std::pop_heap(vInvTx.begin(), vInvTx.end(), compareInvMempoolOrder);
-                    std::set<uint256>::iterator it = vInvTx.back();
-                    vInvTx.pop_back();
-                    uint256 hash = *it;
-                    // Remove it from the to-be-sent set
-                    pto->setInventoryTxToSend.erase(it);
+                txRelayQueue.ForEachFrom(pto->nTxRelayCursor, [&](const CTxRelayQueue::Entry& entry) {
+                    if (nRelayedTransactions >= INVENTORY_BROADCAST_MAX)
+                        return false;
+                    const uint256& hash = entry.tx->GetHash();
                     // Check if not in the filter already
                     if (pto->filterInventoryKnown.contains(hash)) {
-                        continue;
+                        return true;
                     }
-                    // Not in the mempool anymore? don't bother sending it.
-                    auto txinfo = mempool.info(hash);
-                    if (!txinfo.tx) {
-                        continue;
+                    if (filterrate && entry.nFeePerK < filterrate) {
+                        return true;
                     }
-                    if (filterrate && txinfo.feeRate.GetFeePerK() < filterrate) {
-                        continue;
+                    if (pto->pfilter && !pto->pfilter->IsRelevantAndUpdate(*entry.tx)) return true;
+                    // Mined, replaced or evicted since it was queued
+                    if (!mempool.exists(hash)) {
+                        return true;
                     }
-                    if (pto->pfilter && !pto->pfilter->IsRelevantAndUpdate(*txinfo.tx)) continue;
                     // Send
                     vInv.push_back(CInv(MSG_TX, hash));
                     nRelayedTransactions++;
@@ -3218,7 +3414,7 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
                             vRelayExpiration.pop_front();
                         }
 
-                        auto ret = mapRelay.insert(std::make_pair(hash, std::move(txinfo.tx)));
+                        auto ret = mapRelay.insert(std::make_pair(hash, entry.tx));
                         if (ret.second) {
                             vRelayExpiration.push_back(std::make_pair(nNow + 15 * 60 * 1000000, ret.first));
                         }
@@ -3228,7 +3424,8 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
                         vInv.clear();
                     }
                     pto->filterInventoryKnown.insert(hash);
-                }
+                    return true;
+                });
             }
         }
         if (!vInv.empty())
@@ -3236,7 +3433,7 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
 
         // Detect whether we're stalling
         nNow = GetTimeMicros();
-        if (state.nStallingSince && state.nStallingSince < nNow - 1000000 * BLOCK_STALLING_TIMEOUT) {
+        if (state.nStallingSince && state.nStallingSince < nNow - GetBlockStallingTimeout(state.nBlockRoundTripUsec, state.nBlockIntervalUsec, state.nBlocksInFlight)) {
             // Stalling only triggers when the block download window cannot move. During normal steady state,
             // the download window should be much larger than the to-be-downloaded set of blocks, so disconnection
             // should only happen during initial block download.
@@ -3263,10 +3460,10 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
         // Message: getdata (blocks)
         //
         std::vector<CInv> vGetData;
-        if (!pto->fClient && (fFetch || !IsInitialBlockDownload()) && state.nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+        if (!pto->fClient && (fFetch || !IsInitialBlockDownload()) && state.nBlocksInFlight < state.nBlockWindow) {
             std::vector<const CBlockIndex*> vToDownload;
             NodeId staller = -1;
-            FindNextBlocksToDownload(pto->GetId(), MAX_BLOCKS_IN_TRANSIT_PER_PEER - state.nBlocksInFlight, vToDownload, staller, consensusParams);
+            FindNextBlocksToDownload(pto->GetId(), state.nBlockWindow - state.nBlocksInFlight, vToDownload, staller, consensusParams);
             BOOST_FOREACH(const CBlockIndex *pindex, vToDownload) {
                 uint32_t nFetchFlags = GetFetchFlags(pto, pindex->pprev, consensusParams);
                 vGetData.push_back(CInv(MSG_BLOCK | nFetchFlags, pindex->GetBlockHash()));
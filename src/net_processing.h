@@ -41,6 +41,10 @@ struct CNodeStateStats {
     int nSyncHeight;
     int nCommonHeight;
     std::vector<int> vHeightInFlight;
+    int nBlockWindow;
+    int64_t nBlockRoundTripUsec;
+    int64_t nBlockIntervalUsec;
+    int64_t nBlockBytesPerSec;
 };
 
 /** Get statistics from node state */
@@ -29,6 +29,15 @@ public:
         return Make(0, std::move(sCommand), std::forward<Args>(args)...);
     }
 
+    //! A message whose payload was serialized in advance and may be shared
+    CSerializedNetMsg MakeShared(std::string sCommand, std::shared_ptr<const CSharedNetPayload> payload) const
+    {
+        CSerializedNetMsg msg;
+        msg.command = std::move(sCommand);
+        msg.payload = std::move(payload);
+        return msg;
+    }
+
 private:
     const int nVersion;
 };
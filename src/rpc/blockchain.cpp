@@ -1362,6 +1362,60 @@ UniValue getmempoolinfo(const JSONRPCRequest& request)
     return mempoolInfoToJSON();
 }
 
+UniValue mempoolFeeHistogramToJSON()
+{
+    const std::vector<FeeHistogramBucket> histogram = mempool.GetFeeHistogram();
+
+    // Report from the highest fee rate down, so that "cumulative_vsize" is the
+    // virtual size of all transactions paying at least "feerate".
+    UniValue buckets(UniValue::VARR);
+    uint64_t nCumulativeVSize = 0;
+    for (auto it = histogram.rbegin(); it != histogram.rend(); ++it) {
+        if (it->nCount == 0)
+            continue;
+        nCumulativeVSize += it->nVSize;
+        UniValue bucket(UniValue::VOBJ);
+        bucket.push_back(Pair("feerate", ValueFromAmount(it->nMinFeePerK)));
+        bucket.push_back(Pair("count", (int64_t)it->nCount));
+        bucket.push_back(Pair("vsize", (int64_t)it->nVSize));
+        bucket.push_back(Pair("cumulative_vsize", (int64_t)nCumulativeVSize));
+        buckets.push_back(bucket);
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("total_vsize", (int64_t)nCumulativeVSize));
+    ret.push_back(Pair("buckets", buckets));
+    return ret;
+}
+
+UniValue getmempoolfeehistogram(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 0)
+        throw runtime_error(
+            "getmempoolfeehistogram\n"
+            "\nReturns the virtual size of the TX memory pool bucketed by fee rate.\n"
+            "Transactions are bucketed by their own fee rate, ignoring prioritisetransaction deltas.\n"
+            "Only non-empty buckets are listed, highest fee rate first.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"total_vsize\": xxxxx,            (numeric) Sum of all virtual transaction sizes\n"
+            "  \"buckets\": [\n"
+            "    {\n"
+            "      \"feerate\": x.xxxx,           (numeric) Lowest fee rate in " + CURRENCY_UNIT + "/kB counted in this bucket\n"
+            "      \"count\": xxxxx,              (numeric) Number of transactions in this bucket\n"
+            "      \"vsize\": xxxxx,              (numeric) Sum of their virtual sizes\n"
+            "      \"cumulative_vsize\": xxxxx    (numeric) Virtual size of all transactions paying at least feerate\n"
+            "    }, ...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getmempoolfeehistogram", "")
+            + HelpExampleRpc("getmempoolfeehistogram", "")
+        );
+
+    return mempoolFeeHistogramToJSON();
+}
+
 UniValue preciousblock(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 1)
@@ -1490,6 +1544,7 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getmempooldescendants",  &getmempooldescendants,  true,  {"txid","verbose"} },
     { "blockchain",         "getmempoolentry",        &getmempoolentry,        true,  {"txid"} },
     { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         true,  {} },
+    { "blockchain",         "getmempoolfeehistogram", &getmempoolfeehistogram, true,  {} },
     { "blockchain",         "getrawmempool",          &getrawmempool,          true,  {"verbose"} },
     { "blockchain",         "gettxout",               &gettxout,               true,  {"txid","n","include_mempool"} },
     { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true,  {} },
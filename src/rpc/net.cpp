@@ -102,6 +102,10 @@ UniValue getpeerinfo(const JSONRPCRequest& request)
             "       n,                        (numeric) The heights of blocks we're currently asking from this peer\n"
             "       ...\n"
             "    ],\n"
+            "    \"blockwindow\": n,          (numeric) The number of blocks we ask from this peer at once\n"
+            "    \"blockroundtrip\": n,       (numeric) Shortest time between requesting a block and receiving it, in seconds (if measured)\n"
+            "    \"blockrate\": n,            (numeric) Blocks per second this peer delivers while we are downloading (if measured)\n"
+            "    \"blockbytespersec\": n,     (numeric) Bytes per second of blocks this peer delivers (if measured)\n"
             "    \"whitelisted\": true|false, (boolean) Whether the peer is whitelisted\n"					
             "    \"bytessent_per_msg\": {\n"
             "       \"addr\": n,              (numeric) The total bytes sent aggregated by message type\n"
@@ -166,6 +170,12 @@ UniValue getpeerinfo(const JSONRPCRequest& request)
                 heights.push_back(height);
             }
             obj.push_back(Pair("inflight", heights));
+            obj.push_back(Pair("blockwindow", statestats.nBlockWindow));
+            if (statestats.nBlockIntervalUsec > 0) {
+                obj.push_back(Pair("blockroundtrip", statestats.nBlockRoundTripUsec * 0.000001));
+                obj.push_back(Pair("blockrate", 1000000.0 / statestats.nBlockIntervalUsec));
+                obj.push_back(Pair("blockbytespersec", statestats.nBlockBytesPerSec));
+            }
         }
         obj.push_back(Pair("whitelisted", stats.fWhitelisted));
 
@@ -815,36 +815,55 @@ UniValue signrawtransaction(const JSONRPCRequest& request)
     UniValue vErrors(UniValue::VARR);
 
     // Use CTransaction for the constant parts of the
-    // transaction to avoid rehashing.
+    // transaction to avoid rehashing. Signature hashes do not cover other
+    // inputs' scripts, so every input can be signed against it.
     const CTransaction txConst(mergedTx);
-    // Sign what we can:
+    const PrecomputedTransactionData txdata(txConst, true);
+
+    // Look up the spent outputs first, the coins view is not thread safe
+    std::vector<const CTxOut*> vPrevOuts(mergedTx.vin.size(), NULL);
     for (unsigned int i = 0; i < mergedTx.vin.size(); i++) {
-        CTxIn& txin = mergedTx.vin[i];
+        const CTxIn& txin = mergedTx.vin[i];
         const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-        if (coins == NULL || !coins->IsAvailable(txin.prevout.n)) {
-            TxInErrorToJSON(txin, vErrors, "Input not found or already spent");
-            continue;
-        }
-        const CScript& prevPubKey = coins->vout[txin.prevout.n].scriptPubKey;
-        const CAmount& amount = coins->vout[txin.prevout.n].nValue;
+        if (coins != NULL && coins->IsAvailable(txin.prevout.n))
+            vPrevOuts[i] = &coins->vout[txin.prevout.n];
+    }
 
-        SignatureData sigdata;
+    // Sign what we can:
+    std::vector<SignatureData> vSigData(mergedTx.vin.size());
+    std::vector<ScriptError> vScriptErrors(mergedTx.vin.size(), SCRIPT_ERR_OK);
+    ForEachInputParallel(mergedTx.vin.size(), [&](unsigned int i) {
+        if (vPrevOuts[i] == NULL)
+            return;
+        const CScript& prevPubKey = vPrevOuts[i]->scriptPubKey;
+        const CAmount& amount = vPrevOuts[i]->nValue;
+
+        SignatureData& sigdata = vSigData[i];
         // Only sign SIGHASH_SINGLE if there's a corresponding output:
         if (!fHashSingle || (i < mergedTx.vout.size()))
-            ProduceSignature(MutableTransactionSignatureCreator(&keystore, &mergedTx, i, amount, nHashType), prevPubKey, sigdata);
+            ProduceSignature(TransactionSignatureCreator(&keystore, &txConst, i, amount, nHashType, txdata), prevPubKey, sigdata);
 
         // ... and merge in other signatures:
         BOOST_FOREACH(const CMutableTransaction& txv, txVariants) {
             if (txv.vin.size() > i) {
-                sigdata = CombineSignatures(prevPubKey, TransactionSignatureChecker(&txConst, i, amount), sigdata, DataFromTransaction(txv, i));
+                sigdata = CombineSignatures(prevPubKey, TransactionSignatureChecker(&txConst, i, amount, txdata), sigdata, DataFromTransaction(txv, i));
             }
         }
 
-        UpdateTransaction(mergedTx, i, sigdata);
+        VerifyScript(sigdata.scriptSig, prevPubKey, &sigdata.scriptWitness, STANDARD_SCRIPT_VERIFY_FLAGS, TransactionSignatureChecker(&txConst, i, amount, txdata), &vScriptErrors[i]);
+    });
+
+    for (unsigned int i = 0; i < mergedTx.vin.size(); i++) {
+        CTxIn& txin = mergedTx.vin[i];
+        if (vPrevOuts[i] == NULL) {
+            TxInErrorToJSON(txin, vErrors, "Input not found or already spent");
+            continue;
+        }
+
+        UpdateTransaction(mergedTx, i, vSigData[i]);
 
-        ScriptError serror = SCRIPT_ERR_OK;
-        if (!VerifyScript(txin.scriptSig, prevPubKey, &txin.scriptWitness, STANDARD_SCRIPT_VERIFY_FLAGS, TransactionSignatureChecker(&txConst, i, amount), &serror)) {
-            TxInErrorToJSON(txin, vErrors, ScriptErrorString(serror));
+        if (vScriptErrors[i] != SCRIPT_ERR_OK) {
+            TxInErrorToJSON(txin, vErrors, ScriptErrorString(vScriptErrors[i]));
         }
     }
     bool fComplete = vErrors.empty();
@@ -921,11 +940,7 @@ UniValue sendrawtransaction(const JSONRPCRequest& request)
     if(!g_connman)
         throw JSONRPCError(RPC_CLIENT_P2P_DISABLED, "Error: Peer-to-peer functionality missing or disabled");
 
-    CInv inv(MSG_TX, hashTx);
-    g_connman->ForEachNode([&inv](CNode* pnode)
-    {
-        pnode->PushInventory(inv);
-    });
+    g_connman->RelayTransaction(hashTx);
     return hashTx.GetHex();
 }
 
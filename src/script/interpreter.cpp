@@ -11,6 +11,7 @@
 #include "crypto/sha256.h"
 #include "pubkey.h"
 #include "script/script.h"
+#include "streams.h"
 #include "uint256.h"
 
 using namespace std;
@@ -1168,11 +1169,32 @@ uint256 GetOutputsHash(const CTransaction& txTo) {
 
 } // anon namespace
 
-PrecomputedTransactionData::PrecomputedTransactionData(const CTransaction& txTo)
+//! Size of an input serialized with a blanked script: prevout, empty script, nSequence
+static const size_t LEGACY_BLANK_INPUT_SIZE = 36 + 1 + 4;
+
+PrecomputedTransactionData::PrecomputedTransactionData(const CTransaction& txTo, bool fLegacyMidstates)
 {
     hashPrevouts = GetPrevoutHash(txTo);
     hashSequence = GetSequenceHash(txTo);
     hashOutputs = GetOutputsHash(txTo);
+
+    if (!fLegacyMidstates)
+        return;
+
+    CVectorWriter tail(SER_GETHASH, 0, vchLegacyTail, 0);
+    for (unsigned int n = 0; n < txTo.vin.size(); n++)
+        tail << txTo.vin[n].prevout << CScriptBase() << txTo.vin[n].nSequence;
+    assert(vchLegacyTail.size() == txTo.vin.size() * LEGACY_BLANK_INPUT_SIZE);
+    tail << txTo.vout << txTo.nLockTime;
+
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << txTo.nVersion;
+    ::WriteCompactSize(ss, txTo.vin.size());
+    vLegacyMidstates.reserve(txTo.vin.size());
+    for (unsigned int n = 0; n < txTo.vin.size(); n++) {
+        vLegacyMidstates.push_back(ss);
+        ss.write((const char*)&vchLegacyTail[n * LEGACY_BLANK_INPUT_SIZE], LEGACY_BLANK_INPUT_SIZE);
+    }
 }
 
 uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, const CAmount& amount, SigVersion sigversion, const PrecomputedTransactionData* cache)
@@ -1239,6 +1261,18 @@ uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsig
     // Wrapper to serialize only the necessary parts of the transaction being signed
     CTransactionSignatureSerializer txTmp(txTo, scriptCode, nIn, nHashType);
 
+    // Everything but the input being signed serializes the same for all
+    // inputs with these hash types, so resume from the precomputed state.
+    if (cache && nIn < cache->vLegacyMidstates.size() && !(nHashType & SIGHASH_ANYONECANPAY) &&
+        (nHashType & 0x1f) != SIGHASH_SINGLE && (nHashType & 0x1f) != SIGHASH_NONE) {
+        CHashWriter ss(cache->vLegacyMidstates[nIn]);
+        txTmp.SerializeInput(ss, nIn);
+        const size_t nTailStart = (nIn + 1) * LEGACY_BLANK_INPUT_SIZE;
+        ss.write((const char*)cache->vchLegacyTail.data() + nTailStart, cache->vchLegacyTail.size() - nTailStart);
+        ss << nHashType;
+        return ss.GetHash();
+    }
+
     // Serialize and hash
     CHashWriter ss(SER_GETHASH, 0);
     ss << txTmp << nHashType;
@@ -6,6 +6,7 @@
 #ifndef BITCOIN_SCRIPT_INTERPRETER_H
 #define BITCOIN_SCRIPT_INTERPRETER_H
 
+#include "hash.h"
 #include "script_error.h"
 #include "primitives/transaction.h"
 
@@ -114,7 +115,19 @@ struct PrecomputedTransactionData
 {
     uint256 hashPrevouts, hashSequence, hashOutputs;
 
-    PrecomputedTransactionData(const CTransaction& tx);
+    /**
+     * Shared parts of the non-witness SIGHASH_ALL signature hashes, only
+     * filled in when asked for as validation has no use for them. The hash
+     * state after the version, input count and the first n inputs with their
+     * scripts blanked out, for each n, and the serialization of all blanked
+     * inputs followed by the outputs and locktime. Each signature hash then
+     * only has to add its own input and the tail after it, instead of
+     * serializing the whole transaction again.
+     */
+    std::vector<CHashWriter> vLegacyMidstates;
+    std::vector<unsigned char> vchLegacyTail;
+
+    PrecomputedTransactionData(const CTransaction& tx, bool fLegacyMidstates = false);
 };
 
 enum SigVersion
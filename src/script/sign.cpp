@@ -11,6 +11,11 @@
 #include "primitives/transaction.h"
 #include "script/standard.h"
 #include "uint256.h"
+#include "util.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
 
 #include <boost/foreach.hpp>
 
@@ -18,7 +23,9 @@ using namespace std;
 
 typedef std::vector<unsigned char> valtype;
 
-TransactionSignatureCreator::TransactionSignatureCreator(const CKeyStore* keystoreIn, const CTransaction* txToIn, unsigned int nInIn, const CAmount& amountIn, int nHashTypeIn) : BaseSignatureCreator(keystoreIn), txTo(txToIn), nIn(nInIn), nHashType(nHashTypeIn), amount(amountIn), checker(txTo, nIn, amountIn) {}
+TransactionSignatureCreator::TransactionSignatureCreator(const CKeyStore* keystoreIn, const CTransaction* txToIn, unsigned int nInIn, const CAmount& amountIn, int nHashTypeIn) : BaseSignatureCreator(keystoreIn), txTo(txToIn), nIn(nInIn), nHashType(nHashTypeIn), amount(amountIn), txdata(NULL), checker(txTo, nIn, amountIn) {}
+
+TransactionSignatureCreator::TransactionSignatureCreator(const CKeyStore* keystoreIn, const CTransaction* txToIn, unsigned int nInIn, const CAmount& amountIn, int nHashTypeIn, const PrecomputedTransactionData& txdataIn) : BaseSignatureCreator(keystoreIn), txTo(txToIn), nIn(nInIn), nHashType(nHashTypeIn), amount(amountIn), txdata(&txdataIn), checker(txTo, nIn, amountIn, txdataIn) {}
 
 bool TransactionSignatureCreator::CreateSig(std::vector<unsigned char>& vchSig, const CKeyID& address, const CScript& scriptCode, SigVersion sigversion) const
 {
@@ -30,13 +37,43 @@ bool TransactionSignatureCreator::CreateSig(std::vector<unsigned char>& vchSig,
     if (sigversion == SIGVERSION_WITNESS_V0 && !key.IsCompressed())
         return false;
 
-    uint256 hash = SignatureHash(scriptCode, *txTo, nIn, nHashType, amount, sigversion);
+    uint256 hash = SignatureHash(scriptCode, *txTo, nIn, nHashType, amount, sigversion, txdata);
     if (!key.Sign(hash, vchSig))
         return false;
     vchSig.push_back((unsigned char)nHashType);
     return true;
 }
 
+void ForEachInputParallel(unsigned int nInputs, const std::function<void(unsigned int)>& fn, std::vector<int64_t>* pvInputTimes)
+{
+    const int64_t nTimeStart = GetTimeMicros();
+    std::vector<int64_t> vTimes(nInputs);
+    std::atomic<unsigned int> nNext(0);
+    auto worker = [&]() {
+        for (unsigned int nIn = nNext++; nIn < nInputs; nIn = nNext++) {
+            const int64_t nInputStart = GetTimeMicros();
+            fn(nIn);
+            vTimes[nIn] = GetTimeMicros() - nInputStart;
+        }
+    };
+
+    const int nThreads = nInputs < MIN_PARALLEL_SIGNING_INPUTS ? 1 : std::max(1, std::min(GetNumCores(), MAX_SIGNING_THREADS));
+    std::vector<std::thread> vThreads;
+    for (int i = 1; i < nThreads; i++)
+        vThreads.emplace_back(worker);
+    worker();
+    for (std::thread& thread : vThreads)
+        thread.join();
+
+    if (nInputs > 0) {
+        const unsigned int nSlowest = std::max_element(vTimes.begin(), vTimes.end()) - vTimes.begin();
+        LogPrint("bench", "Signed %u inputs on %d threads: %.2fms (slowest input %u: %.2fms)\n", nInputs, nThreads,
+                 0.001 * (GetTimeMicros() - nTimeStart), nSlowest, 0.001 * vTimes[nSlowest]);
+    }
+    if (pvInputTimes)
+        pvInputTimes->swap(vTimes);
+}
+
 static bool Sign1(const CKeyID& address, const BaseSignatureCreator& creator, const CScript& scriptCode, std::vector<valtype>& ret, SigVersion sigversion)
 {
     vector<unsigned char> vchSig;
@@ -8,6 +8,8 @@
 
 #include "script/interpreter.h"
 
+#include <functional>
+
 class CKeyID;
 class CKeyStore;
 class CScript;
@@ -15,6 +17,11 @@ class CTransaction;
 
 struct CMutableTransaction;
 
+//! Maximum number of threads signing the inputs of one transaction
+static const int MAX_SIGNING_THREADS = 8;
+//! Transactions with fewer inputs are signed on the calling thread
+static const unsigned int MIN_PARALLEL_SIGNING_INPUTS = 16;
+
 /** Virtual base class for signature creators. */
 class BaseSignatureCreator {
 protected:
@@ -36,10 +43,12 @@ class TransactionSignatureCreator : public BaseSignatureCreator {
     unsigned int nIn;
     int nHashType;
     CAmount amount;
+    const PrecomputedTransactionData* txdata;
     const TransactionSignatureChecker checker;
 
 public:
     TransactionSignatureCreator(const CKeyStore* keystoreIn, const CTransaction* txToIn, unsigned int nInIn, const CAmount& amountIn, int nHashTypeIn=SIGHASH_ALL);
+    TransactionSignatureCreator(const CKeyStore* keystoreIn, const CTransaction* txToIn, unsigned int nInIn, const CAmount& amountIn, int nHashTypeIn, const PrecomputedTransactionData& txdataIn);
     const BaseSignatureChecker& Checker() const { return checker; }
     bool CreateSig(std::vector<unsigned char>& vchSig, const CKeyID& keyid, const CScript& scriptCode, SigVersion sigversion) const;
 };
@@ -70,6 +79,15 @@ struct SignatureData {
 /** Produce a script signature using a generic signature creator. */
 bool ProduceSignature(const BaseSignatureCreator& creator, const CScript& scriptPubKey, SignatureData& sigdata);
 
+/**
+ * Call fn(nIn) for each input of a transaction with nInputs inputs, spread
+ * over up to MAX_SIGNING_THREADS threads, and log the time taken and the
+ * slowest input under -debug=bench. fn may only modify state belonging to
+ * its own input. If pvInputTimes is given it receives the time each input
+ * took, in microseconds.
+ */
+void ForEachInputParallel(unsigned int nInputs, const std::function<void(unsigned int)>& fn, std::vector<int64_t>* pvInputTimes = NULL);
+
 /** Produce a script signature for a transaction. */
 bool SignSignature(const CKeyStore &keystore, const CScript& fromPubKey, CMutableTransaction& txTo, unsigned int nIn, const CAmount& amount, int nHashType);
 bool SignSignature(const CKeyStore& keystore, const CTransaction& txFrom, CMutableTransaction& txTo, unsigned int nIn, int nHashType);
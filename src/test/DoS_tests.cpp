@@ -33,6 +33,9 @@ struct COrphanTx {
     int64_t nTimeExpire;
 };
 extern std::map<uint256, COrphanTx> mapOrphanTransactions;
+extern int GetBlockRequestWindow(int64_t nRoundTripUsec, int64_t nIntervalUsec);
+extern int GetBlockDownloadWindow(int64_t nBlockBytesAvg);
+extern int64_t GetBlockStallingTimeout(int64_t nRoundTripUsec, int64_t nIntervalUsec, int nBlocksInFlight);
 
 CService ip(uint32_t i)
 {
@@ -215,4 +218,40 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
     BOOST_CHECK(mapOrphanTransactions.empty());
 }
 
+BOOST_AUTO_TEST_CASE(block_download_windows)
+{
+    // A peer's request window stays between 16 and 1024 blocks
+    BOOST_CHECK_EQUAL(GetBlockRequestWindow(0, 0), MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+    BOOST_CHECK_EQUAL(GetBlockRequestWindow(100000, 100000), MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+    BOOST_CHECK_EQUAL(GetBlockRequestWindow(1000000, 100), MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER);
+
+    // A peer limited by its window delivers the whole window every round
+    // trip, so the window doubles each round trip...
+    const int64_t nRoundTrip = 200000;
+    const int64_t nMinInterval = 500;
+    int nWindow = MAX_BLOCKS_IN_TRANSIT_PER_PEER;
+    for (int i = 0; i < 5; i++) {
+        int nNext = GetBlockRequestWindow(nRoundTrip, std::max(nRoundTrip / nWindow, nMinInterval));
+        BOOST_CHECK_EQUAL(nNext, 2 * nWindow + 1);
+        nWindow = nNext;
+    }
+    // ...until the peer's bandwidth limits it, and it settles at twice the
+    // bandwidth-delay product
+    for (int i = 0; i < 2; i++) {
+        nWindow = GetBlockRequestWindow(nRoundTrip, std::max(nRoundTrip / nWindow, nMinInterval));
+        BOOST_CHECK_EQUAL(nWindow, 2 * nRoundTrip / nMinInterval + 1);
+    }
+
+    // The download window spans BLOCK_DOWNLOAD_WINDOW_BYTES of blocks, within its bounds
+    BOOST_CHECK_EQUAL(GetBlockDownloadWindow(0), (int)BLOCK_DOWNLOAD_WINDOW);
+    BOOST_CHECK_EQUAL(GetBlockDownloadWindow(BLOCK_DOWNLOAD_WINDOW_BYTES / 2048), 2048);
+    BOOST_CHECK_EQUAL(GetBlockDownloadWindow(1000000), (int)BLOCK_DOWNLOAD_WINDOW);
+    BOOST_CHECK_EQUAL(GetBlockDownloadWindow(200), (int)MAX_BLOCK_DOWNLOAD_WINDOW);
+
+    // The stalling timeout covers twice what the blocks in flight take, within its bounds
+    BOOST_CHECK_EQUAL(GetBlockStallingTimeout(0, 0, 0), 1000000 * (int64_t)BLOCK_STALLING_TIMEOUT);
+    BOOST_CHECK_EQUAL(GetBlockStallingTimeout(200000, 2000, 1000), 4400000);
+    BOOST_CHECK_EQUAL(GetBlockStallingTimeout(200000, 10000, 1000), 1000000 * (int64_t)MAX_BLOCK_STALLING_TIMEOUT);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,108 @@
+// Copyright (c) 2017 The Prux Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockcache.h"
+#include "hash.h"
+#include "primitives/block.h"
+#include "random.h"
+#include "streams.h"
+#include "version.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockcache_tests, BasicTestingSetup)
+
+// A block of two transactions, the second one with witness data
+static CBlock BuildCacheTestBlock()
+{
+    CBlock block;
+    block.nVersion = 1;
+    block.hashPrevBlock = GetRandHash();
+    block.nBits = 0x207fffff;
+
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig.resize(10);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 42;
+    block.vtx.push_back(MakeTransactionRef(tx));
+
+    tx.vin[0].prevout.hash = GetRandHash();
+    tx.vin[0].prevout.n = 0;
+    tx.vin[0].scriptWitness.stack.push_back(std::vector<unsigned char>(72, 1));
+    block.vtx.push_back(MakeTransactionRef(tx));
+    return block;
+}
+
+static std::vector<unsigned char> SerializeForPeer(const CBlock& block, bool fWitness)
+{
+    std::vector<unsigned char> vch;
+    CVectorWriter{SER_NETWORK, PROTOCOL_VERSION | (fWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS), vch, 0, block};
+    return vch;
+}
+
+BOOST_AUTO_TEST_CASE(blockcache_payloads)
+{
+    CSerializedBlockCache cache;
+    CBlock block = BuildCacheTestBlock();
+    uint256 hash = block.GetHash();
+
+    BOOST_CHECK(!cache.Get(hash, true));
+    BOOST_CHECK(!cache.Get(hash, false));
+
+    std::shared_ptr<const CSharedNetPayload> payloadWitness = cache.Add(hash, block, true);
+    std::shared_ptr<const CSharedNetPayload> payloadNoWitness = cache.Add(hash, block, false);
+    BOOST_CHECK(payloadWitness->data == SerializeForPeer(block, true));
+    BOOST_CHECK(payloadNoWitness->data == SerializeForPeer(block, false));
+    BOOST_CHECK(payloadWitness->data.size() > payloadNoWitness->data.size());
+    BOOST_CHECK(payloadWitness->hash == Hash(payloadWitness->data.begin(), payloadWitness->data.end()));
+    BOOST_CHECK(payloadNoWitness->hash == Hash(payloadNoWitness->data.begin(), payloadNoWitness->data.end()));
+
+    // Every request is served the same buffer
+    BOOST_CHECK(cache.Get(hash, true) == payloadWitness);
+    BOOST_CHECK(cache.Get(hash, false) == payloadNoWitness);
+    BOOST_CHECK(cache.Add(hash, block, true) == payloadWitness);
+    BOOST_CHECK_EQUAL(cache.Count(), 2U);
+    BOOST_CHECK_EQUAL(cache.Bytes(), payloadWitness->data.size() + payloadNoWitness->data.size());
+}
+
+BOOST_AUTO_TEST_CASE(blockcache_eviction)
+{
+    std::vector<CBlock> vBlocks;
+    for (int i = 0; i < 4; i++)
+        vBlocks.push_back(BuildCacheTestBlock());
+    const size_t nBlockSize = SerializeForPeer(vBlocks[0], true).size();
+
+    // Room for three blocks
+    CSerializedBlockCache cache(nBlockSize * 3);
+    for (int i = 0; i < 3; i++)
+        cache.Add(vBlocks[i].GetHash(), vBlocks[i], true);
+    BOOST_CHECK_EQUAL(cache.Count(), 3U);
+
+    // Using the first and third block leaves the second least recently used
+    std::shared_ptr<const CSharedNetPayload> payloadEvicted = cache.Get(vBlocks[1].GetHash(), true);
+    BOOST_CHECK(payloadEvicted);
+    cache.Get(vBlocks[0].GetHash(), true);
+    cache.Get(vBlocks[2].GetHash(), true);
+    cache.Add(vBlocks[3].GetHash(), vBlocks[3], true);
+    BOOST_CHECK_EQUAL(cache.Count(), 3U);
+    BOOST_CHECK_EQUAL(cache.Bytes(), nBlockSize * 3);
+    BOOST_CHECK(cache.Get(vBlocks[0].GetHash(), true));
+    BOOST_CHECK(!cache.Get(vBlocks[1].GetHash(), true));
+    BOOST_CHECK(cache.Get(vBlocks[2].GetHash(), true));
+    BOOST_CHECK(cache.Get(vBlocks[3].GetHash(), true));
+
+    // A payload still queued to a peer outlives its eviction
+    BOOST_CHECK(payloadEvicted->data == SerializeForPeer(vBlocks[1], true));
+
+    // Blocks larger than the whole cache are not kept
+    CSerializedBlockCache cacheSmall(nBlockSize - 1);
+    BOOST_CHECK(cacheSmall.Add(vBlocks[0].GetHash(), vBlocks[0], true)->data.size() == nBlockSize);
+    BOOST_CHECK_EQUAL(cacheSmall.Count(), 0U);
+    BOOST_CHECK(!cacheSmall.Get(vBlocks[0].GetHash(), true));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,74 @@
+// Copyright (c) 2017 The Prux Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilemap.h"
+#include "chain.h"
+#include "clientversion.h"
+#include "streams.h"
+#include "validation.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockfilemap_tests, TestingSetup)
+
+// Write a blk file for nFile holding a magic-like prefix and one uint256
+static uint256 WriteTestBlockFile(int nFile)
+{
+    uint256 hash = GetRandHash();
+    CDiskBlockPos pos(nFile, 0);
+    boost::filesystem::create_directories(GetBlockPosFilename(pos, "blk").parent_path());
+    CAutoFile file(fopen(GetBlockPosFilename(pos, "blk").string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+    file << (uint32_t)nFile << hash;
+    return hash;
+}
+
+BOOST_AUTO_TEST_CASE(blockfilemap_get)
+{
+    CBlockFileMappings mappings(2);
+    uint256 hash1 = WriteTestBlockFile(1);
+    uint256 hash2 = WriteTestBlockFile(2);
+    uint256 hash3 = WriteTestBlockFile(3);
+
+    // Files blocks may still be appended to are not mapped
+    BOOST_CHECK(!mappings.Get(1, false));
+    mappings.SetFirstOpenFile(4);
+
+    std::shared_ptr<const CMappedFile> mapping1 = mappings.Get(1, false);
+    BOOST_REQUIRE(mapping1);
+    BOOST_CHECK_EQUAL(mapping1->size, 4 + 32);
+    CSpanReader reader(SER_DISK, CLIENT_VERSION, mapping1->data + 4, mapping1->data + mapping1->size);
+    uint256 hash;
+    reader >> hash;
+    BOOST_CHECK(hash == hash1);
+    BOOST_CHECK(reader.empty());
+    BOOST_CHECK(mappings.Get(1, false) == mapping1);
+
+    // Missing files are not mapped
+    BOOST_CHECK(!mappings.Get(1, true));
+    BOOST_CHECK_EQUAL(mappings.Count(), 1);
+
+    // The least recently used mapping is evicted, but stays readable for
+    // those still holding it
+    std::shared_ptr<const CMappedFile> mapping2 = mappings.Get(2, false);
+    std::shared_ptr<const CMappedFile> mapping3 = mappings.Get(3, false);
+    BOOST_REQUIRE(mapping2 && mapping3);
+    BOOST_CHECK_EQUAL(mappings.Count(), 2);
+    BOOST_CHECK(mappings.Get(1, false) != mapping1);
+    BOOST_CHECK(memcmp(mapping1->data + 4, hash1.begin(), 32) == 0);
+    BOOST_CHECK(memcmp(mapping2->data + 4, hash2.begin(), 32) == 0);
+    BOOST_CHECK(memcmp(mapping3->data + 4, hash3.begin(), 32) == 0);
+
+    // Reopening a file for appending drops its mapping, and those after it
+    mappings.SetFirstOpenFile(2);
+    BOOST_CHECK_EQUAL(mappings.Count(), 1);
+    BOOST_CHECK(!mappings.Get(3, false));
+
+    mappings.Invalidate(1);
+    BOOST_CHECK_EQUAL(mappings.Count(), 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -430,6 +430,8 @@ BOOST_AUTO_TEST_CASE(merkle_block_4_test_p2pubkey_only)
     // ...and the output address of the 4th transaction
     filter.insert(ParseHex("b6efd80d99179f4f4ff6f4dd0a007d018c385d21"));
 
+    CBloomFilter filterElements(filter);
+
     CMerkleBlock merkleBlock(block, filter);
     BOOST_CHECK(merkleBlock.header.GetHash() == block.GetHash());
 
@@ -437,6 +439,14 @@ BOOST_AUTO_TEST_CASE(merkle_block_4_test_p2pubkey_only)
     BOOST_CHECK(filter.contains(COutPoint(uint256S("0x147caa76786596590baa4e98f5d9f48b86c7765e489f7a6ff3360fe5c674360b"), 0)));
     // ... but not the 4th transaction's output (its not pay-2-pubkey)
     BOOST_CHECK(!filter.contains(COutPoint(uint256S("0x02981fa052f0481dbc5868f4fc2166035a10f27a03cfd2de67326471df5bc041"), 0)));
+
+    // Pre-extracted filter elements match and update the filter the same way
+    CMerkleBlock merkleBlockElements(block, filterElements, CMerkleBlock::GetBlockFilterElements(block));
+    BOOST_CHECK(merkleBlockElements.vMatchedTxn == merkleBlock.vMatchedTxn);
+    CDataStream ssFilter(SER_NETWORK, PROTOCOL_VERSION), ssFilterElements(SER_NETWORK, PROTOCOL_VERSION);
+    ssFilter << filter;
+    ssFilterElements << filterElements;
+    BOOST_CHECK(ssFilter.str() == ssFilterElements.str());
 }
 
 BOOST_AUTO_TEST_CASE(merkle_block_4_test_update_none)
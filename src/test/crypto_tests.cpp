@@ -439,4 +439,36 @@ BOOST_AUTO_TEST_CASE(aes_cbc_testvectors) {
                   "b2eb05e2c39be9fcda6c19078c6a9d1b3f461796d6b0d6b2e0c2a72b4d80e644");
 }
 
+BOOST_AUTO_TEST_CASE(aes256_ctaes_equivalence) {
+    // AES256Encrypt/AES256Decrypt use AES-NI where the CPU has it; they must
+    // agree with ctaes on random keys and blocks.
+    for (int i = 0; i < 1000; i++) {
+        unsigned char key[AES256_KEYSIZE];
+        for (unsigned int j = 0; j < sizeof(key); j++)
+            key[j] = insecure_rand();
+        AES256Encrypt enc(key);
+        AES256Decrypt dec(key);
+        AES256_ctx ctx;
+        AES256_init(&ctx, key);
+
+        for (int n = 0; n < 4; n++) {
+            unsigned char in[AES_BLOCKSIZE], out[AES_BLOCKSIZE], ref[AES_BLOCKSIZE];
+            for (unsigned int j = 0; j < sizeof(in); j++)
+                in[j] = insecure_rand();
+
+            enc.Encrypt(out, in);
+            AES256_encrypt(&ctx, 1, ref, in);
+            BOOST_CHECK(memcmp(out, ref, AES_BLOCKSIZE) == 0);
+
+            dec.Decrypt(out, in);
+            AES256_decrypt(&ctx, 1, ref, in);
+            BOOST_CHECK(memcmp(out, ref, AES_BLOCKSIZE) == 0);
+
+            enc.Encrypt(out, in);
+            dec.Decrypt(ref, out);
+            BOOST_CHECK(memcmp(ref, in, AES_BLOCKSIZE) == 0);
+        }
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
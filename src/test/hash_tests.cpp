@@ -3,8 +3,10 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "hash.h"
+#include "random.h"
 #include "utilstrencodings.h"
 #include "test/test_bitcoin.h"
+#include "test/test_random.h"
 
 #include <vector>
 
@@ -45,6 +47,23 @@ BOOST_AUTO_TEST_CASE(murmurhash3)
 #undef T
 }
 
+BOOST_AUTO_TEST_CASE(murmurhash3_multi)
+{
+    // MurmurHash3Multi must agree with MurmurHash3 for every seed, whether it
+    // lands in a full batch of lanes or in the remainder, and for every tail length
+    std::vector<uint32_t> vSeeds;
+    for (uint32_t i = 0; i < 11; i++)
+        vSeeds.push_back(i * 0xFBA4C795 + 0xdeadbeef);
+    std::vector<unsigned char> vData;
+    for (int nLen = 0; nLen < 40; nLen++) {
+        std::vector<uint32_t> vHashes(vSeeds.size());
+        MurmurHash3Multi(vSeeds.data(), vSeeds.size(), vData.data(), vData.size(), vHashes.data());
+        for (unsigned int i = 0; i < vSeeds.size(); i++)
+            BOOST_CHECK_EQUAL(vHashes[i], MurmurHash3(vSeeds[i], vData));
+        vData.push_back(insecure_rand());
+    }
+}
+
 /*
    SipHash-2-4 output with
    k = 00 01 02 ...
@@ -130,4 +149,24 @@ BOOST_AUTO_TEST_CASE(siphash)
     BOOST_CHECK_EQUAL(SipHashUint256(1, 2, ss.GetHash()), 0x79751e980c2a0a35ULL);
 }
 
+BOOST_AUTO_TEST_CASE(siphash_batch)
+{
+    // The batched implementation must match SipHashUint256 in every lane.
+    for (int i = 0; i < 64; i++) {
+        uint64_t k0 = insecure_rand() | ((uint64_t)insecure_rand() << 32);
+        uint64_t k1 = insecure_rand() | ((uint64_t)insecure_rand() << 32);
+        uint256 vals[SIPHASH_BATCH_LANES];
+        const uint256* pvals[SIPHASH_BATCH_LANES];
+        for (size_t l = 0; l < SIPHASH_BATCH_LANES; l++) {
+            vals[l] = GetRandHash();
+            pvals[l] = &vals[l];
+        }
+        uint64_t out[SIPHASH_BATCH_LANES];
+        SipHashUint256Batch(k0, k1, pvals, out);
+        for (size_t l = 0; l < SIPHASH_BATCH_LANES; l++) {
+            BOOST_CHECK_EQUAL(out[l], SipHashUint256(k0, k1, vals[l]));
+        }
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -4,6 +4,7 @@
 
 #include "policy/policy.h"
 #include "txmempool.h"
+#include "txrelay.h"
 #include "util.h"
 
 #include "test/test_bitcoin.h"
@@ -584,4 +585,165 @@ BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
     SetMockTime(0);
 }
 
+BOOST_AUTO_TEST_CASE(MempoolFeeHistogramTest)
+{
+    CTxMemPool pool(CFeeRate(1000));
+    TestMemPoolEntryHelper entry;
+
+    // Sum of count and vsize over all buckets, and over buckets at or above a fee rate
+    auto totals = [&pool](CAmount nMinFeePerK, uint64_t& nCount, uint64_t& nVSize) {
+        nCount = nVSize = 0;
+        for (const FeeHistogramBucket& bucket : pool.GetFeeHistogram()) {
+            if (bucket.nMinFeePerK >= nMinFeePerK) {
+                nCount += bucket.nCount;
+                nVSize += bucket.nVSize;
+            }
+        }
+    };
+
+    CMutableTransaction tx1 = CMutableTransaction();
+    tx1.vin.resize(1);
+    tx1.vin[0].scriptSig = CScript() << OP_1;
+    tx1.vout.resize(1);
+    tx1.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+    tx1.vout[0].nValue = 10 * COIN;
+    const size_t nSize1 = GetVirtualTransactionSize(tx1);
+    // 1 COIN per kB, well above anything else in this test
+    pool.addUnchecked(tx1.GetHash(), entry.Fee(nSize1 * COIN / 1000).FromTx(tx1, &pool));
+
+    CMutableTransaction tx2 = CMutableTransaction();
+    tx2.vin.resize(1);
+    tx2.vin[0].scriptSig = CScript() << OP_2;
+    tx2.vout.resize(1);
+    tx2.vout[0].scriptPubKey = CScript() << OP_2 << OP_EQUAL;
+    tx2.vout[0].nValue = 10 * COIN;
+    const size_t nSize2 = GetVirtualTransactionSize(tx2);
+    pool.addUnchecked(tx2.GetHash(), entry.Fee(0).FromTx(tx2, &pool));
+
+    uint64_t nCount, nVSize;
+    totals(0, nCount, nVSize);
+    BOOST_CHECK_EQUAL(nCount, 2);
+    BOOST_CHECK_EQUAL(nVSize, nSize1 + nSize2);
+    BOOST_CHECK_EQUAL(nVSize, pool.GetTotalTxSize());
+    totals(FEE_HISTOGRAM_MIN_FEERATE, nCount, nVSize);
+    BOOST_CHECK_EQUAL(nCount, 1);
+    BOOST_CHECK_EQUAL(nVSize, nSize1);
+
+    // Prioritisation does not move transactions between buckets
+    pool.PrioritiseTransaction(tx2.GetHash(), tx2.GetHash().ToString(), 0, COIN);
+    totals(FEE_HISTOGRAM_MIN_FEERATE, nCount, nVSize);
+    BOOST_CHECK_EQUAL(nCount, 1);
+
+    pool.removeRecursive(tx1);
+    totals(0, nCount, nVSize);
+    BOOST_CHECK_EQUAL(nCount, 1);
+    BOOST_CHECK_EQUAL(nVSize, nSize2);
+
+    pool.clear();
+    totals(0, nCount, nVSize);
+    BOOST_CHECK_EQUAL(nCount, 0);
+    BOOST_CHECK_EQUAL(nVSize, 0);
+}
+
+BOOST_AUTO_TEST_CASE(TxRelayQueueTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    CTxRelayQueue queue;
+
+    CMutableTransaction txParent, txChild, txLow, txHigh, txMissing;
+    txParent.vout.resize(1);
+    txParent.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txParent.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(txParent.GetHash(), entry.Fee(1000LL).FromTx(txParent));
+
+    // Pays the most, but has an ancestor
+    txChild.vin.resize(1);
+    txChild.vin[0].prevout = COutPoint(txParent.GetHash(), 0);
+    txChild.vin[0].scriptSig = CScript() << OP_11;
+    txChild.vout.resize(1);
+    txChild.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txChild.vout[0].nValue = 9 * COIN;
+    pool.addUnchecked(txChild.GetHash(), entry.Fee(100000LL).FromTx(txChild));
+
+    txLow.vout.resize(1);
+    txLow.vout[0].scriptPubKey = CScript() << OP_12 << OP_EQUAL;
+    txLow.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(txLow.GetHash(), entry.Fee(2000LL).FromTx(txLow));
+
+    txHigh.vout.resize(1);
+    txHigh.vout[0].scriptPubKey = CScript() << OP_13 << OP_EQUAL;
+    txHigh.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(txHigh.GetHash(), entry.Fee(50000LL).FromTx(txHigh));
+
+    txMissing.vout.resize(1);
+    txMissing.vout[0].scriptPubKey = CScript() << OP_14 << OP_EQUAL;
+    txMissing.vout[0].nValue = 10 * COIN;
+
+    // Duplicates and transactions no longer in the pool are dropped
+    queue.Push(txChild.GetHash());
+    queue.Push(txLow.GetHash());
+    queue.Push(txMissing.GetHash());
+    queue.Push(txParent.GetHash());
+    queue.Push(txHigh.GetHash());
+    queue.Push(txLow.GetHash());
+    BOOST_CHECK_EQUAL(queue.GetEndSequence(), 0);
+    queue.MakeBatch(pool, 1000);
+    BOOST_CHECK_EQUAL(queue.size(), 4);
+    BOOST_CHECK_EQUAL(queue.GetEndSequence(), 4);
+
+    // Fewest ancestors, then highest fee rate first
+    std::vector<uint256> vExpected = {txHigh.GetHash(), txLow.GetHash(), txParent.GetHash(), txChild.GetHash()};
+    std::vector<uint256> vSeen;
+    uint64_t nCursor = 0;
+    queue.ForEachFrom(nCursor, [&](const CTxRelayQueue::Entry& e) {
+        if (vSeen.size() == 2)
+            return false;
+        vSeen.push_back(e.tx->GetHash());
+        return true;
+    });
+    BOOST_CHECK_EQUAL(nCursor, 2);
+    queue.ForEachFrom(nCursor, [&](const CTxRelayQueue::Entry& e) {
+        vSeen.push_back(e.tx->GetHash());
+        return true;
+    });
+    BOOST_CHECK_EQUAL(nCursor, 4);
+    BOOST_CHECK(vSeen == vExpected);
+
+    // Nothing pending, nothing expired: the queue is left as it is
+    queue.MakeBatch(pool, 1000 + TX_RELAY_QUEUE_EXPIRY);
+    BOOST_CHECK_EQUAL(queue.size(), 4);
+
+    // Expired entries are dropped, keeping the sequence numbers; cursors
+    // behind them skip ahead
+    queue.Push(txHigh.GetHash());
+    queue.MakeBatch(pool, 1001 + TX_RELAY_QUEUE_EXPIRY);
+    BOOST_CHECK_EQUAL(queue.size(), 1);
+    BOOST_CHECK_EQUAL(queue.GetEndSequence(), 5);
+    nCursor = 1;
+    vSeen.clear();
+    queue.ForEachFrom(nCursor, [&](const CTxRelayQueue::Entry& e) {
+        vSeen.push_back(e.tx->GetHash());
+        return true;
+    });
+    BOOST_CHECK_EQUAL(nCursor, 5);
+    BOOST_CHECK(vSeen == std::vector<uint256>(1, txHigh.GetHash()));
+
+    // Beyond the size limit the oldest entries are dropped
+    CTxRelayQueue smallQueue(2);
+    smallQueue.Push(txLow.GetHash());
+    smallQueue.Push(txHigh.GetHash());
+    smallQueue.Push(txParent.GetHash());
+    smallQueue.MakeBatch(pool, 1000);
+    BOOST_CHECK_EQUAL(smallQueue.size(), 2);
+    BOOST_CHECK_EQUAL(smallQueue.GetEndSequence(), 3);
+    nCursor = 0;
+    vSeen.clear();
+    smallQueue.ForEachFrom(nCursor, [&](const CTxRelayQueue::Entry& e) {
+        vSeen.push_back(e.tx->GetHash());
+        return true;
+    });
+    BOOST_CHECK(vSeen == std::vector<uint256>({txLow.GetHash(), txParent.GetHash()}));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -70,6 +70,18 @@ CDataStream AddrmanToStream(CAddrManSerializationMock& _addrman)
     return CDataStream(vchData, SER_DISK, CLIENT_VERSION);
 }
 
+// A message as it arrives off the wire: header, then payload
+static std::vector<char> WireMessage(const char* pszCommand, const std::vector<unsigned char>& payload)
+{
+    CMessageHeader hdr(Params().MessageStart(), pszCommand, payload.size());
+    uint256 hash = Hash(payload.begin(), payload.end());
+    memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
+    CDataStream ssWire(SER_NETWORK, INIT_PROTO_VERSION);
+    ssWire << hdr;
+    ssWire.insert(ssWire.end(), (const char*)payload.data(), (const char*)payload.data() + payload.size());
+    return std::vector<char>(ssWire.begin(), ssWire.end());
+}
+
 BOOST_FIXTURE_TEST_SUITE(net_tests, BasicTestingSetup)
 
 BOOST_AUTO_TEST_CASE(caddrdb_read)
@@ -172,4 +184,60 @@ BOOST_AUTO_TEST_CASE(cnode_simple_test)
     BOOST_CHECK(pnode2->fFeeler == false);
 }
 
+BOOST_AUTO_TEST_CASE(cnode_receive_message_pool)
+{
+    in_addr ipv4Addr;
+    ipv4Addr.s_addr = 0xa0b0c001;
+    CAddress addr = CAddress(CService(ipv4Addr, 7777), NODE_NETWORK);
+    std::unique_ptr<CNode> pnode(new CNode(0, NODE_NETWORK, 0, INVALID_SOCKET, addr, 0, 0, "", true));
+
+    // A message received a few bytes at a time is parsed and checksummed
+    std::vector<unsigned char> payload(100, 0x55);
+    std::vector<char> wire = WireMessage("tx", payload);
+    bool fComplete = false;
+    for (size_t nPos = 0; nPos < wire.size(); nPos += 7) {
+        BOOST_CHECK(!fComplete);
+        BOOST_CHECK(pnode->ReceiveMsgBytes(&wire[nPos], std::min<size_t>(7, wire.size() - nPos), fComplete));
+    }
+    BOOST_CHECK(fComplete);
+    pnode->QueueReceivedMsgs(DEFAULT_MAXRECEIVEBUFFER * 1000);
+    const char* pchBuffer;
+    {
+        CNetMessageBatch batch(pnode->recvPool);
+        batch.msgs.splice(batch.msgs.end(), pnode->vProcessMsg);
+        BOOST_CHECK_EQUAL(batch.msgs.size(), 1);
+        const CNetMessage& msg = batch.msgs.front();
+        BOOST_CHECK_EQUAL(msg.hdr.GetCommand(), "tx");
+        BOOST_CHECK(std::equal(msg.vRecv.begin(), msg.vRecv.end(), payload.begin()));
+        BOOST_CHECK(memcmp(msg.GetMessageHash().begin(), msg.hdr.pchChecksum, CMessageHeader::CHECKSUM_SIZE) == 0);
+        pchBuffer = msg.vRecv.data();
+    }
+
+    // The next messages reuse the spent message's buffer where it fits
+    wire = WireMessage("verack", std::vector<unsigned char>());
+    std::vector<char> wire2 = WireMessage("inv", std::vector<unsigned char>(200, 0x11));
+    wire.insert(wire.end(), wire2.begin(), wire2.end());
+    BOOST_CHECK(pnode->ReceiveMsgBytes(wire.data(), wire.size(), fComplete));
+    pnode->QueueReceivedMsgs(DEFAULT_MAXRECEIVEBUFFER * 1000);
+    {
+        CNetMessageBatch batch(pnode->recvPool);
+        batch.msgs.splice(batch.msgs.end(), pnode->vProcessMsg);
+        BOOST_CHECK_EQUAL(batch.msgs.size(), 2);
+        BOOST_CHECK_EQUAL(batch.msgs.front().hdr.GetCommand(), "verack");
+        BOOST_CHECK(batch.msgs.front().vRecv.empty());
+        BOOST_CHECK_EQUAL(batch.msgs.back().hdr.GetCommand(), "inv");
+        BOOST_CHECK_EQUAL(batch.msgs.back().vRecv.size(), 200);
+        BOOST_CHECK(batch.msgs.back().vRecv.data() == pchBuffer);
+    }
+
+    // Messages too large to pool are still received whole
+    payload.assign(MAX_POOLED_RECV_BUFFER * 3 / 2, 0x77);
+    wire = WireMessage("block", payload);
+    BOOST_CHECK(pnode->ReceiveMsgBytes(wire.data(), wire.size(), fComplete));
+    BOOST_CHECK(fComplete);
+    pnode->QueueReceivedMsgs(DEFAULT_MAXRECEIVEBUFFER * 1000);
+    BOOST_CHECK_EQUAL(pnode->vProcessMsg.size(), 1);
+    BOOST_CHECK(std::equal(pnode->vProcessMsg.front().vRecv.begin(), pnode->vProcessMsg.front().vRecv.end(), payload.begin()));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -492,6 +492,41 @@ BOOST_AUTO_TEST_CASE(test_big_witness_transaction) {
     threadGroup.join_all();
 }
 
+// Signing inputs in parallel against the precomputed legacy hash states
+// produces the same signatures as signing them one by one.
+BOOST_AUTO_TEST_CASE(test_parallel_signing) {
+    CKey key;
+    key.MakeNewKey(true);
+    CBasicKeyStore keystore;
+    keystore.AddKeyPubKey(key, key.GetPubKey());
+    const CScript scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+
+    CMutableTransaction mtx;
+    mtx.vin.resize(100);
+    for (uint32_t i = 0; i < mtx.vin.size(); i++)
+        mtx.vin[i].prevout = COutPoint(uint256S("0100"), i);
+    mtx.vout.resize(2);
+    mtx.vout[0].nValue = 1000;
+    mtx.vout[0].scriptPubKey = scriptPubKey;
+    mtx.vout[1].nValue = 2000;
+    mtx.vout[1].scriptPubKey = CScript() << OP_1;
+    const CTransaction tx(mtx);
+    const int sigHashes[] = {SIGHASH_ALL, SIGHASH_NONE, SIGHASH_SINGLE | SIGHASH_ANYONECANPAY};
+
+    const PrecomputedTransactionData txdata(tx, true);
+    std::vector<SignatureData> vSigData(tx.vin.size());
+    std::vector<int64_t> vInputTimes;
+    ForEachInputParallel(tx.vin.size(), [&](unsigned int nIn) {
+        ProduceSignature(TransactionSignatureCreator(&keystore, &tx, nIn, 1000, sigHashes[nIn % 3], txdata), scriptPubKey, vSigData[nIn]);
+    }, &vInputTimes);
+    BOOST_CHECK_EQUAL(vInputTimes.size(), tx.vin.size());
+
+    for (uint32_t i = 0; i < tx.vin.size(); i++) {
+        BOOST_CHECK(SignSignature(keystore, scriptPubKey, mtx, i, 1000, sigHashes[i % 3]));
+        BOOST_CHECK(vSigData[i].scriptSig == mtx.vin[i].scriptSig);
+    }
+}
+
 BOOST_AUTO_TEST_CASE(test_witness)
 {
     CBasicKeyStore keystore, keystore2;
@@ -2,6 +2,7 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "clientversion.h"
 #include "consensus/validation.h"
 #include "key.h"
 #include "validation.h"
@@ -10,7 +11,9 @@
 #include "txmempool.h"
 #include "random.h"
 #include "script/standard.h"
+#include "streams.h"
 #include "test/test_bitcoin.h"
+#include "util.h"
 #include "utiltime.h"
 
 #include <boost/test/unit_test.hpp>
@@ -84,4 +87,65 @@ BOOST_FIXTURE_TEST_CASE(tx_mempool_block_doublespend, TestChain240Setup)
     BOOST_CHECK_EQUAL(mempool.size(), 0);
 }
 
+// Write mempool.dat as DumpMempool does, with the transactions in the given order
+static void WriteMempoolDump(const std::vector<CTransactionRef>& vtx, const uint256& hashTip)
+{
+    FILE* filestr = fopen((GetDataDir() / "mempool.dat").string().c_str(), "wb");
+    CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+    file << (uint64_t)1;
+    file << (uint64_t)vtx.size();
+    for (const CTransactionRef& tx : vtx) {
+        file << *tx;
+        file << GetTime();
+        file << (int64_t)0;
+    }
+    file << std::map<uint256, CAmount>();
+    file << hashTip;
+}
+
+BOOST_FIXTURE_TEST_CASE(mempool_load_reverse_order, TestChain240Setup)
+{
+    CScript scriptPubKey = CScript() <<  ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+
+    // A chain of three transactions, each spending the one before it
+    std::vector<CTransactionRef> vChain;
+    uint256 hashPrev = coinbaseTxns[0].GetHash();
+    CAmount nValue = coinbaseTxns[0].vout[0].nValue;
+    for (int i = 0; i < 3; i++) {
+        CMutableTransaction tx;
+        tx.nVersion = 1;
+        tx.vin.resize(1);
+        tx.vin[0].prevout.hash = hashPrev;
+        tx.vin[0].prevout.n = 0;
+        nValue -= COIN / 100;
+        tx.vout.resize(1);
+        tx.vout[0].nValue = nValue;
+        tx.vout[0].scriptPubKey = scriptPubKey;
+
+        std::vector<unsigned char> vchSig;
+        uint256 hash = SignatureHash(scriptPubKey, tx, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+        BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+        vchSig.push_back((unsigned char)SIGHASH_ALL);
+        tx.vin[0].scriptSig << vchSig;
+
+        vChain.push_back(MakeTransactionRef(tx));
+        hashPrev = tx.GetHash();
+    }
+
+    // Dumped children first, the chain still loads completely, with the
+    // scripts verified and with the dump trusted at its tip
+    std::vector<CTransactionRef> vReversed(vChain.rbegin(), vChain.rend());
+    for (int i = 0; i < 2; i++) {
+        mempool.clear();
+        ForceSetArg("-trustmempooldump", i ? "1" : "0");
+        WriteMempoolDump(vReversed, chainActive.Tip()->GetBlockHash());
+        BOOST_CHECK(LoadMempool());
+        BOOST_CHECK_EQUAL(mempool.size(), vChain.size());
+        for (const CTransactionRef& tx : vChain)
+            BOOST_CHECK(mempool.exists(tx->GetHash()));
+    }
+    ForceSetArg("-trustmempooldump", "0");
+    mempool.clear();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
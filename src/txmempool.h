@@ -16,6 +16,7 @@
 #include "amount.h"
 #include "coins.h"
 #include "indirectmap.h"
+#include "prevector.h"
 #include "primitives/transaction.h"
 #include "sync.h"
 #include "random.h"
@@ -45,6 +46,21 @@ inline bool AllowFree(double dPriority)
 /** Fake height value used in CCoins to signify they are only in the memory pool (since 0.8) */
 static const unsigned int MEMPOOL_HEIGHT = 0x7FFFFFFF;
 
+/** Lowest non-zero bucket boundary of the mempool fee histogram, in satoshis per 1000 virtual bytes */
+static const CAmount FEE_HISTOGRAM_MIN_FEERATE = 1000;
+/** Fee rates at or above this share the top bucket of the mempool fee histogram */
+static const CAmount FEE_HISTOGRAM_MAX_FEERATE = 100 * COIN;
+/** Ratio between consecutive mempool fee histogram bucket boundaries */
+static const double FEE_HISTOGRAM_SPACING = 1.25;
+
+/** One bucket of the mempool fee histogram */
+struct FeeHistogramBucket
+{
+    CAmount nMinFeePerK; //!< Lowest fee rate (satoshis per 1000 vbytes) counted in this bucket
+    uint64_t nCount;     //!< Number of transactions in the bucket
+    uint64_t nVSize;     //!< Sum of their virtual sizes
+};
+
 struct LockPoints
 {
     // Will be set to the blockchain height and median time past
@@ -61,6 +77,14 @@ struct LockPoints
 };
 
 class CTxMemPool;
+class CTxMemPoolEntry;
+
+/**
+ * Direct in-mempool parents or children of a CTxMemPoolEntry. Most mempool
+ * transactions have at most a couple of in-mempool links, so those are stored
+ * inline in the entry instead of in separately allocated set nodes.
+ */
+typedef prevector<2, const CTxMemPoolEntry*> CTxMemPoolEntryLinks;
 
 /** \class CTxMemPoolEntry
  *
@@ -77,6 +101,9 @@ class CTxMemPool;
  * nFee+feeDelta. (This can potentially happen during a reorg, where we limit the
  * amount of work we're willing to do to avoid consuming too much CPU.)
  *
+ * The entry also holds its direct in-mempool parent and child links. They are
+ * owned and kept consistent by CTxMemPool; use CTxMemPool::GetMemPoolParents()
+ * and GetMemPoolChildren() to walk them.
  */
 
 class CTxMemPoolEntry
@@ -90,8 +117,10 @@ private:
     int64_t nTime;             //!< Local time when entering the mempool
     double entryPriority;      //!< Priority when entering the mempool
     unsigned int entryHeight;  //!< Chain height when entering the mempool
-    CAmount inChainInputValue; //!< Sum of all txin values that are already in blockchain
     bool spendsCoinbase;       //!< keep track of transactions that spend a coinbase
+    mutable CTxMemPoolEntryLinks parents;  //!< In-mempool direct parents
+    mutable CTxMemPoolEntryLinks children; //!< In-mempool direct children
+    CAmount inChainInputValue; //!< Sum of all txin values that are already in blockchain
     int64_t sigOpCost;         //!< Total sigop cost
     int64_t feeDelta;          //!< Used for determining the priority of the transaction for mining in a block
     LockPoints lockPoints;     //!< Track the height and time at which tx was final
@@ -158,6 +187,8 @@ public:
     int64_t GetSigOpCostWithAncestors() const { return nSigOpCostWithAncestors; }
 
     mutable size_t vTxHashesIdx; //!< Index in mempool's vTxHashes
+
+    friend class CTxMemPool;
 };
 
 // Helpers for modifying CTxMemPool::mapTx, which is a boost multi_index.
@@ -375,7 +406,7 @@ enum class MemPoolRemovalReason {
  *
  * In order for the feerate sort to remain correct, we must update transactions
  * in the mempool when new descendants arrive.  To facilitate this, we track
- * the set of in-mempool direct parents and direct children in mapLinks.  Within
+ * the in-mempool direct parents and direct children of each entry.  Within
  * each CTxMemPoolEntry, we track the size and fees of all descendants.
  *
  * Usually when a new transaction is added to the mempool, it has no in-mempool
@@ -408,7 +439,7 @@ enum class MemPoolRemovalReason {
  * state, to account for in-mempool, out-of-block descendants for all the
  * in-block transactions by calling UpdateTransactionsFromBlock().  Note that
  * until this is called, the mempool state is not consistent, and in particular
- * mapLinks may not be correct (and therefore functions like
+ * the parent/child links may not be correct (and therefore functions like
  * CalculateMemPoolAncestors() and CalculateDescendants() that rely
  * on them to walk the mempool are not generally safe to use).
  *
@@ -437,12 +468,14 @@ private:
 
     uint64_t totalTxSize;      //!< sum of all mempool tx's virtual sizes. Differs from serialized tx size since witness data is discounted. Defined in BIP 141.
     uint64_t cachedInnerUsage; //!< sum of dynamic memory usage of all the map elements (NOT the maps themselves)
+    std::vector<FeeHistogramBucket> vFeeHistogram; //!< entries by unmodified fee rate, maintained by addUnchecked/removeUnchecked
 
     mutable int64_t lastRollingFeeUpdate;
     mutable bool blockSinceLastRollingFeeBump;
     mutable double rollingMinimumFeeRate; //!< minimum fee to get into the pool, decreases exponentially
 
     void trackPackageRemoved(const CFeeRate& rate);
+    void UpdateFeeHistogram(const CTxMemPoolEntry& entry, bool add);
 
 public:
 
@@ -493,19 +526,42 @@ public:
     };
     typedef std::set<txiter, CompareIteratorByHash> setEntries;
 
-    const setEntries & GetMemPoolParents(txiter entry) const;
-    const setEntries & GetMemPoolChildren(txiter entry) const;
-private:
-    typedef std::map<txiter, setEntries, CompareIteratorByHash> cacheMap;
+    /** Iterable view of an entry's parent or child links that yields txiters. */
+    class LinkedEntries
+    {
+    public:
+        class const_iterator : public std::iterator<std::forward_iterator_tag, txiter, std::ptrdiff_t, const txiter*, txiter>
+        {
+        private:
+            CTxMemPoolEntryLinks::const_iterator it;
+            const indexed_transaction_set* pset;
+        public:
+            const_iterator(CTxMemPoolEntryLinks::const_iterator itIn, const indexed_transaction_set* psetIn) : it(itIn), pset(psetIn) {}
+            txiter operator*() const { return pset->iterator_to(**it); }
+            const_iterator& operator++() { ++it; return *this; }
+            const_iterator operator++(int) { const_iterator copy(*this); ++it; return copy; }
+            bool operator==(const const_iterator& other) const { return it == other.it; }
+            bool operator!=(const const_iterator& other) const { return it != other.it; }
+        };
+        typedef const_iterator iterator;
+
+        LinkedEntries(const CTxMemPoolEntryLinks& linksIn, const indexed_transaction_set& setIn) : links(linksIn), set(setIn) {}
+        const_iterator begin() const { return const_iterator(links.begin(), &set); }
+        const_iterator end() const { return const_iterator(links.end(), &set); }
+        size_t size() const { return links.size(); }
+        bool empty() const { return links.empty(); }
 
-    struct TxLinks {
-        setEntries parents;
-        setEntries children;
+    private:
+        const CTxMemPoolEntryLinks& links;
+        const indexed_transaction_set& set;
     };
 
-    typedef std::map<txiter, TxLinks, CompareIteratorByHash> txlinksMap;
-    txlinksMap mapLinks;
+    LinkedEntries GetMemPoolParents(txiter entry) const;
+    LinkedEntries GetMemPoolChildren(txiter entry) const;
+private:
+    typedef std::map<txiter, setEntries, CompareIteratorByHash> cacheMap;
 
+    void UpdateLink(CTxMemPoolEntryLinks& links, const CTxMemPoolEntry& other, bool add);
     void UpdateParent(txiter entry, txiter parent, bool add);
     void UpdateChild(txiter entry, txiter child, bool add);
 
@@ -588,7 +644,7 @@ public:
      *  limitDescendantSize = max size of descendants any ancestor can have
      *  errString = populated with error reason if any limits are hit
      *  fSearchForParents = whether to search a tx's vin for in-mempool parents, or
-     *    look up parents from mapLinks. Must be true for entries not in the mempool
+     *    look up parents from the entry's links. Must be true for entries not in the mempool
      */
     bool CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntries &setAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string &errString, bool fSearchForParents = true) const;
 
@@ -617,6 +673,9 @@ public:
     /** Returns false if the transaction is in the mempool and not within the chain limit specified. */
     bool TransactionWithinChainLimit(const uint256& txid, size_t chainLimit) const;
 
+    /** Returns the larger of the ancestor and descendant counts of a transaction, or 0 if it is not in the mempool. */
+    uint64_t GetChainLength(const uint256& txid) const;
+
     unsigned long size()
     {
         LOCK(cs);
@@ -629,6 +688,14 @@ public:
         return totalTxSize;
     }
 
+    /** Fee histogram buckets in increasing fee rate order. Transactions are
+     *  bucketed by their own fee rate, ignoring PrioritiseTransaction deltas. */
+    std::vector<FeeHistogramBucket> GetFeeHistogram() const
+    {
+        LOCK(cs);
+        return vFeeHistogram;
+    }
+
     bool exists(uint256 hash) const
     {
         LOCK(cs);
@@ -638,6 +705,9 @@ public:
     CTransactionRef get(const uint256& hash) const;
     TxMempoolInfo info(const uint256& hash) const;
     std::vector<TxMempoolInfo> infoAll() const;
+    /** Info for those of vHashes still in the pool, without duplicates, in
+     *  the order of infoAll (fewest ancestors, then highest score first) */
+    std::vector<TxMempoolInfo> infoSorted(const std::vector<uint256>& vHashes) const;
 
     /** Estimate fee rate needed to get into the next nBlocks
      *  If no answer can be given at nBlocks, return an estimate
@@ -0,0 +1,59 @@
+// Copyright (c) 2017 The Prux Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "txrelay.h"
+
+#include "txmempool.h"
+
+void CTxRelayQueue::Push(const uint256& hash)
+{
+    LOCK(cs_pending);
+    vPending.push_back(hash);
+}
+
+void CTxRelayQueue::MakeBatch(const CTxMemPool& pool, int64_t nNow)
+{
+    std::vector<uint256> vBatch;
+    {
+        LOCK(cs_pending);
+        vBatch.swap(vPending);
+    }
+
+    // Sort outside of the queue lock, so peers announcing from the queue
+    // are not held up by the mempool lookups.
+    std::vector<TxMempoolInfo> vInfo;
+    if (!vBatch.empty()) {
+        vInfo = pool.infoSorted(vBatch);
+    } else {
+        // Quiet periods get here; only expiry may be due.
+        boost::shared_lock<boost::shared_mutex> lock(cs);
+        if (queue.empty() || queue.front().nTime >= nNow - TX_RELAY_QUEUE_EXPIRY)
+            return;
+    }
+
+    boost::unique_lock<boost::shared_mutex> lock(cs);
+    while (!queue.empty() && queue.front().nTime < nNow - TX_RELAY_QUEUE_EXPIRY) {
+        queue.pop_front();
+        nHeadSequence++;
+    }
+    for (TxMempoolInfo& info : vInfo) {
+        queue.push_back(Entry{std::move(info.tx), info.feeRate.GetFeePerK(), nNow});
+    }
+    while (queue.size() > nMaxSize) {
+        queue.pop_front();
+        nHeadSequence++;
+    }
+}
+
+uint64_t CTxRelayQueue::GetEndSequence() const
+{
+    boost::shared_lock<boost::shared_mutex> lock(cs);
+    return nHeadSequence + queue.size();
+}
+
+size_t CTxRelayQueue::size() const
+{
+    boost::shared_lock<boost::shared_mutex> lock(cs);
+    return queue.size();
+}
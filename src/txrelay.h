@@ -0,0 +1,92 @@
+// Copyright (c) 2017 The Prux Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_TXRELAY_H
+#define BITCOIN_TXRELAY_H
+
+#include "amount.h"
+#include "primitives/transaction.h"
+#include "sync.h"
+#include "uint256.h"
+
+#include <deque>
+#include <vector>
+
+#include <boost/thread/shared_mutex.hpp>
+
+class CTxMemPool;
+
+/** Seconds a transaction stays in the relay queue for peers that have not reached it yet */
+static const int64_t TX_RELAY_QUEUE_EXPIRY = 15 * 60;
+/** Most entries the relay queue keeps, oldest dropped first, so a burst cannot pin unbounded transactions in memory */
+static const size_t DEFAULT_TX_RELAY_QUEUE_MAX_SIZE = 50000;
+
+/**
+ * Transactions to announce, shared by all peers. Transactions are pushed as
+ * they are accepted; at each batch, on a timer shared by all peers,
+ * everything pushed since the last batch is looked up and sorted in mempool
+ * order (fewest ancestors, then highest fee rate first) once for all peers,
+ * and appended to the queue. Each peer keeps a cursor into the queue and announces from
+ * it, applying only its own filters.
+ */
+class CTxRelayQueue
+{
+public:
+    struct Entry
+    {
+        CTransactionRef tx;
+        CAmount nFeePerK;
+        //! When the entry was queued, in seconds
+        int64_t nTime;
+    };
+
+    CTxRelayQueue(size_t nMaxSizeIn = DEFAULT_TX_RELAY_QUEUE_MAX_SIZE) : nMaxSize(nMaxSizeIn), nHeadSequence(0) {}
+
+    //! Queue a transaction for announcement to every peer
+    void Push(const uint256& hash);
+
+    /**
+     * Append the transactions pushed since the last batch that are still in
+     * pool, in mempool order, and drop the entries queued more than
+     * TX_RELAY_QUEUE_EXPIRY seconds before nNow, then the oldest ones beyond
+     * the size limit. Cheap when nothing was pushed.
+     */
+    void MakeBatch(const CTxMemPool& pool, int64_t nNow);
+
+    //! Sequence number the next queued entry will get; new peers start here
+    uint64_t GetEndSequence() const;
+
+    //! Number of entries queued
+    size_t size() const;
+
+    /**
+     * Call fn on the entries from sequence number nCursor on, oldest first,
+     * for as long as it returns true, and advance nCursor past the entries
+     * it accepted. A cursor behind the oldest entry still queued skips to it.
+     */
+    template <typename Callable>
+    void ForEachFrom(uint64_t& nCursor, Callable&& fn) const
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs);
+        if (nCursor < nHeadSequence)
+            nCursor = nHeadSequence;
+        while (nCursor < nHeadSequence + queue.size() && fn(queue[nCursor - nHeadSequence]))
+            nCursor++;
+    }
+
+private:
+    const size_t nMaxSize;
+
+    //! Guards vPending
+    CCriticalSection cs_pending;
+    std::vector<uint256> vPending;
+
+    //! Guards queue and nHeadSequence; peers walk the queue under a shared lock
+    mutable boost::shared_mutex cs;
+    std::deque<Entry> queue;
+    //! Sequence number of queue.front()
+    uint64_t nHeadSequence;
+};
+
+#endif // BITCOIN_TXRELAY_H
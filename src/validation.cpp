@@ -7,6 +7,7 @@
 
 #include "alert.h"
 #include "arith_uint256.h"
+#include "blockfilemap.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
@@ -40,8 +41,10 @@
 #include "versionbits.h"
 #include "warnings.h"
 
+#include <algorithm>
 #include <atomic>
 #include <sstream>
+#include <unordered_map>
 
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/algorithm/string/join.hpp>
@@ -76,6 +79,7 @@ bool fIsBareMultisigStd = DEFAULT_PERMIT_BAREMULTISIG;
 bool fRequireStandard = true;
 bool fCheckBlockIndex = false;
 bool fCheckpointsEnabled = DEFAULT_CHECKPOINTS_ENABLED;
+bool fBlockMmap = DEFAULT_BLOCK_MMAP;
 size_t nCoinCacheUsage = 5000 * 300;
 uint64_t nPruneTarget = 0;
 bool fAlerts = DEFAULT_ALERTS;
@@ -587,7 +591,8 @@ static bool IsCurrentForFeeEstimation()
 
 bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const CTransactionRef& ptx, bool fLimitFree,
                               bool* pfMissingInputs, int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced,
-                              bool fOverrideMempoolLimit, const CAmount& nAbsurdFee, std::vector<uint256>& vHashTxnToUncache)
+                              bool fOverrideMempoolLimit, const CAmount& nAbsurdFee, std::vector<uint256>& vHashTxnToUncache,
+                              bool fCheckScripts)
 {
     const CTransaction& tx = *ptx;
     const uint256 hash = tx.GetHash();
@@ -964,7 +969,7 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
         PrecomputedTransactionData txdata(tx);
-        if (!CheckInputs(tx, state, view, true, scriptVerifyFlags, true, txdata)) {
+        if (!CheckInputs(tx, state, view, fCheckScripts, scriptVerifyFlags, true, txdata)) {
             // SCRIPT_VERIFY_CLEANSTACK requires SCRIPT_VERIFY_WITNESS, so we
             // need to turn both off, and compare against just turning off CLEANSTACK
             // to see if the failure is specifically due to witness validation.
@@ -986,7 +991,7 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         // There is a similar check in CreateNewBlock() to prevent creating
         // invalid blocks, however allowing such transactions into the mempool
         // can be exploited as a DoS attack.
-        if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, txdata))
+        if (!CheckInputs(tx, state, view, fCheckScripts, MANDATORY_SCRIPT_VERIFY_FLAGS, true, txdata))
         {
             return error("%s: BUG! PLEASE REPORT THIS! ConnectInputs failed against MANDATORY but not STANDARD flags %s, %s",
                 __func__, hash.ToString(), FormatStateMessage(state));
@@ -1029,10 +1034,10 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
 
 bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState &state, const CTransactionRef &tx, bool fLimitFree,
                         bool* pfMissingInputs, int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced,
-                        bool fOverrideMempoolLimit, const CAmount nAbsurdFee)
+                        bool fOverrideMempoolLimit, const CAmount nAbsurdFee, bool fCheckScripts)
 {
     std::vector<uint256> vHashTxToUncache;
-    bool res = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, nAcceptTime, plTxnReplaced, fOverrideMempoolLimit, nAbsurdFee, vHashTxToUncache);
+    bool res = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, nAcceptTime, plTxnReplaced, fOverrideMempoolLimit, nAbsurdFee, vHashTxToUncache, fCheckScripts);
     if (!res) {
         BOOST_FOREACH(const uint256& hashTx, vHashTxToUncache)
             pcoinsTip->Uncache(hashTx);
@@ -1144,6 +1149,35 @@ bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHea
     return true;
 }
 
+/** Mappings of the finished block and undo files, used with -blockmmap */
+static CBlockFileMappings blockFileMappings;
+
+/** Deserialize with read from the mapped blk or rev file at pos. Returns
+    false, to fall back to reading the file, if the file is not mapped or
+    the read fails. */
+template<typename Callable>
+static bool ReadFromMappedFile(const CDiskBlockPos& pos, bool fUndo, Callable read)
+{
+    if (!fBlockMmap)
+        return false;
+    std::shared_ptr<const CMappedFile> mapping = blockFileMappings.Get(pos.nFile, fUndo);
+    if (!mapping)
+        return false;
+    if (pos.nPos < mapping->size) {
+        CSpanReader reader(SER_DISK, CLIENT_VERSION, mapping->data + pos.nPos, mapping->data + mapping->size);
+        try {
+            read(reader);
+            return true;
+        }
+        catch (const std::exception&) {
+        }
+    }
+    // Written to past the end of the mapping since it was made, or damaged:
+    // map it again next time, and have the file read report any error.
+    blockFileMappings.Invalidate(pos.nFile);
+    return false;
+}
+
 /* Generic implementation of block reading that can handle
    both a block and its header.  */
 
@@ -1152,17 +1186,19 @@ static bool ReadBlockOrHeader(T& block, const CDiskBlockPos& pos, const Consensu
 {
     block.SetNull();
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+    if (!ReadFromMappedFile(pos, false, [&block](CSpanReader& reader) { reader >> block; })) {
+        // Open history file to read
+        CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
 
-    // Read block
-    try {
-        filein >> block;
-    }
-    catch (const std::exception& e) {
-        return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+        // Read block
+        try {
+            filein >> block;
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+        }
     }
 
     // Check the header
@@ -1527,19 +1563,21 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint
 
 bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock)
 {
-    // Open history file to read
-    CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("%s: OpenUndoFile failed", __func__);
-
-    // Read block
     uint256 hashChecksum;
-    try {
-        filein >> blockundo;
-        filein >> hashChecksum;
-    }
-    catch (const std::exception& e) {
-        return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+    if (!ReadFromMappedFile(pos, true, [&](CSpanReader& reader) { reader >> blockundo >> hashChecksum; })) {
+        // Open history file to read
+        CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            return error("%s: OpenUndoFile failed", __func__);
+
+        // Read block
+        try {
+            filein >> blockundo;
+            filein >> hashChecksum;
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+        }
     }
 
     // Verify checksum
@@ -2214,6 +2252,7 @@ bool static DisconnectTip(CValidationState& state, const CChainParams& chainpara
     // Write the chain state to disk, if necessary.
     if (!FlushStateToDisk(state, FLUSH_STATE_IF_NEEDED))
         return false;
+    GetMainSignals().BlockDisconnected(pindexDelete);
 
     if (!fBare) {
         // Resurrect mempool transactions from the disconnected block.
@@ -2311,6 +2350,7 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     mempool.removeForBlock(blockConnecting.vtx, pindexNew->nHeight);
     // Update chainActive & related variables.
     UpdateTip(pindexNew, chainparams);
+    GetMainSignals().BlockConnected(pindexNew);
 
     int64_t nTime6 = GetTimeMicros(); nTimePostConnect += nTime6 - nTime5; nTimeTotal += nTime6 - nTime1;
     LogPrint("bench", "  - Connect postprocess: %.2fms [%.2fs]\n", (nTime6 - nTime5) * 0.001, nTimePostConnect * 0.000001);
@@ -2787,6 +2827,7 @@ bool FindBlockPos(CValidationState &state, CDiskBlockPos &pos, unsigned int nAdd
         }
         FlushBlockFile(!fKnown);
         nLastBlockFile = nFile;
+        blockFileMappings.SetFirstOpenFile(nLastBlockFile);
     }
 
     vinfoBlockFile[nFile].AddBlock(nHeight, nTime);
@@ -3411,6 +3452,7 @@ void UnlinkPrunedFiles(const std::set<int>& setFilesToPrune)
 {
     for (std::set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
         CDiskBlockPos pos(*it, 0);
+        blockFileMappings.Invalidate(*it);
         boost::filesystem::remove(GetBlockPosFilename(pos, "blk"));
         boost::filesystem::remove(GetBlockPosFilename(pos, "rev"));
         LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
@@ -3608,6 +3650,7 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams)
 
     // Load block file info
     pblocktree->ReadLastBlockFile(nLastBlockFile);
+    blockFileMappings.SetFirstOpenFile(nLastBlockFile);
     vinfoBlockFile.resize(nLastBlockFile + 1);
     LogPrintf("%s: last block file = %i\n", __func__, nLastBlockFile);
     for (int nFile = 0; nFile <= nLastBlockFile; nFile++) {
@@ -3872,6 +3915,7 @@ void UnloadBlockIndex()
     mapBlocksUnlinked.clear();
     vinfoBlockFile.clear();
     nLastBlockFile = 0;
+    blockFileMappings.SetFirstOpenFile(nLastBlockFile);
     nBlockSequenceId = 1;
     setDirtyBlockIndex.clear();
     setDirtyFileInfo.clear();
@@ -4261,6 +4305,132 @@ int VersionBitsTipStateSinceHeight(const Consensus::Params& params, Consensus::D
 
 static const uint64_t MEMPOOL_DUMP_VERSION = 1;
 
+namespace {
+
+struct MempoolDumpEntry
+{
+    CTransactionRef tx;
+    int64_t nTime;
+    int64_t nFeeDelta;
+};
+
+/**
+ * Stable-sort loaded mempool entries so that every transaction comes after
+ * any of its in-dump parents. Returns the number of dependency levels.
+ */
+unsigned int SortMempoolDumpByDependency(std::vector<MempoolDumpEntry>& vEntries)
+{
+    std::unordered_map<uint256, size_t, SaltedTxidHasher> mapIndex;
+    mapIndex.reserve(vEntries.size());
+    for (size_t i = 0; i < vEntries.size(); i++) {
+        mapIndex.emplace(vEntries[i].tx->GetHash(), i);
+    }
+
+    // Iterative depth-first walk over in-dump parents. A transaction is
+    // expanded once (its parents are pushed above it) and finished when it is
+    // seen again, at which point all of its parents have a level.
+    enum { UNVISITED, EXPANDED, FINISHED };
+    std::vector<int> vState(vEntries.size(), UNVISITED);
+    std::vector<unsigned int> vLevel(vEntries.size(), 0);
+    std::vector<size_t> vStack;
+    unsigned int nMaxLevel = 0;
+    for (size_t i = 0; i < vEntries.size(); i++) {
+        vStack.push_back(i);
+        while (!vStack.empty()) {
+            const size_t n = vStack.back();
+            if (vState[n] == FINISHED) {
+                vStack.pop_back();
+            } else if (vState[n] == UNVISITED) {
+                vState[n] = EXPANDED;
+                for (const CTxIn& txin : vEntries[n].tx->vin) {
+                    auto it = mapIndex.find(txin.prevout.hash);
+                    if (it != mapIndex.end() && vState[it->second] == UNVISITED)
+                        vStack.push_back(it->second);
+                }
+            } else {
+                // Parents that are still EXPANDED form a cycle, which only a
+                // corrupt dump can contain; AcceptToMemoryPool rejects those.
+                unsigned int nLevel = 1;
+                for (const CTxIn& txin : vEntries[n].tx->vin) {
+                    auto it = mapIndex.find(txin.prevout.hash);
+                    if (it != mapIndex.end() && vState[it->second] == FINISHED)
+                        nLevel = std::max(nLevel, vLevel[it->second] + 1);
+                }
+                vLevel[n] = nLevel;
+                vState[n] = FINISHED;
+                nMaxLevel = std::max(nMaxLevel, nLevel);
+                vStack.pop_back();
+            }
+        }
+    }
+
+    std::vector<size_t> vOrder(vEntries.size());
+    for (size_t i = 0; i < vOrder.size(); i++)
+        vOrder[i] = i;
+    std::stable_sort(vOrder.begin(), vOrder.end(), [&vLevel](size_t a, size_t b) { return vLevel[a] < vLevel[b]; });
+
+    std::vector<MempoolDumpEntry> vSorted;
+    vSorted.reserve(vEntries.size());
+    for (size_t i : vOrder)
+        vSorted.push_back(std::move(vEntries[i]));
+    vEntries.swap(vSorted);
+    return nMaxLevel;
+}
+
+/**
+ * Run the script checks for a batch of loaded transactions on the script
+ * check threads. The verdicts are thrown away: the point is to fill the
+ * signature cache so that the serial AcceptToMemoryPool pass that follows
+ * only has to hit the cache. Inputs are resolved against the coins tip and
+ * against the outputs of other transactions in the dump.
+ */
+void PrecheckMempoolDumpScripts(std::vector<MempoolDumpEntry>::const_iterator begin, std::vector<MempoolDumpEntry>::const_iterator end,
+                                const std::unordered_map<uint256, CTransactionRef, SaltedTxidHasher>& mapDumpTx)
+{
+    AssertLockHeld(cs_main);
+
+    unsigned int flags = STANDARD_SCRIPT_VERIFY_FLAGS;
+    if (!Params().RequireStandard()) {
+        flags = GetArg("-promiscuousmempoolflags", flags);
+    }
+
+    // CScriptCheck keeps a pointer to the precomputed data, so it must not move.
+    std::vector<PrecomputedTransactionData> txdata;
+    txdata.reserve(end - begin);
+    CCheckQueueControl<CScriptCheck> control(&scriptcheckqueue);
+    for (auto it = begin; it != end; ++it) {
+        const CTransaction& tx = *it->tx;
+        if (tx.IsCoinBase())
+            continue;
+        txdata.emplace_back(tx);
+        std::vector<CScriptCheck> vChecks;
+        vChecks.reserve(tx.vin.size());
+        for (unsigned int i = 0; i < tx.vin.size(); i++) {
+            const COutPoint& prevout = tx.vin[i].prevout;
+            const CCoins* coins = pcoinsTip->AccessCoins(prevout.hash);
+            CCoins coinsDump;
+            if (!coins || !coins->IsAvailable(prevout.n)) {
+                auto itParent = mapDumpTx.find(prevout.hash);
+                if (itParent == mapDumpTx.end() || prevout.n >= itParent->second->vout.size())
+                    break;
+                coinsDump = CCoins(*itParent->second, MEMPOOL_HEIGHT);
+                coins = &coinsDump;
+            }
+            vChecks.push_back(CScriptCheck());
+            CScriptCheck check(*coins, tx, i, flags, true, &txdata.back());
+            check.swap(vChecks.back());
+        }
+        // Transactions with missing inputs will fail in AcceptToMemoryPool anyway.
+        if (vChecks.size() == tx.vin.size())
+            control.Add(vChecks);
+    }
+    // A failing check makes the queue skip the rest of the batch; that only
+    // costs cache warmth, the serial pass still verifies every transaction.
+    control.Wait();
+}
+
+} // anon namespace
+
 bool LoadMempool(void)
 {
     int64_t nExpiryTimeout = GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60;
@@ -4275,6 +4445,12 @@ bool LoadMempool(void)
     int64_t skipped = 0;
     int64_t failed = 0;
     int64_t nNow = GetTime();
+    int64_t nStart = GetTimeMicros();
+
+    std::vector<MempoolDumpEntry> vEntries;
+    std::map<uint256, CAmount> mapDeltas;
+    uint256 hashDumpTip;
+    double prioritydummy = 0;
 
     try {
         uint64_t version;
@@ -4284,46 +4460,96 @@ bool LoadMempool(void)
         }
         uint64_t num;
         file >> num;
-        double prioritydummy = 0;
+        vEntries.reserve(std::min<uint64_t>(num, 1000000));
         while (num--) {
-            CTransactionRef tx;
-            int64_t nTime;
-            int64_t nFeeDelta;
-            file >> tx;
-            file >> nTime;
-            file >> nFeeDelta;
-
-            CAmount amountdelta = nFeeDelta;
+            MempoolDumpEntry entry;
+            file >> entry.tx;
+            file >> entry.nTime;
+            file >> entry.nFeeDelta;
+
+            CAmount amountdelta = entry.nFeeDelta;
             if (amountdelta) {
-                mempool.PrioritiseTransaction(tx->GetHash(), tx->GetHash().ToString(), prioritydummy, amountdelta);
+                mempool.PrioritiseTransaction(entry.tx->GetHash(), entry.tx->GetHash().ToString(), prioritydummy, amountdelta);
             }
-            CValidationState state;
-            if (nTime + nExpiryTimeout > nNow) {
-                LOCK(cs_main);
-                AcceptToMemoryPoolWithTime(mempool, state, tx, true, NULL, nTime);
-                if (state.IsValid()) {
-                    ++count;
-                } else {
-                    ++failed;
-                }
+            if (entry.nTime + nExpiryTimeout > nNow) {
+                vEntries.push_back(std::move(entry));
             } else {
                 ++skipped;
             }
             if (ShutdownRequested())
                 return false;
         }
-        std::map<uint256, CAmount> mapDeltas;
         file >> mapDeltas;
-
-        for (const auto& i : mapDeltas) {
-            mempool.PrioritiseTransaction(i.first, i.first.ToString(), prioritydummy, i.second);
-        }
     } catch (const std::exception& e) {
         LogPrintf("Failed to deserialize mempool data on disk: %s. Continuing anyway.\n", e.what());
         return false;
     }
 
+    // Dumps written by older versions end after the deltas.
+    try {
+        file >> hashDumpTip;
+    } catch (const std::exception&) {
+        hashDumpTip.SetNull();
+    }
+
+    unsigned int nLevels = SortMempoolDumpByDependency(vEntries);
+    int64_t nRead = GetTimeMicros();
+
+    bool fTrusted = false;
+    if (GetBoolArg("-trustmempooldump", DEFAULT_TRUST_MEMPOOL_DUMP) && !hashDumpTip.IsNull()) {
+        LOCK(cs_main);
+        fTrusted = chainActive.Tip() && chainActive.Tip()->GetBlockHash() == hashDumpTip;
+        if (!fTrusted)
+            LogPrintf("Mempool file was written at a different tip, verifying scripts\n");
+    }
+
+    std::unordered_map<uint256, CTransactionRef, SaltedTxidHasher> mapDumpTx;
+    auto fillDumpTx = [&]() {
+        if (!nScriptCheckThreads)
+            return;
+        mapDumpTx.reserve(vEntries.size());
+        for (const MempoolDumpEntry& entry : vEntries)
+            mapDumpTx.emplace(entry.tx->GetHash(), entry.tx);
+    };
+    if (!fTrusted)
+        fillDumpTx();
+
+    for (size_t nBatchStart = 0; nBatchStart < vEntries.size(); nBatchStart += MEMPOOL_LOAD_BATCH_SIZE) {
+        auto begin = vEntries.cbegin() + nBatchStart;
+        auto end = vEntries.cbegin() + std::min(vEntries.size(), nBatchStart + MEMPOOL_LOAD_BATCH_SIZE);
+
+        LOCK(cs_main);
+        // cs_main was released since the last batch, so a block may have
+        // been connected in between; the dump is only trusted at its own tip.
+        if (fTrusted && chainActive.Tip()->GetBlockHash() != hashDumpTip) {
+            LogPrintf("Chain tip moved while loading the mempool file, verifying scripts\n");
+            fTrusted = false;
+            fillDumpTx();
+        }
+        if (!mapDumpTx.empty())
+            PrecheckMempoolDumpScripts(begin, end, mapDumpTx);
+        for (auto it = begin; it != end; ++it) {
+            CValidationState state;
+            AcceptToMemoryPoolWithTime(mempool, state, it->tx, true, NULL, it->nTime, NULL, false, 0, !fTrusted);
+            if (state.IsValid()) {
+                ++count;
+            } else {
+                ++failed;
+            }
+        }
+        if (ShutdownRequested())
+            return false;
+    }
+
+    for (const auto& i : mapDeltas) {
+        mempool.PrioritiseTransaction(i.first, i.first.ToString(), prioritydummy, i.second);
+    }
+
+    int64_t nEnd = GetTimeMicros();
     LogPrintf("Imported mempool transactions from disk: %i successes, %i failed, %i expired\n", count, failed, skipped);
+    LogPrint("bench", "    - Mempool load: %.2fms read, %.2fms accept (%u dependency levels, %s scripts)\n",
+             (nRead - nStart) * 0.001, (nEnd - nRead) * 0.001, nLevels,
+             fTrusted ? "trusted" : (mapDumpTx.empty() ? "serial" : "parallel"));
     return true;
 }
 
@@ -4333,9 +4559,12 @@ void DumpMempool(void)
 
     std::map<uint256, CAmount> mapDeltas;
     std::vector<TxMempoolInfo> vinfo;
+    uint256 hashTip;
 
     {
-        LOCK(mempool.cs);
+        LOCK2(cs_main, mempool.cs);
+        if (chainActive.Tip())
+            hashTip = chainActive.Tip()->GetBlockHash();
         for (const auto &i : mempool.mapDeltas) {
             mapDeltas[i.first] = i.second.second;
         }
@@ -4364,6 +4593,8 @@ void DumpMempool(void)
         }
 
         file << mapDeltas;
+        // Appended after the deltas so that older versions can still read the file.
+        file << hashTip;
         FileCommit(file.Get());
         file.fclose();
         RenameOver(GetDataDir() / "mempool.dat.new", GetDataDir() / "mempool.dat");
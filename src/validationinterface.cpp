@@ -19,6 +19,10 @@ void RegisterValidationInterface(CValidationInterface* pwalletIn) {
                                                   pwalletIn, boost::placeholders::_1,
                                                   boost::placeholders::_2,
                                                   boost::placeholders::_3));
+    g_signals.BlockConnected.connect(boost::bind(&CValidationInterface::BlockConnected,
+                                                 pwalletIn, boost::placeholders::_1));
+    g_signals.BlockDisconnected.connect(boost::bind(&CValidationInterface::BlockDisconnected,
+                                                    pwalletIn, boost::placeholders::_1));
     g_signals.SyncTransaction.connect(boost::bind(&CValidationInterface::SyncTransaction,
                                                   pwalletIn, boost::placeholders::_1,
                                                   boost::placeholders::_2,
@@ -64,6 +68,10 @@ void UnregisterValidationInterface(CValidationInterface* pwalletIn) {
                                                      pwalletIn, boost::placeholders::_1,
                                                      boost::placeholders::_2,
                                                      boost::placeholders::_3));
+    g_signals.BlockDisconnected.disconnect(boost::bind(&CValidationInterface::BlockDisconnected,
+                                                       pwalletIn, boost::placeholders::_1));
+    g_signals.BlockConnected.disconnect(boost::bind(&CValidationInterface::BlockConnected,
+                                                    pwalletIn, boost::placeholders::_1));
     g_signals.UpdatedBlockTip.disconnect(boost::bind(&CValidationInterface::UpdatedBlockTip,
                                          pwalletIn, boost::placeholders::_1,
                                          boost::placeholders::_2,
@@ -82,6 +90,8 @@ void UnregisterAllValidationInterfaces() {
     g_signals.SetBestChain.disconnect_all_slots();
     g_signals.UpdatedTransaction.disconnect_all_slots();
     g_signals.SyncTransaction.disconnect_all_slots();
+    g_signals.BlockDisconnected.disconnect_all_slots();
+    g_signals.BlockConnected.disconnect_all_slots();
     g_signals.UpdatedBlockTip.disconnect_all_slots();
     g_signals.NewPoWValidBlock.disconnect_all_slots();
 }
@@ -33,6 +33,8 @@ void UnregisterAllValidationInterfaces();
 class CValidationInterface {
 protected:
     virtual void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload) {}
+    virtual void BlockConnected(const CBlockIndex *pindex) {}
+    virtual void BlockDisconnected(const CBlockIndex *pindex) {}
     virtual void SyncTransaction(const CTransaction &tx, const CBlockIndex *pindex, int posInBlock) {}
     virtual void SetBestChain(const CBlockLocator &locator) {}
     virtual void UpdatedTransaction(const uint256 &hash) {}
@@ -50,6 +52,18 @@ protected:
 struct CMainSignals {
     /** Notifies listeners of updated block chain tip */
     boost::signals2::signal<void (const CBlockIndex *, const CBlockIndex *, bool fInitialDownload)> UpdatedBlockTip;
+    /**
+     * Notifies listeners of a block joining the active chain, with cs_main
+     * held, after its transactions left the mempool. Unlike UpdatedBlockTip
+     * this fires for every block, including those of invalidateblock and
+     * reconsiderblock.
+     */
+    boost::signals2::signal<void (const CBlockIndex *)> BlockConnected;
+    /**
+     * Notifies listeners of a block leaving the active chain, with cs_main
+     * held, before its transactions are returned to the mempool.
+     */
+    boost::signals2::signal<void (const CBlockIndex *)> BlockDisconnected;
     /** A posInBlock value for SyncTransaction calls for tranactions not
      * included in connected blocks such as transactions removed from mempool,
      * accepted to mempool or appearing in disconnected blocks.*/
@@ -162,6 +162,8 @@ bool CCryptoKeyStore::Lock()
     {
         LOCK(cs_KeyStore);
         vMasterKey.clear();
+        mapDecryptedKeys.clear();
+        dequeDecryptedKeys.clear();
     }
 
     NotifyStatusChanged(this);
@@ -175,32 +177,29 @@ bool CCryptoKeyStore::Unlock(const CKeyingMaterial& vMasterKeyIn)
         if (!SetCrypted())
             return false;
 
+        // A sample of the keys is enough to tell whether the master key is
+        // right. The others are checked against their pubkey when GetKey
+        // first decrypts them, so unlocking does not scale with the wallet
+        // size. Keys are ordered by ID, so the first ones are a fair sample.
         bool keyPass = false;
         bool keyFail = false;
-        CryptedKeyMap::const_iterator mi = mapCryptedKeys.begin();
-        for (; mi != mapCryptedKeys.end(); ++mi)
+        unsigned int nChecked = 0;
+        for (CryptedKeyMap::const_iterator mi = mapCryptedKeys.begin(); mi != mapCryptedKeys.end() && nChecked < WALLET_UNLOCK_CHECKED_KEYS; ++mi, ++nChecked)
         {
-            const CPubKey &vchPubKey = (*mi).second.first;
-            const std::vector<unsigned char> &vchCryptedSecret = (*mi).second.second;
             CKey key;
-            if (!DecryptKey(vMasterKeyIn, vchCryptedSecret, vchPubKey, key))
+            if (!DecryptKey(vMasterKeyIn, (*mi).second.second, (*mi).second.first, key))
             {
                 keyFail = true;
-                break;
+                continue;
             }
             keyPass = true;
-            if (fDecryptionThoroughlyChecked)
-                break;
-        }
-        if (keyPass && keyFail)
-        {
-            LogPrintf("The wallet is probably corrupted: Some keys decrypt but not all.\n");
-            assert(false);
+            CacheDecryptedKey((*mi).first, key);
         }
-        if (keyFail || !keyPass)
+        if (!keyPass)
             return false;
+        if (keyFail)
+            LogPrintf("The wallet is probably corrupted: Some keys decrypt but not all.\n");
         vMasterKey = vMasterKeyIn;
-        fDecryptionThoroughlyChecked = true;
     }
     NotifyStatusChanged(this);
     return true;
@@ -227,6 +226,36 @@ bool CCryptoKeyStore::AddKeyPubKey(const CKey& key, const CPubKey &pubkey)
     return true;
 }
 
+bool CCryptoKeyStore::AddKeyPubKeys(const std::vector<std::pair<CKey, CPubKey> >& vKeys)
+{
+    {
+        LOCK(cs_KeyStore);
+        if (!IsCrypted()) {
+            for (const auto& key : vKeys) {
+                if (!CBasicKeyStore::AddKeyPubKey(key.first, key.second))
+                    return false;
+            }
+            return true;
+        }
+
+        if (IsLocked())
+            return false;
+
+        std::vector<std::pair<CPubKey, std::vector<unsigned char> > > vCryptedKeys;
+        vCryptedKeys.reserve(vKeys.size());
+        for (const auto& key : vKeys) {
+            std::vector<unsigned char> vchCryptedSecret;
+            CKeyingMaterial vchSecret(key.first.begin(), key.first.end());
+            if (!EncryptSecret(vMasterKey, vchSecret, key.second.GetHash(), vchCryptedSecret))
+                return false;
+            vCryptedKeys.push_back(std::make_pair(key.second, vchCryptedSecret));
+        }
+
+        if (!AddCryptedKeys(vCryptedKeys))
+            return false;
+    }
+    return true;
+}
 
 bool CCryptoKeyStore::AddCryptedKey(const CPubKey &vchPubKey, const std::vector<unsigned char> &vchCryptedSecret)
 {
@@ -240,6 +269,18 @@ bool CCryptoKeyStore::AddCryptedKey(const CPubKey &vchPubKey, const std::vector<
     return true;
 }
 
+bool CCryptoKeyStore::AddCryptedKeys(const std::vector<std::pair<CPubKey, std::vector<unsigned char> > >& vCryptedKeys)
+{
+    {
+        LOCK(cs_KeyStore);
+        for (const auto& key : vCryptedKeys) {
+            if (!CCryptoKeyStore::AddCryptedKey(key.first, key.second))
+                return false;
+        }
+    }
+    return true;
+}
+
 bool CCryptoKeyStore::GetKey(const CKeyID &address, CKey& keyOut) const
 {
     {
@@ -250,14 +291,41 @@ bool CCryptoKeyStore::GetKey(const CKeyID &address, CKey& keyOut) const
         CryptedKeyMap::const_iterator mi = mapCryptedKeys.find(address);
         if (mi != mapCryptedKeys.end())
         {
+            if (vMasterKey.empty())
+                return false;
+            std::map<CKeyID, CKey>::const_iterator ci = mapDecryptedKeys.find(address);
+            if (ci != mapDecryptedKeys.end())
+            {
+                keyOut = (*ci).second;
+                return true;
+            }
             const CPubKey &vchPubKey = (*mi).second.first;
             const std::vector<unsigned char> &vchCryptedSecret = (*mi).second.second;
-            return DecryptKey(vMasterKey, vchCryptedSecret, vchPubKey, keyOut);
+            if (!DecryptKey(vMasterKey, vchCryptedSecret, vchPubKey, keyOut))
+            {
+                // Unlock already proved the master key on another key
+                LogPrintf("The wallet is probably corrupted: Key %s does not decrypt.\n", address.ToString());
+                return false;
+            }
+            CacheDecryptedKey(address, keyOut);
+            return true;
         }
     }
     return false;
 }
 
+void CCryptoKeyStore::CacheDecryptedKey(const CKeyID& address, const CKey& key) const
+{
+    AssertLockHeld(cs_KeyStore);
+    if (!mapDecryptedKeys.insert(std::make_pair(address, key)).second)
+        return;
+    dequeDecryptedKeys.push_back(address);
+    if (dequeDecryptedKeys.size() > WALLET_DECRYPTED_KEY_CACHE_SIZE) {
+        mapDecryptedKeys.erase(dequeDecryptedKeys.front());
+        dequeDecryptedKeys.pop_front();
+    }
+}
+
 bool CCryptoKeyStore::GetPubKey(const CKeyID &address, CPubKey& vchPubKeyOut) const
 {
     {
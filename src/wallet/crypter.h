@@ -9,11 +9,18 @@
 #include "serialize.h"
 #include "support/allocators/secure.h"
 
+#include <deque>
+#include <map>
+
 class uint256;
 
 const unsigned int WALLET_CRYPTO_KEY_SIZE = 32;
 const unsigned int WALLET_CRYPTO_SALT_SIZE = 8;
 const unsigned int WALLET_CRYPTO_IV_SIZE = 16;
+//! Number of decrypted keys kept in secure memory while the wallet is unlocked
+const unsigned int WALLET_DECRYPTED_KEY_CACHE_SIZE = 4096;
+//! Number of keys Unlock decrypts to check the master key; the rest are checked on first use
+const unsigned int WALLET_UNLOCK_CHECKED_KEYS = 16;
 
 /**
  * Private key encryption is done based on a CMasterKey,
@@ -123,8 +130,14 @@ private:
     //! if fUseCrypto is false, vMasterKey must be empty
     bool fUseCrypto;
 
-    //! keeps track of whether Unlock has run a thorough check before
-    bool fDecryptionThoroughlyChecked;
+    //! Keys already decrypted and checked against their pubkey since the
+    //! last unlock, so signing with them again skips the AES and pubkey
+    //! work. The secrets live in secure memory and are wiped on Lock().
+    mutable std::map<CKeyID, CKey> mapDecryptedKeys;
+    //! mapDecryptedKeys entries, oldest first, for eviction
+    mutable std::deque<CKeyID> dequeDecryptedKeys;
+
+    void CacheDecryptedKey(const CKeyID& address, const CKey& key) const;
 
 protected:
     bool SetCrypted();
@@ -135,7 +148,7 @@ protected:
     bool Unlock(const CKeyingMaterial& vMasterKeyIn);
 
 public:
-    CCryptoKeyStore() : fUseCrypto(false), fDecryptionThoroughlyChecked(false)
+    CCryptoKeyStore() : fUseCrypto(false)
     {
     }
 
@@ -159,7 +172,11 @@ public:
     bool Lock();
 
     virtual bool AddCryptedKey(const CPubKey &vchPubKey, const std::vector<unsigned char> &vchCryptedSecret);
+    //! AddCryptedKey for many keys, so that overrides can store them together
+    virtual bool AddCryptedKeys(const std::vector<std::pair<CPubKey, std::vector<unsigned char> > >& vCryptedKeys);
     bool AddKeyPubKey(const CKey& key, const CPubKey &pubkey);
+    //! AddKeyPubKey for many keys, encrypting all of them under one hold of cs_KeyStore
+    bool AddKeyPubKeys(const std::vector<std::pair<CKey, CPubKey> >& vKeys);
     bool HaveKey(const CKeyID &address) const
     {
         {
@@ -296,9 +296,22 @@ CDB::CDB(const std::string& strFilename, const char* pszMode, bool fFlushOnClose
     }
 }
 
-void CDB::Flush()
+DbTxn* CDB::GetTxn(bool fWrite)
 {
     if (activeTxn)
+        return activeTxn;
+    CDBWriteBatch* batch = bitdb.GetBatch(strFile);
+    if (!batch)
+        return NULL;
+    if (fWrite)
+        batch->AddPending();
+    return batch->GetTxn();
+}
+
+void CDB::Flush()
+{
+    // An open batch checkpoints once when it is done
+    if (activeTxn || bitdb.GetBatch(strFile))
         return;
 
     // Flush database activity from memory pool to disk log
@@ -327,6 +340,78 @@ void CDB::Close()
     }
 }
 
+CDBWriteBatch* CDBEnv::GetBatch(const std::string& strFile)
+{
+    LOCK(cs_db);
+    std::map<std::string, CDBWriteBatch*>::const_iterator it = mapBatch.find(strFile);
+    if (it == mapBatch.end() || !it->second->IsOwnedByThisThread())
+        return NULL;
+    return it->second;
+}
+
+CDBWriteBatch::CDBWriteBatch(const std::string& strFileIn) : strFile(strFileIn), threadId(boost::this_thread::get_id()), ptxn(NULL), nPending(0), fActive(false), fCommitted(false)
+{
+    nBatchSize = std::max(GetArg("-walletbatchsize", DEFAULT_WALLET_BATCH_SIZE), (int64_t)0);
+    fSync = GetBoolArg("-walletbatchfsync", DEFAULT_WALLET_BATCH_FSYNC);
+    if (strFile.empty() || nBatchSize == 0)
+        return;
+
+    LOCK(bitdb.cs_db);
+    if (!bitdb.mapBatch.count(strFile)) {
+        bitdb.mapBatch[strFile] = this;
+        // Keep the file from being closed under the open transaction
+        ++bitdb.mapFileUseCount[strFile];
+        fActive = true;
+    }
+}
+
+CDBWriteBatch::~CDBWriteBatch()
+{
+    if (!fActive)
+        return;
+    if (ptxn) {
+        // Callers Commit() and check the result; this is for early exits
+        if (nPending)
+            LogPrintf("CDBWriteBatch: committing %u writes to %s left pending\n", nPending, strFile);
+        if (!Commit())
+            LogPrintf("CDBWriteBatch: writes to %s since the last commit were lost\n", strFile);
+    }
+    if (fCommitted)
+        bitdb.dbenv->txn_checkpoint(0, 0, 0);
+    {
+        LOCK(bitdb.cs_db);
+        bitdb.mapBatch.erase(strFile);
+        --bitdb.mapFileUseCount[strFile];
+    }
+}
+
+DbTxn* CDBWriteBatch::GetTxn()
+{
+    if (fActive && !ptxn)
+        ptxn = bitdb.TxnBegin();
+    return ptxn;
+}
+
+bool CDBWriteBatch::Commit()
+{
+    if (!ptxn)
+        return true;
+    int ret = ptxn->commit(fSync ? DB_TXN_SYNC : 0);
+    ptxn = NULL;
+    nPending = 0;
+    fCommitted = true;
+    if (ret != 0)
+        return error("CDBWriteBatch::Commit: Error %d committing %s: %s", ret, strFile, DbEnv::strerror(ret));
+    return true;
+}
+
+bool CDBWriteBatch::Checkpoint()
+{
+    if (nPending < nBatchSize)
+        return true;
+    return Commit();
+}
+
 void CDBEnv::CloseDb(const string& strFile)
 {
     {
@@ -17,11 +17,16 @@
 #include <vector>
 
 #include <boost/filesystem/path.hpp>
+#include <boost/thread/thread.hpp>
 
 #include <db_cxx.h>
 
 static const unsigned int DEFAULT_WALLET_DBLOGSIZE = 100;
 static const bool DEFAULT_WALLET_PRIVDB = true;
+static const unsigned int DEFAULT_WALLET_BATCH_SIZE = 1000;
+static const bool DEFAULT_WALLET_BATCH_FSYNC = false;
+
+class CDBWriteBatch;
 
 class CDBEnv
 {
@@ -39,6 +44,7 @@ public:
     DbEnv *dbenv;
     std::map<std::string, int> mapFileUseCount;
     std::map<std::string, Db*> mapDb;
+    std::map<std::string, CDBWriteBatch*> mapBatch;
 
     CDBEnv();
     ~CDBEnv();
@@ -75,10 +81,13 @@ public:
     void CloseDb(const std::string& strFile);
     bool RemoveDb(const std::string& strFile);
 
-    DbTxn* TxnBegin(int flags = DB_TXN_WRITE_NOSYNC)
+    //! Batch the calling thread has open on strFile, if any
+    CDBWriteBatch* GetBatch(const std::string& strFile);
+
+    DbTxn* TxnBegin(int flags = DB_TXN_WRITE_NOSYNC, DbTxn* parent = NULL)
     {
         DbTxn* ptxn = NULL;
-        int ret = dbenv->txn_begin(NULL, &ptxn, flags);
+        int ret = dbenv->txn_begin(parent, &ptxn, flags);
         if (!ptxn || ret != 0)
             return NULL;
         return ptxn;
@@ -87,6 +96,55 @@ public:
 
 extern CDBEnv bitdb;
 
+/**
+ * Groups the writes a thread makes to one database file into Berkeley DB
+ * transactions. While a batch is alive every CDB on strFile used by the
+ * creating thread reads and writes inside its transaction instead of
+ * committing (and checkpointing on close) record by record. Checkpoint()
+ * commits once -walletbatchsize records are pending and Commit() always
+ * does; owners call Commit() when done and check the result. The
+ * destructor only commits (and logs) what an early exit left pending.
+ * -walletbatchfsync makes each commit sync the log to disk.
+ *
+ * Writers to strFile from other threads wait for the open transaction, so
+ * the owner must hold whatever lock serializes them (cs_wallet for a
+ * wallet) for the whole life of the batch. A batch created while another
+ * one is open on the same file does nothing, as does one with
+ * -walletbatchsize=0.
+ */
+class CDBWriteBatch
+{
+private:
+    std::string strFile;
+    boost::thread::id threadId;
+    DbTxn* ptxn;
+    unsigned int nPending;
+    unsigned int nBatchSize;
+    bool fSync;
+    bool fActive;
+    bool fCommitted;
+
+    CDBWriteBatch(const CDBWriteBatch&);
+    void operator=(const CDBWriteBatch&);
+
+public:
+    explicit CDBWriteBatch(const std::string& strFileIn);
+    ~CDBWriteBatch();
+
+    bool IsActive() const { return fActive; }
+    bool IsOwnedByThisThread() const { return threadId == boost::this_thread::get_id(); }
+
+    //! Transaction to use for the next read or write, started on demand
+    DbTxn* GetTxn();
+    void AddPending() { ++nPending; }
+    unsigned int GetPending() const { return nPending; }
+
+    //! Commit the records written so far
+    bool Commit();
+    //! Commit if the batch is full
+    bool Checkpoint();
+};
+
 
 /** RAII class that provides access to a Berkeley database */
 class CDB
@@ -110,6 +168,9 @@ private:
     void operator=(const CDB&);
 
 protected:
+    //! activeTxn, or else the transaction of this thread's batch on strFile
+    DbTxn* GetTxn(bool fWrite = false);
+
     template <typename K, typename T>
     bool Read(const K& key, T& value)
     {
@@ -125,7 +186,7 @@ protected:
         // Read
         Dbt datValue;
         datValue.set_flags(DB_DBT_MALLOC);
-        int ret = pdb->get(activeTxn, &datKey, &datValue, 0);
+        int ret = pdb->get(GetTxn(), &datKey, &datValue, 0);
         memory_cleanse(datKey.get_data(), datKey.get_size());
         bool success = false;
         if (datValue.get_data() != NULL) {
@@ -166,7 +227,7 @@ protected:
         Dbt datValue(ssValue.data(), ssValue.size());
 
         // Write
-        int ret = pdb->put(activeTxn, &datKey, &datValue, (fOverwrite ? 0 : DB_NOOVERWRITE));
+        int ret = pdb->put(GetTxn(true), &datKey, &datValue, (fOverwrite ? 0 : DB_NOOVERWRITE));
 
         // Clear memory in case it was a private key
         memory_cleanse(datKey.get_data(), datKey.get_size());
@@ -189,7 +250,7 @@ protected:
         Dbt datKey(ssKey.data(), ssKey.size());
 
         // Erase
-        int ret = pdb->del(activeTxn, &datKey, 0);
+        int ret = pdb->del(GetTxn(true), &datKey, 0);
 
         // Clear memory
         memory_cleanse(datKey.get_data(), datKey.get_size());
@@ -209,7 +270,7 @@ protected:
         Dbt datKey(ssKey.data(), ssKey.size());
 
         // Exists
-        int ret = pdb->exists(activeTxn, &datKey, 0);
+        int ret = pdb->exists(GetTxn(), &datKey, 0);
 
         // Clear memory
         memory_cleanse(datKey.get_data(), datKey.get_size());
@@ -221,7 +282,7 @@ protected:
         if (!pdb)
             return NULL;
         Dbc* pcursor = NULL;
-        int ret = pdb->cursor(NULL, &pcursor, 0);
+        int ret = pdb->cursor(GetTxn(), &pcursor, 0);
         if (ret != 0)
             return NULL;
         return pcursor;
@@ -267,7 +328,8 @@ public:
     {
         if (!pdb || activeTxn)
             return false;
-        DbTxn* ptxn = bitdb.TxnBegin();
+        // Nest inside an open batch so both see each other's writes
+        DbTxn* ptxn = bitdb.TxnBegin(DB_TXN_WRITE_NOSYNC, GetTxn());
         if (!ptxn)
             return false;
         activeTxn = ptxn;
@@ -465,10 +465,10 @@ UniValue listaddressgroupings(const JSONRPCRequest& request)
 
     UniValue jsonGroupings(UniValue::VARR);
     map<CTxDestination, CAmount> balances = pwalletMain->GetAddressBalances();
-    BOOST_FOREACH(set<CTxDestination> grouping, pwalletMain->GetAddressGroupings())
+    BOOST_FOREACH(const set<CTxDestination>& grouping, pwalletMain->GetAddressGroupings())
     {
         UniValue jsonGrouping(UniValue::VARR);
-        BOOST_FOREACH(CTxDestination address, grouping)
+        BOOST_FOREACH(const CTxDestination& address, grouping)
         {
             UniValue addressInfo(UniValue::VARR);
             addressInfo.push_back(CBitcoinAddress(address).ToString());
@@ -1162,35 +1162,49 @@ UniValue ListReceived(const UniValue& params, bool fByAccounts)
         if(params[2].get_bool())
             filter = filter | ISMINE_WATCH_ONLY;
 
-    // Tally
+    // Tally, visiting only the transactions that pay an address book entry
     map<CBitcoinAddress, tallyitem> mapTally;
-    for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it)
+    BOOST_FOREACH(const PAIRTYPE(const CTxDestination, CAddressBookData)& entry, pwalletMain->mapAddressBook)
     {
-        const CWalletTx& wtx = (*it).second;
-
-        if (wtx.IsCoinBase() || !CheckFinalTx(*wtx.tx))
+        const CTxDestination& address = entry.first;
+        isminefilter mine = IsMine(*pwalletMain, address);
+        if(!(mine & filter))
             continue;
 
-        int nDepth = wtx.GetDepthInMainChain();
-        if (nDepth < nMinDepth)
-            continue;
+        std::set<CTxDestination> setAddress;
+        setAddress.insert(address);
+        std::vector<const CWalletTx*> vwtx;
+        pwalletMain->WalkOrderedTxItems(std::numeric_limits<int64_t>::max(), &setAddress, [&](int64_t nPos, const CWallet::TxPair& item) {
+            vwtx.push_back(item.first);
+            return true;
+        });
+        // List txids in mapWallet order
+        std::sort(vwtx.begin(), vwtx.end(), [](const CWalletTx* a, const CWalletTx* b) { return a->GetHash() < b->GetHash(); });
 
-        BOOST_FOREACH(const CTxOut& txout, wtx.tx->vout)
+        BOOST_FOREACH(const CWalletTx* pwtx, vwtx)
         {
-            CTxDestination address;
-            if (!ExtractDestination(txout.scriptPubKey, address))
+            const CWalletTx& wtx = *pwtx;
+
+            if (wtx.IsCoinBase() || !CheckFinalTx(*wtx.tx))
                 continue;
 
-            isminefilter mine = IsMine(*pwalletMain, address);
-            if(!(mine & filter))
+            int nDepth = wtx.GetDepthInMainChain();
+            if (nDepth < nMinDepth)
                 continue;
 
-            tallyitem& item = mapTally[address];
-            item.nAmount += txout.nValue;
-            item.nConf = min(item.nConf, nDepth);
-            item.txids.push_back(wtx.GetHash());
-            if (mine & ISMINE_WATCH_ONLY)
-                item.fIsWatchonly = true;
+            BOOST_FOREACH(const CTxOut& txout, wtx.tx->vout)
+            {
+                CTxDestination txoutAddress;
+                if (!ExtractDestination(txout.scriptPubKey, txoutAddress) || !(txoutAddress == address))
+                    continue;
+
+                tallyitem& item = mapTally[address];
+                item.nAmount += txout.nValue;
+                item.nConf = min(item.nConf, nDepth);
+                item.txids.push_back(wtx.GetHash());
+                if (mine & ISMINE_WATCH_ONLY)
+                    item.fIsWatchonly = true;
+            }
         }
     }
 
@@ -1571,6 +1585,180 @@ UniValue listtransactions(const JSONRPCRequest& request)
     return ret;
 }
 
+static const unsigned char TX_HISTORY_CURSOR_VERSION = 1;
+
+/**
+ * A history cursor names the wallet order position to resume at and how many
+ * entries at that position were already returned. Order positions never
+ * change once assigned, so a cursor stays valid while new transactions come in.
+ */
+static std::string EncodeTxHistoryCursor(int64_t nOrderPos, uint32_t nSkip)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << TX_HISTORY_CURSOR_VERSION << nOrderPos << nSkip;
+    return HexStr(ss.begin(), ss.end());
+}
+
+static void DecodeTxHistoryCursor(const std::string& strCursor, int64_t& nOrderPos, uint32_t& nSkip)
+{
+    if (!IsHex(strCursor))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+    std::vector<unsigned char> data(ParseHex(strCursor));
+    CDataStream ss(data, SER_NETWORK, PROTOCOL_VERSION);
+    unsigned char nVersion;
+    try {
+        ss >> nVersion >> nOrderPos >> nSkip;
+    } catch (const std::exception&) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+    }
+    if (nVersion != TX_HISTORY_CURSOR_VERSION || !ss.empty() || nOrderPos < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+}
+
+UniValue listtransactionhistory(const JSONRPCRequest& request)
+{
+    if (!EnsureWalletIsAvailable(request.fHelp))
+        return NullUniValue;
+
+    if (request.fHelp || request.params.size() > 3)
+        throw runtime_error(
+            "listtransactionhistory ( count \"cursor\" options )\n"
+            "\nReturns up to 'count' wallet transaction entries, newest first, starting at 'cursor'.\n"
+            "Unlike listtransactions the cost of a page does not depend on how far back it is.\n"
+            "\nArguments:\n"
+            "1. count          (numeric, optional, default=10) The number of entries to return\n"
+            "2. \"cursor\"       (string, optional) The \"next\" value of a previous call. Omit to start at the newest entry\n"
+            "3. options        (json, optional)\n"
+            "   {\n"
+            "     \"address\"            (string, optional) Only entries for this prux address\n"
+            "     \"label\"              (string, optional) Only entries for addresses with this label\n"
+            "     \"start_time\"         (numeric, optional) Only transactions with a time at or after this (seconds since epoch)\n"
+            "     \"end_time\"           (numeric, optional) Only transactions with a time at or before this (seconds since epoch)\n"
+            "     \"include_watchonly\"  (bool, optional, default=false) Include transactions to watch-only addresses\n"
+            "   }\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"transactions\": [ ... ],   (array) Entries as returned by listtransactions, newest first\n"
+            "  \"next\": \"cursor\"           (string) Cursor for the following page. Not present after the oldest entry\n"
+            "}\n"
+            "\nThe same options must be passed with every cursor of a listing.\n"
+            "\nExamples:\n"
+            + HelpExampleCli("listtransactionhistory", "100")
+            + HelpExampleCli("listtransactionhistory", "100 \"cursor\" '{\"label\": \"donations\"}'")
+            + HelpExampleRpc("listtransactionhistory", "100, \"cursor\", {\"start_time\": 1500000000}")
+        );
+
+    int nCount = 10;
+    if (request.params.size() > 0 && !request.params[0].isNull()) {
+        RPCTypeCheckArgument(request.params[0], UniValue::VNUM);
+        nCount = request.params[0].get_int();
+    }
+    if (nCount < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative count");
+
+    int64_t nStartPos = std::numeric_limits<int64_t>::max();
+    uint32_t nSkip = 0;
+    if (request.params.size() > 1 && !request.params[1].isNull()) {
+        RPCTypeCheckArgument(request.params[1], UniValue::VSTR);
+        DecodeTxHistoryCursor(request.params[1].get_str(), nStartPos, nSkip);
+    }
+
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+
+    std::set<CTxDestination> setDests;
+    bool fDestFilter = false;
+    int64_t nStartTime = std::numeric_limits<int64_t>::min();
+    int64_t nEndTime = std::numeric_limits<int64_t>::max();
+    isminefilter filter = ISMINE_SPENDABLE;
+    if (request.params.size() > 2 && !request.params[2].isNull()) {
+        const UniValue& options = request.params[2].get_obj();
+        RPCTypeCheckObj(options,
+            {
+                {"address", UniValueType(UniValue::VSTR)},
+                {"label", UniValueType(UniValue::VSTR)},
+                {"start_time", UniValueType(UniValue::VNUM)},
+                {"end_time", UniValueType(UniValue::VNUM)},
+                {"include_watchonly", UniValueType(UniValue::VBOOL)},
+            },
+            true, true);
+
+        if (options.exists("address") && options.exists("label"))
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Cannot filter by both address and label");
+        if (options.exists("address")) {
+            CBitcoinAddress address(options["address"].get_str());
+            if (!address.IsValid())
+                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid Prux address");
+            setDests.insert(address.Get());
+            fDestFilter = true;
+        }
+        if (options.exists("label")) {
+            const std::string strLabel = options["label"].get_str();
+            BOOST_FOREACH(const PAIRTYPE(CTxDestination, CAddressBookData)& item, pwalletMain->mapAddressBook)
+                if (item.second.name == strLabel)
+                    setDests.insert(item.first);
+            fDestFilter = true;
+        }
+        if (options.exists("start_time"))
+            nStartTime = options["start_time"].get_int64();
+        if (options.exists("end_time"))
+            nEndTime = options["end_time"].get_int64();
+        if (options.exists("include_watchonly") && options["include_watchonly"].get_bool())
+            filter = filter | ISMINE_WATCH_ONLY;
+    }
+
+    std::set<std::string> setAddresses;
+    BOOST_FOREACH(const CTxDestination& dest, setDests)
+        setAddresses.insert(CBitcoinAddress(dest).ToString());
+
+    UniValue transactions(UniValue::VARR);
+    std::string strNext;
+    int64_t nLastPos = -1;
+    uint32_t nSeenAtPos = 0;
+    pwalletMain->WalkOrderedTxItems(nStartPos, fDestFilter ? &setDests : NULL, [&](int64_t nPos, const CWallet::TxPair& item) {
+        const CWalletTx* pwtx = item.first;
+        const CAccountingEntry* pacentry = item.second;
+        const int64_t nTime = pwtx ? pwtx->GetTxTime() : pacentry->nTime;
+        if (nTime < nStartTime || nTime > nEndTime)
+            return true;
+
+        UniValue entries(UniValue::VARR);
+        if (pwtx)
+            ListTransactions(*pwtx, "*", 0, true, entries, filter);
+        else
+            AcentryToJSON(*pacentry, "*", entries);
+        // Reverse the entries of each item too, so that the full listing is
+        // exactly listtransactions in reverse.
+        std::vector<UniValue> vEntries = entries.getValues();
+        std::reverse(vEntries.begin(), vEntries.end());
+
+        if (nPos != nLastPos) {
+            nLastPos = nPos;
+            nSeenAtPos = 0;
+        }
+        BOOST_FOREACH(const UniValue& entry, vEntries) {
+            if (fDestFilter && !setAddresses.count(find_value(entry, "address").getValStr()))
+                continue;
+            if (nPos == nStartPos && nSeenAtPos < nSkip) {
+                nSeenAtPos++;
+                continue;
+            }
+            if ((int)transactions.size() >= nCount) {
+                strNext = EncodeTxHistoryCursor(nPos, nSeenAtPos);
+                return false;
+            }
+            transactions.push_back(entry);
+            nSeenAtPos++;
+        }
+        return true;
+    });
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("transactions", transactions));
+    if (!strNext.empty())
+        ret.push_back(Pair("next", strNext));
+    return ret;
+}
+
 UniValue listaccounts(const JSONRPCRequest& request)
 {
     if (!EnsureWalletIsAvailable(request.fHelp))
@@ -2335,6 +2523,11 @@ UniValue getwalletinfo(const JSONRPCRequest& request)
             "  \"unlocked_until\": ttt,        (numeric) the timestamp in seconds since epoch (midnight Jan 1 1970 GMT) that the wallet is unlocked for transfers, or 0 if the wallet is locked\n"
             "  \"paytxfee\": x.xxxx,           (numeric) the transaction fee configuration, set in " + CURRENCY_UNIT + "/kB\n"
             "  \"hdmasterkeyid\": \"<hash160>\" (string) the Hash160 of the HD master pubkey\n"
+            "  \"scanning\":                   (json object) current scanning details, or false if no scan is in progress\n"
+            "    {\n"
+            "      \"duration\" : xxxx          (numeric) elapsed seconds since scan start\n"
+            "      \"progress\" : x.xxxx,       (numeric) scanning progress percentage [0.0, 1.0]\n"
+            "    }\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getwalletinfo", "")
@@ -2357,6 +2550,14 @@ UniValue getwalletinfo(const JSONRPCRequest& request)
     CKeyID masterKeyID = pwalletMain->GetHDChain().masterKeyID;
     if (!masterKeyID.IsNull())
          obj.push_back(Pair("hdmasterkeyid", masterKeyID.GetHex()));
+    if (pwalletMain->IsScanning()) {
+        UniValue scanning(UniValue::VOBJ);
+        scanning.push_back(Pair("duration", pwalletMain->ScanningDuration() / 1000));
+        scanning.push_back(Pair("progress", pwalletMain->ScanningProgress()));
+        obj.push_back(Pair("scanning", scanning));
+    } else {
+        obj.push_back(Pair("scanning", false));
+    }
     return obj;
 }
 
@@ -3021,6 +3222,7 @@ extern UniValue importwallet(const JSONRPCRequest& request);
 extern UniValue importprunedfunds(const JSONRPCRequest& request);
 extern UniValue removeprunedfunds(const JSONRPCRequest& request);
 extern UniValue importmulti(const JSONRPCRequest& request);
+extern UniValue abortrescan(const JSONRPCRequest& request);
 
 static const CRPCCommand commands[] =
 { //  category              name                        actor (function)           okSafeMode
@@ -3028,6 +3230,7 @@ static const CRPCCommand commands[] =
     { "rawtransactions",    "fundrawtransaction",       &fundrawtransaction,       false,  {"hexstring","options"} },
     { "hidden",             "resendwallettransactions", &resendwallettransactions, true,   {} },
     { "wallet",             "abandontransaction",       &abandontransaction,       false,  {"txid"} },
+    { "wallet",             "abortrescan",              &abortrescan,              false,  {} },
     { "wallet",             "addmultisigaddress",       &addmultisigaddress,       true,   {"nrequired","keys","account"} },
     { "wallet",             "addwitnessaddress",        &addwitnessaddress,        true,   {"address"} },
     { "wallet",             "backupwallet",             &backupwallet,             true,   {"destination"} },
@@ -3060,6 +3263,7 @@ static const CRPCCommand commands[] =
     { "wallet",             "listreceivedbyaddress",    &listreceivedbyaddress,    false,  {"minconf","include_empty","include_watchonly"} },
     { "wallet",             "listsinceblock",           &listsinceblock,           false,  {"blockhash","target_confirmations","include_watchonly"} },
     { "wallet",             "listtransactions",         &listtransactions,         false,  {"account","count","skip","include_watchonly"} },
+    { "wallet",             "listtransactionhistory",   &listtransactionhistory,   false,  {"count","cursor","options"} },
     { "wallet",             "listunspent",              &listunspent,              false,  {"minconf","maxconf","addresses","include_unsafe","query_options"} },
     { "wallet",             "lockunspent",              &lockunspent,              true,   {"unlock","transactions"} },
     { "wallet",             "move",                     &movecmd,                  false,  {"fromaccount","toaccount","amount","minconf","comment"} },
@@ -235,4 +235,86 @@ BOOST_AUTO_TEST_CASE(decrypt) {
     }
 }
 
+class TestCryptoKeyStore : public CCryptoKeyStore
+{
+public:
+    using CCryptoKeyStore::EncryptKeys;
+    using CCryptoKeyStore::Unlock;
+};
+
+BOOST_AUTO_TEST_CASE(keystore_unlock) {
+    CKeyingMaterial vMasterKey(WALLET_CRYPTO_KEY_SIZE);
+    GetRandBytes(&vMasterKey[0], WALLET_CRYPTO_KEY_SIZE);
+
+    TestCryptoKeyStore keystore;
+    std::vector<CKey> vKeys(3);
+    for (CKey& key : vKeys) {
+        key.MakeNewKey(true);
+        BOOST_CHECK(keystore.AddKey(key));
+    }
+    BOOST_CHECK(keystore.EncryptKeys(vMasterKey));
+    BOOST_CHECK(keystore.Lock());
+
+    CKey key;
+    BOOST_CHECK(!keystore.GetKey(vKeys[0].GetPubKey().GetID(), key));
+    CKeyingMaterial vWrongKey(vMasterKey);
+    vWrongKey[0] ^= 1;
+    BOOST_CHECK(!keystore.Unlock(vWrongKey));
+    BOOST_CHECK(keystore.IsLocked());
+    BOOST_CHECK(keystore.Unlock(vMasterKey));
+
+    // Second lookups come from the decrypted key cache
+    for (int i = 0; i < 2; i++) {
+        for (const CKey& k : vKeys) {
+            BOOST_CHECK(keystore.GetKey(k.GetPubKey().GetID(), key));
+            BOOST_CHECK(key == k);
+        }
+    }
+
+    // A damaged key is only noticed when it is used
+    CKey badKey;
+    badKey.MakeNewKey(true);
+    BOOST_CHECK(keystore.AddCryptedKey(badKey.GetPubKey(), std::vector<unsigned char>(48, 0)));
+    BOOST_CHECK(!keystore.GetKey(badKey.GetPubKey().GetID(), key));
+
+    // A damaged key among those Unlock checks does not make the master key
+    // look wrong; only the damaged key is unusable
+    BOOST_CHECK(keystore.Lock());
+    BOOST_CHECK(!keystore.Unlock(vWrongKey));
+    BOOST_CHECK(keystore.Unlock(vMasterKey));
+    BOOST_CHECK(!keystore.GetKey(badKey.GetPubKey().GetID(), key));
+    BOOST_CHECK(keystore.GetKey(vKeys[0].GetPubKey().GetID(), key));
+
+    BOOST_CHECK(keystore.Lock());
+    BOOST_CHECK(!keystore.GetKey(vKeys[0].GetPubKey().GetID(), key));
+}
+
+BOOST_AUTO_TEST_CASE(keystore_add_keys) {
+    CKeyingMaterial vMasterKey(WALLET_CRYPTO_KEY_SIZE);
+    GetRandBytes(&vMasterKey[0], WALLET_CRYPTO_KEY_SIZE);
+
+    TestCryptoKeyStore keystore;
+    std::vector<std::pair<CKey, CPubKey> > vKeys(6);
+    for (auto& key : vKeys) {
+        key.first.MakeNewKey(true);
+        key.second = key.first.GetPubKey();
+    }
+    std::vector<std::pair<CKey, CPubKey> > vPlain(vKeys.begin(), vKeys.begin() + 3);
+    std::vector<std::pair<CKey, CPubKey> > vCrypted(vKeys.begin() + 3, vKeys.end());
+
+    BOOST_CHECK(keystore.AddKeyPubKeys(vPlain));
+    BOOST_CHECK(keystore.EncryptKeys(vMasterKey));
+    BOOST_CHECK(keystore.Lock());
+    BOOST_CHECK(!keystore.AddKeyPubKeys(vCrypted));
+    BOOST_CHECK(!keystore.HaveKey(vCrypted[0].second.GetID()));
+
+    BOOST_CHECK(keystore.Unlock(vMasterKey));
+    BOOST_CHECK(keystore.AddKeyPubKeys(vCrypted));
+    for (const auto& k : vKeys) {
+        CKey key;
+        BOOST_CHECK(keystore.GetKey(k.second.GetID(), key));
+        BOOST_CHECK(key == k.first);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -10,6 +10,8 @@
 #include <utility>
 #include <vector>
 
+#include "chainparams.h"
+#include "consensus/validation.h"
 #include "rpc/server.h"
 #include "test/test_bitcoin.h"
 #include "validation.h"
@@ -364,6 +366,31 @@ BOOST_AUTO_TEST_CASE(ApproximateBestSubset)
     empty_wallet();
 }
 
+BOOST_AUTO_TEST_CASE(coin_selection_many_coins)
+{
+    CoinSet setCoinsRet;
+    CAmount nValueRet;
+
+    LOCK(wallet.cs_wallet);
+
+    empty_wallet();
+
+    // Many small coins of assorted values: an exact subset is found
+    for (int i = 0; i < 10000; i++)
+        add_coin(CENT * (1 + (i * 37) % 50));
+    add_coin(1000 * COIN);
+
+    BOOST_CHECK(wallet.SelectCoinsMinConf(7 * COIN + 3 * CENT, 1, 6, 0, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 7 * COIN + 3 * CENT);
+
+    // No subset of the small coins hits this, and the big coin leaves too much change
+    BOOST_CHECK(wallet.SelectCoinsMinConf(7 * COIN + 1, 1, 6, 0, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK(nValueRet >= 7 * COIN + 1 + MIN_CHANGE);
+    BOOST_CHECK(nValueRet < 1000 * COIN);
+
+    empty_wallet();
+}
+
 BOOST_FIXTURE_TEST_CASE(rescan, TestChain240Setup)
 {
     LOCK(cs_main);
@@ -526,4 +553,408 @@ BOOST_AUTO_TEST_CASE(GetMinimumFee_dust_test)
     BOOST_CHECK_EQUAL(CWallet::GetMinimumFee(tx, 1999, 0, pool), 3 * nMinTxFee);
 }
 
+// Verify the incrementally maintained balances follow coinbase maturity and
+// reorgs. fCheckWalletBalances makes every query compare against a full scan.
+BOOST_FIXTURE_TEST_CASE(balance_ledger, TestChain240Setup)
+{
+    bool fCheckWalletBalancesBackup = fCheckWalletBalances;
+    fCheckWalletBalances = true;
+    LOCK(cs_main);
+
+    CWallet wallet;
+    LOCK(wallet.cs_wallet);
+    wallet.AddKeyPubKey(coinbaseKey, coinbaseKey.GetPubKey());
+    wallet.ScanForWalletTransactions(chainActive.Genesis());
+
+    CAmount nTotal = 0;
+    BOOST_FOREACH(const CTransaction& tx, coinbaseTxns)
+        nTotal += tx.GetValueOut();
+    const CAmount nBalance = wallet.GetBalance();
+    const CAmount nImmature = wallet.GetImmatureBalance();
+    BOOST_CHECK(nBalance > 0);
+    BOOST_CHECK(nImmature > 0);
+    BOOST_CHECK_EQUAL(nBalance + nImmature, nTotal);
+    BOOST_CHECK_EQUAL(wallet.GetUnconfirmedBalance(), 0);
+
+    // A block paying someone else matures one of our coinbases without the
+    // wallet being notified about it.
+    CKey otherKey;
+    otherKey.MakeNewKey(true);
+    CreateAndProcessBlock({}, GetScriptForRawPubKey(otherKey.GetPubKey()));
+    const CAmount nMatured = wallet.GetBalance() - nBalance;
+    BOOST_CHECK(nMatured > 0);
+    BOOST_CHECK_EQUAL(wallet.GetImmatureBalance(), nImmature - nMatured);
+
+    // Disconnecting that block makes the coinbase immature again.
+    CValidationState state;
+    InvalidateBlock(state, Params(), chainActive.Tip());
+    BOOST_CHECK_EQUAL(wallet.GetBalance(), nBalance);
+    BOOST_CHECK_EQUAL(wallet.GetImmatureBalance(), nImmature);
+
+    fCheckWalletBalances = fCheckWalletBalancesBackup;
+}
+
+// A transaction that only spends wallet coins has no output the rescan
+// prefilter matches on; it must still be picked up through its inputs.
+BOOST_FIXTURE_TEST_CASE(rescan_spend_only, TestChain240Setup)
+{
+    CKey otherKey;
+    otherKey.MakeNewKey(true);
+    const CScript scriptCoinbase = GetScriptForRawPubKey(coinbaseKey.GetPubKey());
+    CMutableTransaction spend;
+    CBlockIndex* pindexGenesis;
+    {
+        LOCK(cs_main);
+        spend.vin.resize(1);
+        spend.vin[0].prevout = COutPoint(coinbaseTxns[0].GetHash(), 0);
+        spend.vout.resize(1);
+        spend.vout[0].nValue = coinbaseTxns[0].vout[0].nValue - COIN;
+        spend.vout[0].scriptPubKey = GetScriptForDestination(otherKey.GetPubKey().GetID());
+        uint256 hash = SignatureHash(scriptCoinbase, spend, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+        std::vector<unsigned char> vchSig;
+        BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+        vchSig.push_back((unsigned char)SIGHASH_ALL);
+        spend.vin[0].scriptSig << vchSig;
+        CreateAndProcessBlock({spend}, GetScriptForDestination(otherKey.GetPubKey().GetID()));
+        BOOST_CHECK_EQUAL(chainActive.Tip()->nTx, 2U);
+        pindexGenesis = chainActive.Genesis();
+    }
+    const uint256 spendHash = spend.GetHash();
+
+    CWallet wallet;
+    {
+        LOCK(wallet.cs_wallet);
+        wallet.AddKeyPubKey(coinbaseKey, coinbaseKey.GetPubKey());
+    }
+    // Called without cs_main or cs_wallet, like the RPCs do
+    BOOST_CHECK(wallet.ScanForWalletTransactions(pindexGenesis) != NULL);
+    BOOST_CHECK(!wallet.IsScanning());
+    LOCK2(cs_main, wallet.cs_wallet);
+    BOOST_CHECK(wallet.GetWalletTx(spendHash) != NULL);
+    BOOST_CHECK(wallet.IsSpent(coinbaseTxns[0].GetHash(), 0));
+    BOOST_CHECK_EQUAL(wallet.mapWallet.size(), coinbaseTxns.size() + 1);
+}
+
+BOOST_AUTO_TEST_CASE(owned_scripts)
+{
+    CWallet wallet;
+    LOCK(wallet.cs_wallet);
+
+    CKey keys[4];
+    for (int i = 0; i < 4; i++)
+        keys[i].MakeNewKey(i != 1);
+    wallet.AddKeyPubKey(keys[0], keys[0].GetPubKey());
+    wallet.AddKeyPubKey(keys[1], keys[1].GetPubKey());
+    const CScript witness = GetScriptForWitness(GetScriptForDestination(keys[0].GetPubKey().GetID()));
+    wallet.AddCScript(witness);
+    const CScript multisig = GetScriptForMultisig(1, {keys[0].GetPubKey(), keys[1].GetPubKey()});
+    wallet.AddCScript(multisig);
+    const CScript watched = GetScriptForDestination(keys[2].GetPubKey().GetID());
+    wallet.AddWatchOnly(watched, 0);
+
+    const std::vector<std::pair<CScript, isminetype> > vScripts = {
+        {GetScriptForRawPubKey(keys[0].GetPubKey()), ISMINE_SPENDABLE},
+        {GetScriptForRawPubKey(keys[1].GetPubKey()), ISMINE_SPENDABLE},
+        {GetScriptForDestination(keys[0].GetPubKey().GetID()), ISMINE_SPENDABLE},
+        {witness, ISMINE_SPENDABLE},
+        {GetScriptForDestination(CScriptID(witness)), ISMINE_SPENDABLE},
+        {GetScriptForDestination(CScriptID(multisig)), ISMINE_SPENDABLE},
+        {multisig, ISMINE_SPENDABLE},
+        {watched, ISMINE_WATCH_UNSOLVABLE},
+        {GetScriptForRawPubKey(keys[2].GetPubKey()), ISMINE_NO},
+        {GetScriptForDestination(keys[3].GetPubKey().GetID()), ISMINE_NO},
+        {GetScriptForWitness(GetScriptForDestination(keys[1].GetPubKey().GetID())), ISMINE_NO},
+        {GetScriptForWitness(multisig), ISMINE_NO},
+        {GetScriptForDestination(CScriptID(watched)), ISMINE_NO},
+    };
+    for (const auto& script : vScripts) {
+        BOOST_CHECK_EQUAL(wallet.IsMine(CTxOut(0, script.first)), ::IsMine(wallet, script.first));
+        BOOST_CHECK_EQUAL(wallet.IsMine(CTxOut(0, script.first)), script.second);
+    }
+}
+
+// Walking the order index for a set of destinations must visit the same
+// transactions, in the same order, as filtering the full walk.
+BOOST_AUTO_TEST_CASE(ordered_tx_items_by_destination)
+{
+    CWallet wallet;
+    LOCK(wallet.cs_wallet);
+
+    CKey keys[3];
+    for (int i = 0; i < 3; i++)
+        keys[i].MakeNewKey(true);
+    for (int i = 0; i < 30; i++) {
+        CMutableTransaction tx;
+        tx.nLockTime = i;
+        tx.vout.resize(1 + i % 2);
+        tx.vout[0].nValue = COIN;
+        tx.vout[0].scriptPubKey = GetScriptForDestination(keys[i % 3].GetPubKey().GetID());
+        if (i % 2)
+            tx.vout[1].scriptPubKey = GetScriptForDestination(keys[(i + 1) % 3].GetPubKey().GetID());
+        CWalletTx wtx(&wallet, MakeTransactionRef(std::move(tx)));
+        wtx.nOrderPos = i;
+        wallet.LoadToWallet(wtx);
+    }
+
+    std::set<CTxDestination> setDests;
+    setDests.insert(keys[0].GetPubKey().GetID());
+    setDests.insert(keys[1].GetPubKey().GetID());
+    for (int64_t nStartPos : {int64_t(29), int64_t(17), int64_t(0)}) {
+        std::vector<int64_t> vExpected, vFound;
+        wallet.WalkOrderedTxItems(nStartPos, NULL, [&](int64_t nPos, const CWallet::TxPair& item) {
+            BOOST_FOREACH(const CTxOut& txout, item.first->tx->vout) {
+                CTxDestination dest;
+                if (ExtractDestination(txout.scriptPubKey, dest) && setDests.count(dest)) {
+                    vExpected.push_back(nPos);
+                    break;
+                }
+            }
+            return true;
+        });
+        wallet.WalkOrderedTxItems(nStartPos, &setDests, [&](int64_t nPos, const CWallet::TxPair& item) {
+            vFound.push_back(nPos);
+            return true;
+        });
+        BOOST_CHECK(!vExpected.empty());
+        BOOST_CHECK(vFound == vExpected);
+    }
+
+    int nVisited = 0;
+    wallet.WalkOrderedTxItems(std::numeric_limits<int64_t>::max(), &setDests, [&](int64_t nPos, const CWallet::TxPair& item) {
+        return ++nVisited < 5;
+    });
+    BOOST_CHECK_EQUAL(nVisited, 5);
+}
+
+// Writes through any CWalletDB on the batch's thread join its transaction,
+// including transactions those handles begin themselves.
+BOOST_AUTO_TEST_CASE(wallet_db_batch)
+{
+    const std::string& strFile = pwalletMain->strWalletFile;
+    CKey key;
+    key.MakeNewKey(true);
+    CKeyPool keypool;
+    {
+        CDBWriteBatch dbBatch(strFile);
+        BOOST_CHECK(dbBatch.IsActive());
+        CDBWriteBatch nested(strFile);
+        BOOST_CHECK(!nested.IsActive());
+
+        for (int i = 1; i <= 3; i++)
+            BOOST_CHECK(CWalletDB(strFile).WritePool(1000 + i, CKeyPool(key.GetPubKey())));
+        BOOST_CHECK_EQUAL(dbBatch.GetPending(), 3U);
+        BOOST_CHECK(CWalletDB(strFile).ReadPool(1002, keypool));
+        BOOST_CHECK(keypool.vchPubKey == key.GetPubKey());
+
+        CWalletDB walletdb(strFile);
+        BOOST_CHECK(walletdb.TxnBegin());
+        BOOST_CHECK(walletdb.ErasePool(1003));
+        BOOST_CHECK(walletdb.TxnCommit());
+
+        BOOST_CHECK(dbBatch.Commit());
+        BOOST_CHECK_EQUAL(dbBatch.GetPending(), 0U);
+        // Left pending, as on an early exit; the destructor commits it
+        BOOST_CHECK(CWalletDB(strFile).WritePool(1004, CKeyPool(key.GetPubKey())));
+    }
+
+    CWalletDB walletdb(strFile);
+    BOOST_CHECK(walletdb.ReadPool(1001, keypool));
+    BOOST_CHECK(!walletdb.ReadPool(1003, keypool));
+    BOOST_CHECK(walletdb.ReadPool(1004, keypool));
+    for (int i = 1; i <= 4; i++)
+        walletdb.ErasePool(1000 + i);
+}
+
+// Keys generated in bulk must be the same HD children, in the same order,
+// as generating them one by one would give.
+BOOST_AUTO_TEST_CASE(generate_new_keys)
+{
+    LOCK(pwalletMain->cs_wallet);
+    if (!pwalletMain->IsHDEnabled())
+        pwalletMain->SetHDMasterKey(pwalletMain->GenerateNewHDMasterKey());
+
+    std::vector<CPubKey> vPubKeys;
+    pwalletMain->GenerateNewKeys(50, vPubKeys);
+    BOOST_CHECK_EQUAL(vPubKeys.size(), 50U);
+    vPubKeys.push_back(pwalletMain->GenerateNewKey());
+
+    CExtKey externalChainChildKey;
+    pwalletMain->DeriveExternalChainKey(externalChainChildKey);
+    int nFirst = 0;
+    for (size_t i = 0; i < vPubKeys.size(); i++) {
+        BOOST_CHECK(pwalletMain->HaveKey(vPubKeys[i].GetID()));
+        // m/0'/0'/<n>'
+        const std::string strKeypath = pwalletMain->mapKeyMetadata[vPubKeys[i].GetID()].hdKeypath;
+        const int n = atoi(strKeypath.substr(7, strKeypath.size() - 8));
+        if (i == 0)
+            nFirst = n;
+        BOOST_CHECK_EQUAL(n, nFirst + (int)i);
+        CExtKey childKey;
+        externalChainChildKey.Derive(childKey, n | 0x80000000); // hardened
+        BOOST_CHECK(childKey.key.GetPubKey() == vPubKeys[i]);
+    }
+}
+
+static std::set<CTxDestination> GroupingOf(const std::set<std::set<CTxDestination> >& groupings, const CTxDestination& dest)
+{
+    BOOST_FOREACH(const std::set<CTxDestination>& grouping, groupings)
+        if (grouping.count(dest))
+            return grouping;
+    return std::set<CTxDestination>();
+}
+
+// Groupings kept up to date as transactions arrive, in any order, match a
+// rebuild from the whole wallet.
+BOOST_AUTO_TEST_CASE(address_groupings)
+{
+    LOCK(pwalletMain->cs_wallet);
+
+    CKey keys[5];
+    CTxDestination dests[5];
+    for (int i = 0; i < 5; i++) {
+        keys[i].MakeNewKey(true);
+        dests[i] = keys[i].GetPubKey().GetID();
+        if (i < 4)
+            BOOST_CHECK(pwalletMain->AddKeyPubKey(keys[i], keys[i].GetPubKey()));
+    }
+    pwalletMain->GetAddressGroupings();
+
+    // 0 receives from outside, then pays 4 (not ours) with change to 1
+    CMutableTransaction tx0;
+    tx0.vin.resize(1);
+    tx0.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    tx0.vout.resize(1);
+    tx0.vout[0].nValue = 10 * COIN;
+    tx0.vout[0].scriptPubKey = GetScriptForDestination(dests[0]);
+    CWalletTx wtx0(pwalletMain, MakeTransactionRef(tx0));
+    BOOST_CHECK(pwalletMain->AddToWallet(wtx0));
+    BOOST_CHECK(GroupingOf(pwalletMain->GetAddressGroupings(), dests[0]) == std::set<CTxDestination>({dests[0]}));
+
+    CMutableTransaction tx1;
+    tx1.vin.resize(1);
+    tx1.vin[0].prevout = COutPoint(wtx0.GetHash(), 0);
+    tx1.vout.resize(2);
+    tx1.vout[0].nValue = 4 * COIN;
+    tx1.vout[0].scriptPubKey = GetScriptForDestination(dests[4]);
+    tx1.vout[1].nValue = 5 * COIN;
+    tx1.vout[1].scriptPubKey = GetScriptForDestination(dests[1]);
+    BOOST_CHECK(pwalletMain->AddToWallet(CWalletTx(pwalletMain, MakeTransactionRef(tx1))));
+
+    // 3 is change of a spend from 2 that arrives before 2 is paid
+    CMutableTransaction tx2;
+    tx2.vin.resize(1);
+    tx2.vin[0].prevout = COutPoint(GetRandHash(), 1);
+    tx2.vout.resize(1);
+    tx2.vout[0].nValue = 10 * COIN;
+    tx2.vout[0].scriptPubKey = GetScriptForDestination(dests[2]);
+    CMutableTransaction tx3;
+    tx3.vin.resize(1);
+    tx3.vin[0].prevout = COutPoint(tx2.GetHash(), 0);
+    tx3.vout.resize(1);
+    tx3.vout[0].nValue = 9 * COIN;
+    tx3.vout[0].scriptPubKey = GetScriptForDestination(dests[3]);
+    BOOST_CHECK(pwalletMain->AddToWallet(CWalletTx(pwalletMain, MakeTransactionRef(tx3))));
+    BOOST_CHECK(pwalletMain->AddToWallet(CWalletTx(pwalletMain, MakeTransactionRef(tx2))));
+
+    std::set<std::set<CTxDestination> > groupings = pwalletMain->GetAddressGroupings();
+    BOOST_CHECK(GroupingOf(groupings, dests[0]) == std::set<CTxDestination>({dests[0], dests[1]}));
+    BOOST_CHECK(GroupingOf(groupings, dests[2]) == std::set<CTxDestination>({dests[2], dests[3]}));
+    BOOST_CHECK(GroupingOf(groupings, dests[4]).empty());
+
+    pwalletMain->MarkDirty();
+    BOOST_CHECK(pwalletMain->GetAddressGroupings() == groupings);
+
+    // Naming change in the address book makes it a receive of its own
+    pwalletMain->SetAddressBook(dests[3], "", "receive");
+    BOOST_CHECK(GroupingOf(pwalletMain->GetAddressGroupings(), dests[3]) == std::set<CTxDestination>({dests[3]}));
+}
+
+// Gives the test access to CDB::Write() to store records the way old
+// wallets did.
+class CWalletDBRaw : public CWalletDB
+{
+public:
+    CWalletDBRaw(const std::string& strFilename) : CWalletDB(strFilename, "cr+") {}
+    using CWalletDB::Write;
+};
+
+// Records decoded on the loader threads must end up in the wallet like the
+// serially loaded ones, including keys stored without a checksum.
+BOOST_AUTO_TEST_CASE(wallet_load_records)
+{
+    const std::string strFile = "wallet_load_test.dat";
+    std::vector<CPubKey> vPubKeys;
+    std::vector<uint256> vTxHashes;
+    {
+        CWalletDBRaw walletdb(strFile);
+        for (int i = 0; i < 20; i++) {
+            CKey key;
+            key.MakeNewKey(true);
+            vPubKeys.push_back(key.GetPubKey());
+            if (i % 2)
+                BOOST_CHECK(walletdb.WriteKey(key.GetPubKey(), key.GetPrivKey(), CKeyMetadata(GetTime())));
+            else
+                BOOST_CHECK(walletdb.Write(std::make_pair(std::string("key"), key.GetPubKey()), key.GetPrivKey(), false));
+        }
+        for (int i = 0; i < 20; i++) {
+            CMutableTransaction tx;
+            tx.vin.resize(1);
+            tx.vin[0].prevout = COutPoint(GetRandHash(), i);
+            tx.vout.resize(1);
+            tx.vout[0].nValue = (i + 1) * COIN;
+            CWalletTx wtx(NULL, MakeTransactionRef(std::move(tx)));
+            wtx.nOrderPos = i;
+            vTxHashes.push_back(wtx.GetHash());
+            BOOST_CHECK(walletdb.WriteTx(wtx));
+        }
+    }
+
+    {
+        CWallet wallet(strFile);
+        bool fFirstRun;
+        BOOST_CHECK_EQUAL(wallet.LoadWallet(fFirstRun), DB_LOAD_OK);
+        LOCK(wallet.cs_wallet);
+        for (const CPubKey& pubkey : vPubKeys) {
+            CKey key;
+            BOOST_CHECK(wallet.GetKey(pubkey.GetID(), key));
+            BOOST_CHECK(key.VerifyPubKey(pubkey));
+        }
+        BOOST_CHECK_EQUAL(wallet.mapWallet.size(), vTxHashes.size());
+        BOOST_CHECK_EQUAL(wallet.wtxOrdered.size(), vTxHashes.size());
+        int64_t nOrderPos = 0;
+        for (const auto& item : wallet.wtxOrdered) {
+            BOOST_CHECK_EQUAL(item.first, nOrderPos);
+            BOOST_CHECK(item.second.first->GetHash() == vTxHashes[nOrderPos]);
+            nOrderPos++;
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(wallet_unchecked_keys)
+{
+    CWallet wallet;
+    CKey key, otherKey;
+    key.MakeNewKey(true);
+    otherKey.MakeNewKey(true);
+    CPubKey pubkey = key.GetPubKey();
+    CPubKey otherPubKey = otherKey.GetPubKey();
+
+    // A key filed under another key's pubkey, as a damaged old wallet could have it
+    BOOST_CHECK(wallet.LoadKey(key, pubkey));
+    BOOST_CHECK(wallet.LoadKey(key, otherPubKey));
+    wallet.VerifyKeysInBackground(std::vector<CPubKey>{pubkey, otherPubKey});
+
+    // Not handed out even before the background check gets to it
+    CKey keyOut;
+    BOOST_CHECK(!wallet.GetKey(otherPubKey.GetID(), keyOut));
+    BOOST_CHECK(wallet.GetKey(pubkey.GetID(), keyOut));
+    BOOST_CHECK(keyOut == key);
+
+    // Starting another check waits for the first; it dropped the bad key
+    wallet.VerifyKeysInBackground(std::vector<CPubKey>());
+    BOOST_CHECK(!wallet.HaveKey(otherPubKey.GetID()));
+    BOOST_CHECK(wallet.HaveKey(pubkey.GetID()));
+    BOOST_CHECK(wallet.GetKey(pubkey.GetID(), keyOut));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
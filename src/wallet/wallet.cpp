@@ -8,10 +8,13 @@
 #include "base58.h"
 #include "checkpoints.h"
 #include "chain.h"
+#include "chainparams.h"
 #include "prux.h"
 #include "wallet/coincontrol.h"
 #include "consensus/consensus.h"
 #include "consensus/validation.h"
+#include "hash.h"
+#include "init.h"
 #include "key.h"
 #include "keystore.h"
 #include "validation.h"
@@ -19,6 +22,7 @@
 #include "policy/policy.h"
 #include "primitives/block.h"
 #include "primitives/transaction.h"
+#include "random.h"
 #include "script/script.h"
 #include "script/sign.h"
 #include "timedata.h"
@@ -28,6 +32,8 @@
 #include "utilmoneystr.h"
 
 #include <assert.h>
+#include <future>
+#include <thread>
 
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/filesystem.hpp>
@@ -42,6 +48,7 @@ unsigned int nTxConfirmTarget = DEFAULT_TX_CONFIRM_TARGET;
 bool bSpendZeroConfChange = DEFAULT_SPEND_ZEROCONF_CHANGE;
 bool fSendFreeTransactions = DEFAULT_SEND_FREE_TRANSACTIONS;
 bool fWalletRbf = DEFAULT_WALLET_RBF;
+bool fCheckWalletBalances = false;
 
 const char * DEFAULT_WALLET_DAT = "wallet.dat";
 const uint32_t BIP32_HARDENED_KEY_LIMIT = 0x80000000;
@@ -119,14 +126,91 @@ CPubKey CWallet::GenerateNewKey()
     return pubkey;
 }
 
-void CWallet::DeriveNewChildKey(CKeyMetadata& metadata, CKey& secret)
+void CWallet::GenerateNewKeys(unsigned int nKeys, std::vector<CPubKey>& vPubKeys)
+{
+    AssertLockHeld(cs_wallet); // mapKeyMetadata
+    bool fCompressed = CanSupportFeature(FEATURE_COMPRPUBKEY); // default to compressed public keys if we want 0.6.0 wallets
+    const bool fHD = IsHDEnabled();
+
+    int64_t nCreationTime = GetTime();
+    CExtKey externalChainChildKey;
+    if (fHD)
+        DeriveExternalChainKey(externalChainChildKey);
+
+    vPubKeys.clear();
+    while (vPubKeys.size() < nKeys) {
+        const size_t nNeed = nKeys - vPubKeys.size();
+        const uint32_t nChildStart = hdChain.nExternalChainCounter;
+        std::vector<std::pair<CKey, CPubKey> > vNew(nNeed);
+
+        std::atomic<size_t> nNext(0);
+        auto worker = [&]() {
+            size_t i;
+            while ((i = nNext++) < nNeed) {
+                CKey& secret = vNew[i].first;
+                if (fHD) {
+                    CExtKey childKey;
+                    externalChainChildKey.Derive(childKey, (nChildStart + i) | BIP32_HARDENED_KEY_LIMIT);
+                    secret = childKey.key;
+                } else {
+                    secret.MakeNewKey(fCompressed);
+                }
+                vNew[i].second = secret.GetPubKey();
+                assert(secret.VerifyPubKey(vNew[i].second));
+            }
+        };
+        std::vector<std::thread> vThreads;
+        for (int i = 1; i < std::min<int>(std::max(1, std::min(GetNumCores(), MAX_KEYPOOL_THREADS)), nNeed); i++)
+            vThreads.emplace_back(worker);
+        worker();
+        for (std::thread& thread : vThreads)
+            thread.join();
+
+        // Like DeriveNewChildKey(), skip keys already known to the wallet
+        std::vector<std::pair<CKey, CPubKey> > vAdd;
+        vAdd.reserve(nNeed);
+        for (size_t i = 0; i < nNeed; i++) {
+            const CKeyID keyid = vNew[i].second.GetID();
+            if (fHD && HaveKey(keyid))
+                continue;
+            CKeyMetadata metadata(nCreationTime);
+            if (fHD) {
+                metadata.hdKeypath = "m/0'/0'/" + std::to_string(nChildStart + i) + "'";
+                metadata.hdMasterKeyID = hdChain.masterKeyID;
+            }
+            mapKeyMetadata[keyid] = metadata;
+            vAdd.push_back(vNew[i]);
+        }
+
+        // The derivation above runs outside of the transaction, which makes
+        // other writers to the wallet file wait
+        CDBWriteBatch dbBatch(strWalletFile);
+        if (fHD) {
+            hdChain.nExternalChainCounter = nChildStart + nNeed;
+            if (!CWalletDB(strWalletFile).WriteHDChain(hdChain))
+                throw std::runtime_error(std::string(__func__) + ": Writing HD chain model failed");
+        }
+
+        // Compressed public keys were introduced in version 0.6.0
+        if (fCompressed)
+            SetMinVersion(FEATURE_COMPRPUBKEY);
+
+        if (!AddKeyPubKeys(vAdd))
+            throw std::runtime_error(std::string(__func__) + ": AddKey failed");
+        if (!dbBatch.Commit())
+            throw std::runtime_error(std::string(__func__) + ": committing generated keys failed");
+        for (const auto& key : vAdd)
+            vPubKeys.push_back(key.second);
+    }
+    UpdateTimeFirstKey(nCreationTime);
+}
+
+void CWallet::DeriveExternalChainKey(CExtKey& externalChainChildKey)
 {
     // for now we use a fixed keypath scheme of m/0'/0'/k
     CKey key;                      //master key seed (256bit)
     CExtKey masterKey;             //hd master key
     CExtKey accountKey;            //key at m/0'
-    CExtKey externalChainChildKey; //key at m/0'/0'
-    CExtKey childKey;              //key at m/0'/0'/<n>'
 
     // try to get the master key
     if (!GetKey(hdChain.masterKeyID, key))
@@ -140,6 +224,14 @@ void CWallet::DeriveNewChildKey(CKeyMetadata& metadata, CKey& secret)
 
     // derive m/0'/0'
     accountKey.Derive(externalChainChildKey, BIP32_HARDENED_KEY_LIMIT);
+}
+
+void CWallet::DeriveNewChildKey(CKeyMetadata& metadata, CKey& secret)
+{
+    CExtKey externalChainChildKey; //key at m/0'/0'
+    CExtKey childKey;              //key at m/0'/0'/<n>'
+
+    DeriveExternalChainKey(externalChainChildKey);
 
     // derive child key at next index, skip keys already known to the wallet
     do {
@@ -159,27 +251,84 @@ void CWallet::DeriveNewChildKey(CKeyMetadata& metadata, CKey& secret)
         throw std::runtime_error(std::string(__func__) + ": Writing HD chain model failed");
 }
 
+SaltedScriptHasher::SaltedScriptHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
+
+size_t SaltedScriptHasher::operator()(const CScript& script) const
+{
+    return CSipHasher(k0, k1).Write(script.data(), script.size()).Finalize();
+}
+
+/**
+ * Whether IsMine() of a script is fully decided by setOwnedScripts: P2PKH,
+ * P2SH, P2WPKH, P2WSH and P2PK with a compressed or uncompressed key.
+ */
+static bool IsOwnedScriptTemplate(const CScript& script)
+{
+    const size_t nSize = script.size();
+    if (nSize == 25 && script[0] == OP_DUP && script[1] == OP_HASH160 && script[2] == 20 && script[23] == OP_EQUALVERIFY && script[24] == OP_CHECKSIG)
+        return true;
+    if (script.IsPayToScriptHash())
+        return true;
+    if ((nSize == 22 || nSize == 34) && script[0] == OP_0 && script[1] == nSize - 2)
+        return true;
+    if (((nSize == 35 && script[0] == 33) || (nSize == 67 && script[0] == 65)) && script[nSize - 1] == OP_CHECKSIG)
+        return true;
+    return false;
+}
+
+void CWallet::AddOwnedScripts(const CPubKey& pubkey)
+{
+    LOCK(cs_KeyStore);
+    setOwnedScripts.insert(GetScriptForRawPubKey(pubkey));
+    setOwnedScripts.insert(GetScriptForDestination(pubkey.GetID()));
+}
+
+void CWallet::AddOwnedScripts(const CScript& script, bool fWatchOnly)
+{
+    LOCK(cs_KeyStore);
+    if (fWatchOnly) {
+        setOwnedScripts.insert(script);
+        return;
+    }
+    setOwnedScripts.insert(GetScriptForDestination(CScriptID(script)));
+    int witnessversion;
+    std::vector<unsigned char> witprog;
+    if (script.IsWitnessProgram(witnessversion, witprog))
+        setOwnedScripts.insert(script);
+}
+
 bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey &pubkey)
+{
+    return AddKeyPubKeys(std::vector<std::pair<CKey, CPubKey> >(1, std::make_pair(secret, pubkey)));
+}
+
+bool CWallet::AddKeyPubKeys(const std::vector<std::pair<CKey, CPubKey> >& vKeys)
 {
     AssertLockHeld(cs_wallet); // mapKeyMetadata
-    if (!CCryptoKeyStore::AddKeyPubKey(secret, pubkey))
+    if (!CCryptoKeyStore::AddKeyPubKeys(vKeys))
         return false;
 
-    // check if we need to remove from watch-only
-    CScript script;
-    script = GetScriptForDestination(pubkey.GetID());
-    if (HaveWatchOnly(script))
-        RemoveWatchOnly(script);
-    script = GetScriptForRawPubKey(pubkey);
-    if (HaveWatchOnly(script))
-        RemoveWatchOnly(script);
+    for (const auto& key : vKeys) {
+        const CPubKey& pubkey = key.second;
+        AddOwnedScripts(pubkey);
 
-    if (!fFileBacked)
+        // check if we need to remove from watch-only
+        CScript script;
+        script = GetScriptForDestination(pubkey.GetID());
+        if (HaveWatchOnly(script))
+            RemoveWatchOnly(script);
+        script = GetScriptForRawPubKey(pubkey);
+        if (HaveWatchOnly(script))
+            RemoveWatchOnly(script);
+    }
+
+    // Encrypted keys were saved by AddCryptedKeys()
+    if (!fFileBacked || IsCrypted())
         return true;
-    if (!IsCrypted()) {
-        return CWalletDB(strWalletFile).WriteKey(pubkey,
-                                                 secret.GetPrivKey(),
-                                                 mapKeyMetadata[pubkey.GetID()]);
+    CWalletDB walletdb(strWalletFile);
+    for (const auto& key : vKeys) {
+        if (!walletdb.WriteKey(key.second, key.first.GetPrivKey(), mapKeyMetadata[key.second.GetID()]))
+            return false;
     }
     return true;
 }
@@ -189,6 +338,7 @@ bool CWallet::AddCryptedKey(const CPubKey &vchPubKey,
 {
     if (!CCryptoKeyStore::AddCryptedKey(vchPubKey, vchCryptedSecret))
         return false;
+    AddOwnedScripts(vchPubKey);
     if (!fFileBacked)
         return true;
     {
@@ -205,6 +355,24 @@ bool CWallet::AddCryptedKey(const CPubKey &vchPubKey,
     return false;
 }
 
+bool CWallet::AddCryptedKeys(const std::vector<std::pair<CPubKey, std::vector<unsigned char> > >& vCryptedKeys)
+{
+    if (!CCryptoKeyStore::AddCryptedKeys(vCryptedKeys))
+        return false;
+    for (const auto& key : vCryptedKeys)
+        AddOwnedScripts(key.first);
+    if (!fFileBacked)
+        return true;
+    LOCK(cs_wallet);
+    CWalletDB walletdb(strWalletFile);
+    CWalletDB& db = pwalletdbEncryption ? *pwalletdbEncryption : walletdb;
+    for (const auto& key : vCryptedKeys) {
+        if (!db.WriteCryptedKey(key.first, key.second, mapKeyMetadata[key.first.GetID()]))
+            return false;
+    }
+    return true;
+}
+
 bool CWallet::LoadKeyMetadata(const CTxDestination& keyID, const CKeyMetadata &meta)
 {
     AssertLockHeld(cs_wallet); // mapKeyMetadata
@@ -213,9 +381,35 @@ bool CWallet::LoadKeyMetadata(const CTxDestination& keyID, const CKeyMetadata &m
     return true;
 }
 
+bool CWallet::LoadKey(const CKey& key, const CPubKey &pubkey)
+{
+    if (!CCryptoKeyStore::AddKeyPubKey(key, pubkey))
+        return false;
+    AddOwnedScripts(pubkey);
+    return true;
+}
+
+bool CWallet::GetKey(const CKeyID &address, CKey& keyOut) const
+{
+    LOCK(cs_KeyStore);
+    if (!CCryptoKeyStore::GetKey(address, keyOut))
+        return false;
+    // Loaded without its pubkey/privkey hash and not checked in the
+    // background yet: check it before anything uses it
+    if (setUncheckedKeys.count(address)) {
+        if (keyOut.GetPubKey().GetID() != address)
+            return false;
+        setUncheckedKeys.erase(address);
+    }
+    return true;
+}
+
 bool CWallet::LoadCryptedKey(const CPubKey &vchPubKey, const std::vector<unsigned char> &vchCryptedSecret)
 {
-    return CCryptoKeyStore::AddCryptedKey(vchPubKey, vchCryptedSecret);
+    if (!CCryptoKeyStore::AddCryptedKey(vchPubKey, vchCryptedSecret))
+        return false;
+    AddOwnedScripts(vchPubKey);
+    return true;
 }
 
 void CWallet::UpdateTimeFirstKey(int64_t nCreateTime)
@@ -234,6 +428,8 @@ bool CWallet::AddCScript(const CScript& redeemScript)
 {
     if (!CCryptoKeyStore::AddCScript(redeemScript))
         return false;
+    AddOwnedScripts(redeemScript, false);
+    MarkOwnershipChanged();
     if (!fFileBacked)
         return true;
     return CWalletDB(strWalletFile).WriteCScript(Hash160(redeemScript), redeemScript);
@@ -252,13 +448,18 @@ bool CWallet::LoadCScript(const CScript& redeemScript)
         return true;
     }
 
-    return CCryptoKeyStore::AddCScript(redeemScript);
+    if (!CCryptoKeyStore::AddCScript(redeemScript))
+        return false;
+    AddOwnedScripts(redeemScript, false);
+    return true;
 }
 
 bool CWallet::AddWatchOnly(const CScript& dest)
 {
     if (!CCryptoKeyStore::AddWatchOnly(dest))
         return false;
+    AddOwnedScripts(dest, true);
+    MarkOwnershipChanged();
     const CKeyMetadata& meta = mapKeyMetadata[CScriptID(dest)];
     UpdateTimeFirstKey(meta.nCreateTime);
     NotifyWatchonlyChanged(true);
@@ -278,6 +479,7 @@ bool CWallet::RemoveWatchOnly(const CScript &dest)
     AssertLockHeld(cs_wallet);
     if (!CCryptoKeyStore::RemoveWatchOnly(dest))
         return false;
+    MarkOwnershipChanged();
     if (!HaveWatchOnly())
         NotifyWatchonlyChanged(false);
     if (fFileBacked)
@@ -289,7 +491,10 @@ bool CWallet::RemoveWatchOnly(const CScript &dest)
 
 bool CWallet::LoadWatchOnly(const CScript &dest)
 {
-    return CCryptoKeyStore::AddWatchOnly(dest);
+    if (!CCryptoKeyStore::AddWatchOnly(dest))
+        return false;
+    AddOwnedScripts(dest, true);
+    return true;
 }
 
 bool CWallet::Unlock(const SecureString& strWalletPassphrase)
@@ -560,6 +765,7 @@ bool CWallet::IsSpent(const uint256& hash, unsigned int n) const
 void CWallet::AddToSpends(const COutPoint& outpoint, const uint256& wtxid)
 {
     mapTxSpends.insert(make_pair(outpoint, wtxid));
+    MarkBalanceDirty(outpoint.hash);
 
     pair<TxSpends::iterator, TxSpends::iterator> range;
     range = mapTxSpends.equal_range(outpoint);
@@ -752,9 +958,105 @@ DBErrors CWallet::ReorderTransactions()
     }
     walletdb.WriteOrderPosNext(nOrderPosNext);
 
+    // The transactions were put in wtxOrdered under their old positions
+    wtxOrdered.clear();
+    mapOrderPosByDest.clear();
+    for (map<uint256, CWalletTx>::iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+    {
+        CWalletTx& wtx = (*it).second;
+        wtxOrdered.insert(make_pair(wtx.nOrderPos, TxPair(&wtx, (CAccountingEntry*)0)));
+        IndexOrderPos(wtx);
+    }
+
     return DB_LOAD_OK;
 }
 
+void CWallet::IndexOrderPos(const CWalletTx& wtx)
+{
+    BOOST_FOREACH(const CTxOut& txout, wtx.tx->vout)
+    {
+        CTxDestination address;
+        if (ExtractDestination(txout.scriptPubKey, address))
+            mapOrderPosByDest[address].insert(wtx.nOrderPos);
+    }
+}
+
+void CWallet::UnindexOrderPos(const CWalletTx& wtx)
+{
+    AssertLockHeld(cs_wallet);
+
+    std::pair<TxItems::iterator, TxItems::iterator> range = wtxOrdered.equal_range(wtx.nOrderPos);
+    for (TxItems::iterator it = range.first; it != range.second; ++it)
+    {
+        if ((*it).second.first == &wtx)
+        {
+            wtxOrdered.erase(it);
+            break;
+        }
+    }
+
+    BOOST_FOREACH(const CTxOut& txout, wtx.tx->vout)
+    {
+        CTxDestination address;
+        if (!ExtractDestination(txout.scriptPubKey, address))
+            continue;
+        std::map<CTxDestination, std::set<int64_t> >::iterator mi = mapOrderPosByDest.find(address);
+        if (mi == mapOrderPosByDest.end())
+            continue;
+        (*mi).second.erase(wtx.nOrderPos);
+        if ((*mi).second.empty())
+            mapOrderPosByDest.erase(mi);
+    }
+}
+
+void CWallet::WalkOrderedTxItems(int64_t nStartPos, const std::set<CTxDestination>* pdests, const std::function<bool(int64_t, const TxPair&)>& fn) const
+{
+    AssertLockHeld(cs_wallet);
+
+    if (!pdests)
+    {
+        for (TxItems::const_reverse_iterator it(wtxOrdered.upper_bound(nStartPos)); it != wtxOrdered.rend(); ++it)
+            if (!fn((*it).first, (*it).second))
+                return;
+        return;
+    }
+
+    // Merge the position sets of all destinations, newest first
+    typedef std::set<int64_t>::const_reverse_iterator PosIter;
+    std::vector<std::pair<PosIter, PosIter> > vHeads;
+    BOOST_FOREACH(const CTxDestination& dest, *pdests)
+    {
+        std::map<CTxDestination, std::set<int64_t> >::const_iterator mi = mapOrderPosByDest.find(dest);
+        if (mi != mapOrderPosByDest.end())
+            vHeads.push_back(std::make_pair(PosIter((*mi).second.upper_bound(nStartPos)), (*mi).second.rend()));
+    }
+
+    while (true)
+    {
+        bool fFound = false;
+        int64_t nPos = 0;
+        for (size_t i = 0; i < vHeads.size(); i++)
+        {
+            if (vHeads[i].first == vHeads[i].second)
+                continue;
+            if (!fFound || *vHeads[i].first > nPos)
+                nPos = *vHeads[i].first;
+            fFound = true;
+        }
+        if (!fFound)
+            return;
+        for (size_t i = 0; i < vHeads.size(); i++)
+            if (vHeads[i].first != vHeads[i].second && *vHeads[i].first == nPos)
+                ++vHeads[i].first;
+
+        // Same order within a position as the unfiltered walk
+        std::pair<TxItems::const_iterator, TxItems::const_iterator> range = wtxOrdered.equal_range(nPos);
+        for (TxItems::const_reverse_iterator it(range.second); it != TxItems::const_reverse_iterator(range.first); ++it)
+            if ((*it).second.first && !fn((*it).first, (*it).second))
+                return;
+    }
+}
+
 int64_t CWallet::IncOrderPosNext(CWalletDB *pwalletdb)
 {
     AssertLockHeld(cs_wallet); // nOrderPosNext
@@ -843,11 +1145,23 @@ void CWallet::MarkDirty()
 {
     {
         LOCK(cs_wallet);
+        fBalanceLedgerReset = true;
+        fGroupingsStale = true;
         BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& item, mapWallet)
             item.second.MarkDirty();
     }
 }
 
+// Keys are left out: new ones cannot have been paid yet, and the import
+// RPCs MarkDirty() the wallet once per import.
+void CWallet::MarkOwnershipChanged()
+{
+    LOCK(cs_wallet);
+    fBalanceLedgerReset = true;
+    fOwnershipChanged = true;
+    fGroupingsStale = true;
+}
+
 bool CWallet::MarkReplaced(const uint256& originalHash, const uint256& newHash)
 {
     LOCK(cs_wallet);
@@ -892,9 +1206,11 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFlushOnClose)
     bool fInsertedNew = ret.second;
     if (fInsertedNew)
     {
+        wtx.fBalanceSettled = false;
         wtx.nTimeReceived = GetAdjustedTime();
         wtx.nOrderPos = IncOrderPosNext(&walletdb);
         wtxOrdered.insert(make_pair(wtx.nOrderPos, TxPair(&wtx, (CAccountingEntry*)0)));
+        IndexOrderPos(wtx);
 
         wtx.nTimeSmart = wtx.nTimeReceived;
         if (!wtxIn.hashUnset())
@@ -941,6 +1257,23 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFlushOnClose)
                          wtxIn.hashBlock.ToString());
         }
         AddToSpends(hash);
+
+        if (!fGroupingsStale)
+        {
+            GroupAddresses(wtx);
+            // Spends of this transaction that arrived first can now be grouped with it
+            for (unsigned int i = 0; i < wtx.tx->vout.size(); i++)
+            {
+                std::pair<TxSpends::const_iterator, TxSpends::const_iterator> range = mapTxSpends.equal_range(COutPoint(hash, i));
+                for (TxSpends::const_iterator it = range.first; it != range.second; ++it)
+                {
+                    // mapTxSpends keeps the ids of spends removed with removeprunedfunds
+                    std::map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(it->second);
+                    if (mi != mapWallet.end())
+                        GroupAddresses(mi->second);
+                }
+            }
+        }
     }
 
     bool fUpdated = false;
@@ -980,6 +1313,11 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFlushOnClose)
 
     // Break debit/credit balance caches:
     wtx.MarkDirty();
+    // Confirmation or abandonment changes also change what this spends
+    if (fUpdated && !wtx.IsCoinBase()) {
+        BOOST_FOREACH(const CTxIn& txin, wtx.tx->vin)
+            MarkBalanceDirty(txin.prevout.hash);
+    }
 
     // Notify UI of new or updated transaction
     NotifyTransactionChanged(this, hash, fInsertedNew ? CT_NEW : CT_UPDATED);
@@ -1000,11 +1338,13 @@ bool CWallet::LoadToWallet(const CWalletTx& wtxIn)
 {
     uint256 hash = wtxIn.GetHash();
 
-    mapWallet[hash] = wtxIn;
     CWalletTx& wtx = mapWallet[hash];
+    wtx = wtxIn;
     wtx.BindWallet(this);
     wtxOrdered.insert(make_pair(wtx.nOrderPos, TxPair(&wtx, (CAccountingEntry*)0)));
+    IndexOrderPos(wtx);
     AddToSpends(hash);
+    fGroupingsStale = true;
     BOOST_FOREACH(const CTxIn& txin, wtx.tx->vin) {
         if (mapWallet.count(txin.prevout.hash)) {
             CWalletTx& prevtx = mapWallet[txin.prevout.hash];
@@ -1017,6 +1357,42 @@ bool CWallet::LoadToWallet(const CWalletTx& wtxIn)
     return true;
 }
 
+void CWallet::VerifyKeysInBackground(const std::vector<CPubKey>& vPubKeys)
+{
+    if (threadVerifyKeys.joinable())
+        threadVerifyKeys.join();
+    {
+        LOCK(cs_KeyStore);
+        for (const CPubKey& pubkey : vPubKeys)
+            setUncheckedKeys.insert(pubkey.GetID());
+    }
+    threadVerifyKeys = std::thread([this, vPubKeys]() {
+        RenameThread("prux-keycheck");
+        int64_t nStart = GetTimeMillis();
+        unsigned int nBad = 0;
+        for (const CPubKey& pubkey : vPubKeys) {
+            if (fAbortVerifyKeys)
+                return;
+            CKey key;
+            bool fBad = CCryptoKeyStore::GetKey(pubkey.GetID(), key) && !key.VerifyPubKey(pubkey);
+            LOCK(cs_KeyStore);
+            setUncheckedKeys.erase(pubkey.GetID());
+            if (fBad) {
+                // Keep it out of the keystore, so nothing signs with it
+                mapKeys.erase(pubkey.GetID());
+                LogPrintf("Error: wallet key for %s does not match its public key\n", CBitcoinAddress(pubkey.GetID()).ToString());
+                nBad++;
+            }
+        }
+        LogPrintf("Wallet keys: %u checked in the background in %dms, %u corrupt\n", vPubKeys.size(), GetTimeMillis() - nStart, nBad);
+        if (nBad > 0) {
+            MarkOwnershipChanged();
+            uiInterface.ThreadSafeMessageBox(strprintf(_("Error: %u wallet keys do not match their public keys. %s is probably corrupted; restore it from a backup."), nBad, strWalletFile),
+                                             "", CClientUIInterface::MSG_ERROR);
+        }
+    });
+}
+
 /**
  * Add a transaction to the wallet, or update it.  pIndex and posInBlock should
  * be set when the transaction was known to be included in a block.  When
@@ -1233,6 +1609,11 @@ CAmount CWallet::GetDebit(const CTxIn &txin, const isminefilter& filter) const
 
 isminetype CWallet::IsMine(const CTxOut& txout) const
 {
+    if (IsOwnedScriptTemplate(txout.scriptPubKey)) {
+        LOCK(cs_KeyStore);
+        if (!setOwnedScripts.count(txout.scriptPubKey))
+            return ISMINE_NO;
+    }
     return ::IsMine(*this, txout.scriptPubKey);
 }
 
@@ -1540,22 +1921,131 @@ void CWalletTx::GetAccountAmounts(const string& strAccount, CAmount& nReceived,
     }
 }
 
+void CWallet::MatchScanOutputs(const CBlock& block, std::vector<bool>& vOutputMatch) const
+{
+    vOutputMatch.assign(block.vtx.size(), false);
+    LOCK(cs_KeyStore);
+    for (size_t pos = 0; pos < block.vtx.size(); pos++) {
+        for (const CTxOut& txout : block.vtx[pos]->vout) {
+            if (IsScanCandidateOutput(txout.scriptPubKey)) {
+                vOutputMatch[pos] = true;
+                break;
+            }
+        }
+    }
+}
+
+// May let through outputs IsMine() would reject, but never drops one it
+// would accept: owned scripts of the standard templates are all in
+// setOwnedScripts, and bare multisig needs every key, so at least one.
+bool CWallet::IsScanCandidateOutput(const CScript& scriptPubKey) const
+{
+    AssertLockHeld(cs_KeyStore);
+    if (setOwnedScripts.count(scriptPubKey))
+        return true;
+    if (IsOwnedScriptTemplate(scriptPubKey))
+        return false;
+
+    std::vector<std::vector<unsigned char> > vSolutions;
+    txnouttype whichType;
+    if (!Solver(scriptPubKey, whichType, vSolutions) || whichType != TX_MULTISIG)
+        return false;
+    for (size_t i = 1; i + 1 < vSolutions.size(); i++) {
+        if (setOwnedScripts.count(GetScriptForRawPubKey(CPubKey(vSolutions[i]))))
+            return true;
+    }
+    return false;
+}
+
+/** Whether AddToWalletIfInvolvingMe() could care about tx for reasons other than its outputs. */
+bool CWallet::IsScanCandidate(const CTransaction& tx) const
+{
+    AssertLockHeld(cs_wallet);
+    if (mapWallet.count(tx.GetHash()))
+        return true;
+    for (const CTxIn& txin : tx.vin) {
+        if (mapWallet.count(txin.prevout.hash) || mapTxSpends.count(txin.prevout))
+            return true;
+    }
+    return false;
+}
+
+namespace {
+
+struct CScanBlock
+{
+    CBlockIndex* pindex;
+    bool fRead;
+    CBlock block;
+    //! Per transaction: whether any of its outputs passed the filter
+    std::vector<bool> vOutputMatch;
+
+    explicit CScanBlock(CBlockIndex* pindexIn) : pindex(pindexIn), fRead(false) {}
+};
+
+//! Read and prefilter a batch of blocks, spreading them over nThreads threads. Takes no locks but cs_KeyStore.
+void ReadScanBatch(std::vector<CScanBlock>* pbatch, const CWallet* pwallet, int nThreads)
+{
+    std::atomic<size_t> nNext(0);
+    auto worker = [pbatch, pwallet, &nNext]() {
+        size_t i;
+        while ((i = nNext++) < pbatch->size()) {
+            CScanBlock& blk = (*pbatch)[i];
+            blk.fRead = ReadBlockFromDisk(blk.block, blk.pindex, Params().GetConsensus(blk.pindex->nHeight));
+            if (blk.fRead)
+                pwallet->MatchScanOutputs(blk.block, blk.vOutputMatch);
+        }
+    };
+
+    std::vector<std::thread> vThreads;
+    for (int i = 1; i < std::min<int>(nThreads, pbatch->size()); i++)
+        vThreads.emplace_back(worker);
+    worker();
+    for (std::thread& thread : vThreads)
+        thread.join();
+}
+
+} // namespace
+
 /**
  * Scan the block chain (starting in pindexStart) for transactions
  * from or to us. If fUpdate is true, found transactions that already
  * exist in the wallet will be updated.
  *
+ * Blocks are read and matched against setOwnedScripts by up to
+ * MAX_RESCAN_THREADS threads, one batch ahead of the thread applying the
+ * results, without holding cs_main or cs_wallet; the locks are only taken
+ * to add the (few) candidate transactions of each batch. The scan follows
+ * reorganizations that happen meanwhile, and can be stopped with
+ * AbortRescan().
+ *
  * Returns pointer to the first block in the last contiguous range that was
- * successfully scanned.
+ * successfully scanned, or nullptr if the scan was aborted or could not
+ * write to the wallet file.
  *
  */
 CBlockIndex* CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
 {
+    bool fExpected = false;
+    if (!fScanningWallet.compare_exchange_strong(fExpected, true)) {
+        LogPrintf("%s: a rescan is already in progress\n", __func__);
+        return nullptr;
+    }
+    struct ScanningReset {
+        std::atomic<bool>& fScanning;
+        ~ScanningReset() { fScanning = false; }
+    } scanningReset{fScanningWallet};
+    fAbortRescan = false;
+    nScanStartTime = GetTimeMillis();
+    dScanProgress = 0.0;
+
     CBlockIndex* ret = nullptr;
     int64_t nNow = GetTime();
     const CChainParams& chainParams = Params();
+    const int nThreads = std::max(1, std::min(GetNumCores(), MAX_RESCAN_THREADS));
 
     CBlockIndex* pindex = pindexStart;
+    double dProgressStart, dProgressTip;
     {
         LOCK2(cs_main, cs_wallet);
 
@@ -1565,32 +2055,93 @@ CBlockIndex* CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool f
             pindex = chainActive.Next(pindex);
 
         ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
-        double dProgressStart = GuessVerificationProgress(chainParams.TxData(), pindex);
-        double dProgressTip = GuessVerificationProgress(chainParams.TxData(), chainActive.Tip());
-        while (pindex)
-        {
-            if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
-                ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((GuessVerificationProgress(chainParams.TxData(), pindex) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
-            if (GetTime() >= nNow + 60) {
-                nNow = GetTime();
-                LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, GuessVerificationProgress(chainParams.TxData(), pindex));
-            }
+        dProgressStart = GuessVerificationProgress(chainParams.TxData(), pindex);
+        dProgressTip = GuessVerificationProgress(chainParams.TxData(), chainActive.Tip());
+    }
+
+    // Collect up to RESCAN_BATCH_BLOCKS blocks of the active chain starting at pindexFrom
+    auto collect = [](CBlockIndex* pindexFrom) {
+        std::vector<CScanBlock> batch;
+        LOCK(cs_main);
+        for (CBlockIndex* p = pindexFrom; p && batch.size() < (size_t)RESCAN_BATCH_BLOCKS; p = chainActive.Next(p))
+            batch.emplace_back(p);
+        return batch;
+    };
+
+    std::vector<CScanBlock> batch = collect(pindex);
+    ReadScanBatch(&batch, this, nThreads);
+    while (!batch.empty()) {
+        if (fAbortRescan || ShutdownRequested()) {
+            LogPrintf("Rescan aborted at block %d. Progress=%f\n", batch.front().pindex->nHeight, GuessVerificationProgress(chainParams.TxData(), batch.front().pindex));
+            ret = nullptr;
+            break;
+        }
+
+        // Read the next batch while this one is being applied
+        std::vector<CScanBlock> batchNext;
+        {
+            LOCK(cs_main);
+            if (chainActive.Contains(batch.back().pindex))
+                batchNext = collect(chainActive.Next(batch.back().pindex));
+        }
+        std::future<void> futureNext = std::async(std::launch::async, ReadScanBatch, &batchNext, this, nThreads);
 
-            CBlock block;
-            if (ReadBlockFromDisk(block, pindex, Params().GetConsensus(pindex->nHeight))) {
-                for (size_t posInBlock = 0; posInBlock < block.vtx.size(); ++posInBlock) {
-                    AddToWalletIfInvolvingMe(*block.vtx[posInBlock], pindex, posInBlock, fUpdate);
+        CBlockIndex* pindexResume = nullptr;
+        bool fWriteFailed = false;
+        {
+            LOCK2(cs_main, cs_wallet);
+            CDBWriteBatch dbBatch(strWalletFile);
+            for (CScanBlock& blk : batch) {
+                pindex = blk.pindex;
+                if (!chainActive.Contains(pindex)) {
+                    // Reorganized away while we were reading; continue from the fork
+                    pindexResume = chainActive.Next(chainActive.FindFork(pindex));
+                    break;
                 }
-                if (!ret) {
-                    ret = pindex;
+                if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0) {
+                    dScanProgress = std::max(0.0, std::min(1.0, (GuessVerificationProgress(chainParams.TxData(), pindex) - dProgressStart) / (dProgressTip - dProgressStart)));
+                    ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)(dScanProgress * 100))));
+                }
+                if (GetTime() >= nNow + 60) {
+                    nNow = GetTime();
+                    LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, GuessVerificationProgress(chainParams.TxData(), pindex));
+                }
+
+                if (blk.fRead) {
+                    for (size_t posInBlock = 0; posInBlock < blk.block.vtx.size(); ++posInBlock) {
+                        const CTransaction& tx = *blk.block.vtx[posInBlock];
+                        if (blk.vOutputMatch[posInBlock] || IsScanCandidate(tx))
+                            AddToWalletIfInvolvingMe(tx, pindex, posInBlock, fUpdate);
+                    }
+                    if (!dbBatch.Checkpoint()) {
+                        fWriteFailed = true;
+                        break;
+                    }
+                    if (!ret) {
+                        ret = pindex;
+                    }
+                } else {
+                    ret = nullptr;
                 }
-            } else {
-                ret = nullptr;
             }
-            pindex = chainActive.Next(pindex);
+            if (!fWriteFailed && !dbBatch.Commit())
+                fWriteFailed = true;
+        }
+
+        futureNext.wait();
+        if (fWriteFailed) {
+            LogPrintf("Rescan stopped at block %d: writing to the wallet failed\n", pindex->nHeight);
+            ret = nullptr;
+            break;
+        }
+        if (pindexResume) {
+            batch = collect(pindexResume);
+            ReadScanBatch(&batch, this, nThreads);
+        } else {
+            batch.swap(batchNext);
         }
-        ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
     }
+    ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
     return ret;
 }
 
@@ -1637,11 +2188,7 @@ bool CWalletTx::RelayWalletTransaction(CConnman* connman)
         if (InMempool() || AcceptToMemoryPool(maxTxFee, state)) {
             LogPrintf("Relaying wtx %s\n", GetHash().ToString());
             if (connman) {
-                CInv inv(MSG_TX, GetHash());
-                connman->ForEachNode([&inv](CNode* pnode)
-                {
-                    pnode->PushInventory(inv);
-                });
+                connman->RelayTransaction(GetHash());
                 return true;
             }
         }
@@ -1661,6 +2208,21 @@ set<uint256> CWalletTx::GetConflicts() const
     return result;
 }
 
+void CWalletTx::MarkDirty()
+{
+    fCreditCached = false;
+    fAvailableCreditCached = false;
+    fImmatureCreditCached = false;
+    fWatchDebitCached = false;
+    fWatchCreditCached = false;
+    fAvailableWatchCreditCached = false;
+    fImmatureWatchCreditCached = false;
+    fDebitCached = false;
+    fChangeCached = false;
+    if (pwallet)
+        pwallet->MarkBalanceDirty(GetHash());
+}
+
 CAmount CWalletTx::GetDebit(const isminefilter& filter) const
 {
     if (tx->vin.empty())
@@ -1928,94 +2490,181 @@ void CWallet::ResendWalletTransactions(int64_t nBestBlockTime, CConnman* connman
  */
 
 
-CAmount CWallet::GetBalance() const
+// Add a transaction's contribution to each balance, evaluated from scratch.
+static void AddBalanceContribution(const CWalletTx& wtx, CWalletBalances& balances)
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAvailableCredit();
-        }
+    if (wtx.IsTrusted()) {
+        balances.nTrusted += wtx.GetAvailableCredit();
+        balances.nWatchOnlyTrusted += wtx.GetAvailableWatchOnlyCredit();
+    } else if (wtx.GetDepthInMainChain() == 0 && wtx.InMempool()) {
+        balances.nUntrustedPending += wtx.GetAvailableCredit();
+        balances.nWatchOnlyUntrustedPending += wtx.GetAvailableWatchOnlyCredit();
     }
+    balances.nImmature += wtx.GetImmatureCredit();
+    balances.nWatchOnlyImmature += wtx.GetImmatureWatchOnlyCredit();
+}
 
-    return nTotal;
+void CWallet::MarkBalanceDirty(const uint256& hash) const
+{
+    LOCK(cs_wallet);
+    if (!fBalanceLedgerReset)
+        setBalanceDirty.insert(hash);
 }
 
-CAmount CWallet::GetUnconfirmedBalance() const
+// Re-index the unspent outputs of a transaction, or drop them if it is gone.
+void CWallet::UpdateUnspent(const uint256& hash) const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0 && pcoin->InMempool())
-                nTotal += pcoin->GetAvailableCredit();
-        }
+    map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(hash);
+    if (mi == mapWallet.end()) {
+        std::map<COutPoint, isminetype>::iterator it = mapWalletUnspent.lower_bound(COutPoint(hash, 0));
+        while (it != mapWalletUnspent.end() && it->first.hash == hash)
+            it = mapWalletUnspent.erase(it);
+        return;
+    }
+    const CTransaction& tx = *mi->second.tx;
+    for (unsigned int i = 0; i < tx.vout.size(); i++) {
+        isminetype mine = IsSpent(hash, i) ? ISMINE_NO : IsMine(tx.vout[i]);
+        if (mine != ISMINE_NO)
+            mapWalletUnspent[COutPoint(hash, i)] = mine;
+        else
+            mapWalletUnspent.erase(COutPoint(hash, i));
     }
-    return nTotal;
 }
 
-CAmount CWallet::GetImmatureBalance() const
+// Move wtx into the settled sums if its contribution can no longer change
+// without a MarkDirty() or a reorg. Returns false if it has to stay pending.
+bool CWallet::SettleBalanceTx(const CWalletTx& wtx) const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            nTotal += pcoin->GetImmatureCredit();
-        }
+    assert(!wtx.fBalanceSettled);
+    int nDepth = wtx.GetDepthInMainChain();
+    if (nDepth < 0 || wtx.isAbandoned()) {
+        // Conflicted or abandoned: counts towards nothing until it is
+        // seen again, which marks it dirty.
+        wtx.nSettledCredit = 0;
+        wtx.nSettledWatchCredit = 0;
+    } else if (nDepth == 0 || (wtx.IsCoinBase() && wtx.GetBlocksToMaturity() > 0) || !CheckFinalTx(wtx)) {
+        return false;
+    } else {
+        // Confirmed and final, so IsTrusted() holds until a reorg.
+        wtx.nSettledCredit = wtx.GetAvailableCredit();
+        wtx.nSettledWatchCredit = wtx.GetAvailableWatchOnlyCredit();
     }
-    return nTotal;
+    wtx.fBalanceSettled = true;
+    nSettledBalance += wtx.nSettledCredit;
+    nSettledWatchBalance += wtx.nSettledWatchCredit;
+    return true;
 }
 
-CAmount CWallet::GetWatchOnlyBalance() const
+void CWallet::UpdateBalanceLedger() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAvailableWatchOnlyCredit();
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    // Settled transactions only lose confirmations when blocks get disconnected.
+    if (pindexBalanceLedger && !chainActive.Contains(pindexBalanceLedger))
+        fBalanceLedgerReset = true;
+    pindexBalanceLedger = chainActive.Tip();
+
+    if (fBalanceLedgerReset) {
+        nSettledBalance = 0;
+        nSettledWatchBalance = 0;
+        setBalancePending.clear();
+        setBalanceDirty.clear();
+        mapWalletUnspent.clear();
+        fBalanceLedgerReset = false;
+        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
+            if (fOwnershipChanged) {
+                // IsMine() changed under the cached credits
+                it->second.GetImmatureCredit(false);
+                it->second.GetImmatureWatchOnlyCredit(false);
+                it->second.GetAvailableCredit(false);
+                it->second.GetAvailableWatchOnlyCredit(false);
+            }
+            UpdateUnspent(it->first);
+            it->second.fBalanceSettled = false;
+            if (!SettleBalanceTx(it->second))
+                setBalancePending.insert(it->first);
         }
+        fOwnershipChanged = false;
+        return;
     }
 
-    return nTotal;
+    for (std::set<uint256>::const_iterator it = setBalanceDirty.begin(); it != setBalanceDirty.end(); ++it) {
+        UpdateUnspent(*it);
+        setBalancePending.erase(*it);
+        map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(*it);
+        if (mi == mapWallet.end())
+            continue;
+        const CWalletTx& wtx = mi->second;
+        if (wtx.fBalanceSettled) {
+            nSettledBalance -= wtx.nSettledCredit;
+            nSettledWatchBalance -= wtx.nSettledWatchCredit;
+            wtx.fBalanceSettled = false;
+        }
+        if (!SettleBalanceTx(wtx))
+            setBalancePending.insert(*it);
+    }
+    setBalanceDirty.clear();
+
+    // Pending transactions that confirmed or matured since the last query
+    for (std::set<uint256>::iterator it = setBalancePending.begin(); it != setBalancePending.end(); ) {
+        map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(*it);
+        if (mi == mapWallet.end() || SettleBalanceTx(mi->second))
+            it = setBalancePending.erase(it);
+        else
+            ++it;
+    }
 }
 
-CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const
+CWalletBalances CWallet::GetBalances() const
 {
-    CAmount nTotal = 0;
+    CWalletBalances balances;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0 && pcoin->InMempool())
-                nTotal += pcoin->GetAvailableWatchOnlyCredit();
+        UpdateBalanceLedger();
+        balances.nTrusted = nSettledBalance;
+        balances.nWatchOnlyTrusted = nSettledWatchBalance;
+        for (std::set<uint256>::const_iterator it = setBalancePending.begin(); it != setBalancePending.end(); ++it)
+            AddBalanceContribution(mapWallet.at(*it), balances);
+
+        if (fCheckWalletBalances) {
+            CWalletBalances check;
+            for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+                AddBalanceContribution(it->second, check);
+            assert(balances == check);
         }
     }
-    return nTotal;
+    return balances;
+}
+
+CAmount CWallet::GetBalance() const
+{
+    return GetBalances().nTrusted;
+}
+
+CAmount CWallet::GetUnconfirmedBalance() const
+{
+    return GetBalances().nUntrustedPending;
+}
+
+CAmount CWallet::GetImmatureBalance() const
+{
+    return GetBalances().nImmature;
+}
+
+CAmount CWallet::GetWatchOnlyBalance() const
+{
+    return GetBalances().nWatchOnlyTrusted;
+}
+
+CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const
+{
+    return GetBalances().nWatchOnlyUntrustedPending;
 }
 
 CAmount CWallet::GetImmatureWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            nTotal += pcoin->GetImmatureWatchOnlyCredit();
-        }
-    }
-    return nTotal;
+    return GetBalances().nWatchOnlyImmature;
 }
 
 void CWallet::AvailableCoins(vector<COutput> &vCoins, bool fOnlyConfirmed, const CCoinControl *coinControl, const CAmount &nMinimumAmount, const CAmount &nMaximumAmount, const CAmount &nMinimumSumAmount, const uint64_t &nMaximumCount, const int &nMinDepth, const int &nMaxDepth) const
@@ -2024,13 +2673,32 @@ void CWallet::AvailableCoins(vector<COutput> &vCoins, bool fOnlyConfirmed, const
 
     {
         LOCK2(cs_main, cs_wallet);
+        UpdateBalanceLedger();
+
+        if (fCheckWalletBalances) {
+            std::map<COutPoint, isminetype> mapCheck;
+            for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
+                for (unsigned int i = 0; i < it->second.tx->vout.size(); i++) {
+                    isminetype mine = IsSpent(it->first, i) ? ISMINE_NO : IsMine(it->second.tx->vout[i]);
+                    if (mine != ISMINE_NO)
+                        mapCheck[COutPoint(it->first, i)] = mine;
+                }
+            }
+            assert(mapCheck == mapWalletUnspent);
+        }
 
         CAmount nTotal = 0;
 
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        // mapWalletUnspent is ordered by outpoint, so the outputs of each
+        // transaction are adjacent and it only needs to be checked once.
+        std::map<COutPoint, isminetype>::const_iterator itUnspent = mapWalletUnspent.begin();
+        while (itUnspent != mapWalletUnspent.end())
         {
-            const uint256& wtxid = it->first;
-            const CWalletTx* pcoin = &(*it).second;
+            const uint256 wtxid = itUnspent->first.hash;
+            const CWalletTx* pcoin = &mapWallet.at(wtxid);
+            std::map<COutPoint, isminetype>::const_iterator itNextTx = mapWalletUnspent.lower_bound(COutPoint(wtxid, std::numeric_limits<uint32_t>::max()));
+            std::map<COutPoint, isminetype>::const_iterator itTx = itUnspent;
+            itUnspent = itNextTx;
 
             if (!CheckFinalTx(*pcoin))
                 continue;
@@ -2084,24 +2752,18 @@ void CWallet::AvailableCoins(vector<COutput> &vCoins, bool fOnlyConfirmed, const
             if (nDepth < nMinDepth || nDepth > nMaxDepth)
                 continue;
 
-            for (unsigned int i = 0; i < pcoin->tx->vout.size(); i++) {
+            for (; itTx != itNextTx; ++itTx) {
+                const unsigned int i = itTx->first.n;
                 if (pcoin->tx->vout[i].nValue < nMinimumAmount || pcoin->tx->vout[i].nValue > nMaximumAmount)
                     continue;
 
-                if (coinControl && coinControl->HasSelected() && !coinControl->fAllowOtherInputs && !coinControl->IsSelected(COutPoint((*it).first, i)))
+                if (coinControl && coinControl->HasSelected() && !coinControl->fAllowOtherInputs && !coinControl->IsSelected(itTx->first))
                     continue;
 
-                if (IsLockedCoin((*it).first, i))
+                if (IsLockedCoin(wtxid, i))
                     continue;
 
-                if (IsSpent(wtxid, i))
-                    continue;
-
-                isminetype mine = IsMine(pcoin->tx->vout[i]);
-
-                if (mine == ISMINE_NO) {
-                    continue;
-                }
+                isminetype mine = itTx->second;
 
                 bool fSpendableIn = ((mine & ISMINE_SPENDABLE) != ISMINE_NO) || (coinControl && coinControl->fAllowWatchOnly && (mine & ISMINE_WATCH_SOLVABLE) != ISMINE_NO);
                 bool fSolvableIn = (mine & (ISMINE_SPENDABLE | ISMINE_WATCH_SOLVABLE)) != ISMINE_NO;
@@ -2126,7 +2788,7 @@ void CWallet::AvailableCoins(vector<COutput> &vCoins, bool fOnlyConfirmed, const
     }
 }
 
-static void ApproximateBestSubset(vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > >vValue, const CAmount& nTotalLower, const CAmount& nTargetValue,
+static void ApproximateBestSubset(const vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > >& vValue, const CAmount& nTotalLower, const CAmount& nTargetValue,
                                   vector<char>& vfBest, CAmount& nBest, int iterations = 1000)
 {
     vector<char> vfIncluded;
@@ -2172,38 +2834,112 @@ static void ApproximateBestSubset(vector<pair<CAmount, pair<const CWalletTx*,uns
     }
 }
 
+/**
+ * Branch and bound search for a subset of vValue (sorted by descending
+ * value) that adds up to exactly nTargetValue, giving up after nMaxTries
+ * steps. Branches that cannot reach the target with the remaining coins,
+ * or that already exceed it, are cut, and of several coins with the same
+ * value only the first is tried in a given position.
+ */
+static bool SelectCoinsBnB(const vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > >& vValue, const CAmount& nTotalLower, const CAmount& nTargetValue,
+                           vector<char>& vfBest, int nMaxTries = COIN_SELECTION_BNB_TRIES)
+{
+    vector<char> vfIncluded(vValue.size(), false);
+    CAmount nTotal = 0;
+    CAmount nRemaining = nTotalLower; // value of the coins from i on, not decided yet
+    size_t i = 0;
+
+    for (int nTries = 0; nTries < nMaxTries; nTries++)
+    {
+        if (nTotal == nTargetValue)
+        {
+            vfBest.swap(vfIncluded);
+            return true;
+        }
+
+        if (nTotal > nTargetValue || nTotal + nRemaining < nTargetValue)
+        {
+            // Backtrack to the last included coin and exclude it instead
+            while (i > 0 && !vfIncluded[i - 1])
+            {
+                i--;
+                nRemaining += vValue[i].first;
+            }
+            if (i == 0)
+                return false;
+            vfIncluded[i - 1] = false;
+            nTotal -= vValue[i - 1].first;
+            continue;
+        }
+
+        nRemaining -= vValue[i].first;
+        if (i == 0 || vfIncluded[i - 1] || vValue[i].first != vValue[i - 1].first)
+        {
+            vfIncluded[i] = true;
+            nTotal += vValue[i].first;
+        }
+        i++;
+    }
+    return false;
+}
+
+void CWallet::MakeSelectionCandidates(const vector<COutput>& vCoins, vector<CSelectionCandidate>& vCandidates) const
+{
+    vCandidates.clear();
+    vCandidates.reserve(vCoins.size());
+    BOOST_FOREACH(const COutput &output, vCoins)
+    {
+        if (!output.fSpendable)
+            continue;
+
+        CSelectionCandidate candidate;
+        candidate.nValue = output.tx->tx->vout[output.i].nValue;
+        candidate.coin = make_pair(output.tx, (unsigned int)output.i);
+        candidate.nDepth = output.nDepth;
+        candidate.fFromMe = output.tx->IsFromMe(ISMINE_ALL);
+        candidate.nChainLength = mempool.GetChainLength(output.tx->GetHash());
+        vCandidates.push_back(candidate);
+    }
+
+    random_shuffle(vCandidates.begin(), vCandidates.end(), GetRandInt);
+    std::stable_sort(vCandidates.begin(), vCandidates.end(), [](const CSelectionCandidate& a, const CSelectionCandidate& b) {
+        return a.nValue > b.nValue;
+    });
+}
+
 bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, const int nConfMine, const int nConfTheirs, const uint64_t nMaxAncestors, vector<COutput> vCoins,
                                  set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet) const
+{
+    vector<CSelectionCandidate> vCandidates;
+    MakeSelectionCandidates(vCoins, vCandidates);
+    return SelectCoinsMinConf(nTargetValue, nConfMine, nConfTheirs, nMaxAncestors, vCandidates, setCoinsRet, nValueRet);
+}
+
+bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, const int nConfMine, const int nConfTheirs, const uint64_t nMaxAncestors, const vector<CSelectionCandidate>& vCandidates,
+                                 set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet) const
 {
     setCoinsRet.clear();
     nValueRet = 0;
 
-    // List of values less than target
+    // List of values less than target, in descending order
     pair<CAmount, pair<const CWalletTx*,unsigned int> > coinLowestLarger;
     coinLowestLarger.first = std::numeric_limits<CAmount>::max();
     coinLowestLarger.second.first = NULL;
     vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > > vValue;
     CAmount nTotalLower = 0;
 
-    random_shuffle(vCoins.begin(), vCoins.end(), GetRandInt);
-
-    BOOST_FOREACH(const COutput &output, vCoins)
+    BOOST_FOREACH(const CSelectionCandidate &candidate, vCandidates)
     {
-        if (!output.fSpendable)
-            continue;
-
-        const CWalletTx *pcoin = output.tx;
-
-        if (output.nDepth < (pcoin->IsFromMe(ISMINE_ALL) ? nConfMine : nConfTheirs))
+        if (candidate.nDepth < (candidate.fFromMe ? nConfMine : nConfTheirs))
             continue;
 
-        if (!mempool.TransactionWithinChainLimit(pcoin->GetHash(), nMaxAncestors))
+        // Same as !mempool.TransactionWithinChainLimit(hash, nMaxAncestors)
+        if (candidate.nChainLength != 0 && candidate.nChainLength >= nMaxAncestors)
             continue;
 
-        int i = output.i;
-        CAmount n = pcoin->tx->vout[i].nValue;
+        CAmount n = candidate.nValue;
 
-        pair<CAmount,pair<const CWalletTx*,unsigned int> > coin = make_pair(n,make_pair(pcoin, i));
+        pair<CAmount,pair<const CWalletTx*,unsigned int> > coin = make_pair(n, candidate.coin);
 
         if (n == nTargetValue)
         {
@@ -2241,15 +2977,20 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, const int nConfMin
         return true;
     }
 
-    // Solve subset sum by stochastic approximation
-    std::sort(vValue.begin(), vValue.end(), CompareValueOnly());
-    std::reverse(vValue.begin(), vValue.end());
     vector<char> vfBest;
     CAmount nBest;
 
-    ApproximateBestSubset(vValue, nTotalLower, nTargetValue, vfBest, nBest);
-    if (nBest != nTargetValue && nTotalLower >= nTargetValue + MIN_CHANGE)
-        ApproximateBestSubset(vValue, nTotalLower, nTargetValue + MIN_CHANGE, vfBest, nBest);
+    // An exact match is the best possible outcome; only if there is none (or
+    // it takes too long to find) solve subset sum by stochastic approximation,
+    // with fewer passes the more coins there are.
+    if (SelectCoinsBnB(vValue, nTotalLower, nTargetValue, vfBest)) {
+        nBest = nTargetValue;
+    } else {
+        int nIterations = std::max(10, (int)std::min<size_t>(1000, COIN_SELECTION_APPROXIMATE_BUDGET / vValue.size()));
+        ApproximateBestSubset(vValue, nTotalLower, nTargetValue, vfBest, nBest, nIterations);
+        if (nBest != nTargetValue && nTotalLower >= nTargetValue + MIN_CHANGE)
+            ApproximateBestSubset(vValue, nTotalLower, nTargetValue + MIN_CHANGE, vfBest, nBest, nIterations);
+    }
 
     // If we have a bigger coin and (either the stochastic approximation didn't find a good solution,
     //                                   or the next bigger coin is closer), return the bigger coin
@@ -2277,14 +3018,12 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, const int nConfMin
     return true;
 }
 
-bool CWallet::SelectCoins(const vector<COutput>& vAvailableCoins, const CAmount& nTargetValue, set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, const CCoinControl* coinControl) const
+bool CWallet::SelectCoins(const vector<COutput>& vAvailableCoins, const CAmount& nTargetValue, set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, const CCoinControl* coinControl, vector<CSelectionCandidate>* pvCandidates) const
 {
-    vector<COutput> vCoins(vAvailableCoins);
-
     // coin control -> return all selected outputs (we want all selected to go into the transaction for sure)
     if (coinControl && coinControl->HasSelected() && !coinControl->fAllowOtherInputs)
     {
-        BOOST_FOREACH(const COutput& out, vCoins)
+        BOOST_FOREACH(const COutput& out, vAvailableCoins)
         {
             if (!out.fSpendable)
                  continue;
@@ -2316,26 +3055,33 @@ bool CWallet::SelectCoins(const vector<COutput>& vAvailableCoins, const CAmount&
             return false; // TODO: Allow non-wallet inputs
     }
 
-    // remove preset inputs from vCoins
-    for (vector<COutput>::iterator it = vCoins.begin(); it != vCoins.end() && coinControl && coinControl->HasSelected();)
+    // prepare the remaining coins, unless the caller already did for an earlier call with the same coins
+    vector<CSelectionCandidate> vLocalCandidates;
+    vector<CSelectionCandidate>& vCandidates = pvCandidates ? *pvCandidates : vLocalCandidates;
+    if (vCandidates.empty())
     {
-        if (setPresetCoins.count(make_pair(it->tx, it->i)))
-            it = vCoins.erase(it);
-        else
-            ++it;
+        MakeSelectionCandidates(vAvailableCoins, vCandidates);
+
+        // remove preset inputs
+        if (coinControl && coinControl->HasSelected())
+        {
+            vCandidates.erase(std::remove_if(vCandidates.begin(), vCandidates.end(), [&setPresetCoins](const CSelectionCandidate& candidate) {
+                return setPresetCoins.count(candidate.coin) != 0;
+            }), vCandidates.end());
+        }
     }
 
     size_t nMaxChainLength = std::min(GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT), GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT));
     bool fRejectLongChains = GetBoolArg("-walletrejectlongchains", DEFAULT_WALLET_REJECT_LONG_CHAINS);
 
     bool res = nTargetValue <= nValueFromPresetInputs ||
-        SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 1, 6, 0, vCoins, setCoinsRet, nValueRet) ||
-        SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 1, 1, 0, vCoins, setCoinsRet, nValueRet) ||
-        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, 2, vCoins, setCoinsRet, nValueRet)) ||
-        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, std::min((size_t)4, nMaxChainLength/3), vCoins, setCoinsRet, nValueRet)) ||
-        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, nMaxChainLength/2, vCoins, setCoinsRet, nValueRet)) ||
-        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, nMaxChainLength, vCoins, setCoinsRet, nValueRet)) ||
-        (bSpendZeroConfChange && !fRejectLongChains && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, std::numeric_limits<uint64_t>::max(), vCoins, setCoinsRet, nValueRet));
+        SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 1, 6, 0, vCandidates, setCoinsRet, nValueRet) ||
+        SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 1, 1, 0, vCandidates, setCoinsRet, nValueRet) ||
+        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, 2, vCandidates, setCoinsRet, nValueRet)) ||
+        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, std::min((size_t)4, nMaxChainLength/3), vCandidates, setCoinsRet, nValueRet)) ||
+        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, nMaxChainLength/2, vCandidates, setCoinsRet, nValueRet)) ||
+        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, nMaxChainLength, vCandidates, setCoinsRet, nValueRet)) ||
+        (bSpendZeroConfChange && !fRejectLongChains && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, std::numeric_limits<uint64_t>::max(), vCandidates, setCoinsRet, nValueRet));
 
     // because SelectCoinsMinConf clears the setCoinsRet, we now add the possible inputs to the coinset
     setCoinsRet.insert(setPresetCoins.begin(), setPresetCoins.end());
@@ -2468,6 +3214,8 @@ bool CWallet::CreateTransaction(const vector<CRecipient>& vecSend, CWalletTx& wt
         {
             std::vector<COutput> vAvailableCoins;
             AvailableCoins(vAvailableCoins, true, coinControl);
+            // Filled by the first SelectCoins() call and reused by the following ones
+            std::vector<CSelectionCandidate> vCandidates;
 
             nFeeRet = 0;
             // Start with no fee and loop until there is enough fee
@@ -2518,7 +3266,7 @@ bool CWallet::CreateTransaction(const vector<CRecipient>& vecSend, CWalletTx& wt
                 // Choose coins to use
                 CAmount nValueIn = 0;
                 setCoins.clear();
-                if (!SelectCoins(vAvailableCoins, nValueToSelect, setCoins, nValueIn, coinControl))
+                if (!SelectCoins(vAvailableCoins, nValueToSelect, setCoins, nValueIn, coinControl, &vCandidates))
                 {
                     strFailReason = _("Insufficient funds");
                     return false;
@@ -2727,21 +3475,25 @@ bool CWallet::CreateTransaction(const vector<CRecipient>& vecSend, CWalletTx& wt
         if (sign)
         {
             CTransaction txNewConst(txNew);
-            int nIn = 0;
+            const PrecomputedTransactionData txdata(txNewConst, true);
+            std::vector<const CTxOut*> vPrevOuts;
             for (const auto& coin : setCoins)
-            {
-                const CScript& scriptPubKey = coin.first->tx->vout[coin.second].scriptPubKey;
-                SignatureData sigdata;
+                vPrevOuts.push_back(&coin.first->tx->vout[coin.second]);
+
+            std::vector<SignatureData> vSigData(vPrevOuts.size());
+            std::vector<char> vSigned(vPrevOuts.size());
+            ForEachInputParallel(vPrevOuts.size(), [&](unsigned int nIn) {
+                vSigned[nIn] = ProduceSignature(TransactionSignatureCreator(this, &txNewConst, nIn, vPrevOuts[nIn]->nValue, SIGHASH_ALL, txdata), vPrevOuts[nIn]->scriptPubKey, vSigData[nIn]);
+            });
 
-                if (!ProduceSignature(TransactionSignatureCreator(this, &txNewConst, nIn, coin.first->tx->vout[coin.second].nValue, SIGHASH_ALL), scriptPubKey, sigdata))
+            for (unsigned int nIn = 0; nIn < vPrevOuts.size(); nIn++)
+            {
+                if (!vSigned[nIn])
                 {
                     strFailReason = _("Signing transaction failed");
                     return false;
-                } else {
-                    UpdateTransaction(txNew, nIn, sigdata);
                 }
-
-                nIn++;
+                UpdateTransaction(txNew, nIn, vSigData[nIn]);
             }
         }
 
@@ -2963,6 +3715,9 @@ bool CWallet::SetAddressBook(const CTxDestination& address, const string& strNam
         LOCK(cs_wallet); // mapAddressBook
         std::map<CTxDestination, CAddressBookData>::iterator mi = mapAddressBook.find(address);
         fUpdated = mi != mapAddressBook.end();
+        // Outputs to an address book entry are not change
+        if (!fUpdated && mapOrderPosByDest.count(address))
+            fGroupingsStale = true;
         mapAddressBook[address].name = strName;
         if (!strPurpose.empty()) /* update purpose only if requested */
             mapAddressBook[address].purpose = strPurpose;
@@ -2990,7 +3745,8 @@ bool CWallet::DelAddressBook(const CTxDestination& address)
                 CWalletDB(strWalletFile).EraseDestData(strAddress, item.first);
             }
         }
-        mapAddressBook.erase(address);
+        if (mapAddressBook.erase(address) && mapOrderPosByDest.count(address))
+            fGroupingsStale = true;
     }
 
     NotifyAddressBookChanged(this, address, "", ::IsMine(*this, address) != ISMINE_NO, "", CT_DELETED);
@@ -3021,19 +3777,32 @@ bool CWallet::NewKeyPool()
     {
         LOCK(cs_wallet);
         CWalletDB walletdb(strWalletFile);
-        BOOST_FOREACH(int64_t nIndex, setKeyPool)
-            walletdb.ErasePool(nIndex);
+        {
+            CDBWriteBatch dbBatch(strWalletFile);
+            BOOST_FOREACH(int64_t nIndex, setKeyPool)
+                walletdb.ErasePool(nIndex);
+            if (!dbBatch.Commit())
+                throw runtime_error(std::string(__func__) + ": committing erased keys failed");
+        }
         setKeyPool.clear();
 
         if (IsLocked())
             return false;
 
         int64_t nKeys = max(GetArg("-keypool", DEFAULT_KEYPOOL_SIZE), (int64_t)0);
-        for (int i = 0; i < nKeys; i++)
+        int64_t nIndex = 0;
+        std::vector<CPubKey> vPubKeys;
+        while (nIndex < nKeys)
         {
-            int64_t nIndex = i+1;
-            walletdb.WritePool(nIndex, CKeyPool(GenerateNewKey()));
-            setKeyPool.insert(nIndex);
+            GenerateNewKeys(std::min<int64_t>(nKeys - nIndex, KEYPOOL_GENERATE_BATCH), vPubKeys);
+            CDBWriteBatch dbBatch(strWalletFile);
+            for (const CPubKey& pubkey : vPubKeys)
+            {
+                walletdb.WritePool(++nIndex, CKeyPool(pubkey));
+                setKeyPool.insert(nIndex);
+            }
+            if (!dbBatch.Commit())
+                throw runtime_error(std::string(__func__) + ": committing generated keys failed");
         }
         LogPrintf("CWallet::NewKeyPool wrote %d new keys\n", nKeys);
     }
@@ -3057,15 +3826,24 @@ bool CWallet::TopUpKeyPool(unsigned int kpSize)
         else
             nTargetSize = max(GetArg("-keypool", DEFAULT_KEYPOOL_SIZE), (int64_t) 0);
 
+        std::vector<CPubKey> vPubKeys;
         while (setKeyPool.size() < (nTargetSize + 1))
         {
+            GenerateNewKeys(std::min<size_t>(nTargetSize + 1 - setKeyPool.size(), KEYPOOL_GENERATE_BATCH), vPubKeys);
             int64_t nEnd = 1;
             if (!setKeyPool.empty())
                 nEnd = *(--setKeyPool.end()) + 1;
-            if (!walletdb.WritePool(nEnd, CKeyPool(GenerateNewKey())))
-                throw runtime_error(std::string(__func__) + ": writing generated key failed");
-            setKeyPool.insert(nEnd);
-            LogPrintf("keypool added key %d, size=%u\n", nEnd, setKeyPool.size());
+            const int64_t nFirst = nEnd;
+            CDBWriteBatch dbBatch(strWalletFile);
+            for (const CPubKey& pubkey : vPubKeys)
+            {
+                if (!walletdb.WritePool(nEnd, CKeyPool(pubkey)))
+                    throw runtime_error(std::string(__func__) + ": writing generated key failed");
+                setKeyPool.insert(nEnd++);
+            }
+            if (!dbBatch.Commit())
+                throw runtime_error(std::string(__func__) + ": committing generated keys failed");
+            LogPrintf("keypool added keys %d-%d, size=%u\n", nFirst, nEnd - 1, setKeyPool.size());
         }
     }
     return true;
@@ -3161,10 +3939,19 @@ std::map<CTxDestination, CAmount> CWallet::GetAddressBalances()
     map<CTxDestination, CAmount> balances;
 
     {
-        LOCK(cs_wallet);
-        BOOST_FOREACH(PAIRTYPE(uint256, CWalletTx) walletEntry, mapWallet)
+        LOCK2(cs_main, cs_wallet);
+        UpdateBalanceLedger();
+
+        // Only unspent outputs add to a balance, so walk mapWalletUnspent
+        // like AvailableCoins() instead of every output in the wallet.
+        // Destinations whose outputs are all spent are left out.
+        std::map<COutPoint, isminetype>::const_iterator itUnspent = mapWalletUnspent.begin();
+        while (itUnspent != mapWalletUnspent.end())
         {
-            CWalletTx *pcoin = &walletEntry.second;
+            const CWalletTx* pcoin = &mapWallet.at(itUnspent->first.hash);
+            std::map<COutPoint, isminetype>::const_iterator itNextTx = mapWalletUnspent.lower_bound(COutPoint(itUnspent->first.hash, std::numeric_limits<uint32_t>::max()));
+            std::map<COutPoint, isminetype>::const_iterator itTx = itUnspent;
+            itUnspent = itNextTx;
 
             if (!pcoin->IsTrusted())
                 continue;
@@ -3176,19 +3963,13 @@ std::map<CTxDestination, CAmount> CWallet::GetAddressBalances()
             if (nDepth < (pcoin->IsFromMe(ISMINE_ALL) ? 0 : 1))
                 continue;
 
-            for (unsigned int i = 0; i < pcoin->tx->vout.size(); i++)
+            for (; itTx != itNextTx; ++itTx)
             {
+                const CTxOut& txout = pcoin->tx->vout[itTx->first.n];
                 CTxDestination addr;
-                if (!IsMine(pcoin->tx->vout[i]))
-                    continue;
-                if(!ExtractDestination(pcoin->tx->vout[i].scriptPubKey, addr))
+                if (!ExtractDestination(txout.scriptPubKey, addr))
                     continue;
-
-                CAmount n = IsSpent(walletEntry.first, i) ? 0 : pcoin->tx->vout[i].nValue;
-
-                if (!balances.count(addr))
-                    balances[addr] = 0;
-                balances[addr] += n;
+                balances[addr] += txout.nValue;
             }
         }
     }
@@ -3196,95 +3977,90 @@ std::map<CTxDestination, CAmount> CWallet::GetAddressBalances()
     return balances;
 }
 
-set< set<CTxDestination> > CWallet::GetAddressGroupings()
+CTxDestination CWallet::FindGroupingRoot(const CTxDestination& dest)
 {
-    AssertLockHeld(cs_wallet); // mapWallet
-    set< set<CTxDestination> > groupings;
-    set<CTxDestination> grouping;
-
-    BOOST_FOREACH(PAIRTYPE(uint256, CWalletTx) walletEntry, mapWallet)
+    std::map<CTxDestination, CTxDestination>::iterator it = mapGroupingParent.find(dest);
+    while (!(it->second == it->first))
     {
-        CWalletTx *pcoin = &walletEntry.second;
+        // Path halving: point each visited node at its grandparent
+        std::map<CTxDestination, CTxDestination>::iterator parent = mapGroupingParent.find(it->second);
+        it->second = parent->second;
+        it = mapGroupingParent.find(it->second);
+    }
+    return it->first;
+}
 
-        if (pcoin->tx->vin.size() > 0)
+// Merge the addresses wtx links together into one group: its inputs that are
+// ours and, if there are any, its change. Every output of ours is at least
+// its own group.
+void CWallet::GroupAddresses(const CWalletTx& wtx)
+{
+    AssertLockHeld(cs_wallet); // mapWallet, mapGroupingParent
+    std::vector<CTxDestination> vGrouping;
+
+    if (wtx.tx->vin.size() > 0)
+    {
+        bool any_mine = false;
+        BOOST_FOREACH(const CTxIn& txin, wtx.tx->vin)
         {
-            bool any_mine = false;
-            // group all input addresses with each other
-            BOOST_FOREACH(CTxIn txin, pcoin->tx->vin)
-            {
-                CTxDestination address;
-                if(!IsMine(txin)) /* If this input isn't mine, ignore it */
-                    continue;
-                if(!ExtractDestination(mapWallet[txin.prevout.hash].tx->vout[txin.prevout.n].scriptPubKey, address))
-                    continue;
-                grouping.insert(address);
-                any_mine = true;
-            }
+            CTxDestination address;
+            if (!IsMine(txin))
+                continue;
+            if (!ExtractDestination(mapWallet.at(txin.prevout.hash).tx->vout[txin.prevout.n].scriptPubKey, address))
+                continue;
+            vGrouping.push_back(address);
+            any_mine = true;
+        }
 
-            // group change with input addresses
-            if (any_mine)
-            {
-               BOOST_FOREACH(CTxOut txout, pcoin->tx->vout)
-                   if (IsChange(txout))
-                   {
-                       CTxDestination txoutAddr;
-                       if(!ExtractDestination(txout.scriptPubKey, txoutAddr))
-                           continue;
-                       grouping.insert(txoutAddr);
-                   }
-            }
-            if (grouping.size() > 0)
+        if (any_mine)
+        {
+            BOOST_FOREACH(const CTxOut& txout, wtx.tx->vout)
             {
-                groupings.insert(grouping);
-                grouping.clear();
+                CTxDestination txoutAddr;
+                if (IsChange(txout) && ExtractDestination(txout.scriptPubKey, txoutAddr))
+                    vGrouping.push_back(txoutAddr);
             }
         }
+    }
 
-        // group lone addrs by themselves
-        for (unsigned int i = 0; i < pcoin->tx->vout.size(); i++)
-            if (IsMine(pcoin->tx->vout[i]))
-            {
-                CTxDestination address;
-                if(!ExtractDestination(pcoin->tx->vout[i].scriptPubKey, address))
-                    continue;
-                grouping.insert(address);
-                groupings.insert(grouping);
-                grouping.clear();
-            }
+    BOOST_FOREACH(const CTxOut& txout, wtx.tx->vout)
+    {
+        CTxDestination address;
+        if (IsMine(txout) && ExtractDestination(txout.scriptPubKey, address))
+            mapGroupingParent.insert(std::make_pair(address, address));
     }
 
-    set< set<CTxDestination>* > uniqueGroupings; // a set of pointers to groups of addresses
-    map< CTxDestination, set<CTxDestination>* > setmap;  // map addresses to the unique group containing it
-    BOOST_FOREACH(set<CTxDestination> _grouping, groupings)
+    for (size_t i = 0; i < vGrouping.size(); i++)
     {
-        // make a set of all the groups hit by this new group
-        set< set<CTxDestination>* > hits;
-        map< CTxDestination, set<CTxDestination>* >::iterator it;
-        BOOST_FOREACH(CTxDestination address, _grouping)
-            if ((it = setmap.find(address)) != setmap.end())
-                hits.insert((*it).second);
+        mapGroupingParent.insert(std::make_pair(vGrouping[i], vGrouping[i]));
+        if (i == 0)
+            continue;
+        CTxDestination root = FindGroupingRoot(vGrouping[i]);
+        CTxDestination rootFirst = FindGroupingRoot(vGrouping[0]);
+        if (!(root == rootFirst))
+            mapGroupingParent[root] = rootFirst;
+    }
+}
 
-        // merge all hit groups into a new single group and delete old groups
-        set<CTxDestination>* merged = new set<CTxDestination>(_grouping);
-        BOOST_FOREACH(set<CTxDestination>* hit, hits)
-        {
-            merged->insert(hit->begin(), hit->end());
-            uniqueGroupings.erase(hit);
-            delete hit;
-        }
-        uniqueGroupings.insert(merged);
+set< set<CTxDestination> > CWallet::GetAddressGroupings()
+{
+    AssertLockHeld(cs_wallet); // mapWallet
 
-        // update setmap
-        BOOST_FOREACH(CTxDestination element, *merged)
-            setmap[element] = merged;
+    if (fGroupingsStale)
+    {
+        mapGroupingParent.clear();
+        fGroupingsStale = false;
+        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+            GroupAddresses(it->second);
     }
 
+    map<CTxDestination, set<CTxDestination> > mapGroups;
+    for (std::map<CTxDestination, CTxDestination>::const_iterator it = mapGroupingParent.begin(); it != mapGroupingParent.end(); ++it)
+        mapGroups[FindGroupingRoot(it->first)].insert(it->first);
+
     set< set<CTxDestination> > ret;
-    BOOST_FOREACH(set<CTxDestination>* uniqueGrouping, uniqueGroupings)
-    {
-        ret.insert(*uniqueGrouping);
-        delete uniqueGrouping;
-    }
+    for (map<CTxDestination, set<CTxDestination> >::iterator it = mapGroups.begin(); it != mapGroups.end(); ++it)
+        ret.insert(std::move(it->second));
 
     return ret;
 }
@@ -3605,9 +4381,12 @@ std::string CWallet::GetWalletHelpString(bool showDebug)
     {
         strUsage += HelpMessageGroup(_("Wallet debugging/testing options:"));
 
+        strUsage += HelpMessageOpt("-checkwalletbalances", strprintf("Verify the incrementally maintained wallet balances and unspent outputs against a full scan on every query (default: %u)", Params(CBaseChainParams::MAIN).DefaultConsistencyChecks()));
         strUsage += HelpMessageOpt("-dblogsize=<n>", strprintf("Flush wallet database activity from memory to disk log every <n> megabytes (default: %u)", DEFAULT_WALLET_DBLOGSIZE));
         strUsage += HelpMessageOpt("-flushwallet", strprintf("Run a thread to flush wallet periodically (default: %u)", DEFAULT_FLUSHWALLET));
         strUsage += HelpMessageOpt("-privdb", strprintf("Sets the DB_PRIVATE flag in the wallet db environment (default: %u)", DEFAULT_WALLET_PRIVDB));
+        strUsage += HelpMessageOpt("-walletbatchfsync", strprintf("Sync the wallet db log to disk on every commit of a rescan, import or keypool write batch (default: %u)", DEFAULT_WALLET_BATCH_FSYNC));
+        strUsage += HelpMessageOpt("-walletbatchsize=<n>", strprintf("Commit rescan, import and keypool wallet writes in transactions of up to <n> records, 0 to commit every record (default: %u)", DEFAULT_WALLET_BATCH_SIZE));
         strUsage += HelpMessageOpt("-walletrejectlongchains", strprintf(_("Wallet will not create transactions that violate mempool chain limits (default: %u)"), DEFAULT_WALLET_REJECT_LONG_CHAINS));
     }
 
@@ -3910,6 +4689,7 @@ bool CWallet::ParameterInteraction()
     bSpendZeroConfChange = GetBoolArg("-spendzeroconfchange", DEFAULT_SPEND_ZEROCONF_CHANGE);
     fSendFreeTransactions = GetBoolArg("-sendfreetransactions", DEFAULT_SEND_FREE_TRANSACTIONS);
     fWalletRbf = GetBoolArg("-walletrbf", DEFAULT_WALLET_RBF);
+    fCheckWalletBalances = GetBoolArg("-checkwalletbalances", Params().DefaultConsistencyChecks());
 
     if (fSendFreeTransactions && GetArg("-limitfreerelay", DEFAULT_LIMITFREERELAY) <= 0)
         return InitError("Creation of free transactions with their relay disabled is not supported.");
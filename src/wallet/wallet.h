@@ -12,6 +12,7 @@
 #include "tinyformat.h"
 #include "ui_interface.h"
 #include "utilstrencodings.h"
+#include "utiltime.h"
 #include "validationinterface.h"
 #include "script/ismine.h"
 #include "script/sign.h"
@@ -21,11 +22,14 @@
 
 #include <algorithm>
 #include <atomic>
+#include <functional>
 #include <map>
 #include <set>
 #include <stdexcept>
 #include <stdint.h>
 #include <string>
+#include <thread>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -42,6 +46,7 @@ extern unsigned int nTxConfirmTarget;
 extern bool bSpendZeroConfChange;
 extern bool fSendFreeTransactions;
 extern bool fWalletRbf;
+extern bool fCheckWalletBalances;
 
 static const unsigned int DEFAULT_KEYPOOL_SIZE = 100;
 //! -paytxfee default
@@ -72,6 +77,18 @@ static const bool DEFAULT_WALLETBROADCAST = true;
 static const bool DEFAULT_DISABLE_WALLET = false;
 //! if set, all keys will be derived by using BIP32
 static const bool DEFAULT_USE_HD_WALLET = true;
+//! Steps the exact-match coin selection search may take before falling back to the stochastic one
+static const int COIN_SELECTION_BNB_TRIES = 100000;
+//! Coins visited, summed over all passes, that the stochastic coin selection is limited to
+static const int COIN_SELECTION_APPROXIMATE_BUDGET = 10000000;
+//! Maximum number of threads reading and prefiltering blocks during a rescan
+static const int MAX_RESCAN_THREADS = 8;
+//! Number of blocks handed to the rescan threads at once
+static const int RESCAN_BATCH_BLOCKS = 64;
+//! Maximum number of threads deriving keys for the keypool
+static const int MAX_KEYPOOL_THREADS = 8;
+//! Number of keys the keypool generates, stores and commits at once
+static const unsigned int KEYPOOL_GENERATE_BATCH = 1000;
 
 extern const char * DEFAULT_WALLET_DAT;
 
@@ -212,6 +229,10 @@ public:
     mutable CAmount nImmatureWatchCreditCached;
     mutable CAmount nAvailableWatchCreditCached;
     mutable CAmount nChangeCached;
+    // balance ledger state (memory only, see CWallet::UpdateBalanceLedger)
+    mutable bool fBalanceSettled;
+    mutable CAmount nSettledCredit;
+    mutable CAmount nSettledWatchCredit;
 
     CWalletTx()
     {
@@ -251,6 +272,9 @@ public:
         nAvailableWatchCreditCached = 0;
         nImmatureWatchCreditCached = 0;
         nChangeCached = 0;
+        fBalanceSettled = false;
+        nSettledCredit = 0;
+        nSettledWatchCredit = 0;
         nOrderPos = -1;
     }
 
@@ -299,18 +323,7 @@ public:
     }
 
     //! make sure balances are recalculated
-    void MarkDirty()
-    {
-        fCreditCached = false;
-        fAvailableCreditCached = false;
-        fImmatureCreditCached = false;
-        fWatchDebitCached = false;
-        fWatchCreditCached = false;
-        fAvailableWatchCreditCached = false;
-        fImmatureWatchCreditCached = false;
-        fDebitCached = false;
-        fChangeCached = false;
-    }
+    void MarkDirty();
 
     void BindWallet(CWallet *pwalletIn)
     {
@@ -372,6 +385,21 @@ public:
     std::string ToString() const;
 };
 
+/**
+ * A spendable output as seen by coin selection. SelectCoins() prepares these
+ * once per transaction, sorted by descending value (equal values in random
+ * order), and every confirmation tier and fee loop iteration then filters
+ * the same list instead of reshuffling and resorting the wallet's coins.
+ */
+struct CSelectionCandidate
+{
+    CAmount nValue;
+    std::pair<const CWalletTx*, unsigned int> coin;
+    int nDepth;
+    bool fFromMe;
+    //! CTxMemPool::GetChainLength() of the transaction holding the output
+    uint64_t nChainLength;
+};
 
 
 
@@ -485,6 +513,38 @@ private:
 };
 
 
+/** Wallet balances, split the same way as the CWallet::Get*Balance() accessors. */
+struct CWalletBalances
+{
+    CAmount nTrusted;
+    CAmount nUntrustedPending;
+    CAmount nImmature;
+    CAmount nWatchOnlyTrusted;
+    CAmount nWatchOnlyUntrustedPending;
+    CAmount nWatchOnlyImmature;
+
+    CWalletBalances() : nTrusted(0), nUntrustedPending(0), nImmature(0), nWatchOnlyTrusted(0), nWatchOnlyUntrustedPending(0), nWatchOnlyImmature(0) {}
+
+    bool operator==(const CWalletBalances& b) const
+    {
+        return nTrusted == b.nTrusted && nUntrustedPending == b.nUntrustedPending && nImmature == b.nImmature &&
+               nWatchOnlyTrusted == b.nWatchOnlyTrusted && nWatchOnlyUntrustedPending == b.nWatchOnlyUntrustedPending && nWatchOnlyImmature == b.nWatchOnlyImmature;
+    }
+};
+
+/** Salted hasher for the wallet's set of owned scriptPubKeys, so that others cannot make its buckets collide. */
+class SaltedScriptHasher
+{
+private:
+    /** Salt */
+    const uint64_t k0, k1;
+
+public:
+    SaltedScriptHasher();
+
+    size_t operator()(const CScript& script) const;
+};
+
 /** 
  * A CWallet is an extension of a keystore, which also maintains a set of transactions and balances,
  * and provides the ability to create new transactions.
@@ -499,7 +559,9 @@ private:
      * all coins from coinControl are selected; Never select unconfirmed coins
      * if they are not ours
      */
-    bool SelectCoins(const std::vector<COutput>& vAvailableCoins, const CAmount& nTargetValue, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, const CCoinControl *coinControl = NULL) const;
+    bool SelectCoins(const std::vector<COutput>& vAvailableCoins, const CAmount& nTargetValue, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, const CCoinControl *coinControl = NULL, std::vector<CSelectionCandidate>* pvCandidates = NULL) const;
+    void MakeSelectionCandidates(const std::vector<COutput>& vCoins, std::vector<CSelectionCandidate>& vCandidates) const;
+    bool SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, uint64_t nMaxAncestors, const std::vector<CSelectionCandidate>& vCandidates, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet) const;
 
     CWalletDB *pwalletdbEncryption;
 
@@ -548,6 +610,86 @@ private:
      */
     bool AddWatchOnly(const CScript& dest) override;
 
+    /**
+     * Balance ledger, guarded by cs_wallet. Confirmed, final, mature
+     * transactions can only change their contribution to the balance through
+     * CWalletTx::MarkDirty() or a reorg, so their available credit is summed
+     * into nSettledBalance/nSettledWatchBalance once. Unconfirmed transactions
+     * and immature coinbases (setBalancePending) depend on mempool state and
+     * chain height and are still evaluated on every query.
+     *
+     * Adding a script or watch-only script changes what IsMine() accepts
+     * without touching any transaction. MarkOwnershipChanged() then only
+     * flags a reset, and the rebuild recomputes the cached credits of every
+     * transaction as it walks them.
+     *
+     * The dirty set also drives mapWalletUnspent: every output of a wallet
+     * transaction that IsMine() and is not IsSpent(), keyed by outpoint (so
+     * in the same order as walking mapWallet) with its ismine type. Whether
+     * an output is spent changes under the same conditions as its
+     * transaction's available credit, so AvailableCoins() only has to look
+     * at unspent outputs.
+     */
+    mutable CAmount nSettledBalance;
+    mutable CAmount nSettledWatchBalance;
+    mutable std::set<uint256> setBalancePending;
+    mutable std::set<uint256> setBalanceDirty;
+    mutable bool fBalanceLedgerReset;
+    mutable bool fOwnershipChanged;
+    //! Tip the ledger was last brought up to date with; a reorg away from it forces a reset
+    mutable const CBlockIndex* pindexBalanceLedger;
+
+    mutable std::map<COutPoint, isminetype> mapWalletUnspent;
+
+    bool SettleBalanceTx(const CWalletTx& wtx) const;
+    void UpdateUnspent(const uint256& hash) const;
+    void UpdateBalanceLedger() const;
+    void MarkOwnershipChanged();
+
+    /**
+     * scriptPubKeys of the standard templates that IsMine() can only accept
+     * because of something the keystore holds: P2PK and P2PKH of each key,
+     * P2SH of each script (and the script itself if it is a witness program)
+     * and each watch-only script. An output of one of those templates that
+     * is not in here is not ours, which CWallet::IsMine() answers with a
+     * single hash probe, and rescans prefilter block outputs on it. Entries
+     * are never removed; a stale one only costs a full ::IsMine() call.
+     * Guarded by cs_KeyStore.
+     */
+    std::unordered_set<CScript, SaltedScriptHasher> setOwnedScripts;
+    void AddOwnedScripts(const CPubKey& pubkey);
+    void AddOwnedScripts(const CScript& script, bool fWatchOnly);
+
+    /**
+     * Address groupings as a union-find forest over destinations, each
+     * mapped to its parent and roots to themselves. While it is current,
+     * new transactions are merged in by AddToWallet(). Anything that can
+     * split a group (MarkDirty() after imports or zapping, a new script or
+     * watch-only script, an address book change that turns change into a
+     * receive) marks it stale instead and the next GetAddressGroupings()
+     * rebuilds it. Guarded by cs_wallet.
+     */
+    std::map<CTxDestination, CTxDestination> mapGroupingParent;
+    bool fGroupingsStale;
+    CTxDestination FindGroupingRoot(const CTxDestination& dest);
+    void GroupAddresses(const CWalletTx& wtx);
+
+    //! Rescan state, readable without cs_wallet so a rescan can be watched and aborted while it runs
+    std::atomic<bool> fScanningWallet;
+    std::atomic<bool> fAbortRescan;
+    std::atomic<int64_t> nScanStartTime;
+    std::atomic<double> dScanProgress;
+
+    bool IsScanCandidate(const CTransaction& tx) const;
+    bool IsScanCandidateOutput(const CScript& scriptPubKey) const;
+
+    //! Checks keys loaded without their pubkey/privkey hash, see VerifyKeysInBackground()
+    std::thread threadVerifyKeys;
+    std::atomic<bool> fAbortVerifyKeys;
+    //! Keys loaded without their pubkey/privkey hash that the background check
+    //! has not reached yet; GetKey checks them itself. Guarded by cs_KeyStore.
+    mutable std::set<CKeyID> setUncheckedKeys;
+
 public:
     /*
      * Main wallet lock.
@@ -593,6 +735,9 @@ public:
 
     ~CWallet()
     {
+        fAbortVerifyKeys = true;
+        if (threadVerifyKeys.joinable())
+            threadVerifyKeys.join();
         delete pwalletdbEncryption;
         pwalletdbEncryption = NULL;
     }
@@ -609,6 +754,17 @@ public:
         nLastResend = 0;
         nTimeFirstKey = 0;
         fBroadcastTransactions = false;
+        nSettledBalance = 0;
+        nSettledWatchBalance = 0;
+        fBalanceLedgerReset = true;
+        fOwnershipChanged = false;
+        pindexBalanceLedger = NULL;
+        fGroupingsStale = true;
+        fScanningWallet = false;
+        fAbortRescan = false;
+        fAbortVerifyKeys = false;
+        nScanStartTime = 0;
+        dScanProgress = 0.0;
     }
 
     std::map<uint256, CWalletTx> mapWallet;
@@ -618,6 +774,24 @@ public:
     typedef std::multimap<int64_t, TxPair > TxItems;
     TxItems wtxOrdered;
 
+    /**
+     * Order positions of the wallet transactions with an output to each
+     * destination, filled alongside wtxOrdered. History queries for an
+     * address or label only visit the transactions in here.
+     */
+    std::map<CTxDestination, std::set<int64_t> > mapOrderPosByDest;
+    void IndexOrderPos(const CWalletTx& wtx);
+    //! Remove wtx from wtxOrdered and mapOrderPosByDest, before it is erased from mapWallet
+    void UnindexOrderPos(const CWalletTx& wtx);
+
+    /**
+     * Visit wtxOrdered newest first, starting at the items with order
+     * position nStartPos or below. If pdests is given only transactions
+     * with an output to one of those destinations are visited. Stops when
+     * fn returns false.
+     */
+    void WalkOrderedTxItems(int64_t nStartPos, const std::set<CTxDestination>* pdests, const std::function<bool(int64_t, const TxPair&)>& fn) const;
+
     int64_t nOrderPosNext;
     std::map<uint256, int> mapRequestCount;
 
@@ -658,11 +832,22 @@ public:
      * Generate a new key
      */
     CPubKey GenerateNewKey();
+    /**
+     * Generate nKeys keys as GenerateNewKey() would. The key derivation and
+     * public key computation is spread over up to MAX_KEYPOOL_THREADS threads
+     * and the keys are added to the keystore in one pass.
+     */
+    void GenerateNewKeys(unsigned int nKeys, std::vector<CPubKey>& vPubKeys);
     void DeriveNewChildKey(CKeyMetadata& metadata, CKey& secret);
+    //! Derive m/0'/0', the parent of the keys DeriveNewChildKey() hands out
+    void DeriveExternalChainKey(CExtKey& externalChainChildKey);
     //! Adds a key to the store, and saves it to disk.
     bool AddKeyPubKey(const CKey& key, const CPubKey &pubkey) override;
+    //! Adds many keys to the store, and saves them to disk.
+    bool AddKeyPubKeys(const std::vector<std::pair<CKey, CPubKey> >& vKeys);
     //! Adds a key to the store, without saving it to disk (used by LoadWallet)
-    bool LoadKey(const CKey& key, const CPubKey &pubkey) { return CCryptoKeyStore::AddKeyPubKey(key, pubkey); }
+    bool LoadKey(const CKey& key, const CPubKey &pubkey);
+    bool GetKey(const CKeyID &address, CKey& keyOut) const override;
     //! Load metadata (used by LoadWallet)
     bool LoadKeyMetadata(const CTxDestination& pubKey, const CKeyMetadata &metadata);
 
@@ -671,6 +856,8 @@ public:
 
     //! Adds an encrypted key to the store, and saves it to disk.
     bool AddCryptedKey(const CPubKey &vchPubKey, const std::vector<unsigned char> &vchCryptedSecret) override;
+    //! Adds many encrypted keys to the store, and saves them to disk through one database handle.
+    bool AddCryptedKeys(const std::vector<std::pair<CPubKey, std::vector<unsigned char> > >& vCryptedKeys) override;
     //! Adds an encrypted key to the store, without saving it to disk (used by LoadWallet)
     bool LoadCryptedKey(const CPubKey &vchPubKey, const std::vector<unsigned char> &vchCryptedSecret);
     bool AddCScript(const CScript& redeemScript) override;
@@ -707,14 +894,33 @@ public:
     bool GetAccountPubkey(CPubKey &pubKey, std::string strAccount, bool bForceNew = false);
 
     void MarkDirty();
+    //! Queue a transaction whose credit or confirmation state changed for re-evaluation by the balance ledger
+    void MarkBalanceDirty(const uint256& hash) const;
     bool AddToWallet(const CWalletTx& wtxIn, bool fFlushOnClose=true);
     bool LoadToWallet(const CWalletTx& wtxIn);
+    /**
+     * Check the private keys of vPubKeys against their pubkeys on a thread
+     * of its own. Used for keys of old wallets that were stored without a
+     * hash to check them with, so the wallet does not wait for an EC
+     * multiplication per key at startup. A key that does not match is
+     * removed from the keystore, logged and reported to the user as
+     * corruption; until it is checked, GetKey checks it before handing it out.
+     */
+    void VerifyKeysInBackground(const std::vector<CPubKey>& vPubKeys);
     void SyncTransaction(const CTransaction& tx, const CBlockIndex *pindex, int posInBlock) override;
     bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlockIndex* pIndex, int posInBlock, bool fUpdate);
     CBlockIndex* ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false);
+    //! Flag the transactions of block with an output IsMine() may accept. Only takes cs_KeyStore, for the rescan threads.
+    void MatchScanOutputs(const CBlock& block, std::vector<bool>& vOutputMatch) const;
+    void AbortRescan() { fAbortRescan = true; }
+    bool IsAbortingRescan() const { return fAbortRescan; }
+    bool IsScanning() const { return fScanningWallet; }
+    int64_t ScanningDuration() const { return fScanningWallet ? GetTimeMillis() - nScanStartTime : 0; }
+    double ScanningProgress() const { return fScanningWallet ? dScanProgress.load() : 0.0; }
     void ReacceptWalletTransactions();
     void ResendWalletTransactions(int64_t nBestBlockTime, CConnman* connman) override;
     std::vector<uint256> ResendWalletTransactionsBefore(int64_t nTime, CConnman* connman);
+    CWalletBalances GetBalances() const;
     CAmount GetBalance() const;
     CAmount GetUnconfirmedBalance() const;
     CAmount GetImmatureBalance() const;
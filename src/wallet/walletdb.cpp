@@ -16,6 +16,7 @@
 #include "wallet/wallet.h"
 
 #include <atomic>
+#include <thread>
 
 #include <boost/version.hpp>
 #include <boost/filesystem.hpp>
@@ -278,6 +279,126 @@ public:
     }
 };
 
+/**
+ * Decode a "tx" record whose type has already been read off ssKey. This is
+ * the expensive part of loading a transaction and touches no wallet state,
+ * so LoadWallet() runs it on several threads.
+ */
+static bool DecodeTxRecord(CDataStream& ssKey, CDataStream& ssValue, CWalletTx& wtx, bool& fUpgraded, string& strErr)
+{
+    uint256 hash;
+    ssKey >> hash;
+    ssValue >> wtx;
+    CValidationState state;
+    if (!(CheckTransaction(wtx, state) && (wtx.GetHash() == hash) && state.IsValid()))
+        return false;
+
+    // Undo serialize changes in 31600
+    fUpgraded = false;
+    if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703)
+    {
+        if (!ssValue.empty())
+        {
+            char fTmp;
+            char fUnused;
+            ssValue >> fTmp >> fUnused >> wtx.strFromAccount;
+            strErr = strprintf("LoadWallet() upgrading tx ver=%d %d '%s' %s",
+                               wtx.fTimeReceivedIsTxTime, fTmp, wtx.strFromAccount, hash.ToString());
+            wtx.fTimeReceivedIsTxTime = fTmp;
+        }
+        else
+        {
+            strErr = strprintf("LoadWallet() repairing tx ver=%d %s", wtx.fTimeReceivedIsTxTime, hash.ToString());
+            wtx.fTimeReceivedIsTxTime = 0;
+        }
+        fUpgraded = true;
+    }
+    return true;
+}
+
+static void LoadTxRecord(CWallet* pwallet, const CWalletTx& wtx, bool fUpgraded, CWalletScanState& wss)
+{
+    if (fUpgraded)
+        wss.vWalletUpgrade.push_back(wtx.GetHash());
+
+    if (wtx.nOrderPos == -1)
+        wss.fAnyUnordered = true;
+
+    pwallet->LoadToWallet(wtx);
+}
+
+/**
+ * Decode a "key" or "wkey" record whose type has already been read off
+ * ssKey. Like DecodeTxRecord() it touches no wallet state. Keys stored
+ * without a hash of pubkey and privkey can only be checked by deriving the
+ * pubkey again; with fDeferCheck that is left to the caller, which fVerify
+ * tells about it.
+ */
+static bool DecodeKeyRecord(const string& strType, CDataStream& ssKey, CDataStream& ssValue,
+                            CKey& key, CPubKey& vchPubKey, bool fDeferCheck, bool& fVerify, string& strErr)
+{
+    ssKey >> vchPubKey;
+    if (!vchPubKey.IsValid())
+    {
+        strErr = "Error reading wallet database: CPubKey corrupt";
+        return false;
+    }
+    CPrivKey pkey;
+    uint256 hash;
+
+    if (strType == "key")
+    {
+        ssValue >> pkey;
+    } else {
+        CWalletKey wkey;
+        ssValue >> wkey;
+        pkey = wkey.vchPrivKey;
+    }
+
+    // Old wallets store keys as "key" [pubkey] => [privkey]
+    // ... which was slow for wallets with lots of keys, because the public key is re-derived from the private key
+    // using EC operations as a checksum.
+    // Newer wallets store keys as "key"[pubkey] => [privkey][hash(pubkey,privkey)], which is much faster while
+    // remaining backwards-compatible.
+    try
+    {
+        ssValue >> hash;
+    }
+    catch (...) {}
+
+    bool fSkipCheck = false;
+    fVerify = false;
+
+    if (!hash.IsNull())
+    {
+        // hash pubkey/privkey to accelerate wallet load
+        std::vector<unsigned char> vchKey;
+        vchKey.reserve(vchPubKey.size() + pkey.size());
+        vchKey.insert(vchKey.end(), vchPubKey.begin(), vchPubKey.end());
+        vchKey.insert(vchKey.end(), pkey.begin(), pkey.end());
+
+        if (Hash(vchKey.begin(), vchKey.end()) != hash)
+        {
+            strErr = "Error reading wallet database: CPubKey/CPrivKey corrupt";
+            return false;
+        }
+
+        fSkipCheck = true;
+    }
+    else if (fDeferCheck)
+    {
+        fSkipCheck = true;
+        fVerify = true;
+    }
+
+    if (!key.Load(pkey, vchPubKey, fSkipCheck))
+    {
+        strErr = "Error reading wallet database: CPrivKey corrupt";
+        return false;
+    }
+    return true;
+}
+
 bool
 ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
              CWalletScanState &wss, string& strType, string& strErr)
@@ -301,38 +422,11 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
         }
         else if (strType == "tx")
         {
-            uint256 hash;
-            ssKey >> hash;
             CWalletTx wtx;
-            ssValue >> wtx;
-            CValidationState state;
-            if (!(CheckTransaction(wtx, state) && (wtx.GetHash() == hash) && state.IsValid()))
+            bool fUpgraded;
+            if (!DecodeTxRecord(ssKey, ssValue, wtx, fUpgraded, strErr))
                 return false;
-
-            // Undo serialize changes in 31600
-            if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703)
-            {
-                if (!ssValue.empty())
-                {
-                    char fTmp;
-                    char fUnused;
-                    ssValue >> fTmp >> fUnused >> wtx.strFromAccount;
-                    strErr = strprintf("LoadWallet() upgrading tx ver=%d %d '%s' %s",
-                                       wtx.fTimeReceivedIsTxTime, fTmp, wtx.strFromAccount, hash.ToString());
-                    wtx.fTimeReceivedIsTxTime = fTmp;
-                }
-                else
-                {
-                    strErr = strprintf("LoadWallet() repairing tx ver=%d %s", wtx.fTimeReceivedIsTxTime, hash.ToString());
-                    wtx.fTimeReceivedIsTxTime = 0;
-                }
-                wss.vWalletUpgrade.push_back(hash);
-            }
-
-            if (wtx.nOrderPos == -1)
-                wss.fAnyUnordered = true;
-
-            pwallet->LoadToWallet(wtx);
+            LoadTxRecord(pwallet, wtx, fUpgraded, wss);
         }
         else if (strType == "acentry")
         {
@@ -363,62 +457,13 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
         }
         else if (strType == "key" || strType == "wkey")
         {
-            CPubKey vchPubKey;
-            ssKey >> vchPubKey;
-            if (!vchPubKey.IsValid())
-            {
-                strErr = "Error reading wallet database: CPubKey corrupt";
-                return false;
-            }
-            CKey key;
-            CPrivKey pkey;
-            uint256 hash;
-
             if (strType == "key")
-            {
                 wss.nKeys++;
-                ssValue >> pkey;
-            } else {
-                CWalletKey wkey;
-                ssValue >> wkey;
-                pkey = wkey.vchPrivKey;
-            }
-
-            // Old wallets store keys as "key" [pubkey] => [privkey]
-            // ... which was slow for wallets with lots of keys, because the public key is re-derived from the private key
-            // using EC operations as a checksum.
-            // Newer wallets store keys as "key"[pubkey] => [privkey][hash(pubkey,privkey)], which is much faster while
-            // remaining backwards-compatible.
-            try
-            {
-                ssValue >> hash;
-            }
-            catch (...) {}
-
-            bool fSkipCheck = false;
-
-            if (!hash.IsNull())
-            {
-                // hash pubkey/privkey to accelerate wallet load
-                std::vector<unsigned char> vchKey;
-                vchKey.reserve(vchPubKey.size() + pkey.size());
-                vchKey.insert(vchKey.end(), vchPubKey.begin(), vchPubKey.end());
-                vchKey.insert(vchKey.end(), pkey.begin(), pkey.end());
-
-                if (Hash(vchKey.begin(), vchKey.end()) != hash)
-                {
-                    strErr = "Error reading wallet database: CPubKey/CPrivKey corrupt";
-                    return false;
-                }
-
-                fSkipCheck = true;
-            }
-
-            if (!key.Load(pkey, vchPubKey, fSkipCheck))
-            {
-                strErr = "Error reading wallet database: CPrivKey corrupt";
+            CKey key;
+            CPubKey vchPubKey;
+            bool fVerify;
+            if (!DecodeKeyRecord(strType, ssKey, ssValue, key, vchPubKey, false, fVerify, strErr))
                 return false;
-            }
             if (!pwallet->LoadKey(key, vchPubKey))
             {
                 strErr = "Error reading wallet database: LoadKey failed";
@@ -552,12 +597,88 @@ static bool IsKeyType(string strType)
             strType == "mkey" || strType == "ckey");
 }
 
+namespace {
+
+/** A record read by CWalletDB::LoadWallet() and what a worker made of it */
+struct CWalletLoadRecord
+{
+    CDataStream ssKey;
+    CDataStream ssValue;
+    string strType;
+    string strErr;
+    //! Set for "tx", "key" and "wkey" records, which are decoded by the
+    //! workers; everything else goes through ReadKeyValue() afterwards
+    bool fDecoded;
+    bool fDecodeOK;
+    CWalletTx wtx;
+    bool fUpgraded;
+    CKey key;
+    CPubKey vchPubKey;
+    bool fVerifyKey;
+
+    CWalletLoadRecord() : ssKey(SER_DISK, CLIENT_VERSION), ssValue(SER_DISK, CLIENT_VERSION),
+                          fDecoded(false), fDecodeOK(false), fUpgraded(false), fVerifyKey(false) {}
+};
+
+void DecodeLoadRecord(CWalletLoadRecord& rec)
+{
+    try {
+        // Peek at the type on a copy so records left to ReadKeyValue() are untouched
+        CDataStream ssKey(rec.ssKey);
+        ssKey >> rec.strType;
+        if (rec.strType == "tx") {
+            rec.fDecoded = true;
+            rec.fDecodeOK = DecodeTxRecord(ssKey, rec.ssValue, rec.wtx, rec.fUpgraded, rec.strErr);
+        } else if (rec.strType == "key" || rec.strType == "wkey") {
+            rec.fDecoded = true;
+            rec.fDecodeOK = DecodeKeyRecord(rec.strType, ssKey, rec.ssValue, rec.key, rec.vchPubKey, true, rec.fVerifyKey, rec.strErr);
+        }
+    } catch (...) {
+        rec.fDecodeOK = false;
+    }
+}
+
+bool LoadDecodedRecord(CWallet* pwallet, CWalletLoadRecord& rec, CWalletScanState& wss, vector<CPubKey>& vVerifyKeys)
+{
+    if (rec.strType == "key")
+        wss.nKeys++;
+    if (!rec.fDecodeOK)
+        return false;
+    if (rec.strType == "tx") {
+        LoadTxRecord(pwallet, rec.wtx, rec.fUpgraded, wss);
+        return true;
+    }
+    if (!pwallet->LoadKey(rec.key, rec.vchPubKey)) {
+        rec.strErr = "Error reading wallet database: LoadKey failed";
+        return false;
+    }
+    if (rec.fVerifyKey)
+        vVerifyKeys.push_back(rec.vchPubKey);
+    return true;
+}
+
+} // namespace
+
+/**
+ * Records are read off the cursor WALLET_LOAD_BATCH at a time. Transactions
+ * and plaintext keys in a batch, which are most of a large wallet and most
+ * of the time spent loading it, are deserialized and checked by up to
+ * MAX_WALLET_LOAD_THREADS threads; then every record of the batch is loaded
+ * into the wallet in cursor order, as before. Keys from old wallets that
+ * lack the pubkey/privkey hash are checked against their pubkey by
+ * CWallet::VerifyKeysInBackground() once the wallet is up, rather than
+ * holding up startup with an EC multiplication per key.
+ */
 DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
 {
     pwallet->vchDefaultKey = CPubKey();
     CWalletScanState wss;
     bool fNoncriticalErrors = false;
     DBErrors result = DB_LOAD_OK;
+    vector<CPubKey> vVerifyKeys;
+    const int nThreads = std::max(1, std::min(GetNumCores(), MAX_WALLET_LOAD_THREADS));
+    unsigned int nRecords = 0;
+    int64_t nTimeReadTotal = 0, nTimeDecodeTotal = 0, nTimeLoadTotal = 0;
 
     LOCK(pwallet->cs_wallet);
     try {
@@ -577,39 +698,77 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
             return DB_CORRUPT;
         }
 
-        while (true)
+        std::vector<CWalletLoadRecord> vRecords;
+        bool fEnd = false;
+        while (!fEnd)
         {
-            // Read next record
-            CDataStream ssKey(SER_DISK, CLIENT_VERSION);
-            CDataStream ssValue(SER_DISK, CLIENT_VERSION);
-            int ret = ReadAtCursor(pcursor, ssKey, ssValue);
-            if (ret == DB_NOTFOUND)
-                break;
-            else if (ret != 0)
+            // Read the next batch of records
+            int64_t nTimeStart = GetTimeMicros();
+            vRecords.clear();
+            while (vRecords.size() < WALLET_LOAD_BATCH)
             {
-                LogPrintf("Error reading next record from wallet database\n");
-                return DB_CORRUPT;
+                vRecords.emplace_back();
+                int ret = ReadAtCursor(pcursor, vRecords.back().ssKey, vRecords.back().ssValue);
+                if (ret == DB_NOTFOUND)
+                {
+                    vRecords.pop_back();
+                    fEnd = true;
+                    break;
+                }
+                else if (ret != 0)
+                {
+                    LogPrintf("Error reading next record from wallet database\n");
+                    return DB_CORRUPT;
+                }
             }
-
-            // Try to be tolerant of single corrupt records:
-            string strType, strErr;
-            if (!ReadKeyValue(pwallet, ssKey, ssValue, wss, strType, strErr))
+            nRecords += vRecords.size();
+            int64_t nTimeRead = GetTimeMicros();
+            nTimeReadTotal += nTimeRead - nTimeStart;
+
+            std::atomic<size_t> nNext(0);
+            auto worker = [&]() {
+                size_t i;
+                while ((i = nNext++) < vRecords.size())
+                    DecodeLoadRecord(vRecords[i]);
+            };
+            std::vector<std::thread> vThreads;
+            for (int i = 1; i < std::min<int>(nThreads, vRecords.size()); i++)
+                vThreads.emplace_back(worker);
+            worker();
+            for (std::thread& thread : vThreads)
+                thread.join();
+            int64_t nTimeDecode = GetTimeMicros();
+            nTimeDecodeTotal += nTimeDecode - nTimeRead;
+
+            for (CWalletLoadRecord& rec : vRecords)
             {
-                // losing keys is considered a catastrophic error, anything else
-                // we assume the user can live with:
-                if (IsKeyType(strType))
-                    result = DB_CORRUPT;
-                else
+                // Try to be tolerant of single corrupt records:
+                string strType = rec.strType, strErr;
+                bool fLoaded;
+                if (rec.fDecoded) {
+                    fLoaded = LoadDecodedRecord(pwallet, rec, wss, vVerifyKeys);
+                    strErr = rec.strErr;
+                } else
+                    fLoaded = ReadKeyValue(pwallet, rec.ssKey, rec.ssValue, wss, strType, strErr);
+                if (!fLoaded)
                 {
-                    // Leave other errors alone, if we try to fix them we might make things worse.
-                    fNoncriticalErrors = true; // ... but do warn the user there is something wrong.
-                    if (strType == "tx")
-                        // Rescan if there is a bad transaction record:
-                        SoftSetBoolArg("-rescan", true);
+                    // losing keys is considered a catastrophic error, anything else
+                    // we assume the user can live with:
+                    if (IsKeyType(strType))
+                        result = DB_CORRUPT;
+                    else
+                    {
+                        // Leave other errors alone, if we try to fix them we might make things worse.
+                        fNoncriticalErrors = true; // ... but do warn the user there is something wrong.
+                        if (strType == "tx")
+                            // Rescan if there is a bad transaction record:
+                            SoftSetBoolArg("-rescan", true);
+                    }
                 }
+                if (!strErr.empty())
+                    LogPrintf("%s\n", strErr);
             }
-            if (!strErr.empty())
-                LogPrintf("%s\n", strErr);
+            nTimeLoadTotal += GetTimeMicros() - nTimeDecode;
         }
         pcursor->close();
     }
@@ -628,6 +787,9 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
     if (result != DB_LOAD_OK)
         return result;
 
+    LogPrintf("Wallet records: %u read in %.2fms, decoded on %d threads in %.2fms, loaded in %.2fms\n",
+              nRecords, nTimeReadTotal * 0.001, nThreads, nTimeDecodeTotal * 0.001, nTimeLoadTotal * 0.001);
+
     LogPrintf("nFileVersion = %d\n", wss.nFileVersion);
 
     LogPrintf("Keys: %u plaintext, %u encrypted, %u w/ metadata, %u total\n",
@@ -647,6 +809,7 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
     if (wss.nFileVersion < CLIENT_VERSION) // Update
         WriteVersion(CLIENT_VERSION);
 
+    int64_t nTimeStart = GetTimeMicros();
     if (wss.fAnyUnordered)
         result = pwallet->ReorderTransactions();
 
@@ -655,6 +818,11 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
     BOOST_FOREACH(CAccountingEntry& entry, pwallet->laccentries) {
         pwallet->wtxOrdered.insert(make_pair(entry.nOrderPos, CWallet::TxPair((CWalletTx*)0, &entry)));
     }
+    LogPrintf("Wallet accounting entries: %u loaded%s in %.2fms\n", pwallet->laccentries.size(),
+              wss.fAnyUnordered ? ", transactions reordered," : "", (GetTimeMicros() - nTimeStart) * 0.001);
+
+    if (!vVerifyKeys.empty())
+        pwallet->VerifyKeysInBackground(vVerifyKeys);
 
     return result;
 }
@@ -739,6 +907,7 @@ DBErrors CWalletDB::ZapSelectTx(CWallet* pwallet, vector<uint256>& vTxHashIn, ve
     std::sort(vTxHashIn.begin(), vTxHashIn.end());
 
     // erase each matching wallet TX
+    LOCK(pwallet->cs_wallet);
     bool delerror = false;
     vector<uint256>::iterator it = vTxHashIn.begin();
     BOOST_FOREACH (uint256 hash, vTxHash) {
@@ -749,7 +918,12 @@ DBErrors CWalletDB::ZapSelectTx(CWallet* pwallet, vector<uint256>& vTxHashIn, ve
             break;
         }
         else if ((*it) == hash) {
-            pwallet->mapWallet.erase(hash);
+            std::map<uint256, CWalletTx>::iterator mi = pwallet->mapWallet.find(hash);
+            if (mi != pwallet->mapWallet.end()) {
+                // Nothing may point at the transaction once it is gone
+                pwallet->UnindexOrderPos((*mi).second);
+                pwallet->mapWallet.erase(mi);
+            }
             if(!EraseTx(hash)) {
                 LogPrint("db", "Transaction was found for deletion but returned database error: %s\n", hash.GetHex());
                 delerror = true;
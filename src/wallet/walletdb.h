@@ -18,6 +18,10 @@
 #include <vector>
 
 static const bool DEFAULT_FLUSHWALLET = true;
+//! Maximum number of threads decoding wallet records at load
+static const int MAX_WALLET_LOAD_THREADS = 8;
+//! Number of wallet records read off the cursor and decoded at once at load
+static const unsigned int WALLET_LOAD_BATCH = 10000;
 
 class CAccount;
 class CAccountingEntry;
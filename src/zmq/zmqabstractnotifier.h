@@ -9,6 +9,7 @@
 
 class CBlockIndex;
 class CZMQAbstractNotifier;
+enum class MemPoolRemovalReason;
 
 typedef CZMQAbstractNotifier* (*CZMQNotifierFactory)();
 
@@ -34,6 +35,11 @@ public:
 
     virtual bool NotifyBlock(const CBlockIndex *pindex);
     virtual bool NotifyTransaction(const CTransaction &transaction);
+    // Mempool and active chain change events, in the order they happened
+    virtual bool NotifyTransactionAcceptance(const CTransactionRef &ptx);
+    virtual bool NotifyTransactionRemoval(const CTransactionRef &ptx, MemPoolRemovalReason reason);
+    virtual bool NotifyBlockConnect(const CBlockIndex *pindex);
+    virtual bool NotifyBlockDisconnect(const CBlockIndex *pindex);
 
 protected:
     void *psocket;
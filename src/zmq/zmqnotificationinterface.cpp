@@ -8,8 +8,11 @@
 #include "version.h"
 #include "validation.h"
 #include "streams.h"
+#include "txmempool.h"
 #include "util.h"
 
+#include <boost/bind.hpp>
+
 void zmqError(const char *str)
 {
     LogPrint("zmq", "zmq: Error: %s, errno=%s\n", str, zmq_strerror(errno));
@@ -39,6 +42,7 @@ CZMQNotificationInterface* CZMQNotificationInterface::Create()
     factories["pubhashtx"] = CZMQAbstractNotifier::Create<CZMQPublishHashTransactionNotifier>;
     factories["pubrawblock"] = CZMQAbstractNotifier::Create<CZMQPublishRawBlockNotifier>;
     factories["pubrawtx"] = CZMQAbstractNotifier::Create<CZMQPublishRawTransactionNotifier>;
+    factories["pubsequence"] = CZMQAbstractNotifier::Create<CZMQPublishSequenceNotifier>;
 
     for (std::map<std::string, CZMQNotifierFactory>::const_iterator i=factories.begin(); i!=factories.end(); ++i)
     {
@@ -103,6 +107,9 @@ bool CZMQNotificationInterface::Initialize()
         return false;
     }
 
+    mempool.NotifyEntryAdded.connect(boost::bind(&CZMQNotificationInterface::TransactionAddedToMempool, this, _1));
+    mempool.NotifyEntryRemoved.connect(boost::bind(&CZMQNotificationInterface::TransactionRemovedFromMempool, this, _1, _2));
+
     return true;
 }
 
@@ -112,6 +119,9 @@ void CZMQNotificationInterface::Shutdown()
     LogPrint("zmq", "zmq: Shutdown notification interface\n");
     if (pcontext)
     {
+        mempool.NotifyEntryAdded.disconnect(boost::bind(&CZMQNotificationInterface::TransactionAddedToMempool, this, _1));
+        mempool.NotifyEntryRemoved.disconnect(boost::bind(&CZMQNotificationInterface::TransactionRemovedFromMempool, this, _1, _2));
+
         for (std::list<CZMQAbstractNotifier*>::iterator i=notifiers.begin(); i!=notifiers.end(); ++i)
         {
             CZMQAbstractNotifier *notifier = *i;
@@ -124,15 +134,14 @@ void CZMQNotificationInterface::Shutdown()
     }
 }
 
-void CZMQNotificationInterface::UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload)
+// Call func on every notifier, shutting down and dropping the ones that fail
+template <typename Function>
+static void TryForEachAndRemoveFailed(std::list<CZMQAbstractNotifier*>& notifiers, const Function& func)
 {
-    if (fInitialDownload || pindexNew == pindexFork) // In IBD or blocks were disconnected without any new ones
-        return;
-
     for (std::list<CZMQAbstractNotifier*>::iterator i = notifiers.begin(); i!=notifiers.end(); )
     {
         CZMQAbstractNotifier *notifier = *i;
-        if (notifier->NotifyBlock(pindexNew))
+        if (func(notifier))
         {
             i++;
         }
@@ -144,19 +153,55 @@ void CZMQNotificationInterface::UpdatedBlockTip(const CBlockIndex *pindexNew, co
     }
 }
 
+void CZMQNotificationInterface::UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload)
+{
+    if (fInitialDownload || pindexNew == pindexFork) // In IBD or blocks were disconnected without any new ones
+        return;
+
+    TryForEachAndRemoveFailed(notifiers, [pindexNew](CZMQAbstractNotifier* notifier) {
+        return notifier->NotifyBlock(pindexNew);
+    });
+}
+
+// Block connects and disconnects are published as they are applied, so they
+// stay in order with the mempool changes they cause.
+void CZMQNotificationInterface::BlockConnected(const CBlockIndex *pindex)
+{
+    if (IsInitialBlockDownload()) // Don't flood subscribers during IBD
+        return;
+
+    TryForEachAndRemoveFailed(notifiers, [pindex](CZMQAbstractNotifier* notifier) {
+        return notifier->NotifyBlockConnect(pindex);
+    });
+}
+
+void CZMQNotificationInterface::BlockDisconnected(const CBlockIndex *pindex)
+{
+    if (IsInitialBlockDownload())
+        return;
+
+    TryForEachAndRemoveFailed(notifiers, [pindex](CZMQAbstractNotifier* notifier) {
+        return notifier->NotifyBlockDisconnect(pindex);
+    });
+}
+
 void CZMQNotificationInterface::SyncTransaction(const CTransaction& tx, const CBlockIndex* pindex, int posInBlock)
 {
-    for (std::list<CZMQAbstractNotifier*>::iterator i = notifiers.begin(); i!=notifiers.end(); )
-    {
-        CZMQAbstractNotifier *notifier = *i;
-        if (notifier->NotifyTransaction(tx))
-        {
-            i++;
-        }
-        else
-        {
-            notifier->Shutdown();
-            i = notifiers.erase(i);
-        }
-    }
+    TryForEachAndRemoveFailed(notifiers, [&tx](CZMQAbstractNotifier* notifier) {
+        return notifier->NotifyTransaction(tx);
+    });
+}
+
+void CZMQNotificationInterface::TransactionAddedToMempool(CTransactionRef ptx)
+{
+    TryForEachAndRemoveFailed(notifiers, [&ptx](CZMQAbstractNotifier* notifier) {
+        return notifier->NotifyTransactionAcceptance(ptx);
+    });
+}
+
+void CZMQNotificationInterface::TransactionRemovedFromMempool(CTransactionRef ptx, MemPoolRemovalReason reason)
+{
+    TryForEachAndRemoveFailed(notifiers, [&ptx, reason](CZMQAbstractNotifier* notifier) {
+        return notifier->NotifyTransactionRemoval(ptx, reason);
+    });
 }
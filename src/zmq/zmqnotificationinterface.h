@@ -6,11 +6,13 @@
 #define BITCOIN_ZMQ_ZMQNOTIFICATIONINTERFACE_H
 
 #include "validationinterface.h"
+#include "primitives/transaction.h"
 #include <string>
 #include <map>
 
 class CBlockIndex;
 class CZMQAbstractNotifier;
+enum class MemPoolRemovalReason;
 
 class CZMQNotificationInterface : public CValidationInterface
 {
@@ -26,6 +28,12 @@ protected:
     // CValidationInterface
     void SyncTransaction(const CTransaction& tx, const CBlockIndex *pindex, int posInBlock);
     void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload);
+    void BlockConnected(const CBlockIndex *pindex);
+    void BlockDisconnected(const CBlockIndex *pindex);
+
+    // CTxMemPool signals
+    void TransactionAddedToMempool(CTransactionRef ptx);
+    void TransactionRemovedFromMempool(CTransactionRef ptx, MemPoolRemovalReason reason);
 
 private:
     CZMQNotificationInterface();
@@ -4,6 +4,7 @@
 
 #include "chainparams.h"
 #include "streams.h"
+#include "txmempool.h"
 #include "zmqpublishnotifier.h"
 #include "validation.h"
 #include "util.h"
@@ -15,6 +16,7 @@ static const char *MSG_HASHBLOCK = "hashblock";
 static const char *MSG_HASHTX    = "hashtx";
 static const char *MSG_RAWBLOCK  = "rawblock";
 static const char *MSG_RAWTX     = "rawtx";
+static const char *MSG_SEQUENCE  = "sequence";
 
 // Internal function to send multipart message
 static int zmq_send_multipart(void *sock, const void* data, size_t size, ...)
@@ -191,3 +193,48 @@ bool CZMQPublishRawTransactionNotifier::NotifyTransaction(const CTransaction &tr
     ss << transaction;
     return SendMessage(MSG_RAWTX, &(*ss.begin()), ss.size());
 }
+
+bool CZMQPublishSequenceNotifier::SendSequenceMessage(const uint256 &hash, char label, const CTransactionRef &ptx, int nReason)
+{
+    const int nVersion = PROTOCOL_VERSION | RPCSerializationFlags();
+    std::vector<unsigned char> data;
+    data.reserve(32 + 1 + 8 + (ptx ? ::GetSerializeSize(*ptx, SER_NETWORK, nVersion) : 1));
+    for (unsigned int i = 0; i < 32; i++)
+        data.push_back(hash.begin()[31 - i]);
+    data.push_back(label);
+    data.resize(data.size() + 8);
+
+    LOCK(cs);
+    WriteLE64(&data[33], nEventSequence++);
+    if (ptx) {
+        // Serialize straight from the shared transaction, no intermediate copy.
+        CVectorWriter(SER_NETWORK, nVersion, data, data.size(), *ptx);
+    } else if (nReason >= 0) {
+        data.push_back((unsigned char)nReason);
+    }
+    return SendMessage(MSG_SEQUENCE, data.data(), data.size());
+}
+
+bool CZMQPublishSequenceNotifier::NotifyTransactionAcceptance(const CTransactionRef &ptx)
+{
+    LogPrint("zmq", "zmq: Publish sequence mempool acceptance %s\n", ptx->GetHash().GetHex());
+    return SendSequenceMessage(ptx->GetHash(), 'A', ptx, -1);
+}
+
+bool CZMQPublishSequenceNotifier::NotifyTransactionRemoval(const CTransactionRef &ptx, MemPoolRemovalReason reason)
+{
+    LogPrint("zmq", "zmq: Publish sequence mempool removal %s\n", ptx->GetHash().GetHex());
+    return SendSequenceMessage(ptx->GetHash(), 'R', CTransactionRef(), (int)reason);
+}
+
+bool CZMQPublishSequenceNotifier::NotifyBlockConnect(const CBlockIndex *pindex)
+{
+    LogPrint("zmq", "zmq: Publish sequence block connect %s\n", pindex->GetBlockHash().GetHex());
+    return SendSequenceMessage(pindex->GetBlockHash(), 'C', CTransactionRef(), -1);
+}
+
+bool CZMQPublishSequenceNotifier::NotifyBlockDisconnect(const CBlockIndex *pindex)
+{
+    LogPrint("zmq", "zmq: Publish sequence block disconnect %s\n", pindex->GetBlockHash().GetHex());
+    return SendSequenceMessage(pindex->GetBlockHash(), 'D', CTransactionRef(), -1);
+}
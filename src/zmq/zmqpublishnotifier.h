@@ -6,6 +6,7 @@
 #define BITCOIN_ZMQ_ZMQPUBLISHNOTIFIER_H
 
 #include "zmqabstractnotifier.h"
+#include "sync.h"
 
 class CBlockIndex;
 
@@ -52,4 +53,30 @@ public:
     bool NotifyTransaction(const CTransaction &transaction);
 };
 
+/**
+ * Publishes every mempool and active chain change as a single "sequence"
+ * message, so a subscriber can mirror the mempool incrementally:
+ *   <32-byte hash> 'C'|'D' <8-byte LE sequence>                 block connected/disconnected
+ *   <32-byte hash> 'A' <8-byte LE sequence> <raw transaction>   transaction added to the mempool
+ *   <32-byte hash> 'R' <8-byte LE sequence> <1-byte reason>     transaction removed (MemPoolRemovalReason)
+ * The sequence number is shared by all four event types and increases by one
+ * per event, so a gap means the subscriber missed something and must resync.
+ */
+class CZMQPublishSequenceNotifier : public CZMQAbstractPublishNotifier
+{
+private:
+    CCriticalSection cs;
+    uint64_t nEventSequence; //!< upcounting per event sequence number (protected by cs)
+
+    bool SendSequenceMessage(const uint256 &hash, char label, const CTransactionRef &ptx, int nReason);
+
+public:
+    CZMQPublishSequenceNotifier() : nEventSequence(0) { }
+
+    bool NotifyTransactionAcceptance(const CTransactionRef &ptx);
+    bool NotifyTransactionRemoval(const CTransactionRef &ptx, MemPoolRemovalReason reason);
+    bool NotifyBlockConnect(const CBlockIndex *pindex);
+    bool NotifyBlockDisconnect(const CBlockIndex *pindex);
+};
+
 #endif // BITCOIN_ZMQ_ZMQPUBLISHNOTIFIER_H